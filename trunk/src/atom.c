@@ -0,0 +1,306 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  atom.c - string interning table functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "scelib/atom.h"
+#include "scelib/thread.h"
+#include "scelib/memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+
+/* ========================================================================= */
+/* Constants and macros used in this module                                  */
+
+#define ATOMS_MIN_SIZE		64
+#define ATOMS_MAX_SIZE		(1 << 30)
+
+#define ATOM_HEADER(atom)	((atom_header_t *) (atom) - 1)
+
+/* tables are published to other threads without locks */
+#if defined(__GNUC__)
+#define ATOMS_BARRIER()		__sync_synchronize()
+#else
+#define ATOMS_BARRIER()
+#endif
+
+
+
+/* ========================================================================= */
+/* internal types                                                            */
+
+/* ------------------------------------------------------------------------- */
+/* stored just before the characters of each atom                           */
+typedef struct atom_header_type
+{
+	int hash;
+	int len;
+} atom_header_t;
+
+/* ------------------------------------------------------------------------- */
+/* open addressing table of the atoms, linked to the previous one            */
+typedef struct atoms_table_type
+{
+	int size;
+	atom_t *slots;
+	struct atoms_table_type *retired;	/* kept until the end for readers */
+} atoms_table_t;
+
+/* ------------------------------------------------------------------------- */
+/* main atom table structure; readers only load the current table, writers  */
+/* hold the lock                                                             */
+struct atoms_type
+{
+	atoms_table_t *volatile table;
+	volatile int count;
+	lock_t lock;
+	mem_arena_t arena;		/* append-only atoms storage */
+};
+
+
+
+/* ========================================================================= */
+/* static functions                                                          */
+
+/* ------------------------------------------------------------------------- */
+/* FNV-1a hash, kept positive                                                */
+static int atoms_hash(const char *str, size_t len)
+{
+	const unsigned char *s = (const unsigned char *) str;
+	unsigned int h = 2166136261U;
+
+	while (len--)
+		h ^= *s++, h *= 16777619U;
+	return (int) (h & 0x7fffffff);
+}
+
+/* ------------------------------------------------------------------------- */
+static atoms_table_t *atoms_table_new(int size)
+{
+	atoms_table_t *tab;
+
+	if (!(tab = mem_new(atoms_table_t, 1)))
+		return NULL;
+	if (!(tab->slots = mem_new(atom_t, size)))
+	{
+		SAFEERRNO(free(tab));
+		return NULL;
+	}
+	tab->size = size;
+	return tab;
+}
+
+/* ------------------------------------------------------------------------- */
+/* linear probing, returns the slot of the atom or the empty one ending the  */
+/* search                                                                    */
+static atom_t *atoms_lookup(atoms_table_t *tab, const char *str, size_t len,
+							int hash)
+{
+	atom_t *slot;
+	atom_header_t *hdr;
+	int i = hash & (tab->size - 1);
+
+	for (;; i = (i + 1) & (tab->size - 1))
+	{
+		slot = tab->slots + i;
+		if (!*slot)
+			return slot;
+		hdr = ATOM_HEADER(*slot);
+		if (hdr->hash == hash && (size_t) hdr->len == len &&
+			!memcmp(*slot, str, len))
+			return slot;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* copies the string in the atoms memory area; the lock must be held         */
+static atom_t atoms_store(atoms_t atoms, const char *str, size_t len, int hash)
+{
+	atom_header_t *hdr;
+	char *atom;
+
+	if (!(hdr = (atom_header_t *) mem_arena_alloc(atoms->arena,
+												  sizeof(atom_header_t) + len + 1)))
+		return NULL;
+	hdr->hash = hash;
+	hdr->len = (int) len;
+	atom = (char *) (hdr + 1);
+	memcpy(atom, str, len);
+	atom[len] = '\0';
+	return atom;
+}
+
+/* ------------------------------------------------------------------------- */
+/* doubles the table when it is half full; the lock must be held. The old    */
+/* table stays readable by the threads still probing it                      */
+static int atoms_grow(atoms_t atoms)
+{
+	atoms_table_t *tab = atoms->table, *next;
+	atom_t atom;
+	int i;
+
+	if (atoms->count < tab->size / 2)
+		return 0;
+	if (tab->size >= ATOMS_MAX_SIZE)
+		return RETERROR(ENOMEM, -1);
+
+	if (!(next = atoms_table_new(tab->size * 2)))
+		return -1;
+	for (i = 0; i < tab->size; i++)
+	{
+		if ((atom = tab->slots[i]))
+			*atoms_lookup(next, atom, ATOM_HEADER(atom)->len,
+						  ATOM_HEADER(atom)->hash) = atom;
+	}
+	next->retired = tab;
+	ATOMS_BARRIER();
+	atoms->table = next;
+	return 0;
+}
+
+
+
+/* ========================================================================= */
+/* public functions                                                          */
+
+atoms_t atoms_new(int size)
+{
+	atoms_t atoms;
+	int tabsize = ATOMS_MIN_SIZE;
+
+	/* keeps the table at most half full */
+	while (tabsize < ATOMS_MAX_SIZE && tabsize / 2 < size)
+		tabsize *= 2;
+
+	if (!(atoms = mem_new(struct atoms_type, 1)))
+		return NULL;
+	if (!(atoms->table = atoms_table_new(tabsize)) ||
+		!(atoms->lock = thread_lock_create()) ||
+		!(atoms->arena = mem_arena_create(0)))
+	{
+		SAFEERRNO(atoms_delete(atoms));
+		return NULL;
+	}
+	return atoms;
+}
+
+int atoms_delete(atoms_t atoms)
+{
+	atoms_table_t *tab, *next;
+
+	if (!atoms)
+		return RETERROR(EINVAL, -1);
+
+	for (tab = atoms->table; tab; tab = next)
+	{
+		next = tab->retired;
+		free(tab->slots);
+		free(tab);
+	}
+	if (atoms->arena)
+		mem_arena_destroy(atoms->arena);
+	thread_lock_destroy(atoms->lock);
+	free(atoms);
+	return 0;
+}
+
+int atoms_count(atoms_t atoms)
+{
+	if (!atoms)
+		return RETERROR(EINVAL, -1);
+	return atoms->count;
+}
+
+atom_t atom_intern(atoms_t atoms, const char *str)
+{
+	if (!str)
+		return RETERROR(EINVAL, NULL);
+	return atom_intern_len(atoms, str, strlen(str));
+}
+
+atom_t atom_intern_len(atoms_t atoms, const char *str, size_t len)
+{
+	atom_t *slot, atom;
+	int hash;
+
+	if (!atoms || !str || len > (size_t) MAP_HASH_MAX)
+		return RETERROR(EINVAL, NULL);
+
+	/* most strings are already interned, and found without the lock */
+	hash = atoms_hash(str, len);
+	if ((atom = *atoms_lookup(atoms->table, str, len, hash)))
+		return atom;
+
+	thread_lock(atoms->lock);
+	slot = atoms_lookup(atoms->table, str, len, hash);
+	if (!(atom = *slot) && !atoms_grow(atoms) &&
+		(atom = atoms_store(atoms, str, len, hash)))
+	{
+		/* the atom is complete before readers can see it */
+		ATOMS_BARRIER();
+		*atoms_lookup(atoms->table, str, len, hash) = atom;
+		atoms->count++;
+	}
+	thread_unlock(atoms->lock);
+	return atom;
+}
+
+atom_t atom_find(atoms_t atoms, const char *str)
+{
+	atom_t atom;
+	size_t len;
+	int hash;
+
+	if (!atoms || !str)
+		return RETERROR(EINVAL, NULL);
+
+	len = strlen(str);
+	hash = atoms_hash(str, len);
+	if (!(atom = *atoms_lookup(atoms->table, str, len, hash)))
+		return RETERROR(ERANGE, NULL);
+	return atom;
+}
+
+int atom_hash(atom_t atom)
+{
+	if (!atom)
+		return RETERROR(EINVAL, -1);
+	return ATOM_HEADER(atom)->hash;
+}
+
+size_t atom_len(atom_t atom)
+{
+	if (!atom)
+		return RETERROR(EINVAL, 0);
+	return (size_t) ATOM_HEADER(atom)->len;
+}
+
+int atom_map_hash(int size, void *key)
+{
+	return ATOM_HEADER(key)->hash % size;
+}
+
+int atom_map_comp(void *key1, void *key2)
+{
+	return (key1 < key2 ? -1 : (key1 > key2 ? 1 : 0));
+}
+
+/* vi:set ts=4 sw=4: */
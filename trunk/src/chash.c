@@ -0,0 +1,362 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  chash.c - consistent hashing functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "scelib/chash.h"
+#include "scelib/memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+
+/* ========================================================================= */
+/* Constants and macros used in this module                                  */
+
+#define CHASH_MAX_TOKENS	(1 << 24)
+
+
+
+/* ========================================================================= */
+/* internal types                                                            */
+
+/* ------------------------------------------------------------------------- */
+typedef struct chash_node_type
+{
+	char *name;
+	unsigned int seed;		/* hash of the name */
+	int weight;
+	void *data;
+} chash_node_t;
+
+/* ------------------------------------------------------------------------- */
+/* virtual node, only used while sorting                                     */
+typedef struct chash_vnode_type
+{
+	unsigned int token;
+	int owner;
+	chash_node_t *nodes;
+} chash_vnode_t;
+
+/* ------------------------------------------------------------------------- */
+/* main ring structure; the tokens and their owners are kept in separate     */
+/* arrays, so that the binary search only touches the tokens                 */
+struct chash_type
+{
+	int vnodes;
+	map_hash_t hashf;
+	chash_node_t *nodes;
+	int count;
+	int size;				/* allocated nodes */
+	unsigned int *tokens;
+	int *owners;
+	int ntokens;
+};
+
+
+
+/* ========================================================================= */
+/* static functions                                                          */
+
+/* ------------------------------------------------------------------------- */
+/* final mix of MurmurHash3, spreading weak hashes over the whole ring       */
+static unsigned int chash_mix(unsigned int h)
+{
+	h ^= h >> 16;
+	h *= 0x85EBCA6BU;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35U;
+	h ^= h >> 16;
+	return h;
+}
+
+/* ------------------------------------------------------------------------- */
+static unsigned int chash_key(chash_t ring, void *key)
+{
+	int h = ring->hashf(MAP_HASH_MAX, key);
+	return chash_mix((unsigned int) (h < 0 ? -(h + 1) : h));
+}
+
+/* ------------------------------------------------------------------------- */
+/* FNV-1a hash of the node names                                             */
+static unsigned int chash_name(const char *name)
+{
+	const unsigned char *s = (const unsigned char *) name;
+	unsigned int h = 2166136261U;
+
+	while (*s)
+		h ^= *s++, h *= 16777619U;
+	return h;
+}
+
+/* ------------------------------------------------------------------------- */
+/* equal tokens are ordered by node names, the same in every process         */
+static int chash_vnode_comp(const void *p1, const void *p2)
+{
+	const chash_vnode_t *v1 = (const chash_vnode_t *) p1;
+	const chash_vnode_t *v2 = (const chash_vnode_t *) p2;
+
+	if (v1->token != v2->token)
+		return (v1->token < v2->token ? -1 : 1);
+	return strcmp(v1->nodes[v1->owner].name, v2->nodes[v2->owner].name);
+}
+
+/* ------------------------------------------------------------------------- */
+/* rebuilds the sorted tokens from the nodes                                 */
+static int chash_build(chash_t ring)
+{
+	chash_vnode_t *vnodes;
+	unsigned int *tokens = NULL;
+	int *owners = NULL;
+	int i, j, n = 0;
+
+	/* the limit is checked before each sum, which can't overflow */
+	for (i = 0; i < ring->count; i++)
+	{
+		if (ring->nodes[i].weight > (CHASH_MAX_TOKENS - n) / ring->vnodes)
+			return RETERROR(ERANGE, -1);
+		n += ring->nodes[i].weight * ring->vnodes;
+	}
+
+	if (!(vnodes = mem_new(chash_vnode_t, n + 1)))
+		return -1;
+	if (!(tokens = mem_new(unsigned int, n + 1)) ||
+		!(owners = mem_new(int, n + 1)))
+	{
+		SAFEERRNO(free(tokens); free(vnodes));
+		return -1;
+	}
+
+	for (i = n = 0; i < ring->count; i++)
+	{
+		for (j = 0; j < ring->nodes[i].weight * ring->vnodes; j++, n++)
+		{
+			vnodes[n].token = chash_mix(ring->nodes[i].seed ^
+										chash_mix((unsigned int) j + 1));
+			vnodes[n].owner = i;
+			vnodes[n].nodes = ring->nodes;
+		}
+	}
+	qsort(vnodes, n, sizeof(chash_vnode_t), chash_vnode_comp);
+	for (i = 0; i < n; i++)
+	{
+		tokens[i] = vnodes[i].token;
+		owners[i] = vnodes[i].owner;
+	}
+	free(vnodes);
+
+	free(ring->tokens);
+	free(ring->owners);
+	ring->tokens = tokens;
+	ring->owners = owners;
+	ring->ntokens = n;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* index of the first token not lower than the hash, wrapping to the first */
+static int chash_search(chash_t ring, unsigned int hash)
+{
+	const unsigned int *tokens = ring->tokens;
+	int lo = 0, n = ring->ntokens, half;
+
+	while (n > 0)
+	{
+		half = n / 2;
+		if (tokens[lo + half] < hash)
+			lo += half + 1, n -= half + 1;
+		else
+			n = half;
+	}
+	return (lo < ring->ntokens ? lo : 0);
+}
+
+/* ------------------------------------------------------------------------- */
+static int chash_find(chash_t ring, const char *name)
+{
+	int i;
+
+	for (i = 0; i < ring->count; i++)
+	{
+		if (!strcmp(ring->nodes[i].name, name))
+			return i;
+	}
+	return -1;
+}
+
+
+
+/* ========================================================================= */
+/* public functions                                                          */
+
+chash_t chash_new(int vnodes, map_hash_t hash_func)
+{
+	chash_t ring;
+
+	if (vnodes <= 0 || vnodes > CHASH_MAX_TOKENS || !hash_func)
+		return RETERROR(EINVAL, NULL);
+
+	if (!(ring = mem_new(struct chash_type, 1)))
+		return NULL;
+	ring->vnodes = vnodes;
+	ring->hashf = hash_func;
+	return ring;
+}
+
+int chash_delete(chash_t ring)
+{
+	int i;
+
+	if (!ring)
+		return RETERROR(EINVAL, -1);
+
+	for (i = 0; i < ring->count; i++)
+		free(ring->nodes[i].name);
+	free(ring->nodes);
+	free(ring->tokens);
+	free(ring->owners);
+	free(ring);
+	return 0;
+}
+
+int chash_count(chash_t ring)
+{
+	if (!ring)
+		return RETERROR(EINVAL, -1);
+	return ring->count;
+}
+
+int chash_add(chash_t ring, const char *name, int weight, void *node)
+{
+	chash_node_t *nodes, *n;
+
+	if (!ring || !name || weight <= 0 || !node)
+		return RETERROR(EINVAL, -1);
+	if (weight > CHASH_MAX_TOKENS / ring->vnodes)
+		return RETERROR(ERANGE, -1);
+	if (chash_find(ring, name) != -1)
+		return RETERROR(EEXIST, -1);
+
+	if (ring->count == ring->size)
+	{
+		if (!(nodes = (chash_node_t *) realloc(ring->nodes,
+					(ring->size * 2 + 4) * sizeof(chash_node_t))))
+			return -1;
+		ring->nodes = nodes;
+		ring->size = ring->size * 2 + 4;
+	}
+	n = ring->nodes + ring->count;
+	if (!(n->name = (char *) malloc(strlen(name) + 1)))
+		return -1;
+	strcpy(n->name, name);
+	n->seed = chash_name(name);
+	n->weight = weight;
+	n->data = node;
+
+	ring->count++;
+	if (chash_build(ring))
+	{
+		SAFEERRNO(ring->count--; free(n->name));
+		return -1;
+	}
+	return ring->count;
+}
+
+int chash_remove(chash_t ring, const char *name, void **node)
+{
+	chash_node_t removed;
+	int i;
+
+	if (!ring || !name)
+		return RETERROR(EINVAL, -1);
+	if ((i = chash_find(ring, name)) == -1)
+		return RETERROR(ERANGE, -1);
+
+	removed = ring->nodes[i];
+	memmove(ring->nodes + i, ring->nodes + i + 1,
+			(ring->count - i - 1) * sizeof(chash_node_t));
+	ring->count--;
+	if (chash_build(ring))
+	{
+		/* the ring is left unchanged */
+		SAFEERRNO(memmove(ring->nodes + i + 1, ring->nodes + i,
+						  (ring->count - i) * sizeof(chash_node_t));
+				  ring->nodes[i] = removed; ring->count++);
+		return -1;
+	}
+
+	mem_init(node, removed.data);
+	free(removed.name);
+	return ring->count;
+}
+
+void *chash_get(chash_t ring, void *key)
+{
+	if (!ring || !key)
+		return RETERROR(EINVAL, NULL);
+	if (!ring->ntokens)
+		return NULL;
+
+	return ring->nodes[ring->owners[chash_search(ring, chash_key(ring, key))]].data;
+}
+
+int chash_route(chash_t ring, void **keys, void **nodes, int n)
+{
+	int i;
+
+	if (!ring || !keys || !nodes || n < 0)
+		return RETERROR(EINVAL, -1);
+	if (!ring->ntokens)
+		return RETERROR(ERANGE, -1);
+
+	/* hashing all the keys first leaves the searches back to back, with the */
+	/* top levels of the tokens kept in cache                                */
+	for (i = 0; i < n; i++)
+	{
+		if (!keys[i])
+			return RETERROR(EINVAL, -1);
+		nodes[i] = (void *) (size_t) chash_key(ring, keys[i]);
+	}
+	for (i = 0; i < n; i++)
+		nodes[i] = ring->nodes[ring->owners[chash_search(ring,
+								(unsigned int) (size_t) nodes[i])]].data;
+	return 0;
+}
+
+int chash_jump(int hash, int buckets)
+{
+	unsigned long long key;
+	long long b = -1, j = 0;
+
+	if (buckets <= 0)
+		return RETERROR(EINVAL, -1);
+
+	/* Lamping and Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm" */
+	key = chash_mix((unsigned int) hash);
+	while (j < buckets)
+	{
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (long long) ((b + 1) * ((double) (1LL << 31) /
+									(double) ((key >> 33) + 1)));
+	}
+	return (int) b;
+}
+
+/* vi:set ts=4 sw=4: */
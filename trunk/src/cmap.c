@@ -0,0 +1,410 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  cmap.c - concurrent map functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "scelib/cmap.h"
+#include "scelib/thread.h"
+#include "scelib/memory.h"
+#include <stdlib.h>
+#include <errno.h>
+
+
+
+/* ========================================================================= */
+/* Constants and macros used in this module                                  */
+
+/* number of bucket locks, which is also the minimum table size: as table   */
+/* sizes are powers of 2, bucket i of a table and the buckets i and i+size  */
+/* it is split into in the next table are always protected by the same lock */
+#define CMAP_STRIPES		64
+#define CMAP_MAX_SIZE		(1 << 30)
+
+/* number of buckets moved at once by a thread helping a resize */
+#define CMAP_CHUNK			1024
+
+#define CMAP_LOCK(map, h)	((map)->stripes[(h) & (CMAP_STRIPES - 1)])
+
+/* marker of the buckets already moved to the next table */
+#define CMAP_FORWARD		(&cmap_forward)
+
+/* tables are published to other threads without locks */
+#if defined(__GNUC__)
+#define CMAP_BARRIER()		__sync_synchronize()
+#else
+#define CMAP_BARRIER()
+#endif
+
+
+
+/* ========================================================================= */
+/* internal types                                                            */
+
+/* ------------------------------------------------------------------------- */
+typedef struct cmap_node_type
+{
+	struct cmap_node_type *next;
+	int hash;
+	void *key;
+	void *data;
+} cmap_node_t;
+
+/* ------------------------------------------------------------------------- */
+/* buckets table, linked to the one it is being resized to                   */
+typedef struct cmap_table_type
+{
+	int size;
+	int chunk;						/* buckets per migration chunk */
+	cmap_node_t **bins;
+	volatile int claimed;			/* chunks claimed by helpers */
+	volatile int moved;				/* chunks fully moved */
+	struct cmap_table_type *volatile next;
+	struct cmap_table_type *retired;	/* previous table, kept until the end */
+} cmap_table_t;
+
+/* ------------------------------------------------------------------------- */
+/* main concurrent map structure                                             */
+struct cmap_type
+{
+	cmap_table_t *volatile table;
+	volatile int count;
+	lock_t resize;					/* serializes resize starts */
+	lock_t stripes[CMAP_STRIPES];
+	map_hash_t hashf;
+	map_comp_t compf;
+	map_alloc_t allocf;
+	map_free_t freef;
+};
+
+static cmap_node_t cmap_forward;
+
+
+
+/* ========================================================================= */
+/* static functions                                                          */
+
+/* ------------------------------------------------------------------------- */
+static int cmap_hash(cmap_t map, void *key)
+{
+	int h = map->hashf(MAP_HASH_MAX, key);
+	return (h < 0 ? -(h + 1) : h);
+}
+
+/* ------------------------------------------------------------------------- */
+static cmap_table_t *cmap_table_new(int size)
+{
+	cmap_table_t *tab;
+
+	if (!(tab = mem_new(cmap_table_t, 1)))
+		return NULL;
+	if (!(tab->bins = mem_new(cmap_node_t *, size)))
+	{
+		SAFEERRNO(free(tab));
+		return NULL;
+	}
+	tab->size = size;
+	tab->chunk = (size < CMAP_CHUNK ? size : CMAP_CHUNK);
+	return tab;
+}
+
+/* ------------------------------------------------------------------------- */
+/* splits the buckets of a chunk into the next table                         */
+static void cmap_move(cmap_t map, cmap_table_t *tab, int chunk)
+{
+	cmap_table_t *next = tab->next;
+	cmap_node_t *node, *lo, *hi;
+	int i, end;
+
+	for (i = chunk * tab->chunk, end = i + tab->chunk; i < end; i++)
+	{
+		thread_lock(CMAP_LOCK(map, i));
+		for (lo = hi = NULL; (node = tab->bins[i]); )
+		{
+			tab->bins[i] = node->next;
+			if (node->hash & tab->size)
+				node->next = hi, hi = node;
+			else
+				node->next = lo, lo = node;
+		}
+		next->bins[i] = lo;
+		next->bins[i + tab->size] = hi;
+		tab->bins[i] = CMAP_FORWARD;
+		thread_unlock(CMAP_LOCK(map, i));
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* moves chunks of the table being resized until none is left to claim; the  */
+/* thread moving the last chunk publishes the new table                      */
+static void cmap_help(cmap_t map, cmap_table_t *tab)
+{
+	int chunk, nchunks = tab->size / tab->chunk;
+
+	CMAP_BARRIER();
+	while (tab->claimed < nchunks &&
+		   (chunk = thread_atomic_add(&tab->claimed, 1) - 1) < nchunks)
+	{
+		cmap_move(map, tab, chunk);
+		if (thread_atomic_add(&tab->moved, 1) == nchunks)
+		{
+			map->table = tab->next;
+			CMAP_BARRIER();
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* starts a resize if the table is loaded enough, and helps it               */
+static void cmap_grow(cmap_t map, int count)
+{
+	cmap_table_t *tab = map->table, *next;
+
+	if (tab->next || count <= tab->size - tab->size / 4 ||
+		tab->size >= CMAP_MAX_SIZE)
+		return;
+
+	thread_lock(map->resize);
+	if (map->table == tab && !tab->next && (next = cmap_table_new(tab->size * 2)))
+	{
+		/* on failure, buckets just get longer until the next try */
+		next->retired = tab;
+		CMAP_BARRIER();
+		tab->next = next;
+	}
+	thread_unlock(map->resize);
+
+	if (tab->next)
+		cmap_help(map, tab);
+}
+
+/* ------------------------------------------------------------------------- */
+/* locks and returns the bucket of the hash, helping any resize in progress  */
+static cmap_node_t **cmap_lock_bin(cmap_t map, int hash)
+{
+	cmap_table_t *tab = map->table;
+	cmap_node_t **bin;
+
+	if (tab->next)
+	{
+		cmap_help(map, tab);
+		tab = map->table;
+	}
+
+	/* buckets of a table being resized may have been moved, and then are    */
+	/* in the next table, under the same lock                                */
+	thread_lock(CMAP_LOCK(map, hash));
+	for (;;)
+	{
+		bin = tab->bins + (hash & (tab->size - 1));
+		if (*bin != CMAP_FORWARD)
+			return bin;
+		tab = tab->next;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+static cmap_node_t **cmap_lookup(cmap_t map, cmap_node_t **bin, int hash,
+								 void *key)
+{
+	cmap_node_t *node;
+
+	for (; (node = *bin); bin = &node->next)
+	{
+		if (node->hash == hash && (node->key == key || !map->compf(key, node->key)))
+			break;
+	}
+	return bin;
+}
+
+
+
+/* ========================================================================= */
+/* public functions                                                          */
+
+cmap_t cmap_new(int size, map_hash_t hash_func, map_comp_t comp_func,
+				map_alloc_t alloc_func, map_free_t free_func)
+{
+	cmap_t map;
+	int i, tabsize = CMAP_STRIPES;
+
+	if (!hash_func || !comp_func)
+		return RETERROR(EINVAL, NULL);
+
+	/* keeps the table at most 3/4 full */
+	while (tabsize < CMAP_MAX_SIZE && tabsize - tabsize / 4 < size)
+		tabsize *= 2;
+
+	if (!(map = mem_new(struct cmap_type, 1)))
+		return NULL;
+	if (!(map->table = cmap_table_new(tabsize)) ||
+		!(map->resize = thread_lock_create()))
+	{
+		SAFEERRNO(cmap_delete(map));
+		return NULL;
+	}
+	for (i = 0; i < CMAP_STRIPES; i++)
+	{
+		if (!(map->stripes[i] = thread_lock_create()))
+		{
+			SAFEERRNO(cmap_delete(map));
+			return NULL;
+		}
+	}
+	map->hashf = hash_func;
+	map->compf = comp_func;
+	map->allocf = alloc_func;
+	map->freef = free_func;
+	return map;
+}
+
+int cmap_delete(cmap_t map)
+{
+	cmap_table_t *tab, *next;
+	cmap_node_t *node;
+	int i;
+
+	if (!map)
+		return RETERROR(EINVAL, -1);
+
+	for (tab = map->table; tab; tab = next)
+	{
+		for (i = 0; i < tab->size; i++)
+		{
+			while ((node = tab->bins[i]) && node != CMAP_FORWARD)
+			{
+				tab->bins[i] = node->next;
+				if (map->freef)
+					map->freef(node->key);
+				free(node);
+			}
+		}
+		next = tab->retired;
+		free(tab->bins);
+		free(tab);
+	}
+	for (i = 0; i < CMAP_STRIPES; i++)
+		thread_lock_destroy(map->stripes[i]);
+	thread_lock_destroy(map->resize);
+	free(map);
+	return 0;
+}
+
+int cmap_count(cmap_t map)
+{
+	if (!map)
+		return RETERROR(EINVAL, -1);
+	return map->count;
+}
+
+void *cmap_get(cmap_t map, void *key)
+{
+	cmap_node_t **bin;
+	void *data = NULL;
+	int hash;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, NULL);
+
+	hash = cmap_hash(map, key);
+	bin = cmap_lock_bin(map, hash);
+	bin = cmap_lookup(map, bin, hash, key);
+	if (*bin)
+		data = (*bin)->data;
+	thread_unlock(CMAP_LOCK(map, hash));
+	return data;
+}
+
+int cmap_set(cmap_t map, void *key, void *data, void **olddata)
+{
+	cmap_node_t **bin, *node = NULL;
+	int hash, count;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, -1);
+
+	hash = cmap_hash(map, key);
+	for (;;)
+	{
+		bin = cmap_lock_bin(map, hash);
+		bin = cmap_lookup(map, bin, hash, key);
+		if (*bin)
+		{
+			/* replacing a value needs no allocation */
+			mem_init(olddata, (*bin)->data);
+			(*bin)->data = data;
+			thread_unlock(CMAP_LOCK(map, hash));
+			if (node)
+			{
+				/* another thread added the key while we were allocating */
+				if (map->freef)
+					map->freef(node->key);
+				free(node);
+			}
+			return map->count;
+		}
+		if (node)
+			break;
+		thread_unlock(CMAP_LOCK(map, hash));
+
+		/* allocations are done out of the lock, and the key looked up again */
+		if (!(node = (cmap_node_t *) malloc(sizeof(cmap_node_t))))
+			return -1;
+		if (!(node->key = (map->allocf ? map->allocf(key) : key)))
+		{
+			SAFEERRNO(free(node));
+			return -1;
+		}
+		node->hash = hash;
+		node->data = data;
+	}
+	node->next = NULL;
+	*bin = node;
+	thread_unlock(CMAP_LOCK(map, hash));
+
+	count = thread_atomic_add(&map->count, 1);
+	cmap_grow(map, count);
+	return count;
+}
+
+int cmap_unset(cmap_t map, void *key, void **olddata)
+{
+	cmap_node_t **bin, *node;
+	int hash;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, -1);
+
+	hash = cmap_hash(map, key);
+	bin = cmap_lock_bin(map, hash);
+	bin = cmap_lookup(map, bin, hash, key);
+	if (!(node = *bin))
+	{
+		thread_unlock(CMAP_LOCK(map, hash));
+		return RETERROR(ERANGE, -1);
+	}
+	*bin = node->next;
+	thread_unlock(CMAP_LOCK(map, hash));
+
+	mem_init(olddata, node->data);
+	if (map->freef)
+		map->freef(node->key);
+	free(node);
+	return thread_atomic_add(&map->count, -1);
+}
+
+/* vi:set ts=4 sw=4: */
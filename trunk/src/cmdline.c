@@ -17,6 +17,7 @@
  */
 
 #include "scelib/cmdline.h"
+#include "scelib/memory.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -36,6 +37,8 @@ struct cmdline_type
 
 	cmdopt_t *opthead;
 	int optcount;
+
+	const mem_allocator_t *allocator;
 };
 
 struct cmdopt_type
@@ -143,14 +146,16 @@ static cmdopt_t *cmdline_checkdefined(cmdline_t cl, cmdparsed_t *current)
 /* ------------------------------------------------------------------------- */
 cmdline_t cmdline_create(int flags, cmdline_cb_t callback)
 {
+	const mem_allocator_t *allocator = mem_allocator_get();
 	cmdline_t cl;
 
 	if (callback == NULL)
 		return RETERROR(EINVAL, NULL);
 
-	if ((cl = (cmdline_t) malloc(sizeof(struct cmdline_type))) == NULL)
+	if ((cl = (cmdline_t) mem_allocator_alloc(allocator, sizeof(struct cmdline_type))) == NULL)
 		return NULL;
 
+	cl->allocator = allocator;
 	cl->flags = flags;
 	cl->cb = callback;
 	cl->opthead = NULL;
@@ -171,10 +176,10 @@ int cmdline_destroy(cmdline_t cl)
 	while (ptr)
 	{
 		next = ptr->next;
-		free(ptr);
+		mem_allocator_free(cl->allocator, ptr);
 		ptr = next;
 	}
-	free(cl);
+	mem_allocator_free(cl->allocator, cl);
 	return 0;
 }
 
@@ -203,7 +208,7 @@ int cmdline_parse(cmdline_t cl, int argc, char **argv, void* userdata)
 		got.opt_pos = argi;
 		if (got.opt_name)
 		{
-			free(got.opt_name);
+			mem_allocator_free(cl->allocator, got.opt_name);
 			got.opt_name = NULL;
 		}
 		cb = NULL;
@@ -261,7 +266,7 @@ int cmdline_parse(cmdline_t cl, int argc, char **argv, void* userdata)
 					got.opt_arg = argv[++argi];
 			}
 
-			got.opt_name = (char *) malloc(sizeof(char) * (optlen + 1));
+			got.opt_name = (char *) mem_allocator_alloc(cl->allocator, sizeof(char) * (optlen + 1));
 			if (got.opt_name == NULL)
 				return -1;
 			strncpy(got.opt_name, argv[cur] + start, optlen);
@@ -296,7 +301,7 @@ int cmdline_parse(cmdline_t cl, int argc, char **argv, void* userdata)
 	}
 
 	if (got.opt_name)
-		free(got.opt_name);
+		mem_allocator_free(cl->allocator, got.opt_name);
 
 	return ret;
 }
@@ -307,7 +312,7 @@ int cmdline_addopt(cmdline_t cl, char sname, char *lname,
 {
 	cmdopt_t *newopt;
 
-	if ((newopt = (cmdopt_t *) malloc(sizeof(cmdopt_t))) == NULL)
+	if ((newopt = (cmdopt_t *) mem_allocator_alloc(cl->allocator, sizeof(cmdopt_t))) == NULL)
 		return -1;
 
 	newopt->id = cl->optcount + 1;
@@ -0,0 +1,354 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  count.c - concurrent counting map functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "scelib/count.h"
+#include "scelib/thread.h"
+#include "scelib/memory.h"
+#include <stdlib.h>
+#include <errno.h>
+
+
+
+/* ========================================================================= */
+/* Constants and macros used in this module                                  */
+
+/* increments buffered by a thread before being merged */
+#define COUNT_FLUSH_ADDS	4096
+
+/* distinct keys a thread buffer keeps between merges */
+#define COUNT_BUFFER_KEYS	1024
+
+/* counters are stored as map data */
+#define COUNT_VALUE(data)	((long) (data))
+#define COUNT_DATA(value)	((void *) (value))
+
+
+
+/* ========================================================================= */
+/* internal types                                                            */
+
+/* ------------------------------------------------------------------------- */
+/* per thread buffer, only locked by its thread until merged                 */
+typedef struct count_buffer_type
+{
+	struct count_buffer_type *next;
+	count_t owner;
+	lock_t lock;
+	map_t deltas;
+	int pending;			/* increments since the last merge */
+} count_buffer_t;
+
+/* ------------------------------------------------------------------------- */
+/* main counting map structure; locks are taken in the order buffers_lock,   */
+/* buffer lock, then lock                                                    */
+struct count_type
+{
+	map_t table;
+	lock_t lock;			/* protects the shared table */
+	lock_t buffers_lock;	/* protects the buffers list */
+	count_buffer_t *buffers;
+	tls_t tls;
+	map_hash_t hashf;
+	map_comp_t compf;
+	map_alloc_t allocf;
+	map_free_t freef;
+};
+
+
+
+/* ========================================================================= */
+/* static functions                                                          */
+
+/* ------------------------------------------------------------------------- */
+static void count_buffer_free(count_buffer_t *buf)
+{
+	map_delete(buf->deltas);
+	thread_lock_destroy(buf->lock);
+	mem_free_aligned((void **) &buf);
+}
+
+/* ------------------------------------------------------------------------- */
+/* merges the buffer into the shared table; the buffer must be locked. The   */
+/* buffer keys are kept with a null delta, so that counting them again       */
+/* doesn't duplicate them                                                    */
+static int count_merge(count_t map, count_buffer_t *buf)
+{
+	map_iter_t iter;
+	void *key, *data, **slot;
+	long delta;
+	int ret = 0;
+
+	if (!(iter = map_iter_new(buf->deltas)))
+		return -1;
+
+	thread_lock(map->lock);
+	while (map_iter_next(iter, &key, &data))
+	{
+		if (!(delta = COUNT_VALUE(data)))
+			continue;
+		if (!(slot = map_slot(map->table, key)))
+		{
+			ret = -1;
+			break;
+		}
+		*slot = COUNT_DATA(COUNT_VALUE(*slot) + delta);
+		map_set(buf->deltas, key, COUNT_DATA(0), NULL);
+	}
+	thread_unlock(map->lock);
+	map_iter_delete(iter);
+
+	if (!ret && map_count(buf->deltas) > COUNT_BUFFER_KEYS)
+		ret = map_clear(buf->deltas, MAP_SIZE_AUTO);
+	buf->pending = 0;
+	return ret;
+}
+
+/* ------------------------------------------------------------------------- */
+/* thread exit destructor                                                    */
+static void count_buffer_exit(void *data)
+{
+	count_buffer_t **pbuf, *buf = (count_buffer_t *) data;
+	count_t map = buf->owner;
+
+	thread_lock(map->buffers_lock);
+	for (pbuf = &map->buffers; *pbuf != buf; pbuf = &(*pbuf)->next)
+		;
+	*pbuf = buf->next;
+	thread_lock(buf->lock);
+	count_merge(map, buf);
+	thread_unlock(buf->lock);
+	thread_unlock(map->buffers_lock);
+	count_buffer_free(buf);
+}
+
+/* ------------------------------------------------------------------------- */
+/* gets the calling thread buffer, creating it at first use                  */
+static count_buffer_t *count_buffer_get(count_t map)
+{
+	count_buffer_t *buf;
+
+	if ((buf = (count_buffer_t *) thread_tls_get(map->tls)))
+		return buf;
+
+	/* buffers are updated by different threads, and don't share cache lines */
+	if (!(buf = mem_new_aligned(count_buffer_t, 1, MEM_CACHE_LINE)))
+		return NULL;
+	buf->owner = map;
+	if (!(buf->lock = thread_lock_create()) ||
+		!(buf->deltas = map_new(MAP_SIZE_AUTO, map->hashf, map->compf,
+								map->allocf, map->freef)) ||
+		thread_tls_set(map->tls, buf))
+	{
+		SAFEERRNO(map_delete(buf->deltas); thread_lock_destroy(buf->lock);
+				  mem_free_aligned((void **) &buf));
+		return NULL;
+	}
+
+	thread_lock(map->buffers_lock);
+	buf->next = map->buffers;
+	map->buffers = buf;
+	thread_unlock(map->buffers_lock);
+	return buf;
+}
+
+/* ------------------------------------------------------------------------- */
+/* adds the delta to the buffer, which must be locked                        */
+static int count_buffer_add(count_t map, count_buffer_t *buf, void *key,
+							long delta)
+{
+	void **slot;
+
+	/* a single lookup, the key being added with a null delta if needed */
+	if (!(slot = map_slot(buf->deltas, key)))
+		return -1;
+	*slot = COUNT_DATA(COUNT_VALUE(*slot) + delta);
+	if (++ buf->pending >= COUNT_FLUSH_ADDS)
+		return count_merge(map, buf);
+	return 0;
+}
+
+
+
+/* ========================================================================= */
+/* public functions                                                          */
+
+count_t count_new(map_hash_t hash_func, map_comp_t comp_func,
+				  map_alloc_t alloc_func, map_free_t free_func)
+{
+	count_t map;
+
+	if (!hash_func || !comp_func)
+		return RETERROR(EINVAL, NULL);
+
+	if (!(map = mem_new(struct count_type, 1)))
+		return NULL;
+	map->hashf = hash_func;
+	map->compf = comp_func;
+	map->allocf = alloc_func;
+	map->freef = free_func;
+	if (!(map->table = map_new(MAP_SIZE_AUTO, hash_func, comp_func,
+							   alloc_func, free_func)) ||
+		!(map->lock = thread_lock_create()) ||
+		!(map->buffers_lock = thread_lock_create()) ||
+		!(map->tls = thread_tls_new(count_buffer_exit)))
+	{
+		SAFEERRNO(count_delete(map));
+		return NULL;
+	}
+	return map;
+}
+
+int count_delete(count_t map)
+{
+	count_buffer_t *buf;
+
+	if (!map)
+		return RETERROR(EINVAL, -1);
+
+	/* deleting the key first, no thread exit can reach the buffers */
+	thread_tls_delete(map->tls);
+	while ((buf = map->buffers))
+	{
+		map->buffers = buf->next;
+		count_buffer_free(buf);
+	}
+	if (map->table)
+		map_delete(map->table);
+	thread_lock_destroy(map->lock);
+	thread_lock_destroy(map->buffers_lock);
+	free(map);
+	return 0;
+}
+
+int count_add(count_t map, void *key, long delta)
+{
+	count_buffer_t *buf;
+	int ret;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, -1);
+
+	if (!(buf = count_buffer_get(map)))
+		return -1;
+	thread_lock(buf->lock);
+	ret = count_buffer_add(map, buf, key, delta);
+	thread_unlock(buf->lock);
+	return ret;
+}
+
+int count_add_bulk(count_t map, void **keys, long *deltas, int n)
+{
+	count_buffer_t *buf;
+	int i, ret = 0;
+
+	if (!map || !keys || n < 0)
+		return RETERROR(EINVAL, -1);
+
+	if (!(buf = count_buffer_get(map)))
+		return -1;
+	thread_lock(buf->lock);
+	for (i = 0; i < n && !ret; ++i)
+	{
+		if (!keys[i])
+			ret = RETERROR(EINVAL, -1);
+		else
+			ret = count_buffer_add(map, buf, keys[i], (deltas ? deltas[i] : 1));
+	}
+	thread_unlock(buf->lock);
+	return ret;
+}
+
+int count_flush(count_t map)
+{
+	count_buffer_t *buf;
+	int ret;
+
+	if (!map)
+		return RETERROR(EINVAL, -1);
+
+	if (!(buf = (count_buffer_t *) thread_tls_get(map->tls)))
+		return 0;
+	thread_lock(buf->lock);
+	ret = count_merge(map, buf);
+	thread_unlock(buf->lock);
+	return ret;
+}
+
+long count_get(count_t map, void *key)
+{
+	count_buffer_t *buf;
+	long value;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, 0);
+
+	/* all the buffers are locked while reading, so that no delta is merged
+	   into the table between the reads */
+	thread_lock(map->buffers_lock);
+	for (buf = map->buffers; buf; buf = buf->next)
+		thread_lock(buf->lock);
+	thread_lock(map->lock);
+	value = COUNT_VALUE(map_get(map->table, key));
+	for (buf = map->buffers; buf; buf = buf->next)
+		value += COUNT_VALUE(map_get(buf->deltas, key));
+	thread_unlock(map->lock);
+	for (buf = map->buffers; buf; buf = buf->next)
+		thread_unlock(buf->lock);
+	thread_unlock(map->buffers_lock);
+	return value;
+}
+
+count_entry_t *count_snapshot(count_t map, int *n)
+{
+	count_buffer_t *buf;
+	count_entry_t *entries = NULL;
+	map_iter_t iter;
+	void *data;
+	int i = 0;
+
+	if (!map || !n)
+		return RETERROR(EINVAL, NULL);
+
+	thread_lock(map->buffers_lock);
+	for (buf = map->buffers; buf; buf = buf->next)
+	{
+		thread_lock(buf->lock);
+		count_merge(map, buf);
+		thread_unlock(buf->lock);
+	}
+
+	thread_lock(map->lock);
+	if ((entries = mem_new(count_entry_t, map_count(map->table) + 1)) &&
+		(iter = map_iter_new(map->table)))
+	{
+		while (map_iter_next(iter, &entries[i].key, &data))
+			entries[i++].count = COUNT_VALUE(data);
+		map_iter_delete(iter);
+	}
+	else
+		mem_free((void **) &entries);
+	thread_unlock(map->lock);
+	thread_unlock(map->buffers_lock);
+
+	*n = i;
+	return entries;
+}
+
+/* vi:set ts=4 sw=4: */
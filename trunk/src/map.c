@@ -1,8 +1,10 @@
 #include "scelib/map.h"
 #include "scelib/memory.h"
+#include "scelib/thread.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #ifdef _DEBUG
 #include <stdio.h>
@@ -11,223 +13,444 @@
 #define DPRINT(m)
 #endif
 
-typedef struct bucket_type
+/* index slot values which don't refer to an entry */
+#define IX_EMPTY	(-1)
+#define IX_DUMMY	(-2)
+
+/* number of entries a table of the given size can hold (2/3 load factor) */
+#define MAP_USABLE(size)	((size) * 2 / 3)
+
+/* all the map memory comes from its allocator */
+#define MAP_MALLOC(map, size)		mem_allocator_alloc((map)->allocator, (size))
+#define MAP_CALLOC(map, n, size)	mem_allocator_calloc((map)->allocator, (size), (n))
+#define MAP_FREE(map, ptr)			mem_allocator_free((map)->allocator, (ptr))
+
+/* with the standard allocator, tables come from the large allocation path,
+ * mapped on huge pages once big enough */
+#define MAP_LARGE(map)	((map)->allocator == &mem_allocator_std)
+#define MAP_TABLE_ALLOC(map, size) \
+	(MAP_LARGE(map) ? mem_large_alloc(size) : MAP_CALLOC(map, 1, (size)))
+#define MAP_TABLE_FREE(map, ptr) \
+	(MAP_LARGE(map) ? mem_large_free((void **) &(ptr)) : MAP_FREE(map, ptr))
+
+/* source entries probed at once by a map_merge_all() thread */
+#define MERGE_BLOCK		4096
+
+/* timing wheel of the entries expiry: WHEEL_LEVELS levels of WHEEL_SLOTS
+ * slots, with a one second tick, a level n slot covering 64^n seconds */
+#define WHEEL_BITS		6
+#define WHEEL_SLOTS		(1 << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS	4
+
+typedef struct entry_type
 {
-	void *key;
+	int hash;
+	void *key;		/* null once the entry is deleted */
 	void *data;
-	struct bucket_type *next;
-} bucket_t;
+} entry_t;
+
+typedef struct timer_type
+{
+	struct timer_type *next;
+	struct timer_type **pprev;	/* previous next pointer, or slot head */
+	time_t expire;
+	int ix;						/* entry index */
+} map_timer_t;
+
+typedef struct wheel_type
+{
+	time_t now;					/* last processed tick */
+	map_timer_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	int count;
+} wheel_t;
 
 struct map_type
 {
-	bucket_t **buckets;
+	void *index;		/* sparse index of 'size' slots of 'width' bytes */
+	int width;
 	int size;
+	entry_t *entries;	/* dense entries table, in insertion order */
+	int used;			/* entries consumed, deleted ones included */
+	int usable;			/* entries allocated */
 	int count;
+	map_timer_t **timers;	/* entries expiry, allocated by the first one */
+	wheel_t *wheel;
 	map_hash_t hashf;
 	map_comp_t compf;
 	map_alloc_t allocf;
 	map_free_t freef;
+	const mem_allocator_t *allocator;
 };
 
 struct map_iter_type
 {
 	map_t map;
-	bucket_t *bucket;
 	int index;
 	int count;
 };
 
-/* Increasing sequence of valid (i.e. prime) table sizes to choose from. */
-static const int table_sizes[] =
-{
-	11, 23, 47, 101, 199, 401, 797, 1601, 3203, 6397, 12799, 25601,
-	51199, 102397, 204803, 409597, 819187, 1638431, 3276799, 6553621,
-	13107197, 26214401
-};
+/* key of a source entry, as found in the destination map by the probe phase
+ * of map_merge_all() */
+typedef struct probe_type
+{
+	int hash;
+	void *dkey;		/* destination key, or null if not found */
+} probe_t;
+
+/* map_merge_all() probe phase work, shared by the threads */
+typedef struct merge_type
+{
+	map_t dst;
+	map_t *srcs;
+	probe_t **probes;
+	int *blocks;			/* cumulated number of blocks of the sources */
+	int n;
+	volatile int next;		/* next block to probe */
+	volatile int misses;	/* source keys not in the destination */
+} merge_t;
+
+/* Increasing sequence of valid (i.e. prime) table sizes to choose from. */
+static const int table_sizes[] =
+{
+	11, 23, 47, 101, 199, 401, 797, 1601, 3203, 6397, 12799, 25601,
+	51199, 102397, 204803, 409597, 819187, 1638431, 3276799, 6553621,
+	13107197, 26214401, 52428767, 104857589, 209715199, 419430383,
+	838860791
+};
 
 /* get number of items in the table */
-static const int num_table_sizes = sizeof(table_sizes) / sizeof(table_sizes[0]);
+static const int num_table_sizes = sizeof(table_sizes) / sizeof(table_sizes[0]);
 
-/* average bucket length threshold that must be reached before a map grows */
-static const double table_resize_factor = 2.0;
+static int map_index_width(int size)
+{
+	/* the index must hold entry numbers up to MAP_USABLE(size) - 1 */
+	if (size <= 128)
+		return 1;
+	if (size <= 32768)
+		return 2;
+	return 4;
+}
 
-static bucket_t *map_bucket_find(map_t map, void *key)
+static int map_index_get(map_t map, int slot)
 {
-	bucket_t *b;
+	switch (map->width)
+	{
+		case 1:
+			return ((signed char *) map->index)[slot];
+		case 2:
+			return ((short *) map->index)[slot];
+		default:
+			return ((int *) map->index)[slot];
+	}
+}
 
-	b = map->buckets[map->hashf(map->size, key)];
-	while (b)
+static void map_index_set(map_t map, int slot, int ix)
+{
+	switch (map->width)
 	{
-		if (!map->compf(key, b->key))
+		case 1:
+			((signed char *) map->index)[slot] = (signed char) ix;
+			break;
+		case 2:
+			((short *) map->index)[slot] = (short) ix;
+			break;
+		default:
+			((int *) map->index)[slot] = ix;
+	}
+}
+
+static int map_hash(map_t map, void *key)
+{
+	int h = map->hashf(MAP_HASH_MAX, key);
+	return (h < 0 ? -(h + 1) : h);
+}
+
+/* Returns the index slot referring to the key entry, or -1 if not found. In
+ * this last case, the slot where the key can be inserted is given back in
+ * pfree. */
+static int map_lookup(map_t map, int hash, void *key, int *pfree)
+{
+	int slot, ix, freeslot = -1;
+	entry_t *e;
+
+	slot = hash % map->size;
+	for (;;)
+	{
+		ix = map_index_get(map, slot);
+		if (ix == IX_EMPTY)
 		{
-			DPRINT(("found bucket at %p for key %p\n", b, key));
-			return b;
+			mem_init(pfree, (freeslot == -1 ? slot : freeslot));
+			return -1;
 		}
-		b = b->next;
+		if (ix == IX_DUMMY)
+		{
+			if (freeslot == -1)
+				freeslot = slot;
+		}
+		else
+		{
+			e = map->entries + ix;
+			if (e->hash == hash && (e->key == key || !map->compf(key, e->key)))
+			{
+				DPRINT(("found entry %d for key %p\n", ix, key));
+				return slot;
+			}
+		}
+		if (++slot == map->size)
+			slot = 0;
 	}
-	return 0;
 }
 
-static bucket_t *map_bucket_alloc(map_t map, void *key, void *data)
+static void map_timer_link(wheel_t *wheel, map_timer_t *t)
 {
-	bucket_t *b;
+	time_t expire = t->expire, delta;
+	map_timer_t **slot;
+	int level;
+
+	/* a late timer goes to the next tick, and a too far one to the last
+	 * level, from which it is cascaded again later; a timer due now, being
+	 * cascaded, goes to the current slot drained by map_expire() */
+	if (expire < wheel->now)
+		expire = wheel->now + 1;
+	delta = expire - wheel->now;
+	for (level = 0; level < WHEEL_LEVELS - 1; ++level)
+	{
+		if (delta < ((time_t) 1 << (WHEEL_BITS * (level + 1))))
+			break;
+	}
+	if (delta >= ((time_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)))
+		expire = wheel->now + ((time_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+	slot = &wheel->slots[level][(expire >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	if ((t->next = *slot))
+		t->next->pprev = &t->next;
+	t->pprev = slot;
+	*slot = t;
+	++ wheel->count;
+}
 
-	if (!(b = (bucket_t *) malloc(sizeof(bucket_t))))
-		return 0;
+static void map_timer_unlink(wheel_t *wheel, map_timer_t *t)
+{
+	if ((*t->pprev = t->next))
+		t->next->pprev = t->pprev;
+	-- wheel->count;
+}
 
-	b->key = (map->allocf ? map->allocf(key) : key);
-	if (!b->key)
+static void map_timer_free(map_t map, int ix)
+{
+	if (map->timers && map->timers[ix])
 	{
-		SAFEERRNO(free(b));
-		return 0;
+		map_timer_unlink(map->wheel, map->timers[ix]);
+		MAP_FREE(map, map->timers[ix]);
+		map->timers[ix] = 0;
 	}
-	DPRINT(("allocated bucket at %p\n", b));
-	if (map->allocf)
-		DPRINT(("copied key at %p\n", b->key));
-	b->data = data;
-	b->next = 0;
-	return b;
 }
 
-static bucket_t *map_bucket_free(map_t map, bucket_t *bucket)
+static int map_expired(map_t map, int ix)
 {
-	bucket_t *next;
+	return (map->timers && map->timers[ix] &&
+			map->timers[ix]->expire <= time(0));
+}
+
+/* Removes the entry referred by the index slot. */
+static void map_entry_remove(map_t map, int slot)
+{
+	int ix = map_index_get(map, slot);
+	entry_t *e = map->entries + ix;
+
+	map_index_set(map, slot, IX_DUMMY);
 	if (map->freef)
 	{
-		DPRINT(("calling key free function for %p\n", bucket->key));
-		map->freef(bucket->key);
+		DPRINT(("calling key free function for %p\n", e->key));
+		map->freef(e->key);
 	}
-	next = bucket->next;
-	DPRINT(("freeing bucket at %p\n", bucket));
-	free(bucket);
-	return next;
+	e->key = 0;
+	e->data = 0;
+	map_timer_free(map, ix);
+	-- map->count;
 }
 
-static void map_set_buckets(map_t map, bucket_t **buckets, int size)
+static entry_t *map_entry_find(map_t map, void *key)
 {
-	if (map->buckets)
-	{
-		int i;
-		bucket_t *b;
-		for (i = 0; i < map->size; ++i)
-		{
-			b = map->buckets[i];
-			while (b)
-				b = map_bucket_free(map, b);
-		}
-		DPRINT(("freeing buckets table at %p\n", map->buckets));
-		free(map->buckets);
-	}
-	DPRINT(("settings buckets table to %p\n", buckets));
-	map->buckets = buckets;
-	map->size = size;
+	int slot, ix;
+
+	slot = map_lookup(map, map_hash(map, key), key, 0);
+	if (slot == -1 || map_expired(map, ix = map_index_get(map, slot)))
+		return 0;
+	return map->entries + ix;
 }
 
-static int map_calc_size(int size)
+static void map_entries_free(map_t map)
 {
 	int i;
 
-	if (size == MAP_SIZE_AUTO)
-		size = table_sizes[0];
-
-	/* ensure using only prime numbers */
-	for (i = 0; i < num_table_sizes; ++i)
+	if (map->freef)
 	{
-		if (table_sizes[i] >= size)
+		for (i = 0; i < map->used; ++i)
 		{
-			size = table_sizes[i];
-			break;
+			if (map->entries[i].key)
+			{
+				DPRINT(("calling key free function for %p\n", map->entries[i].key));
+				map->freef(map->entries[i].key);
+			}
 		}
 	}
-
-	if (i == num_table_sizes)
-		return RETERROR(ERANGE, -1);
-	DPRINT(("calculated table size to %d\n", size));
-	return size;
+	if (map->timers)
+	{
+		for (i = 0; i < map->used; ++i)
+			MAP_FREE(map, map->timers[i]);
+		memset(map->timers, 0, (size_t) map->usable * sizeof(map_timer_t *));
+		memset(map->wheel->slots, 0, sizeof(map->wheel->slots));
+		map->wheel->count = 0;
+	}
+	map->used = 0;
+	map->count = 0;
 }
 
-static int map_resize(map_t map, int newsize, int force)
+/* Reallocates the map tables with the given index size, compacting live
+ * entries and rebuilding the index from their cached hash values. */
+static int map_rebuild(map_t map, int size)
 {
-	if ((newsize = map_calc_size(newsize)) == -1)
+	void *index;
+	entry_t *entries, *e;
+	map_timer_t **timers = 0;
+	int width, usable, i, j, slot;
+
+	width = map_index_width(size);
+	usable = MAP_USABLE(size);
+	if ((size_t) usable > (size_t) -1 / sizeof(entry_t))
+		return RETERROR(ENOMEM, -1);
+
+	if (!(index = MAP_TABLE_ALLOC(map, (size_t) size * width)))
+		return -1;
+	if (!(entries = (entry_t *) MAP_TABLE_ALLOC(map, (size_t) usable * sizeof(entry_t))))
+	{
+		SAFEERRNO(MAP_TABLE_FREE(map, index));
+		return -1;
+	}
+	if (map->timers &&
+		!(timers = (map_timer_t **) MAP_TABLE_ALLOC(map, (size_t) usable * sizeof(map_timer_t *))))
+	{
+		SAFEERRNO(MAP_TABLE_FREE(map, index); MAP_TABLE_FREE(map, entries));
 		return -1;
+	}
+	memset(index, 0xFF, (size_t) size * width);	/* all slots to IX_EMPTY */
 
-	if (force || newsize > map->size)
+	for (i = 0, j = 0; i < map->used; ++i)
 	{
-		map_t newmap;
-		int i;
-		bucket_t *b;
+		if (map->entries[i].key)
+		{
+			if (timers && (timers[j] = map->timers[i]))
+				timers[j]->ix = j;
+			entries[j++] = map->entries[i];
+		}
+	}
+	DPRINT(("rebuilding map at %p with size %d (%d entries)\n", map, size, j));
 
-		newmap = map_new(newsize, map->hashf, map->compf, map->allocf, map->freef);
-		if (!newmap)
-			return -1;
-		for (i = 0; i < map->size; ++i)
+	MAP_TABLE_FREE(map, map->index);
+	MAP_TABLE_FREE(map, map->entries);
+	MAP_TABLE_FREE(map, map->timers);
+	map->index = index;
+	map->width = width;
+	map->size = size;
+	map->entries = entries;
+	map->timers = timers;
+	map->used = j;
+	map->usable = usable;
+
+	for (i = 0, e = entries; i < map->used; ++i, ++e)
+	{
+		slot = e->hash % size;
+		while (map_index_get(map, slot) != IX_EMPTY)
 		{
-			b = map->buckets[i];
-			while (b)
-			{
-				map_set(newmap, b->key, b->data, 0);
-				b = b->next;
-			}
+			if (++slot == size)
+				slot = 0;
 		}
-		map_set_buckets(map, newmap->buckets, newsize);
-		free(newmap);
+		map_index_set(map, slot, i);
 	}
-	return map->size;
+	return 0;
 }
 
-static int map_iter_nextbucket(map_iter_t iter, int startindex)
+static int map_calc_size(int count)
 {
 	int i;
 
-	for (i = startindex; i < iter->map->size; ++i)
+	if (count == MAP_SIZE_AUTO)
+		count = 0;
+
+	/* ensure using only prime numbers */
+	for (i = 0; i < num_table_sizes; ++i)
 	{
-		if (iter->map->buckets[i])
+		if (MAP_USABLE(table_sizes[i]) >= count)
 		{
-			iter->bucket = iter->map->buckets[i];
-			return i;
+			DPRINT(("calculated table size to %d\n", table_sizes[i]));
+			return table_sizes[i];
 		}
 	}
-	iter->bucket = 0;
-	return -1;
+	return RETERROR(ERANGE, -1);
+}
+
+static int map_resize(map_t map, int newcount, int force)
+{
+	int newsize;
+
+	if ((newsize = map_calc_size(newcount)) == -1)
+		return -1;
+
+	if (force || newsize > map->size)
+	{
+		if (map_rebuild(map, newsize))
+			return -1;
+	}
+	return map->size;
 }
 
 int map_ptr_hash(int size, void *key)
 {
-	const unsigned char *k = key;
-	unsigned int h = 0;
-
-	while (*k)
-		h *= 31, h += *k++;
-	h %= size;
-	DPRINT(("calculated hash %d for key %p\n", h, key));
-	return h;
+	const unsigned char *k = key;
+	unsigned int h = 0;
+
+	while (*k)
+		h *= 31, h += *k++;
+	h %= size;
+	DPRINT(("calculated hash %d for key %p\n", h, key));
+	return h;
 }
 
 map_t map_new(int size, map_hash_t hash_func, map_comp_t comp_func,
 			  map_alloc_t alloc_func, map_free_t free_func)
+{
+	return map_new_ex(size, hash_func, comp_func, alloc_func, free_func, NULL);
+}
+
+map_t map_new_ex(int size, map_hash_t hash_func, map_comp_t comp_func,
+				 map_alloc_t alloc_func, map_free_t free_func,
+				 const mem_allocator_t *allocator)
 {
 	map_t map;
 
 	if ((size = map_calc_size(size)) == -1)
 		return 0;
 
-	if (!(map = (map_t) malloc(sizeof(struct map_type))))
+	if (!allocator)
+		allocator = mem_allocator_get();
+	if (!(map = mem_allocator_new(allocator, struct map_type, 1)))
 		return NULL;
+	map->allocator = allocator;
 
-	if (!(map->buckets = (bucket_t **) calloc(size, sizeof(bucket_t *))))
+	if (map_rebuild(map, size))
 	{
-		SAFEERRNO(free(map));
+		SAFEERRNO(MAP_FREE(map, map));
 		return 0;
 	}
-	map->size = size;
-	map->count = 0;
 	map->hashf = hash_func;
 	map->compf = comp_func;
 	map->allocf = alloc_func;
 	map->freef = free_func;
 
 	DPRINT(("allocated map at %p\n", map));
-	DPRINT(("allocated buckets table at %p\n", map->buckets));
+	DPRINT(("allocated tables at %p and %p\n", map->index, map->entries));
 	return map;
 }
 
@@ -240,21 +463,11 @@ int map_count(map_t map)
 
 int map_clear(map_t map, int newsize)
 {
-	int i;
-	bucket_t *b;
-
 	if (!map || !newsize)
 		return RETERROR(EINVAL, -1);
 
-	for (i = 0; i < map->size; ++i)
-	{
-		b = map->buckets[i];
-		while (b)
-			b = map_bucket_free(map, b);
-		map->buckets[i] = 0;
-	}
-	DPRINT(("clear buckets table at %p\n", map->buckets));
-	map->count = 0;
+	map_entries_free(map);
+	DPRINT(("clear tables at %p and %p\n", map->index, map->entries));
 
 	return (map_resize(map, newsize, 1) > 0 ? 0 : -1);
 }
@@ -264,93 +477,469 @@ int map_delete(map_t map)
 	if (!map)
 		return RETERROR(EINVAL, -1);
 
-	map_set_buckets(map, 0, 0);
+	map_entries_free(map);
+	DPRINT(("freeing tables at %p and %p\n", map->index, map->entries));
+	MAP_TABLE_FREE(map, map->index);
+	MAP_TABLE_FREE(map, map->entries);
+	MAP_TABLE_FREE(map, map->timers);
+	MAP_FREE(map, map->wheel);
 	DPRINT(("freeing map at %p\n", map));
-	free(map);
+	MAP_FREE(map, map);
 	return 0;
 }
 
 void *map_find(map_t map, void *key)
 {
-	bucket_t *b;
+	entry_t *e;
 
 	if (!map || !key)
 		return RETERROR(EINVAL, 0);
 
-	b = map_bucket_find(map, key);
-	return (b ? b->key : 0);
+	e = map_entry_find(map, key);
+	return (e ? e->key : 0);
 }
 
 void *map_get(map_t map, void *key)
 {
-	bucket_t *b;
+	entry_t *e;
 
 	if (!map || !key)
 		return RETERROR(EINVAL, 0);
 
-	b = map_bucket_find(map, key);
-	return (b ? b->data : 0);
+	e = map_entry_find(map, key);
+	return (e ? e->data : 0);
+}
+
+/* Sets the key data, its hash being already known. The data of an existing
+ * key is replaced, by the one returned by the conflict function if given.
+ * Returns the entry of the key, or 0 if any error. */
+static entry_t *map_store_entry(map_t map, int hash, void *key, void *data,
+								map_conflict_t conflict, void **olddata)
+{
+	entry_t *e;
+	int slot, freeslot;
+
+	slot = map_lookup(map, hash, key, &freeslot);
+	if (slot != -1 && map_expired(map, map_index_get(map, slot)))
+	{
+		/* an expired key is replaced by a new one */
+		map_entry_remove(map, slot);
+		slot = map_lookup(map, hash, key, &freeslot);
+	}
+	if (slot != -1)
+	{
+		e = map->entries + map_index_get(map, slot);
+		mem_init(olddata, e->data);
+		e->data = (conflict ? conflict(e->key, e->data, data) : data);
+		return e;
+	}
+
+	if (map->used == map->usable)
+	{
+		/* grow, or only compact if enough entries were deleted */
+		if (map_resize(map, map->count * 2 + 1, 1) == -1)
+			return 0;
+		map_lookup(map, hash, key, &freeslot);
+	}
+
+	e = map->entries + map->used;
+	e->key = (map->allocf ? map->allocf(key) : key);
+	if (!e->key)
+		return 0;
+	if (map->allocf)
+		DPRINT(("copied key at %p\n", e->key));
+	e->hash = hash;
+	e->data = data;
+	if (map->timers)
+		map->timers[map->used] = 0;
+	map_index_set(map, freeslot, map->used);
+	++ map->used;
+	++ map->count;
+	return e;
+}
+
+/* Same as map_store_entry(), returning the new item count or -1. */
+static int map_store(map_t map, int hash, void *key, void *data,
+					 map_conflict_t conflict, void **olddata)
+{
+	return (map_store_entry(map, hash, key, data, conflict, olddata) ?
+			map->count : -1);
+}
+
+/* Conflict function keeping the data already in the map. */
+static void *map_keep(void *key, void *dstdata, void *srcdata)
+{
+	(void) key;
+	(void) srcdata;
+	return dstdata;
+}
+
+/* Ensures the map can get 'count' more keys without being rebuilt. */
+static int map_grow(map_t map, int count)
+{
+	int size;
+
+	if (count <= map->usable - map->used)
+		return 0;
+	if (count > INT_MAX - map->count)
+		return RETERROR(ERANGE, -1);
+	if ((size = map_calc_size(map->count + count)) == -1)
+		return -1;
+	return map_rebuild(map, size);
+}
+
+/* Hash of a source entry key for the destination map, reusing the cached
+ * one if both maps use the same hash function. */
+static int map_hash_from(map_t dst, map_t src, entry_t *e)
+{
+	return (dst->hashf == src->hashf ? e->hash : map_hash(dst, e->key));
+}
+
+/* Probes the destination map for the keys of a block of source entries. */
+static void map_merge_probe(merge_t *merge, int block)
+{
+	map_t src;
+	entry_t *e;
+	probe_t *probe;
+	int s, i, end, slot, misses = 0;
+
+	for (s = 0; merge->blocks[s + 1] <= block; ++s)
+		;
+	src = merge->srcs[s];
+	i = (block - merge->blocks[s]) * MERGE_BLOCK;
+	end = (i + MERGE_BLOCK < src->used ? i + MERGE_BLOCK : src->used);
+	for (e = src->entries + i, probe = merge->probes[s] + i; i < end; ++i, ++e, ++probe)
+	{
+		if (!e->key)
+			continue;
+		probe->hash = map_hash_from(merge->dst, src, e);
+		slot = map_lookup(merge->dst, probe->hash, e->key, 0);
+		/* an expired destination key is replaced, so it counts as missing */
+		if (slot == -1 || map_expired(merge->dst, map_index_get(merge->dst, slot)))
+		{
+			probe->dkey = 0;
+			++ misses;
+		}
+		else
+			probe->dkey = merge->dst->entries[map_index_get(merge->dst, slot)].key;
+	}
+	thread_atomic_add(&merge->misses, misses);
+}
+
+static void map_merge_free(merge_t *merge)
+{
+	int s;
+
+	if (merge->probes)
+	{
+		for (s = 0; s < merge->n; ++s)
+			MAP_FREE(merge->dst, merge->probes[s]);
+	}
+	MAP_FREE(merge->dst, merge->probes);
+	MAP_FREE(merge->dst, merge->blocks);
+}
+
+static void map_merge_proc(thread_t thread, void *userdata)
+{
+	merge_t *merge = (merge_t *) userdata;
+	int block;
+
+	(void) thread;
+	while ((block = thread_atomic_add(&merge->next, 1) - 1) < merge->blocks[merge->n])
+		map_merge_probe(merge, block);
 }
 
 int map_set(map_t map, void *key, void *data, void **olddata)
 {
-	bucket_t *b;
+	if (!map || !key)
+		return RETERROR(EINVAL, -1);
+
+	return map_store(map, map_hash(map, key), key, data, 0, olddata);
+}
+
+void **map_slot(map_t map, void *key)
+{
+	entry_t *e;
 
 	if (!map || !key)
+		return RETERROR(EINVAL, NULL);
+
+	e = map_store_entry(map, map_hash(map, key), key, NULL, map_keep, 0);
+	return (e ? &e->data : NULL);
+}
+
+int map_reserve(map_t map, int count)
+{
+	if (!map || count < 0)
 		return RETERROR(EINVAL, -1);
 
-	b = map_bucket_find(map, key);
-	if (b)
+	return (count > map->count ? map_grow(map, count - map->count) : 0);
+}
+
+int map_merge(map_t dst, map_t src, map_conflict_t conflict)
+{
+	entry_t *e;
+	int i;
+
+	if (!dst || !src)
+		return RETERROR(EINVAL, -1);
+	if (dst == src)
+		return dst->count;
+
+	if (map_grow(dst, src->count))
+		return -1;
+	for (i = 0, e = src->entries; i < src->used; ++i, ++e)
 	{
-		mem_init(olddata, b->data);
-		b->data = data;
+		if (e->key && !map_expired(src, i) &&
+			map_store(dst, map_hash_from(dst, src, e), e->key, e->data,
+					  conflict, 0) == -1)
+			return -1;
 	}
-	else
+	return dst->count;
+}
+
+int map_merge_all(map_t dst, map_t *srcs, int n, map_conflict_t conflict,
+				  int nthreads)
+{
+	merge_t merge;
+	thread_t *threads = 0;
+	map_t src;
+	entry_t *e;
+	probe_t *probe;
+	int s, i, slot, ret = -1;
+
+	if (!dst || (n && !srcs) || n < 0)
+		return RETERROR(EINVAL, -1);
+	for (s = 0; s < n; ++s)
 	{
-		int hash;
+		if (!srcs[s] || srcs[s] == dst)
+			return RETERROR(EINVAL, -1);
+	}
 
-		if (!map_resize(map, map->count + 1, 0))
-			return -1;
+	/* without threads, merging the maps one after the other reserves less
+	 * memory when they share keys */
+	if (nthreads <= 1)
+	{
+		for (s = 0; s < n; ++s)
+		{
+			if (map_merge(dst, srcs[s], conflict) == -1)
+				return -1;
+		}
+		return dst->count;
+	}
 
-		if (!(b = map_bucket_alloc(map, key, data)))
-			return -1;
+	memset(&merge, 0, sizeof(merge));
+	merge.dst = dst;
+	merge.srcs = srcs;
+	merge.n = n;
+	if (!(merge.blocks = (int *) MAP_CALLOC(dst, n + 1, sizeof(int))) ||
+		!(merge.probes = (probe_t **) MAP_CALLOC(dst, n, sizeof(probe_t *))) ||
+		!(threads = (thread_t *) MAP_CALLOC(dst, nthreads, sizeof(thread_t))))
+		goto cleanup;
+	for (s = 0; s < n; ++s)
+	{
+		merge.blocks[s + 1] = merge.blocks[s] + (srcs[s]->used + MERGE_BLOCK - 1) / MERGE_BLOCK;
+		if (srcs[s]->used &&
+			!(merge.probes[s] = (probe_t *) MAP_MALLOC(dst, srcs[s]->used * sizeof(probe_t))))
+			goto cleanup;
+	}
 
-		hash = map->hashf(map->size, key);
-		b->next = map->buckets[hash];
-		map->buckets[hash] = b;
-		++ map->count;
+	/* parallel phase: the destination is only read, while hashing and
+	 * looking up the source keys; the current thread works too */
+	for (i = 1; i < nthreads; ++i)
+	{
+		if ((threads[i] = thread_new(map_merge_proc, &merge)))
+			thread_start(threads[i]);
+	}
+	map_merge_proc(0, &merge);
+	for (i = 1; i < nthreads; ++i)
+	{
+		if (threads[i])
+			thread_waitfor(threads[i]);
 	}
 
-	return map->count;
+	/* serial phase: keys found by the probes are looked up again by their
+	 * source pointer, as a destination key expiring meanwhile is freed when
+	 * the first source replaces it */
+	if (map_grow(dst, merge.misses))
+		goto cleanup;
+	for (s = 0; s < n; ++s)
+	{
+		src = srcs[s];
+		for (i = 0, e = src->entries, probe = merge.probes[s]; i < src->used; ++i, ++e, ++probe)
+		{
+			if (!e->key || map_expired(src, i))
+				continue;
+			if (probe->dkey &&
+				(slot = map_lookup(dst, probe->hash, e->key, 0)) != -1 &&
+				!map_expired(dst, map_index_get(dst, slot)))
+			{
+				entry_t *d = dst->entries + map_index_get(dst, slot);
+				d->data = (conflict ? conflict(d->key, d->data, e->data) : e->data);
+			}
+			else if (map_store(dst, probe->hash, e->key, e->data, conflict, 0) == -1)
+				goto cleanup;
+		}
+	}
+	ret = dst->count;
+
+cleanup:
+	SAFEERRNO(map_merge_free(&merge); MAP_FREE(dst, threads));
+	return ret;
+}
+
+int map_intersect(map_t dst, map_t src, map_conflict_t conflict)
+{
+	entry_t *e, *se;
+	int i, slot;
+
+	if (!dst || !src)
+		return RETERROR(EINVAL, -1);
+	if (dst == src)
+		return dst->count;
+
+	for (i = 0, e = dst->entries; i < dst->used; ++i, ++e)
+	{
+		if (!e->key)
+			continue;
+		slot = map_lookup(src, map_hash_from(src, dst, e), e->key, 0);
+		if (slot == -1 || map_expired(src, map_index_get(src, slot)))
+			map_entry_remove(dst, map_lookup(dst, e->hash, e->key, 0));
+		else if (conflict)
+		{
+			se = src->entries + map_index_get(src, slot);
+			e->data = conflict(e->key, e->data, se->data);
+		}
+	}
+	return dst->count;
+}
+
+int map_diff(map_t dst, map_t src)
+{
+	entry_t *e;
+	int i, slot;
+
+	if (!dst || !src)
+		return RETERROR(EINVAL, -1);
+	if (dst == src)
+		return (map_clear(dst, MAP_SIZE_AUTO) ? -1 : 0);
+
+	for (i = 0, e = dst->entries; i < dst->used; ++i, ++e)
+	{
+		if (!e->key)
+			continue;
+		slot = map_lookup(src, map_hash_from(src, dst, e), e->key, 0);
+		if (slot != -1 && !map_expired(src, map_index_get(src, slot)))
+			map_entry_remove(dst, map_lookup(dst, e->hash, e->key, 0));
+	}
+	return dst->count;
 }
 
 int map_unset(map_t map, void *key, void **olddata)
 {
-	bucket_t *b, *prev;
-	int hash;
+	entry_t *e;
+	int slot;
 
 	if (!map || !key)
 		return RETERROR(EINVAL, -1);
 
-	hash = map->hashf(map->size, key);
-	b = map->buckets[hash];
-	prev = 0;
-	while (b)
+	slot = map_lookup(map, map_hash(map, key), key, 0);
+	if (slot == -1)
+		return RETERROR(ERANGE, -1);
+
+	e = map->entries + map_index_get(map, slot);
+	mem_init(olddata, e->data);
+	map_entry_remove(map, slot);
+	return map->count;
+}
+
+int map_set_ttl(map_t map, void *key, int seconds)
+{
+	map_timer_t *t;
+	int slot, ix;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, -1);
+
+	slot = map_lookup(map, map_hash(map, key), key, 0);
+	if (slot == -1 || map_expired(map, ix = map_index_get(map, slot)))
+		return RETERROR(ERANGE, -1);
+
+	if (seconds <= 0)
+	{
+		map_timer_free(map, ix);
+		return 0;
+	}
+
+	if (!map->wheel)
+	{
+		if (!(map->wheel = (wheel_t *) MAP_CALLOC(map, 1, sizeof(wheel_t))))
+			return -1;
+		map->wheel->now = time(0);
+	}
+	if (!map->timers &&
+		!(map->timers = (map_timer_t **) MAP_TABLE_ALLOC(map, (size_t) map->usable * sizeof(map_timer_t *))))
+		return -1;
+
+	if ((t = map->timers[ix]))
+		map_timer_unlink(map->wheel, t);
+	else
+	{
+		if (!(t = (map_timer_t *) MAP_MALLOC(map, sizeof(map_timer_t))))
+			return -1;
+		t->ix = ix;
+		map->timers[ix] = t;
+	}
+	t->expire = time(0) + seconds;
+	map_timer_link(map->wheel, t);
+	return 0;
+}
+
+int map_expire(map_t map)
+{
+	wheel_t *wheel;
+	map_timer_t *t, *list;
+	entry_t *e;
+	time_t now;
+	int level, removed = 0;
+
+	if (!map)
+		return RETERROR(EINVAL, -1);
+	if (!(wheel = map->wheel))
+		return 0;
+
+	now = time(0);
+	if (!wheel->count && wheel->now < now)
+		wheel->now = now;
+	while (wheel->now < now)
 	{
-		if (!map->compf(key, b->key))
+		++ wheel->now;
+
+		/* when a level wraps, the current slot of the next one is spread
+		 * over the lower levels */
+		for (level = 1; level < WHEEL_LEVELS; ++level)
 		{
-			if (prev)
-				prev->next = b->next;
-			else
-				map->buckets[hash] = b->next;
-			mem_init(olddata, b->data);
-			map_bucket_free(map, b);
-			return -- map->count;;
+			if ((wheel->now >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK)
+				break;
+			list = wheel->slots[level][(wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+			wheel->slots[level][(wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK] = 0;
+			while ((t = list))
+			{
+				list = t->next;
+				-- wheel->count;
+				map_timer_link(wheel, t);
+			}
+		}
+
+		/* all timers of the current first level slot are due */
+		while ((t = wheel->slots[0][wheel->now & WHEEL_MASK]))
+		{
+			e = map->entries + t->ix;
+			map_entry_remove(map, map_lookup(map, e->hash, e->key, 0));
+			++ removed;
 		}
-		prev = b;
-		b = b->next;
 	}
-	return RETERROR(ERANGE, -1);
+	return removed;
 }
 
 map_iter_t map_iter_new(map_t map)
@@ -360,12 +949,11 @@ map_iter_t map_iter_new(map_t map)
 	if (!map)
 		return RETERROR(EINVAL, 0);
 
-	if (!(iter = (map_iter_t) malloc(sizeof(struct map_iter_type))))
+	if (!(iter = (map_iter_t) MAP_MALLOC(map, sizeof(struct map_iter_type))))
 		return NULL;
 
 	iter->map = map;
-	iter->bucket = NULL;
-	iter->index = -1;
+	iter->index = 0;
 	iter->count = 0;
 
 	DPRINT(("iterator allocated at %p\n", iter));
@@ -377,62 +965,59 @@ int map_iter_delete(map_iter_t iter)
 	if (!iter)
 		return RETERROR(EINVAL, -1);
 
-	free(iter);
+	MAP_FREE(iter->map, iter);
 	return 0;
 }
 
 int map_iter_next(map_iter_t iter, void **key, void **data)
 {
+	entry_t *e;
+
 	if (!iter)
 		return RETERROR(EINVAL, -1);
 
-	if (iter->index == -1)
+	while (iter->index < iter->map->used)
 	{
-		iter->index = map_iter_nextbucket(iter, 0);
-	}
-	else
-	{
-		bucket_t *b = iter->bucket->next;
-		if (!b)
-			iter->index = map_iter_nextbucket(iter, iter->index + 1);
-		else
-			iter->bucket = b;
+		e = iter->map->entries + iter->index++;
+		if (e->key && !map_expired(iter->map, iter->index - 1))
+		{
+			mem_init(key, e->key);
+			mem_init(data, e->data);
+			return ++ iter->count;
+		}
 	}
-	if (!iter->bucket)
-		return 0;
-
-	mem_init(key, iter->bucket->key);
-	mem_init(data, iter->bucket->data);
-
-	return ++ iter->count;
+	return 0;
 }
 
 #ifdef _DEBUG
 int map_dump(map_t map)
 {
-	bucket_t *b;
-	int i;
+	entry_t *e;
+	int i, ix;
 
 	if (!map)
 		return RETERROR(EINVAL, -1);
 
-	printf("map at #%p (size %d, %d elements)\n", map, map->size, map->count);
-	printf("buckets table at #%p\n", map->buckets);
+	printf("map at #%p (size %d, %d elements, %d/%d entries used)\n",
+		map, map->size, map->count, map->used, map->usable);
+	printf("index table at #%p (%d bytes slots)\n", map->index, map->width);
 	for (i = 0; i < map->size; ++i)
 	{
-		b = map->buckets[i];
-		if (!b)
-		{
+		ix = map_index_get(map, i);
+		if (ix == IX_EMPTY)
 			printf("[%d]: empty\n", i);
-			continue;
-		}
-		printf("[%d]: #%p - key %p - data %p\n", i, b, b->key, b->data);
-		b = b->next;
-		while (b)
-		{
-			printf("   -> #%p - key %p - data %p\n", b, b->key, b->data);
-			b = b->next;
-		}
+		else if (ix == IX_DUMMY)
+			printf("[%d]: deleted\n", i);
+		else
+			printf("[%d]: entry %d\n", i, ix);
+	}
+	printf("entries table at #%p\n", map->entries);
+	for (i = 0, e = map->entries; i < map->used; ++i, ++e)
+	{
+		if (e->key)
+			printf("(%d): hash %d - key %p - data %p\n", i, e->hash, e->key, e->data);
+		else
+			printf("(%d): deleted\n", i);
 	}
 	return 0;
 }
@@ -18,69 +18,2016 @@
  *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+/* the trace functions use the untraced ones */
+#define SCELIB_MEM_NOTRACE
+
+/* mremap() is a GNU extension */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "scelib/memory.h"
+#include "scelib/thread.h"
+#include "scelib/platform.h"
 #include <string.h>
 #include <errno.h>
 
+#if PLATFORM_IS(UNIX)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 /* ========================================================================= */
-/* Public functions                                                          */
+/* Constants and macros used in this module                                  */
+
+/* alignment of the arena allocations, the malloc() one on common systems */
+#define MEM_ARENA_ALIGN		16
+#define MEM_ARENA_ROUND(n)	(((n) + MEM_ARENA_ALIGN - 1) & ~(size_t) (MEM_ARENA_ALIGN - 1))
+
+/* the allocations start after the chunk header */
+#define MEM_ARENA_HEADER	MEM_ARENA_ROUND(sizeof(mem_chunk_t))
+#define MEM_ARENA_DATA(c)	((char *) (c) + MEM_ARENA_HEADER)
+
+/* objects per pool magazine */
+#define MEM_POOL_ROUNDS		64
+
+/* scratch memory is preceded by a header, aligned as the arena memory */
+#define MEM_SCRATCH_HEADER	MEM_ARENA_ROUND(sizeof(mem_scratch_block_t))
+
+/* traced call sites, a last one counting the sites beyond them */
+#define MEM_TRACE_SITES		1024
+#define MEM_TRACE_OTHER		MEM_TRACE_SITES
+
+/* hash buckets of the recorded allocations */
+#define MEM_TRACE_BUCKETS	4096
+#define MEM_TRACE_BUCKET(p)	(((size_t) (p) >> 4) & (MEM_TRACE_BUCKETS - 1))
+
+/* large blocks are mapped on huge pages of this size when possible */
+#define MEM_LARGE_HUGE_PAGE	(2 * 1024 * 1024)
+
+#if PLATFORM_IS(UNIX) && !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS		MAP_ANON
+#endif
+
+/* trace sites are published to other threads without locks */
+#if defined(__GNUC__)
+#define MEM_BARRIER()		__sync_synchronize()
+#else
+#define MEM_BARRIER()
+#endif
+
+/* ========================================================================= */
+/* Internal types                                                            */
 
 /* ------------------------------------------------------------------------- */
-/* mem_free()                                                                */
+/* arena chunk, linked to the previously allocated one                       */
 
-void mem_free(void **pmem) {
+typedef struct mem_chunk_type {
+	struct mem_chunk_type *next;
+	size_t size;
+	size_t used;
+} mem_chunk_t;
 
-	if (pmem) {
-		if (*pmem) {
-			free(*pmem);
-			*pmem = NULL;
-		}
+/* ------------------------------------------------------------------------- */
+/* arena structure: allocations are bumped in the current chunk, large ones  */
+/* get their own chunk, and all chunks are listed newest first               */
+
+struct mem_arena_type {
+	mem_chunk_t *chunks;
+	mem_chunk_t *current;
+	size_t chunk_size;
+	const mem_allocator_t *allocator;
+};
+
+/* ------------------------------------------------------------------------- */
+/* pool magazine, a stack of free objects                                    */
+
+typedef struct mem_mag_type {
+	struct mem_mag_type *next;
+	int rounds;
+	void *objs[MEM_POOL_ROUNDS];
+} mem_mag_t;
+
+/* ------------------------------------------------------------------------- */
+/* per thread pool cache, only used by its thread: allocations and frees     */
+/* use the loaded magazine, and the previous one before going to the depot   */
+
+typedef struct mem_cache_type {
+	struct mem_cache_type *next;
+	mem_pool_t pool;
+	mem_mag_t *loaded;
+	mem_mag_t *previous;
+} mem_cache_t;
+
+/* ------------------------------------------------------------------------- */
+/* pool structure; objects and magazines are carved from an arena, and the   */
+/* depot lists magazines shared by the threads                               */
+
+struct mem_pool_type {
+	const mem_allocator_t *allocator;
+	size_t size;
+	int zero;
+	tls_t tls;
+	lock_t lock;			/* protects the members below */
+	mem_arena_t arena;
+	mem_mag_t *full;
+	mem_mag_t *empty;
+	mem_cache_t *caches;
+};
+
+/* ------------------------------------------------------------------------- */
+/* scratch memory header, giving the state of the scratch stack to restore  */
+/* when popped; the memory pushed once the region is full comes from the    */
+/* heap, and such blocks are listed newest first                             */
+
+typedef struct mem_scratch_block_type {
+	size_t used;
+	size_t depth;
+	struct mem_scratch_block_type *next;
+} mem_scratch_block_t;
+
+/* ------------------------------------------------------------------------- */
+/* scratch stack of a thread                                                 */
+
+typedef struct mem_scratch_type {
+	char *region;
+	size_t used;			/* bytes used in the region */
+	size_t depth;			/* number of pushed blocks */
+	mem_scratch_block_t *heap;
+} mem_scratch_t;
+
+/* ------------------------------------------------------------------------- */
+/* reference counted buffer; the memory of the buffers made by mem_buf_new() */
+/* follows their structure, and slices refer to the buffer they view         */
+
+struct mem_buf_type {
+	volatile int refs;
+	char *data;
+	size_t len;
+	struct mem_buf_type *parent;
+	mem_buf_release_t release;
+	void *context;
+	const mem_allocator_t *allocator;
+};
+
+#define MEM_BUF_HEADER		MEM_ARENA_ROUND(sizeof(struct mem_buf_type))
+
+/* ------------------------------------------------------------------------- */
+/* traced call site                                                          */
+
+typedef struct mem_site_type {
+	const char *volatile file;
+	int line;
+	size_t live;			/* recorded bytes allocated by the site */
+} mem_site_t;
+
+/* ------------------------------------------------------------------------- */
+/* per thread trace counters, indexed by call site, only written by their    */
+/* thread so that counting takes no lock                                     */
+
+typedef struct mem_trace_thread_type {
+	struct mem_trace_thread_type *next;
+	long allocs[MEM_TRACE_SITES + 1];
+	long frees[MEM_TRACE_SITES + 1];
+	size_t bytes[MEM_TRACE_SITES + 1];
+	long sizes[MEM_TRACE_CLASSES];
+	size_t countdown;		/* bytes allocated before the next record */
+} mem_trace_thread_t;
+
+/* ------------------------------------------------------------------------- */
+/* recorded allocation                                                       */
+
+typedef struct mem_record_type {
+	struct mem_record_type *next;
+	void *ptr;
+	size_t weight;			/* bytes it stands for */
+	int site;
+} mem_record_t;
+
+/* ========================================================================= */
+/* Static variables                                                          */
+
+static void *mem_std_alloc(void *context, size_t size) {
+
+	(void) context;
+	return malloc(size);
+}
+
+static void *mem_std_realloc(void *context, void *mem, size_t size) {
+
+	(void) context;
+	return realloc(mem, size);
+}
+
+static void mem_std_free(void *context, void *mem) {
+
+	(void) context;
+	free(mem);
+}
+
+const mem_allocator_t mem_allocator_std = {
+	mem_std_alloc, mem_std_realloc, mem_std_free, NULL
+};
+
+static const mem_allocator_t *volatile mem_global = &mem_allocator_std;
+
+/* large allocations */
+static volatile size_t mem_large_min = MEM_LARGE_THRESHOLD;
+
+/* the thread allocators key is created by the first thread setting one */
+static tls_t mem_thread_key;
+static volatile int mem_thread_state;
+
+/* the scratch stacks key is created by the first push */
+static tls_t mem_scratch_key;
+static volatile int mem_scratch_state;
+
+/* the trace state is created by the first traced call; the lock protects  */
+/* the threads list, the records, and the sites creation                    */
+static volatile int mem_trace_state;
+static tls_t mem_trace_key;
+static lock_t mem_trace_lock;
+static mem_trace_thread_t *mem_trace_threads;
+static mem_trace_thread_t mem_trace_exited;
+static mem_site_t mem_trace_sites[MEM_TRACE_SITES + 1];
+static mem_record_t *mem_trace_buckets[MEM_TRACE_BUCKETS];
+static size_t mem_trace_interval;
+static size_t mem_trace_live;
+static size_t mem_trace_peak;
+
+#if defined(__GNUC__)
+/* the thread counters and scratch stack are found faster than with the    */
+/* thread local keys                                                        */
+static __thread mem_trace_thread_t *mem_trace_self;
+static __thread mem_scratch_t *mem_scratch_self;
+#endif
+
+/* ========================================================================= */
+/* Static functions                                                          */
+
+/* ------------------------------------------------------------------------- */
+/* allocates a chunk and pushes it on the arena list                         */
+
+static mem_chunk_t *mem_chunk_new(mem_arena_t arena, size_t size) {
+
+	mem_chunk_t *chunk;
+
+	chunk = (mem_chunk_t *) mem_allocator_alloc(arena->allocator, MEM_ARENA_HEADER + size);
+	if (!chunk) {
+		return NULL;
+	}
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	return chunk;
+}
+
+/* ------------------------------------------------------------------------- */
+/* frees the newest chunks until the given one                               */
+
+static void mem_chunk_free(mem_arena_t arena, mem_chunk_t *until) {
+
+	mem_chunk_t *chunk;
+
+	while ((chunk = arena->chunks) != until) {
+		arena->chunks = chunk->next;
+		mem_allocator_free(arena->allocator, chunk);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* gets an empty magazine from the depot; the pool must be locked            */
+
+static mem_mag_t *mem_mag_empty(mem_pool_t pool) {
+
+	mem_mag_t *mag = pool->empty;
+
+	if (mag) {
+		pool->empty = mag->next;
 	}
 	else {
-		errno = EINVAL;
+		mag = (mem_mag_t *) mem_arena_alloc(pool->arena, sizeof(mem_mag_t));
 	}
+	if (mag) {
+		mag->rounds = 0;
+	}
+	return mag;
 }
 
 /* ------------------------------------------------------------------------- */
-/* mem_realloc()                                                             */
+/* gives a magazine back to the depot; the pool must be locked               */
 
-void *mem_realloc(void **pmem, size_t count) {
+static void mem_mag_put(mem_pool_t pool, mem_mag_t *mag) {
 
-	void *ptr, *reptr;
+	mem_mag_t **list = (mag->rounds) ? &pool->full : &pool->empty;
 
-	if (!count) {
-		mem_free(pmem);
+	mag->next = *list;
+	*list = mag;
+}
+
+/* ------------------------------------------------------------------------- */
+/* thread exit destructor, giving the cache magazines to the depot           */
+
+static void mem_cache_exit(void *data) {
+
+	mem_cache_t **pcache, *cache = (mem_cache_t *) data;
+	mem_pool_t pool = cache->pool;
+
+	thread_lock(pool->lock);
+	for (pcache = &pool->caches; *pcache != cache; pcache = &(*pcache)->next)
+		;
+	*pcache = cache->next;
+	mem_mag_put(pool, cache->loaded);
+	mem_mag_put(pool, cache->previous);
+	thread_unlock(pool->lock);
+	mem_allocator_free(pool->allocator, cache);
+}
+
+/* ------------------------------------------------------------------------- */
+/* gets the calling thread cache, creating it at first use                   */
+
+static mem_cache_t *mem_cache_get(mem_pool_t pool) {
+
+	mem_cache_t *cache;
+
+	cache = (mem_cache_t *) thread_tls_get(pool->tls);
+	if (cache) {
+		return cache;
+	}
+
+	cache = mem_allocator_new(pool->allocator, mem_cache_t, 1);
+	if (!cache) {
+		return NULL;
+	}
+	cache->pool = pool;
+	thread_lock(pool->lock);
+	cache->loaded = mem_mag_empty(pool);
+	cache->previous = mem_mag_empty(pool);
+	if (!cache->loaded || !cache->previous || thread_tls_set(pool->tls, cache)) {
+		SAFEERRNO(if (cache->loaded) { mem_mag_put(pool, cache->loaded); }
+				  if (cache->previous) { mem_mag_put(pool, cache->previous); }
+				  thread_unlock(pool->lock);
+				  mem_allocator_free(pool->allocator, cache));
 		return NULL;
 	}
+	cache->next = pool->caches;
+	pool->caches = cache;
+	thread_unlock(pool->lock);
+	return cache;
+}
 
-	ptr = (pmem) ? *pmem : NULL;
-	reptr = (ptr) ? realloc(ptr, count) : calloc(1, count);
-	if (!reptr) {
-		free(ptr);
-		errno = ENOMEM;
+/* ------------------------------------------------------------------------- */
+/* refills the empty loaded magazine, with a full one of the depot, or with  */
+/* new objects                                                               */
+
+static int mem_cache_reload(mem_pool_t pool, mem_cache_t *cache) {
+
+	mem_mag_t *mag = cache->loaded;
+	char *objs;
+	int i, ret = 0;
+
+	thread_lock(pool->lock);
+	if (pool->full) {
+		cache->loaded = pool->full;
+		pool->full = cache->loaded->next;
+		mem_mag_put(pool, mag);
 	}
-	mem_init(pmem, (reptr) ? reptr : NULL);
-	return reptr;
+	else if ((objs = (char *) mem_arena_alloc(pool->arena,
+											  pool->size * MEM_POOL_ROUNDS))) {
+		for (i = 0; i < MEM_POOL_ROUNDS; i++) {
+			mag->objs[i] = objs + i * pool->size;
+		}
+		mag->rounds = MEM_POOL_ROUNDS;
+	}
+	else {
+		ret = -1;
+	}
+	thread_unlock(pool->lock);
+	return ret;
 }
 
 /* ------------------------------------------------------------------------- */
-/* mem_dup()                                                                 */
+/* arena allocator functions; allocations are prefixed with their size, so   */
+/* that they can be reallocated                                              */
 
-void *mem_dup(void *mem, size_t size) {
+static void *mem_arena_alloc_size(void *context, size_t size) {
+
+	size_t *ptr;
+
+	ptr = (size_t *) mem_arena_alloc((mem_arena_t) context, MEM_ARENA_ALIGN + size);
+	if (!ptr) {
+		return NULL;
+	}
+	*ptr = size;
+	return (char *) ptr + MEM_ARENA_ALIGN;
+}
 
+static void *mem_arena_realloc_size(void *context, void *mem, size_t size) {
+
+	size_t oldsize;
 	void *ptr;
 
-	if (!size || !mem) {
+	if (!mem) {
+		return mem_arena_alloc_size(context, size);
+	}
+	oldsize = *(size_t *) ((char *) mem - MEM_ARENA_ALIGN);
+	if (size <= oldsize) {
+		return mem;
+	}
+	ptr = mem_arena_alloc_size(context, size);
+	return (ptr) ? memcpy(ptr, mem, oldsize) : NULL;
+}
+
+static void mem_arena_free_size(void *context, void *mem) {
+
+	/* arena memory is only freed with the arena */
+	(void) context;
+	(void) mem;
+}
+
+/* ------------------------------------------------------------------------- */
+/* runs an initialization function once: the state is 0 before, 1 while it  */
+/* runs, and 2 after; a failed initialization is tried again next time      */
+
+static int mem_once(volatile int *state, int (*init)(void)) {
+
+	int ret;
+
+	while (*state != 2) {
+		if (thread_atomic_cas(state, 0, 1)) {
+			ret = init();
+			thread_atomic_add(state, (ret) ? -1 : 1);
+			if (ret) {
+				return -1;
+			}
+		}
+		else {
+			thread_yield();
+		}
+	}
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* thread allocators initialization                                          */
+
+static int mem_thread_init(void) {
+
+	mem_thread_key = thread_tls_new(NULL);
+	return (mem_thread_key) ? 0 : -1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* frees the scratch stack of an exiting thread                              */
+
+static void mem_scratch_exit(void *data) {
+
+	mem_scratch_t *scratch = (mem_scratch_t *) data;
+	mem_scratch_block_t *block;
+
+	while ((block = scratch->heap)) {
+		scratch->heap = block->next;
+		free(block);
+	}
+#if defined(__GNUC__)
+	mem_scratch_self = NULL;
+#endif
+	free(scratch->region);
+	free(scratch);
+}
+
+/* ------------------------------------------------------------------------- */
+/* scratch stacks initialization                                             */
+
+static int mem_scratch_init(void) {
+
+	mem_scratch_key = thread_tls_new(mem_scratch_exit);
+	return (mem_scratch_key) ? 0 : -1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* returns the scratch stack of the calling thread, created on first use;    */
+/* its region is only touched as it's used, malloc() mapping such a large   */
+/* block on most systems                                                     */
+
+static mem_scratch_t *mem_scratch_get(void) {
+
+	mem_scratch_t *scratch;
+
+#if defined(__GNUC__)
+	if (mem_scratch_self) {
+		return mem_scratch_self;
+	}
+#endif
+	if (mem_once(&mem_scratch_state, mem_scratch_init)) {
 		return NULL;
 	}
+	scratch = (mem_scratch_t *) thread_tls_get(mem_scratch_key);
+	if (scratch) {
+		return scratch;
+	}
 
-	ptr = malloc(size);
-	if (!ptr) {
+	scratch = (mem_scratch_t *) calloc(1, sizeof(mem_scratch_t));
+	if (!scratch) {
+		return NULL;
+	}
+	scratch->region = (char *) malloc(MEM_SCRATCH_SIZE);
+	if (thread_tls_set(mem_scratch_key, scratch)) {
+		SAFEERRNO(free(scratch->region); free(scratch));
 		return NULL;
 	}
+#if defined(__GNUC__)
+	mem_scratch_self = scratch;
+#endif
+	return scratch;
+}
 
-	return memcpy(ptr, mem, size);
+/* ------------------------------------------------------------------------- */
+/* adds the counters of a trace thread to others                             */
+
+static void mem_trace_add(mem_trace_thread_t *to, const mem_trace_thread_t *from) {
+
+	int i;
+
+	for (i = 0; i <= MEM_TRACE_SITES; i++) {
+		to->allocs[i] += from->allocs[i];
+		to->frees[i] += from->frees[i];
+		to->bytes[i] += from->bytes[i];
+	}
+	for (i = 0; i < MEM_TRACE_CLASSES; i++) {
+		to->sizes[i] += from->sizes[i];
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* thread exit destructor, keeping the counters of the thread                */
+
+static void mem_trace_exit(void *data) {
+
+	mem_trace_thread_t **pthr, *thr = (mem_trace_thread_t *) data;
+
+	thread_lock(mem_trace_lock);
+	for (pthr = &mem_trace_threads; *pthr != thr; pthr = &(*pthr)->next)
+		;
+	*pthr = thr->next;
+	mem_trace_add(&mem_trace_exited, thr);
+	thread_unlock(mem_trace_lock);
+#if defined(__GNUC__)
+	mem_trace_self = NULL;
+#endif
+	free(thr);
+}
+
+/* ------------------------------------------------------------------------- */
+/* trace initialization                                                      */
+
+static int mem_trace_init(void) {
+
+	mem_trace_sites[MEM_TRACE_OTHER].file = "(other sites)";
+	mem_trace_lock = thread_lock_create();
+	mem_trace_key = thread_tls_new(mem_trace_exit);
+	if (!mem_trace_lock || !mem_trace_key) {
+		SAFEERRNO(thread_lock_destroy(mem_trace_lock); thread_tls_delete(mem_trace_key));
+		return -1;
+	}
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* gets the trace counters of the calling thread, or NULL if any error      */
+
+static mem_trace_thread_t *mem_trace_thread(void) {
+
+	mem_trace_thread_t *thr;
+
+#if defined(__GNUC__)
+	if (mem_trace_self) {
+		return mem_trace_self;
+	}
+#endif
+	if (mem_once(&mem_trace_state, mem_trace_init)) {
+		return NULL;
+	}
+	thr = (mem_trace_thread_t *) thread_tls_get(mem_trace_key);
+	if (thr) {
+		return thr;
+	}
+
+	thr = (mem_trace_thread_t *) calloc(1, sizeof(mem_trace_thread_t));
+	if (!thr) {
+		return NULL;
+	}
+	thr->countdown = mem_trace_interval;
+	if (thread_tls_set(mem_trace_key, thr)) {
+		SAFEERRNO(free(thr));
+		return NULL;
+	}
+	thread_lock(mem_trace_lock);
+	thr->next = mem_trace_threads;
+	mem_trace_threads = thr;
+	thread_unlock(mem_trace_lock);
+#if defined(__GNUC__)
+	mem_trace_self = thr;
+#endif
+	return thr;
+}
+
+/* ------------------------------------------------------------------------- */
+/* finds the index of a call site, found without lock once created          */
+
+static int mem_trace_site(const char *file, int line) {
 
+	size_t h = ((size_t) file >> 3) ^ ((size_t) line * 2654435761U);
+	mem_site_t *site = NULL;
+	int i, locked = 0;
+
+	for (i = 0; i < MEM_TRACE_SITES; i++) {
+		site = mem_trace_sites + ((h + i) & (MEM_TRACE_SITES - 1));
+		if (site->file == file && site->line == line) {
+			break;
+		}
+		if (!site->file) {
+			if (!locked) {
+				/* the slot is checked again under the lock */
+				thread_lock(mem_trace_lock);
+				locked = 1;
+				i--;
+				continue;
+			}
+			site->line = line;
+			MEM_BARRIER();
+			site->file = file;
+			break;
+		}
+	}
+	if (locked) {
+		thread_unlock(mem_trace_lock);
+	}
+	return (i < MEM_TRACE_SITES) ? (int) (site - mem_trace_sites) : MEM_TRACE_OTHER;
+}
+
+/* ------------------------------------------------------------------------- */
+/* counts an allocation, and records it when the sampling interval elapsed  */
+
+static void mem_trace_alloc(void *ptr, size_t size, const char *file, int line) {
+
+	mem_trace_thread_t *thr;
+	mem_record_t *rec;
+	size_t weight = size, bucket;
+	int site, cls;
+
+	if (!ptr || !(thr = mem_trace_thread())) {
+		return;
+	}
+	site = mem_trace_site(file, line);
+	thr->allocs[site]++;
+	thr->bytes[site] += size;
+#if defined(__GNUC__)
+	cls = (size) ? (int) (sizeof(long) * 8) - __builtin_clzl((unsigned long) size) : 0;
+#else
+	for (cls = 0; cls < MEM_TRACE_CLASSES && (size >> cls); cls++)
+		;
+#endif
+	thr->sizes[(cls < MEM_TRACE_CLASSES) ? cls : MEM_TRACE_CLASSES - 1]++;
+
+	if (mem_trace_interval) {
+		if (size < thr->countdown) {
+			thr->countdown -= size;
+			return;
+		}
+		thr->countdown = mem_trace_interval;
+		if (weight < mem_trace_interval) {
+			weight = mem_trace_interval;
+		}
+	}
+
+	rec = (mem_record_t *) malloc(sizeof(mem_record_t));
+	if (!rec) {
+		return;
+	}
+	rec->ptr = ptr;
+	rec->weight = weight;
+	rec->site = site;
+	bucket = MEM_TRACE_BUCKET(ptr);
+	thread_lock(mem_trace_lock);
+	rec->next = mem_trace_buckets[bucket];
+	mem_trace_buckets[bucket] = rec;
+	mem_trace_sites[site].live += weight;
+	mem_trace_live += weight;
+	if (mem_trace_live > mem_trace_peak) {
+		mem_trace_peak = mem_trace_live;
+	}
+	thread_unlock(mem_trace_lock);
+}
+
+/* ------------------------------------------------------------------------- */
+/* forgets the record of a freed allocation, if any                          */
+
+static void mem_trace_forget(void *ptr) {
+
+	mem_record_t **prec, *rec = NULL;
+	size_t bucket = MEM_TRACE_BUCKET(ptr);
+
+	/* most frees are of unrecorded allocations, with an empty bucket */
+	if (!mem_trace_buckets[bucket]) {
+		return;
+	}
+
+	thread_lock(mem_trace_lock);
+	for (prec = &mem_trace_buckets[bucket]; *prec; prec = &(*prec)->next) {
+		if ((*prec)->ptr == ptr) {
+			rec = *prec;
+			*prec = rec->next;
+			mem_trace_sites[rec->site].live -= rec->weight;
+			mem_trace_live -= rec->weight;
+			break;
+		}
+	}
+	thread_unlock(mem_trace_lock);
+	free(rec);
+}
+
+/* ------------------------------------------------------------------------- */
+/* orders the sites by decreasing memory in use, then allocations           */
+
+static mem_trace_thread_t *mem_trace_sort_totals;
+
+static int mem_trace_site_comp(const void *p1, const void *p2) {
+
+	int i1 = *(const int *) p1, i2 = *(const int *) p2;
+
+	if (mem_trace_sites[i1].live != mem_trace_sites[i2].live) {
+		return (mem_trace_sites[i1].live > mem_trace_sites[i2].live) ? -1 : 1;
+	}
+	if (mem_trace_sort_totals->allocs[i1] != mem_trace_sort_totals->allocs[i2]) {
+		return (mem_trace_sort_totals->allocs[i1] > mem_trace_sort_totals->allocs[i2]) ? -1 : 1;
+	}
+	return i1 - i2;
+}
+
+/* ========================================================================= */
+/* Public functions                                                          */
+
+/* ------------------------------------------------------------------------- */
+/* mem_free()                                                                */
+
+void mem_free(void **pmem) {
+
+	if (pmem) {
+		if (*pmem) {
+			free(*pmem);
+			*pmem = NULL;
+		}
+	}
+	else {
+		errno = EINVAL;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_realloc()                                                             */
+
+void *mem_realloc(void **pmem, size_t count) {
+
+	void *ptr, *reptr;
+
+	if (!count) {
+		mem_free(pmem);
+		return NULL;
+	}
+
+	ptr = (pmem) ? *pmem : NULL;
+	reptr = (ptr) ? realloc(ptr, count) : calloc(1, count);
+	if (!reptr) {
+		free(ptr);
+		errno = ENOMEM;
+	}
+	mem_init(pmem, (reptr) ? reptr : NULL);
+	return reptr;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_dup()                                                                 */
+
+void *mem_dup(void *mem, size_t size) {
+
+	void *ptr;
+
+	if (!size || !mem) {
+		return NULL;
+	}
+
+	ptr = malloc(size);
+	if (!ptr) {
+		return NULL;
+	}
+
+	return memcpy(ptr, mem, size);
+
+}
+
+/* ------------------------------------------------------------------------- */
+/* aligned allocations are preceded by a header, giving the malloc() memory  */
+/* and the size to copy when reallocated                                     */
+
+typedef struct mem_aligned_type {
+	void *base;
+	size_t size;
+} mem_aligned_t;
+
+#define MEM_ALIGNED_HEADER(mem)	((mem_aligned_t *) (mem) - 1)
+
+/* ------------------------------------------------------------------------- */
+/* mem_aligned_calloc()                                                      */
+
+void *mem_aligned_calloc(size_t size, size_t count, size_t align) {
+
+	char *base, *mem;
+
+	if (!align || (align & (align - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (align < sizeof(void *)) {
+		align = sizeof(void *);
+	}
+	if ((count && size > ((size_t) -1 - align - sizeof(mem_aligned_t)) / count)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	base = (char *) calloc(1, size * count + align - 1 + sizeof(mem_aligned_t));
+	if (!base) {
+		return NULL;
+	}
+	mem = base + sizeof(mem_aligned_t);
+	mem += (align - (size_t) mem % align) % align;
+	MEM_ALIGNED_HEADER(mem)->base = base;
+	MEM_ALIGNED_HEADER(mem)->size = size * count;
+	return mem;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_aligned_realloc()                                                     */
+
+void *mem_aligned_realloc(void **pmem, size_t count, size_t align) {
+
+	void *ptr, *reptr;
+	size_t size;
+
+	if (!count) {
+		mem_free_aligned(pmem);
+		return NULL;
+	}
+
+	ptr = (pmem) ? *pmem : NULL;
+	reptr = mem_aligned_calloc(1, count, align);
+	if (ptr) {
+		if (reptr) {
+			size = MEM_ALIGNED_HEADER(ptr)->size;
+			memcpy(reptr, ptr, (size < count) ? size : count);
+		}
+		SAFEERRNO(free(MEM_ALIGNED_HEADER(ptr)->base));
+	}
+	mem_init(pmem, reptr);
+	return reptr;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_free_aligned()                                                        */
+
+void mem_free_aligned(void **pmem) {
+
+	if (pmem) {
+		if (*pmem) {
+			free(MEM_ALIGNED_HEADER(*pmem)->base);
+			*pmem = NULL;
+		}
+	}
+	else {
+		errno = EINVAL;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_lines_new()                                                           */
+
+void *mem_lines_new(size_t size, size_t count, size_t *stride) {
+
+	size_t line = (size + MEM_CACHE_LINE - 1) & ~(size_t) (MEM_CACHE_LINE - 1);
+
+	if (!size || !stride) {
+		errno = EINVAL;
+		return NULL;
+	}
+	*stride = line;
+	return mem_aligned_calloc(line, count, MEM_CACHE_LINE);
+}
+
+/* ------------------------------------------------------------------------- */
+/* large blocks are preceded by a header, giving the size asked for and the  */
+/* length of their mapping, 0 for calloc() memory                            */
+
+typedef struct mem_large_type {
+	size_t size;
+	size_t mapped;
+} mem_large_t;
+
+#define MEM_LARGE_HEADER(mem)	((mem_large_t *) (mem) - 1)
+
+#if PLATFORM_IS(UNIX)
+
+/* mapping lengths are multiple of pages, their lowest bit tells huge ones */
+#define MEM_LARGE_HUGE			1
+#define MEM_LARGE_LENGTH(m)		((m) & ~(size_t) MEM_LARGE_HUGE)
+#define MEM_LARGE_ROUND(n, p)	(((n) + (p) - 1) & ~(size_t) ((p) - 1))
+
+static size_t mem_large_page(size_t mapped) {
+
+	static size_t page;
+
+	if (mapped & MEM_LARGE_HUGE) {
+		return MEM_LARGE_HUGE_PAGE;
+	}
+	if (!page) {
+		long n = sysconf(_SC_PAGESIZE);
+		page = (n > 0) ? (size_t) n : 4096;
+	}
+	return page;
+}
+
+/* maps zeroed memory for a block and its header, on huge pages when the  */
+/* system has some reserved, or hinting it to back the block with them     */
+static mem_large_t *mem_large_map(size_t total) {
+
+	mem_large_t *block;
+	size_t length;
+
+#if defined(MAP_HUGETLB)
+	if (total >= MEM_LARGE_HUGE_PAGE) {
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#if defined(MAP_HUGE_SHIFT)
+		flags |= 21 << MAP_HUGE_SHIFT;	/* the size rounded to, not the default one */
+#endif
+		length = MEM_LARGE_ROUND(total, MEM_LARGE_HUGE_PAGE);
+		block = (mem_large_t *) mmap(NULL, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (block != (mem_large_t *) MAP_FAILED) {
+			block->mapped = length | MEM_LARGE_HUGE;
+			return block;
+		}
+	}
+#endif
+
+	length = MEM_LARGE_ROUND(total, mem_large_page(0));
+	block = (mem_large_t *) mmap(NULL, length, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (block == (mem_large_t *) MAP_FAILED) {
+		errno = ENOMEM;
+		return NULL;
+	}
+#if defined(MADV_HUGEPAGE)
+	if (length >= MEM_LARGE_HUGE_PAGE) {
+		madvise(block, length, MADV_HUGEPAGE);
+	}
+#endif
+	block->mapped = length;
+	return block;
+}
+
+/* resizes a mapped block, keeping the memory beyond its size zeroed */
+static mem_large_t *mem_large_remap(mem_large_t *block, size_t size) {
+
+	size_t page = mem_large_page(block->mapped);
+	size_t huge = block->mapped & MEM_LARGE_HUGE;
+	size_t length = MEM_LARGE_LENGTH(block->mapped);
+	size_t total = sizeof(mem_large_t) + size;
+	size_t want = MEM_LARGE_ROUND(total, page);
+	mem_large_t *moved;
+
+	if (want <= length) {
+		/* the kept pages may be reused when growing again */
+		if (size < block->size) {
+			size_t end = sizeof(mem_large_t) + block->size;
+			memset((char *) block + total, 0, ((end < want) ? end : want) - total);
+		}
+		if (want < length) {
+#if defined(__linux__)
+			if (mremap(block, length, want, 0) != MAP_FAILED) {
+				block->mapped = want | huge;
+			}
+#else
+			if (!munmap((char *) block + want, length - want)) {
+				block->mapped = want | huge;
+			}
+#endif
+		}
+		block->size = size;
+		return block;
+	}
+
+#if defined(__linux__)
+	moved = (mem_large_t *) mremap(block, length, want, MREMAP_MAYMOVE);
+	if (moved != (mem_large_t *) MAP_FAILED) {
+		moved->mapped = want | huge;
+		moved->size = size;
+		return moved;
+	}
+#endif
+
+	if (!(moved = mem_large_map(total))) {
+		return NULL;
+	}
+	memcpy(moved + 1, block + 1, block->size);
+	moved->size = size;
+	munmap(block, length);
+	return moved;
+}
+
+#endif /* PLATFORM_IS(UNIX) */
+
+/* ------------------------------------------------------------------------- */
+/* mem_large_threshold()                                                     */
+
+size_t mem_large_threshold(size_t threshold) {
+
+	size_t old = mem_large_min;
+
+	mem_large_min = (threshold) ? threshold : MEM_LARGE_THRESHOLD;
+	return old;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_large_alloc()                                                         */
+
+void *mem_large_alloc(size_t size) {
+
+	mem_large_t *block;
+
+	if (size > (size_t) -1 / 2) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+#if PLATFORM_IS(UNIX)
+	if (size >= mem_large_min) {
+		if (!(block = mem_large_map(sizeof(mem_large_t) + size))) {
+			return NULL;
+		}
+		block->size = size;
+		return block + 1;
+	}
+#endif
+
+	block = (mem_large_t *) calloc(1, sizeof(mem_large_t) + size);
+	if (!block) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	block->size = size;
+	block->mapped = 0;
+	return block + 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_large_realloc()                                                       */
+
+void *mem_large_realloc(void **pmem, size_t size) {
+
+	mem_large_t *block, *reblock;
+	void *ptr;
+
+	if (!size) {
+		mem_large_free(pmem);
+		return NULL;
+	}
+
+	ptr = (pmem) ? *pmem : NULL;
+	if (!ptr) {
+		ptr = mem_large_alloc(size);
+		mem_init(pmem, ptr);
+		return ptr;
+	}
+	block = MEM_LARGE_HEADER(ptr);
+	if (size > (size_t) -1 / 2) {
+		mem_large_free(pmem);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+#if PLATFORM_IS(UNIX)
+	if (block->mapped) {
+		if (!(reblock = mem_large_remap(block, size))) {
+			SAFEERRNO(munmap(block, MEM_LARGE_LENGTH(block->mapped)));
+		}
+		ptr = (reblock) ? reblock + 1 : NULL;
+		mem_init(pmem, ptr);
+		return ptr;
+	}
+	if (size >= mem_large_min) {
+		/* calloc() memory moves to a mapping once large enough */
+		if ((ptr = mem_large_alloc(size))) {
+			memcpy(ptr, block + 1, (block->size < size) ? block->size : size);
+		}
+		SAFEERRNO(free(block));
+		mem_init(pmem, ptr);
+		return ptr;
+	}
+#endif
+
+	reblock = (mem_large_t *) realloc(block, sizeof(mem_large_t) + size);
+	if (!reblock) {
+		free(block);
+		errno = ENOMEM;
+	}
+	else {
+		if (size > reblock->size) {
+			memset((char *) (reblock + 1) + reblock->size, 0, size - reblock->size);
+		}
+		reblock->size = size;
+	}
+	ptr = (reblock) ? reblock + 1 : NULL;
+	mem_init(pmem, ptr);
+	return ptr;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_large_free()                                                          */
+
+void mem_large_free(void **pmem) {
+
+	mem_large_t *block;
+
+	if (pmem) {
+		if (*pmem) {
+			block = MEM_LARGE_HEADER(*pmem);
+#if PLATFORM_IS(UNIX)
+			if (block->mapped) {
+				munmap(block, MEM_LARGE_LENGTH(block->mapped));
+			}
+			else
+#endif
+			free(block);
+			*pmem = NULL;
+		}
+	}
+	else {
+		errno = EINVAL;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_arena_create()                                                        */
+
+mem_arena_t mem_arena_create(size_t chunk_size) {
+
+	const mem_allocator_t *allocator = mem_allocator_get();
+	mem_arena_t arena;
+
+	arena = mem_allocator_new(allocator, struct mem_arena_type, 1);
+	if (!arena) {
+		return NULL;
+	}
+	arena->allocator = allocator;
+	arena->chunk_size = MEM_ARENA_ROUND(chunk_size ? chunk_size : MEM_ARENA_CHUNK);
+	return arena;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_arena_destroy()                                                       */
+
+void mem_arena_destroy(mem_arena_t arena) {
+
+	if (!arena) {
+		errno = EINVAL;
+		return;
+	}
+	mem_chunk_free(arena, NULL);
+	mem_allocator_free(arena->allocator, arena);
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_arena_alloc()                                                         */
+
+void *mem_arena_alloc(mem_arena_t arena, size_t size) {
+
+	mem_chunk_t *chunk;
+	void *ptr;
+
+	if (!arena) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (size > (size_t) -1 / 2) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size = MEM_ARENA_ROUND(size ? size : 1);
+
+	chunk = arena->current;
+	if (!chunk || chunk->used + size > chunk->size) {
+
+		/* large allocations don't waste the current chunk */
+		if (size > arena->chunk_size / 4) {
+			chunk = mem_chunk_new(arena, size);
+			if (!chunk) {
+				return NULL;
+			}
+			chunk->used = size;
+			return MEM_ARENA_DATA(chunk);
+		}
+
+		chunk = mem_chunk_new(arena, arena->chunk_size);
+		if (!chunk) {
+			return NULL;
+		}
+		arena->current = chunk;
+	}
+
+	ptr = MEM_ARENA_DATA(chunk) + chunk->used;
+	chunk->used += size;
+	return ptr;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_arena_calloc()                                                        */
+
+void *mem_arena_calloc(mem_arena_t arena, size_t size, size_t count) {
+
+	void *ptr;
+
+	if (count && size > (size_t) -1 / count) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	ptr = mem_arena_alloc(arena, size * count);
+	return (ptr) ? memset(ptr, 0, size * count) : NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_arena_dup()                                                           */
+
+void *mem_arena_dup(mem_arena_t arena, const void *mem, size_t size) {
+
+	void *ptr;
+
+	if (!size || !mem) {
+		return NULL;
+	}
+	ptr = mem_arena_alloc(arena, size);
+	return (ptr) ? memcpy(ptr, mem, size) : NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_arena_strdup()                                                        */
+
+char *mem_arena_strdup(mem_arena_t arena, const char *str) {
+
+	if (!str) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return (char *) mem_arena_dup(arena, str, strlen(str) + 1);
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_arena_save()                                                          */
+
+void mem_arena_save(mem_arena_t arena, mem_arena_mark_t *mark) {
+
+	if (!arena || !mark) {
+		errno = EINVAL;
+		return;
+	}
+	mark->chunks = arena->chunks;
+	mark->current = arena->current;
+	mark->used = (arena->current) ? arena->current->used : 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_arena_rewind()                                                        */
+
+void mem_arena_rewind(mem_arena_t arena, const mem_arena_mark_t *mark) {
+
+	if (!arena || !mark) {
+		errno = EINVAL;
+		return;
+	}
+
+	/* the chunks allocated after the savepoint are the newest ones */
+	mem_chunk_free(arena, (mem_chunk_t *) mark->chunks);
+	arena->current = (mem_chunk_t *) mark->current;
+	if (arena->current) {
+		arena->current->used = mark->used;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_arena_reset()                                                         */
+
+void mem_arena_reset(mem_arena_t arena) {
+
+	mem_chunk_t *keep;
+
+	if (!arena) {
+		errno = EINVAL;
+		return;
+	}
+
+	keep = arena->current;
+	if (keep) {
+		/* the current chunk is unlinked to survive, then is the only one */
+		mem_chunk_t **pchunk = &arena->chunks;
+		while (*pchunk != keep) {
+			pchunk = &(*pchunk)->next;
+		}
+		*pchunk = keep->next;
+		mem_chunk_free(arena, NULL);
+		keep->next = NULL;
+		keep->used = 0;
+		arena->chunks = keep;
+	}
+	else {
+		mem_chunk_free(arena, NULL);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_arena_used()                                                          */
+
+size_t mem_arena_used(mem_arena_t arena, size_t *reserved) {
+
+	mem_chunk_t *chunk;
+	size_t used = 0, size = 0;
+
+	if (!arena) {
+		errno = EINVAL;
+		return 0;
+	}
+	for (chunk = arena->chunks; chunk; chunk = chunk->next) {
+		used += chunk->used;
+		size += chunk->size;
+	}
+	mem_init(reserved, size);
+	return used;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_pool_create()                                                         */
+
+mem_pool_t mem_pool_create(size_t size, int zero) {
+
+	const mem_allocator_t *allocator = mem_allocator_get();
+	mem_pool_t pool;
+
+	if (!size || size > (size_t) -1 / 2 / MEM_POOL_ROUNDS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pool = mem_allocator_new(allocator, struct mem_pool_type, 1);
+	if (!pool) {
+		return NULL;
+	}
+	pool->allocator = allocator;
+	pool->size = MEM_ARENA_ROUND(size);
+	pool->zero = zero;
+
+	/* chunks hold several batches of objects */
+	pool->arena = mem_arena_create(pool->size * MEM_POOL_ROUNDS * 4 > MEM_ARENA_CHUNK ?
+								   pool->size * MEM_POOL_ROUNDS * 4 : MEM_ARENA_CHUNK);
+	pool->lock = thread_lock_create();
+	pool->tls = thread_tls_new(mem_cache_exit);
+	if (!pool->arena || !pool->lock || !pool->tls) {
+		SAFEERRNO(mem_pool_destroy(pool));
+		return NULL;
+	}
+	return pool;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_pool_destroy()                                                        */
+
+void mem_pool_destroy(mem_pool_t pool) {
+
+	mem_cache_t *cache;
+
+	if (!pool) {
+		errno = EINVAL;
+		return;
+	}
+
+	/* deleting the key first, no thread exit can reach the caches */
+	thread_tls_delete(pool->tls);
+	while ((cache = pool->caches)) {
+		pool->caches = cache->next;
+		mem_allocator_free(pool->allocator, cache);
+	}
+	if (pool->arena) {
+		mem_arena_destroy(pool->arena);
+	}
+	thread_lock_destroy(pool->lock);
+	mem_allocator_free(pool->allocator, pool);
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_pool_alloc()                                                          */
+
+void *mem_pool_alloc(mem_pool_t pool) {
+
+	mem_cache_t *cache;
+	mem_mag_t *mag;
+	void *obj;
+
+	if (!pool) {
+		errno = EINVAL;
+		return NULL;
+	}
+	cache = mem_cache_get(pool);
+	if (!cache) {
+		return NULL;
+	}
+
+	if (!cache->loaded->rounds) {
+		if (cache->previous->rounds) {
+			mag = cache->loaded;
+			cache->loaded = cache->previous;
+			cache->previous = mag;
+		}
+		else if (mem_cache_reload(pool, cache)) {
+			return NULL;
+		}
+	}
+
+	mag = cache->loaded;
+	obj = mag->objs[--mag->rounds];
+	if (pool->zero) {
+		memset(obj, 0, pool->size);
+	}
+	return obj;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_pool_free()                                                           */
+
+void mem_pool_free(mem_pool_t pool, void *obj) {
+
+	mem_cache_t *cache;
+	mem_mag_t *mag;
+
+	if (!pool) {
+		errno = EINVAL;
+		return;
+	}
+	if (!obj) {
+		return;
+	}
+	cache = mem_cache_get(pool);
+	if (!cache) {
+		/* the object is lost until the pool is destroyed */
+		return;
+	}
+
+	if (cache->loaded->rounds == MEM_POOL_ROUNDS) {
+		if (cache->previous->rounds < MEM_POOL_ROUNDS) {
+			mag = cache->loaded;
+			cache->loaded = cache->previous;
+			cache->previous = mag;
+		}
+		else {
+			/* the previous magazine goes full to the depot */
+			thread_lock(pool->lock);
+			mag = mem_mag_empty(pool);
+			if (mag) {
+				mem_mag_put(pool, cache->previous);
+				cache->previous = cache->loaded;
+				cache->loaded = mag;
+			}
+			thread_unlock(pool->lock);
+			if (!mag) {
+				return;
+			}
+		}
+	}
+
+	mag = cache->loaded;
+	mag->objs[mag->rounds++] = obj;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_scratch_push()                                                        */
+
+void *mem_scratch_push(size_t size) {
+
+	mem_scratch_t *scratch = mem_scratch_get();
+	mem_scratch_block_t *block;
+	size_t total;
+
+	if (!scratch) {
+		return NULL;
+	}
+	if (size > (size_t) -1 - MEM_SCRATCH_HEADER - MEM_ARENA_ALIGN) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	total = MEM_SCRATCH_HEADER + MEM_ARENA_ROUND(size);
+	if (scratch->region && total <= MEM_SCRATCH_SIZE - scratch->used) {
+		block = (mem_scratch_block_t *) (scratch->region + scratch->used);
+	}
+	else {
+		block = (mem_scratch_block_t *) malloc(total);
+		if (!block) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		block->next = scratch->heap;
+		scratch->heap = block;
+		total = 0;
+	}
+	block->used = scratch->used;
+	block->depth = scratch->depth++;
+	scratch->used += total;
+	return (char *) block + MEM_SCRATCH_HEADER;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_scratch_calloc()                                                      */
+
+void *mem_scratch_calloc(size_t size, size_t count) {
+
+	void *mem;
+
+	if (count && size > (size_t) -1 / count) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	mem = mem_scratch_push(size * count);
+	if (mem) {
+		memset(mem, 0, size * count);
+	}
+	return mem;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_scratch_pop()                                                         */
+
+void mem_scratch_pop(void *mem) {
+
+	mem_scratch_t *scratch = mem_scratch_get();
+	mem_scratch_block_t *block, *heap;
+
+	if (!mem || !scratch) {
+		return;
+	}
+
+	/* the heap blocks pushed after this one are freed with it */
+	block = (mem_scratch_block_t *) ((char *) mem - MEM_SCRATCH_HEADER);
+	scratch->used = block->used;
+	scratch->depth = block->depth;
+	while ((heap = scratch->heap) && heap->depth >= scratch->depth) {
+		scratch->heap = heap->next;
+		free(heap);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_buf_new()                                                             */
+
+mem_buf_t mem_buf_new(size_t len) {
+
+	const mem_allocator_t *allocator = mem_allocator_get();
+	mem_buf_t buf;
+
+	if (len > (size_t) -1 - MEM_BUF_HEADER) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	buf = (mem_buf_t) mem_allocator_alloc(allocator, MEM_BUF_HEADER + len);
+	if (!buf) {
+		return NULL;
+	}
+	memset(buf, 0, sizeof(struct mem_buf_type));
+	buf->refs = 1;
+	buf->data = (char *) buf + MEM_BUF_HEADER;
+	buf->len = len;
+	buf->allocator = allocator;
+	return buf;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_buf_dup()                                                             */
+
+mem_buf_t mem_buf_dup(const void *data, size_t len) {
+
+	mem_buf_t buf;
+
+	if (!data && len) {
+		errno = EINVAL;
+		return NULL;
+	}
+	buf = mem_buf_new(len);
+	if (buf && len) {
+		memcpy(buf->data, data, len);
+	}
+	return buf;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_buf_wrap()                                                            */
+
+mem_buf_t mem_buf_wrap(void *data, size_t len, mem_buf_release_t release,
+					   void *context) {
+
+	const mem_allocator_t *allocator = mem_allocator_get();
+	mem_buf_t buf;
+
+	if (!data && len) {
+		errno = EINVAL;
+		return NULL;
+	}
+	buf = mem_allocator_new(allocator, struct mem_buf_type, 1);
+	if (!buf) {
+		return NULL;
+	}
+	buf->refs = 1;
+	buf->data = (char *) data;
+	buf->len = len;
+	buf->release = release;
+	buf->context = context;
+	buf->allocator = allocator;
+	return buf;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_buf_slice()                                                           */
+
+mem_buf_t mem_buf_slice(mem_buf_t buf, size_t offset, size_t len) {
+
+	const mem_allocator_t *allocator = mem_allocator_get();
+	mem_buf_t slice;
+
+	if (!buf) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (offset > buf->len || len > buf->len - offset) {
+		errno = ERANGE;
+		return NULL;
+	}
+	slice = mem_allocator_new(allocator, struct mem_buf_type, 1);
+	if (!slice) {
+		return NULL;
+	}
+
+	/* slices of slices refer to the viewed buffer, keeping chains short */
+	slice->refs = 1;
+	slice->data = buf->data + offset;
+	slice->len = len;
+	if (buf->parent) {
+		buf = buf->parent;
+	}
+	slice->parent = mem_buf_ref(buf);
+	slice->allocator = allocator;
+	return slice;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_buf_ref()                                                             */
+
+mem_buf_t mem_buf_ref(mem_buf_t buf) {
+
+	if (buf) {
+		thread_atomic_add(&buf->refs, 1);
+	}
+	return buf;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_buf_unref()                                                           */
+
+void mem_buf_unref(mem_buf_t buf) {
+
+	if (!buf || thread_atomic_add(&buf->refs, -1)) {
+		return;
+	}
+	if (buf->parent) {
+		mem_buf_unref(buf->parent);
+	}
+	else if (buf->release) {
+		buf->release(buf->data, buf->len, buf->context);
+	}
+	mem_allocator_free(buf->allocator, buf);
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_buf_data()                                                            */
+
+void *mem_buf_data(mem_buf_t buf) {
+
+	return (buf) ? buf->data : NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_buf_len()                                                             */
+
+size_t mem_buf_len(mem_buf_t buf) {
+
+	return (buf) ? buf->len : 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_buf_refs()                                                            */
+
+int mem_buf_refs(mem_buf_t buf) {
+
+	return (buf) ? buf->refs : 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_allocator_set()                                                       */
+
+void mem_allocator_set(const mem_allocator_t *allocator) {
+
+	mem_global = (allocator) ? allocator : &mem_allocator_std;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_allocator_set_thread()                                                */
+
+int mem_allocator_set_thread(const mem_allocator_t *allocator) {
+
+	if (mem_once(&mem_thread_state, mem_thread_init)) {
+		return -1;
+	}
+	return thread_tls_set(mem_thread_key, (void *) allocator);
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_allocator_get()                                                       */
+
+const mem_allocator_t *mem_allocator_get(void) {
+
+	const mem_allocator_t *allocator;
+
+	if (mem_thread_state == 2) {
+		allocator = (const mem_allocator_t *) thread_tls_get(mem_thread_key);
+		if (allocator) {
+			return allocator;
+		}
+	}
+	return mem_global;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_allocator_alloc()                                                     */
+
+void *mem_allocator_alloc(const mem_allocator_t *allocator, size_t size) {
+
+	void *ptr;
+
+	if (!allocator) {
+		allocator = mem_allocator_get();
+	}
+	ptr = allocator->alloc(allocator->context, size);
+	if (!ptr) {
+		errno = ENOMEM;
+	}
+	return ptr;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_allocator_calloc()                                                    */
+
+void *mem_allocator_calloc(const mem_allocator_t *allocator, size_t size,
+						   size_t count) {
+
+	void *ptr;
+
+	if (!allocator) {
+		allocator = mem_allocator_get();
+	}
+	if (allocator == &mem_allocator_std) {
+		return calloc(size, count);
+	}
+	if (count && size > (size_t) -1 / count) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	ptr = mem_allocator_alloc(allocator, size * count);
+	return (ptr) ? memset(ptr, 0, size * count) : NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_allocator_realloc()                                                   */
+
+void *mem_allocator_realloc(const mem_allocator_t *allocator, void *mem,
+							size_t size) {
+
+	void *ptr;
+
+	if (!allocator) {
+		allocator = mem_allocator_get();
+	}
+	ptr = allocator->realloc(allocator->context, mem, size);
+	if (!ptr) {
+		errno = ENOMEM;
+	}
+	return ptr;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_allocator_free()                                                      */
+
+void mem_allocator_free(const mem_allocator_t *allocator, void *mem) {
+
+	if (!mem) {
+		return;
+	}
+	if (!allocator) {
+		allocator = mem_allocator_get();
+	}
+	allocator->free(allocator->context, mem);
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_arena_allocator()                                                     */
+
+void mem_arena_allocator(mem_arena_t arena, mem_allocator_t *allocator) {
+
+	if (!arena || !allocator) {
+		errno = EINVAL;
+		return;
+	}
+	allocator->alloc = mem_arena_alloc_size;
+	allocator->realloc = mem_arena_realloc_size;
+	allocator->free = mem_arena_free_size;
+	allocator->context = arena;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_trace_sample()                                                        */
+
+void mem_trace_sample(size_t interval) {
+
+	mem_trace_interval = interval;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_trace_stats()                                                         */
+
+void mem_trace_stats(mem_trace_stats_t *stats) {
+
+	mem_trace_thread_t *totals, *thr;
+	int i;
+
+	if (!stats) {
+		errno = EINVAL;
+		return;
+	}
+	memset(stats, 0, sizeof(mem_trace_stats_t));
+	if (mem_once(&mem_trace_state, mem_trace_init) ||
+		!(totals = (mem_trace_thread_t *) calloc(1, sizeof(mem_trace_thread_t)))) {
+		return;
+	}
+
+	thread_lock(mem_trace_lock);
+	mem_trace_add(totals, &mem_trace_exited);
+	for (thr = mem_trace_threads; thr; thr = thr->next) {
+		mem_trace_add(totals, thr);
+	}
+	stats->live = mem_trace_live;
+	stats->peak = mem_trace_peak;
+	thread_unlock(mem_trace_lock);
+
+	for (i = 0; i <= MEM_TRACE_SITES; i++) {
+		stats->allocs += totals->allocs[i];
+		stats->frees += totals->frees[i];
+		stats->bytes += totals->bytes[i];
+	}
+	memcpy(stats->sizes, totals->sizes, sizeof(stats->sizes));
+	free(totals);
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_trace_dump()                                                          */
+
+int mem_trace_dump(FILE *out) {
+
+	mem_trace_thread_t *totals, *thr;
+	mem_trace_stats_t stats;
+	int *order, i, n = 0;
+
+	if (!out) {
+		errno = EINVAL;
+		return -1;
+	}
+	mem_trace_stats(&stats);
+	if (mem_once(&mem_trace_state, mem_trace_init)) {
+		return -1;
+	}
+	totals = (mem_trace_thread_t *) calloc(1, sizeof(mem_trace_thread_t));
+	order = (int *) malloc((MEM_TRACE_SITES + 1) * sizeof(int));
+	if (!totals || !order) {
+		SAFEERRNO(free(totals); free(order));
+		return -1;
+	}
+
+	/* the sort is done under the lock, the sites live bytes changing */
+	thread_lock(mem_trace_lock);
+	mem_trace_add(totals, &mem_trace_exited);
+	for (thr = mem_trace_threads; thr; thr = thr->next) {
+		mem_trace_add(totals, thr);
+	}
+	for (i = 0; i <= MEM_TRACE_SITES; i++) {
+		if (mem_trace_sites[i].file && (totals->allocs[i] || totals->frees[i] ||
+										mem_trace_sites[i].live)) {
+			order[n++] = i;
+		}
+	}
+	mem_trace_sort_totals = totals;
+	qsort(order, n, sizeof(int), mem_trace_site_comp);
+
+	fprintf(out, "allocs %ld, frees %ld, bytes %lu, live %lu, peak %lu%s\n",
+			stats.allocs, stats.frees, (unsigned long) stats.bytes,
+			(unsigned long) stats.live, (unsigned long) stats.peak,
+			(mem_trace_interval) ? " (sampled)" : "");
+	for (i = 0; i < MEM_TRACE_CLASSES; i++) {
+		if (stats.sizes[i]) {
+			fprintf(out, "size < %lu: %ld\n", 1UL << i, stats.sizes[i]);
+		}
+	}
+	for (i = 0; i < n; i++) {
+		mem_site_t *site = mem_trace_sites + order[i];
+		fprintf(out, "%s:%d: live %lu, allocs %ld, frees %ld, bytes %lu\n",
+				site->file, site->line, (unsigned long) site->live,
+				totals->allocs[order[i]], totals->frees[order[i]],
+				(unsigned long) totals->bytes[order[i]]);
+	}
+	thread_unlock(mem_trace_lock);
+
+	free(totals);
+	free(order);
+	return (ferror(out)) ? -1 : 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_trace_calloc()                                                        */
+
+void *mem_trace_calloc(size_t size, size_t count, const char *file, int line) {
+
+	void *ptr = calloc(size, count);
+
+	mem_trace_alloc(ptr, size * count, file, line);
+	return ptr;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_trace_realloc()                                                       */
+
+void *mem_trace_realloc(void **pmem, size_t count, const char *file, int line) {
+
+	void *old = (pmem) ? *pmem : NULL, *ptr;
+	mem_trace_thread_t *thr;
+
+	/* forgotten before realloc() releases it, as another thread may then get
+	   and record the same address; mem_realloc() frees it if it fails */
+	if (old && mem_trace_state == 2) {
+		mem_trace_forget(old);
+	}
+	ptr = mem_realloc(pmem, count);
+	if (ptr) {
+		mem_trace_alloc(ptr, count, file, line);
+	}
+	else if (old && (thr = mem_trace_thread())) {
+		thr->frees[mem_trace_site(file, line)]++;
+	}
+	return ptr;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_trace_dup()                                                           */
+
+void *mem_trace_dup(void *mem, size_t size, const char *file, int line) {
+
+	void *ptr = mem_dup(mem, size);
+
+	mem_trace_alloc(ptr, size, file, line);
+	return ptr;
+}
+
+/* ------------------------------------------------------------------------- */
+/* mem_trace_free()                                                          */
+
+void mem_trace_free(void **pmem, const char *file, int line) {
+
+	mem_trace_thread_t *thr;
+
+	if (pmem && *pmem && (thr = mem_trace_thread())) {
+		thr->frees[mem_trace_site(file, line)]++;
+		mem_trace_forget(*pmem);
+	}
+	mem_free(pmem);
 }
 
 /* vi:set ts=4 sw=4: */
@@ -0,0 +1,237 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  mmap.c - memory mapped files functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* MAP_POPULATE and madvise() are extensions */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "scelib/mmap.h"
+#include "scelib/platform.h"
+#if PLATFORM_IS(UNIX)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+
+
+/* ========================================================================= */
+/* Constants and macros used in this module                                  */
+
+#if PLATFORM_IS(UNIX) && !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS		MAP_ANON
+#endif
+
+
+
+/* ========================================================================= */
+/* static variables                                                          */
+
+/* memory given for empty files, which can't be mapped */
+static char mem_map_empty[1];
+
+
+
+/* ========================================================================= */
+/* static functions                                                          */
+
+#if PLATFORM_IS(UNIX)
+
+/* ------------------------------------------------------------------------- */
+/* reads a file which can't be mapped (some file systems don't allow it) in  */
+/* anonymous memory, so that it's unmapped the same way                      */
+static void *mem_map_read(int fd, size_t len, int flags)
+{
+	char *mem;
+	size_t done;
+	ssize_t n;
+
+	mem = (char *) mmap(NULL, len, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == (char *) MAP_FAILED)
+		return RETERROR(ENOMEM, NULL);
+
+	for (done = 0; done < len; done += (size_t) n)
+	{
+		if ((n = pread(fd, mem + done, len - done, (off_t) done)) <= 0)
+		{
+			if (n == -1 && errno == EINTR)
+			{
+				n = 0;
+				continue;
+			}
+			SAFEERRNO(munmap(mem, len));
+			return RETERROR(n ? errno : EIO, NULL);
+		}
+	}
+	if (!(flags & MEM_MAP_WRITE) && mprotect(mem, len, PROT_READ) == -1)
+	{
+		SAFEERRNO(munmap(mem, len));
+		return NULL;
+	}
+	return mem;
+}
+
+#endif /* PLATFORM_IS(UNIX) */
+
+
+
+/* ========================================================================= */
+/* public functions                                                          */
+
+#if PLATFORM_IS(UNIX)
+
+void *mem_map_file(const char *path, int flags, size_t *len)
+{
+	struct stat st;
+	void *mem;
+	int fd, mflags = MAP_PRIVATE;
+
+	if (!path || !len)
+		return RETERROR(EINVAL, NULL);
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1)
+	{
+		SAFEERRNO(close(fd));
+		return NULL;
+	}
+	if (!S_ISREG(st.st_mode) || (off_t) (size_t) st.st_size != st.st_size)
+	{
+		close(fd);
+		return RETERROR(S_ISREG(st.st_mode) ? EFBIG : EINVAL, NULL);
+	}
+	if (!(*len = (size_t) st.st_size))
+	{
+		close(fd);
+		return mem_map_empty;
+	}
+
+#if defined(MAP_POPULATE)
+	if (flags & MEM_MAP_POPULATE)
+		mflags |= MAP_POPULATE;
+#endif
+	mem = mmap(NULL, *len, PROT_READ | ((flags & MEM_MAP_WRITE) ? PROT_WRITE : 0),
+			   mflags, fd, 0);
+	if (mem == MAP_FAILED)
+		mem = mem_map_read(fd, *len, flags);
+	else
+	{
+		mem_map_advise(mem, *len, flags);
+#if !defined(MAP_POPULATE)
+		if (flags & MEM_MAP_POPULATE)
+		{
+			volatile char *p;
+			long page = sysconf(_SC_PAGESIZE);
+
+			for (p = (char *) mem; p < (char *) mem + *len; p += page)
+				(void) *p;
+		}
+#endif
+	}
+	SAFEERRNO(close(fd));
+	return mem;
+}
+
+int mem_map_advise(void *mem, size_t len, int flags)
+{
+	if (!mem)
+		return RETERROR(EINVAL, -1);
+	if (mem == mem_map_empty)
+		return 0;
+
+#if defined(MADV_SEQUENTIAL)
+	if ((flags & MEM_MAP_SEQUENTIAL) && madvise(mem, len, MADV_SEQUENTIAL) == -1)
+		return -1;
+#endif
+#if defined(MADV_RANDOM)
+	if ((flags & MEM_MAP_RANDOM) && madvise(mem, len, MADV_RANDOM) == -1)
+		return -1;
+#endif
+#if defined(MADV_WILLNEED)
+	if ((flags & MEM_MAP_WILLNEED) && madvise(mem, len, MADV_WILLNEED) == -1)
+		return -1;
+#endif
+	return 0;
+}
+
+int mem_unmap_file(void *mem, size_t len)
+{
+	if (!mem)
+		return RETERROR(EINVAL, -1);
+	if (mem == mem_map_empty)
+		return 0;
+	return munmap(mem, len);
+}
+
+#else /* PLATFORM_IS(UNIX) */
+
+void *mem_map_file(const char *path, int flags, size_t *len)
+{
+	FILE *f;
+	char *mem;
+	long size;
+
+	if (!path || !len)
+		return RETERROR(EINVAL, NULL);
+
+	if (!(f = fopen(path, "rb")))
+		return NULL;
+	if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET))
+	{
+		SAFEERRNO(fclose(f));
+		return NULL;
+	}
+	if (!(*len = (size_t) size))
+		mem = mem_map_empty;
+	else if ((mem = (char *) malloc(*len)) &&
+			 fread(mem, 1, *len, f) != *len)
+	{
+		free(mem);
+		mem = RETERROR(EIO, NULL);
+	}
+	SAFEERRNO(fclose(f));
+	return mem;
+}
+
+int mem_map_advise(void *mem, size_t len, int flags)
+{
+	return (mem ? 0 : RETERROR(EINVAL, -1));
+}
+
+int mem_unmap_file(void *mem, size_t len)
+{
+	if (!mem)
+		return RETERROR(EINVAL, -1);
+	if (mem != mem_map_empty)
+		free(mem);
+	return 0;
+}
+
+#endif /* PLATFORM_IS(UNIX) */
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,610 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  pmap.c - persistent map (hash array mapped trie) functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "scelib/pmap.h"
+#include "scelib/thread.h"
+#include "scelib/memory.h"
+#include <stdlib.h>
+#include <errno.h>
+
+/* each trie level consumes 5 bits of the hash value */
+#define PMAP_BITS		5
+#define PMAP_MASK		((1 << PMAP_BITS) - 1)
+
+/* a 31 bits hash gives at most 7 branch levels */
+#define PMAP_MAXDEPTH	7
+
+#define NODE_BRANCH		0
+#define NODE_LEAF		1
+
+typedef struct pnode_type
+{
+	volatile int refs;
+	int kind;
+} pnode_t;
+
+/* keys are shared by all the leaves built for them */
+typedef struct pkey_type
+{
+	volatile int refs;
+	void *key;
+} pkey_t;
+
+typedef struct pleaf_type
+{
+	pnode_t node;
+	int hash;
+	pkey_t *key;
+	void *data;
+	struct pleaf_type *next;	/* leaves with the same hash value */
+} pleaf_t;
+
+typedef struct pbranch_type
+{
+	pnode_t node;
+	unsigned int bitmap;		/* which of the 32 ways are used */
+	pnode_t *children[1];		/* one child per bit set in the bitmap */
+} pbranch_t;
+
+struct pmap_type
+{
+	pnode_t *root;
+	int count;
+	map_hash_t hashf;
+	map_comp_t compf;
+	map_alloc_t allocf;
+	map_free_t freef;
+};
+
+struct pmap_iter_type
+{
+	pnode_t *root;
+	map_free_t freef;
+	pbranch_t *stack[PMAP_MAXDEPTH];
+	int pos[PMAP_MAXDEPTH];
+	int depth;
+	pleaf_t *leaf;				/* next leaf to return */
+	int count;
+};
+
+static int pmap_popcount(unsigned int x)
+{
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0F0F0F0F;
+	return (int) (((x * 0x01010101) >> 24) & 0xFF);
+}
+
+static int pmap_hash(pmap_t map, void *key)
+{
+	int h = map->hashf(MAP_HASH_MAX, key);
+	return (h < 0 ? -(h + 1) : h);
+}
+
+static pnode_t *pnode_ref(pnode_t *node)
+{
+	if (node)
+		thread_atomic_add(&node->refs, 1);
+	return node;
+}
+
+static void pkey_release(map_free_t freef, pkey_t *key)
+{
+	if (thread_atomic_add(&key->refs, -1) == 0)
+	{
+		if (freef)
+			freef(key->key);
+		free(key);
+	}
+}
+
+static void pnode_release(map_free_t freef, pnode_t *node)
+{
+	pbranch_t *b;
+	pleaf_t *leaf;
+	int i, n;
+
+	while (node && thread_atomic_add(&node->refs, -1) == 0)
+	{
+		if (node->kind == NODE_BRANCH)
+		{
+			b = (pbranch_t *) node;
+			n = pmap_popcount(b->bitmap);
+			for (i = 0; i < n; ++i)
+				pnode_release(freef, b->children[i]);
+			free(b);
+			node = 0;
+		}
+		else
+		{
+			/* go on with the next leaf of the chain */
+			leaf = (pleaf_t *) node;
+			pkey_release(freef, leaf->key);
+			node = (pnode_t *) leaf->next;
+			free(leaf);
+		}
+	}
+}
+
+static pbranch_t *pbranch_alloc(unsigned int bitmap)
+{
+	pbranch_t *b;
+	int n = pmap_popcount(bitmap);
+
+	b = (pbranch_t *) malloc(sizeof(pbranch_t) + (n - 1) * sizeof(pnode_t *));
+	if (!b)
+		return 0;
+	b->node.refs = 1;
+	b->node.kind = NODE_BRANCH;
+	b->bitmap = bitmap;
+	return b;
+}
+
+/* the new leaf takes a reference on the key, and owns the next one */
+static pleaf_t *pleaf_alloc(int hash, pkey_t *key, void *data, pleaf_t *next)
+{
+	pleaf_t *leaf;
+
+	if (!(leaf = (pleaf_t *) malloc(sizeof(pleaf_t))))
+		return 0;
+	leaf->node.refs = 1;
+	leaf->node.kind = NODE_LEAF;
+	leaf->hash = hash;
+	leaf->key = key;
+	thread_atomic_add(&key->refs, 1);
+	leaf->data = data;
+	leaf->next = next;
+	return leaf;
+}
+
+static pleaf_t *pmap_lookup(pmap_t map, int hash, void *key)
+{
+	pnode_t *node = map->root;
+	pbranch_t *b;
+	pleaf_t *leaf;
+	unsigned int bit;
+	int shift = 0;
+
+	while (node && node->kind == NODE_BRANCH)
+	{
+		b = (pbranch_t *) node;
+		bit = 1u << ((hash >> shift) & PMAP_MASK);
+		if (!(b->bitmap & bit))
+			return 0;
+		node = b->children[pmap_popcount(b->bitmap & (bit - 1))];
+		shift += PMAP_BITS;
+	}
+	for (leaf = (pleaf_t *) node; leaf; leaf = leaf->next)
+	{
+		if (leaf->hash != hash)
+			break;
+		if (leaf->key->key == key || !map->compf(key, leaf->key->key))
+			return leaf;
+	}
+	return 0;
+}
+
+/* Copies a same hash leaves chain, replacing the data of the leaf of the
+ * given key, or removing this leaf. The chain tail following this leaf is
+ * shared. perr is set if an allocation failed. */
+static pleaf_t *pchain_copy(map_free_t freef, pleaf_t *chain, pkey_t *key,
+							void *data, int remove, int *perr)
+{
+	pleaf_t *head = 0, **tail = &head, *leaf;
+
+	for (leaf = chain; leaf; leaf = leaf->next)
+	{
+		if (leaf->key == key)
+		{
+			if (remove)
+				*tail = (pleaf_t *) pnode_ref((pnode_t *) leaf->next);
+			else if (!(*tail = pleaf_alloc(leaf->hash, key, data, leaf->next)))
+				break;
+			else
+				pnode_ref((pnode_t *) leaf->next);
+			return head;
+		}
+		if (!(*tail = pleaf_alloc(leaf->hash, leaf->key, leaf->data, 0)))
+			break;
+		tail = &(*tail)->next;
+	}
+	SAFEERRNO(pnode_release(freef, (pnode_t *) head));
+	*perr = 1;
+	return 0;
+}
+
+/* Builds the branches separating two leaves of different hash values. */
+static pnode_t *pnode_split(pleaf_t *l1, pleaf_t *l2, int shift)
+{
+	pbranch_t *b;
+	pnode_t *child;
+	int f1, f2;
+
+	f1 = (l1->hash >> shift) & PMAP_MASK;
+	f2 = (l2->hash >> shift) & PMAP_MASK;
+	if (f1 == f2)
+	{
+		if (!(child = pnode_split(l1, l2, shift + PMAP_BITS)))
+			return 0;
+		if (!(b = pbranch_alloc(1u << f1)))
+		{
+			/* only free the branches, the leaves still belong to the caller */
+			SAFEERRNO(pnode_ref((pnode_t *) l1); pnode_ref((pnode_t *) l2);
+				pnode_release(0, child));
+			return 0;
+		}
+		b->children[0] = child;
+	}
+	else
+	{
+		if (!(b = pbranch_alloc((1u << f1) | (1u << f2))))
+			return 0;
+		b->children[(f1 < f2) ? 0 : 1] = (pnode_t *) l1;
+		b->children[(f1 < f2) ? 1 : 0] = (pnode_t *) l2;
+	}
+	return (pnode_t *) b;
+}
+
+/* Returns a new version of the node with the key set, or 0 if any error. */
+static pnode_t *pnode_set(pmap_t map, pnode_t *node, int shift, int hash,
+						  pkey_t *key, void *data)
+{
+	pbranch_t *b, *nb;
+	pleaf_t *leaf, *nleaf;
+	pnode_t *child;
+	unsigned int bit;
+	int i, n, pos, err = 0;
+
+	if (!node)
+		return (pnode_t *) pleaf_alloc(hash, key, data, 0);
+
+	if (node->kind == NODE_LEAF)
+	{
+		leaf = (pleaf_t *) node;
+		if (leaf->hash == hash)
+		{
+			/* existing key, or a new one colliding with the chain */
+			for (nleaf = leaf; nleaf && nleaf->key != key; nleaf = nleaf->next)
+				;
+			if (nleaf)
+				return (pnode_t *) pchain_copy(map->freef, leaf, key, data, 0,
+					&err);
+			if (!(nleaf = pleaf_alloc(hash, key, data, leaf)))
+				return 0;
+			pnode_ref(node);
+			return (pnode_t *) nleaf;
+		}
+
+		if (!(nleaf = pleaf_alloc(hash, key, data, 0)))
+			return 0;
+		if (!(child = pnode_split((pleaf_t *) pnode_ref(node), nleaf, shift)))
+		{
+			SAFEERRNO(pnode_release(map->freef, node);
+				pnode_release(map->freef, (pnode_t *) nleaf));
+			return 0;
+		}
+		return child;
+	}
+
+	b = (pbranch_t *) node;
+	bit = 1u << ((hash >> shift) & PMAP_MASK);
+	pos = pmap_popcount(b->bitmap & (bit - 1));
+	n = pmap_popcount(b->bitmap);
+
+	if (b->bitmap & bit)
+	{
+		if (!(child = pnode_set(map, b->children[pos], shift + PMAP_BITS,
+			hash, key, data)))
+			return 0;
+		if (!(nb = pbranch_alloc(b->bitmap)))
+		{
+			SAFEERRNO(pnode_release(map->freef, child));
+			return 0;
+		}
+		for (i = 0; i < n; ++i)
+			nb->children[i] = (i == pos) ? child : pnode_ref(b->children[i]);
+		return (pnode_t *) nb;
+	}
+
+	if (!(child = (pnode_t *) pleaf_alloc(hash, key, data, 0)))
+		return 0;
+	if (!(nb = pbranch_alloc(b->bitmap | bit)))
+	{
+		SAFEERRNO(pnode_release(map->freef, child));
+		return 0;
+	}
+	for (i = 0; i < pos; ++i)
+		nb->children[i] = pnode_ref(b->children[i]);
+	nb->children[pos] = child;
+	for (i = pos; i < n; ++i)
+		nb->children[i + 1] = pnode_ref(b->children[i]);
+	return (pnode_t *) nb;
+}
+
+/* Returns a new version of the node without the key (0 if it becomes empty),
+ * perr being set if any error. The key is known to be in the node. */
+static pnode_t *pnode_unset(pmap_t map, pnode_t *node, int shift, int hash,
+							pkey_t *key, int *perr)
+{
+	pbranch_t *b, *nb;
+	pnode_t *child;
+	unsigned int bit;
+	int i, j, n, pos;
+
+	if (node->kind == NODE_LEAF)
+		return (pnode_t *) pchain_copy(map->freef, (pleaf_t *) node, key, 0, 1,
+			perr);
+
+	b = (pbranch_t *) node;
+	bit = 1u << ((hash >> shift) & PMAP_MASK);
+	pos = pmap_popcount(b->bitmap & (bit - 1));
+	n = pmap_popcount(b->bitmap);
+
+	child = pnode_unset(map, b->children[pos], shift + PMAP_BITS, hash, key,
+		perr);
+	if (*perr)
+		return 0;
+
+	/* collapse branches left with a single leaf */
+	if (!child)
+	{
+		if (n == 1)
+			return 0;
+		if (n == 2 && b->children[1 - pos]->kind == NODE_LEAF)
+			return pnode_ref(b->children[1 - pos]);
+	}
+	else if (n == 1 && child->kind == NODE_LEAF)
+		return child;
+
+	if (!(nb = pbranch_alloc(child ? b->bitmap : (b->bitmap & ~bit))))
+	{
+		SAFEERRNO(pnode_release(map->freef, child));
+		*perr = 1;
+		return 0;
+	}
+	for (i = 0, j = 0; i < n; ++i)
+	{
+		if (i != pos)
+			nb->children[j++] = pnode_ref(b->children[i]);
+		else if (child)
+			nb->children[j++] = child;
+	}
+	return (pnode_t *) nb;
+}
+
+pmap_t pmap_new(map_hash_t hash_func, map_comp_t comp_func,
+				map_alloc_t alloc_func, map_free_t free_func)
+{
+	pmap_t map;
+
+	if (!hash_func || !comp_func)
+		return RETERROR(EINVAL, NULL);
+
+	if (!(map = (pmap_t) malloc(sizeof(struct pmap_type))))
+		return 0;
+
+	map->root = 0;
+	map->count = 0;
+	map->hashf = hash_func;
+	map->compf = comp_func;
+	map->allocf = alloc_func;
+	map->freef = free_func;
+	return map;
+}
+
+pmap_t pmap_snapshot(pmap_t map)
+{
+	pmap_t snap;
+
+	if (!map)
+		return RETERROR(EINVAL, NULL);
+
+	if (!(snap = (pmap_t) malloc(sizeof(struct pmap_type))))
+		return 0;
+
+	*snap = *map;
+	pnode_ref(snap->root);
+	return snap;
+}
+
+int pmap_delete(pmap_t map)
+{
+	if (!map)
+		return RETERROR(EINVAL, -1);
+
+	pnode_release(map->freef, map->root);
+	free(map);
+	return 0;
+}
+
+int pmap_count(pmap_t map)
+{
+	if (!map)
+		return RETERROR(EINVAL, -1);
+	return map->count;
+}
+
+void *pmap_find(pmap_t map, void *key)
+{
+	pleaf_t *leaf;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, NULL);
+
+	leaf = pmap_lookup(map, pmap_hash(map, key), key);
+	return (leaf ? leaf->key->key : 0);
+}
+
+void *pmap_get(pmap_t map, void *key)
+{
+	pleaf_t *leaf;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, NULL);
+
+	leaf = pmap_lookup(map, pmap_hash(map, key), key);
+	return (leaf ? leaf->data : 0);
+}
+
+int pmap_set(pmap_t map, void *key, void *data, void **olddata)
+{
+	pleaf_t *leaf;
+	pkey_t *kcell;
+	pnode_t *root;
+	int hash;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, -1);
+
+	hash = pmap_hash(map, key);
+	if ((leaf = pmap_lookup(map, hash, key)))
+	{
+		mem_init(olddata, leaf->data);
+		kcell = leaf->key;
+	}
+	else
+	{
+		/* new key cell, only referenced by us until a leaf takes it */
+		if (!(kcell = (pkey_t *) malloc(sizeof(pkey_t))))
+			return -1;
+		kcell->refs = 1;
+		kcell->key = (map->allocf ? map->allocf(key) : key);
+		if (!kcell->key)
+		{
+			SAFEERRNO(free(kcell));
+			return -1;
+		}
+	}
+
+	/* the leaves built before a failure may have released the key cell
+	   already, so it's only freed with the last reference */
+	root = pnode_set(map, map->root, 0, hash, kcell, data);
+	if (!leaf)
+	{
+		SAFEERRNO(pkey_release(map->freef, kcell));
+	}
+	if (!root)
+		return -1;
+
+	pnode_release(map->freef, map->root);
+	map->root = root;
+	return (leaf ? map->count : ++ map->count);
+}
+
+int pmap_unset(pmap_t map, void *key, void **olddata)
+{
+	pleaf_t *leaf;
+	pnode_t *root;
+	int hash, err = 0;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, -1);
+
+	hash = pmap_hash(map, key);
+	if (!(leaf = pmap_lookup(map, hash, key)))
+		return RETERROR(ERANGE, -1);
+
+	mem_init(olddata, leaf->data);
+	root = pnode_unset(map, map->root, 0, hash, leaf->key, &err);
+	if (err)
+		return -1;
+
+	pnode_release(map->freef, map->root);
+	map->root = root;
+	return -- map->count;
+}
+
+pmap_iter_t pmap_iter_new(pmap_t map)
+{
+	pmap_iter_t iter;
+
+	if (!map)
+		return RETERROR(EINVAL, NULL);
+
+	if (!(iter = (pmap_iter_t) malloc(sizeof(struct pmap_iter_type))))
+		return 0;
+
+	iter->root = pnode_ref(map->root);
+	iter->freef = map->freef;
+	iter->depth = 0;
+	iter->leaf = 0;
+	iter->count = 0;
+	if (iter->root)
+	{
+		if (iter->root->kind == NODE_LEAF)
+			iter->leaf = (pleaf_t *) iter->root;
+		else
+		{
+			iter->stack[0] = (pbranch_t *) iter->root;
+			iter->pos[0] = 0;
+			iter->depth = 1;
+		}
+	}
+	return iter;
+}
+
+int pmap_iter_delete(pmap_iter_t iter)
+{
+	if (!iter)
+		return RETERROR(EINVAL, -1);
+
+	pnode_release(iter->freef, iter->root);
+	free(iter);
+	return 0;
+}
+
+int pmap_iter_next(pmap_iter_t iter, void **key, void **data)
+{
+	pbranch_t *b;
+	pnode_t *node;
+	int i;
+
+	if (!iter)
+		return RETERROR(EINVAL, -1);
+
+	while (!iter->leaf && iter->depth > 0)
+	{
+		b = iter->stack[iter->depth - 1];
+		i = iter->pos[iter->depth - 1]++;
+		if (i >= pmap_popcount(b->bitmap))
+		{
+			-- iter->depth;
+			continue;
+		}
+		node = b->children[i];
+		if (node->kind == NODE_LEAF)
+			iter->leaf = (pleaf_t *) node;
+		else
+		{
+			iter->stack[iter->depth] = (pbranch_t *) node;
+			iter->pos[iter->depth] = 0;
+			++ iter->depth;
+		}
+	}
+	if (!iter->leaf)
+		return 0;
+
+	mem_init(key, iter->leaf->key->key);
+	mem_init(data, iter->leaf->data);
+	iter->leaf = iter->leaf->next;
+	return ++ iter->count;
+}
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,404 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  rope.c - ropes functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "scelib/rope.h"
+#include "scelib/memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+
+/* ========================================================================= */
+/* Constants and macros used in this module                                  */
+
+/* characters held by a chunk */
+#define ROPE_CHUNK			1024
+
+#define ROPE_TEXT(node)		((char *) (node) + sizeof(rope_node_t))
+#define ROPE_SIZE(node)		((node) ? (node)->size : 0)
+
+
+
+/* ========================================================================= */
+/* internal types                                                            */
+
+/* ------------------------------------------------------------------------- */
+/* the rope is a treap of chunks ordered by position: the tree is kept       */
+/* balanced by random priorities, a node having a greater one than its       */
+/* children. The chunk text follows the node                                 */
+typedef struct rope_node_type
+{
+	struct rope_node_type *left;
+	struct rope_node_type *right;
+	unsigned int prio;
+	size_t size;		/* characters of the subtree */
+	size_t len;			/* characters of the chunk */
+} rope_node_t;
+
+/* ------------------------------------------------------------------------- */
+struct rope_type
+{
+	rope_node_t *root;
+	unsigned int seed;
+	char *flat;			/* whole text, built by rope_str() */
+	size_t flatsize;	/* allocated size of flat */
+	int flatok;			/* flat is up to date */
+	const mem_allocator_t *allocator;
+};
+
+
+
+/* ========================================================================= */
+/* static functions                                                          */
+
+/* ------------------------------------------------------------------------- */
+static rope_node_t *rope_node_new(rope_t rope, const char *str, size_t len)
+{
+	rope_node_t *node;
+
+	node = (rope_node_t *) mem_allocator_alloc(rope->allocator,
+											   sizeof(rope_node_t) + ROPE_CHUNK);
+	if (!node)
+		return NULL;
+	rope->seed ^= rope->seed << 13;		/* xorshift */
+	rope->seed ^= rope->seed >> 17;
+	rope->seed ^= rope->seed << 5;
+	node->left = node->right = NULL;
+	node->prio = rope->seed;
+	node->size = node->len = len;
+	if (len)
+		memcpy(ROPE_TEXT(node), str, len);
+	return node;
+}
+
+/* ------------------------------------------------------------------------- */
+static void rope_node_free(rope_t rope, rope_node_t *node)
+{
+	if (node)
+	{
+		rope_node_free(rope, node->left);
+		rope_node_free(rope, node->right);
+		mem_allocator_free(rope->allocator, node);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+static rope_node_t *rope_update(rope_node_t *node)
+{
+	node->size = ROPE_SIZE(node->left) + node->len + ROPE_SIZE(node->right);
+	return node;
+}
+
+/* ------------------------------------------------------------------------- */
+/* joins two trees, all the characters of the first one coming before the    */
+/* characters of the second one                                              */
+static rope_node_t *rope_merge(rope_node_t *a, rope_node_t *b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	if (a->prio >= b->prio)
+	{
+		a->right = rope_merge(a->right, b);
+		return rope_update(a);
+	}
+	b->left = rope_merge(a, b->left);
+	return rope_update(b);
+}
+
+/* ------------------------------------------------------------------------- */
+/* splits a tree before the character pos; a chunk holding characters on    */
+/* both sides is cut, its second part going to the spare node, which is set */
+/* to NULL once used                                                         */
+static void rope_split(rope_node_t *node, size_t pos, rope_node_t **left,
+					   rope_node_t **right, rope_node_t **spare)
+{
+	size_t lsize, off;
+
+	if (!node)
+	{
+		*left = *right = NULL;
+		return;
+	}
+
+	lsize = ROPE_SIZE(node->left);
+	if (pos <= lsize)
+	{
+		rope_split(node->left, pos, left, &node->left, spare);
+		*right = rope_update(node);
+	}
+	else if (pos >= lsize + node->len)
+	{
+		rope_split(node->right, pos - lsize - node->len, &node->right, right,
+				   spare);
+		*left = rope_update(node);
+	}
+	else
+	{
+		/* the second part takes the place of the node in the right tree */
+		off = pos - lsize;
+		(*spare)->len = node->len - off;
+		memcpy(ROPE_TEXT(*spare), ROPE_TEXT(node) + off, (*spare)->len);
+		(*spare)->prio = node->prio;
+		(*spare)->left = NULL;
+		(*spare)->right = node->right;
+		*right = rope_update(*spare);
+		*spare = NULL;
+
+		node->len = off;
+		node->right = NULL;
+		*left = rope_update(node);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* inserts characters in the chunk holding pos if it has room for them       */
+static int rope_fill(rope_node_t *node, size_t pos, const char *str, size_t len)
+{
+	size_t lsize = ROPE_SIZE(node->left), off;
+	int done;
+
+	if (pos <= lsize && node->left)
+		done = rope_fill(node->left, pos, str, len);
+	else if (pos <= lsize + node->len)
+	{
+		if ((done = (node->len + len <= ROPE_CHUNK)))
+		{
+			off = pos - lsize;
+			memmove(ROPE_TEXT(node) + off + len, ROPE_TEXT(node) + off,
+					node->len - off);
+			memcpy(ROPE_TEXT(node) + off, str, len);
+			node->len += len;
+		}
+	}
+	else
+		done = rope_fill(node->right, pos - lsize - node->len, str, len);
+
+	if (done)
+		node->size += len;
+	return done;
+}
+
+/* ------------------------------------------------------------------------- */
+/* finds the chunk holding pos, giving the offset of pos in it               */
+static rope_node_t *rope_find(rope_node_t *node, size_t pos, size_t *off)
+{
+	size_t lsize;
+
+	while (node)
+	{
+		lsize = ROPE_SIZE(node->left);
+		if (pos < lsize)
+			node = node->left;
+		else if (pos < lsize + node->len)
+		{
+			*off = pos - lsize;
+			return node;
+		}
+		else
+		{
+			pos -= lsize + node->len;
+			node = node->right;
+		}
+	}
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+static char *rope_flatten(rope_node_t *node, char *dest)
+{
+	if (!node)
+		return dest;
+	dest = rope_flatten(node->left, dest);
+	memcpy(dest, ROPE_TEXT(node), node->len);
+	return rope_flatten(node->right, dest + node->len);
+}
+
+
+
+/* ========================================================================= */
+/* public functions                                                          */
+
+rope_t rope_new(void)
+{
+	const mem_allocator_t *allocator = mem_allocator_get();
+	rope_t rope;
+
+	if (!(rope = mem_allocator_new(allocator, struct rope_type, 1)))
+		return NULL;
+	rope->seed = 2463534242U ^ (unsigned int) (size_t) rope;
+	if (!rope->seed)
+		rope->seed = 2463534242U;
+	rope->allocator = allocator;
+	return rope;
+}
+
+int rope_delete(rope_t rope)
+{
+	if (!rope)
+		return RETERROR(EINVAL, -1);
+
+	rope_node_free(rope, rope->root);
+	mem_allocator_free(rope->allocator, rope->flat);
+	mem_allocator_free(rope->allocator, rope);
+	return 0;
+}
+
+size_t rope_len(rope_t rope)
+{
+	if (!rope)
+		return RETERROR(EINVAL, 0);
+	return ROPE_SIZE(rope->root);
+}
+
+int rope_insert(rope_t rope, size_t pos, const char *str, size_t len)
+{
+	rope_node_t *left, *right, *middle = NULL, *node, *spare;
+	size_t n;
+
+	if (!rope || (!str && len))
+		return RETERROR(EINVAL, -1);
+	if (pos > ROPE_SIZE(rope->root))
+		return RETERROR(ERANGE, -1);
+	if (!len)
+		return 0;
+	rope->flatok = 0;
+
+	/* small insertions go in the chunk at pos when it has room */
+	if (rope->root && rope_fill(rope->root, pos, str, len))
+		return 0;
+
+	/* otherwise new chunks are made for the characters, and put at pos */
+	for (; len; str += n, len -= n)
+	{
+		n = (len < ROPE_CHUNK) ? len : ROPE_CHUNK;
+		if (!(node = rope_node_new(rope, str, n)))
+		{
+			SAFEERRNO(rope_node_free(rope, middle));
+			return -1;
+		}
+		middle = rope_merge(middle, node);
+	}
+	if (!(spare = rope_node_new(rope, str, 0)))
+	{
+		SAFEERRNO(rope_node_free(rope, middle));
+		return -1;
+	}
+	rope_split(rope->root, pos, &left, &right, &spare);
+	rope->root = rope_merge(rope_merge(left, middle), right);
+	if (spare)
+		mem_allocator_free(rope->allocator, spare);
+	return 0;
+}
+
+int rope_append(rope_t rope, const char *str, size_t len)
+{
+	return rope_insert(rope, (rope ? ROPE_SIZE(rope->root) : 0), str, len);
+}
+
+int rope_erase(rope_t rope, size_t pos, size_t count)
+{
+	rope_node_t *left, *middle, *right, *spare[2];
+	size_t size;
+
+	if (!rope)
+		return RETERROR(EINVAL, -1);
+	size = ROPE_SIZE(rope->root);
+	if (pos > size || count > size - pos)
+		return RETERROR(ERANGE, -1);
+	if (!count)
+		return 0;
+	rope->flatok = 0;
+
+	/* both ends may cut a chunk */
+	if (!(spare[0] = rope_node_new(rope, NULL, 0)) ||
+		!(spare[1] = rope_node_new(rope, NULL, 0)))
+	{
+		SAFEERRNO(mem_allocator_free(rope->allocator, spare[0]));
+		return -1;
+	}
+	rope_split(rope->root, pos, &left, &right, &spare[0]);
+	rope_split(right, count, &middle, &right, spare[0] ? &spare[0] : &spare[1]);
+	rope_node_free(rope, middle);
+	rope->root = rope_merge(left, right);
+	mem_allocator_free(rope->allocator, spare[0]);
+	mem_allocator_free(rope->allocator, spare[1]);
+	return 0;
+}
+
+const char *rope_chunk(rope_t rope, size_t pos, size_t *len)
+{
+	rope_node_t *node;
+	size_t off;
+
+	if (!rope || !len)
+		return RETERROR(EINVAL, NULL);
+
+	*len = 0;
+	if (!(node = rope_find(rope->root, pos, &off)))
+		return NULL;
+	*len = node->len - off;
+	return ROPE_TEXT(node) + off;
+}
+
+size_t rope_copy(rope_t rope, size_t pos, size_t count, char *dest)
+{
+	const char *chunk;
+	size_t len, done = 0;
+
+	if (!rope || (!dest && count))
+		return RETERROR(EINVAL, 0);
+
+	while (done < count && (chunk = rope_chunk(rope, pos + done, &len)))
+	{
+		if (len > count - done)
+			len = count - done;
+		memcpy(dest + done, chunk, len);
+		done += len;
+	}
+	return done;
+}
+
+const char *rope_str(rope_t rope)
+{
+	size_t size;
+	char *flat;
+
+	if (!rope)
+		return RETERROR(EINVAL, NULL);
+	if (rope->flatok)
+		return rope->flat;
+
+	size = ROPE_SIZE(rope->root) + 1;
+	if (size > rope->flatsize)
+	{
+		if (!(flat = (char *) mem_allocator_realloc(rope->allocator, rope->flat, size)))
+			return NULL;
+		rope->flat = flat;
+		rope->flatsize = size;
+	}
+	*rope_flatten(rope->root, rope->flat) = '\0';
+	rope->flatok = 1;
+	return rope->flat;
+}
+
+/* vi:set ts=4 sw=4: */
@@ -35,6 +35,19 @@
 #include "scelib/thread.h"
 #include "scelib/memory.h"
 #include "scelib/str.h"
+#include "scelib/map.h"
+#include "scelib/shmap.h"
+#include "scelib/pmap.h"
+#include "scelib/smap.h"
+#include "scelib/cmap.h"
+#include "scelib/count.h"
+#include "scelib/sketch.h"
+#include "scelib/atom.h"
+#include "scelib/chash.h"
+#include "scelib/vec.h"
+#include "scelib/mmap.h"
+#include "scelib/strbuf.h"
+#include "scelib/rope.h"
 
 #endif /* __SCELIB_H */
 /* vi:set ts=4 sw=4: */
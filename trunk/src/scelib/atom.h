@@ -0,0 +1,114 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief String interning table.
+ *
+ *	An atom table keeps a single copy of each string interned in it, the
+ *	atom, so that equal strings are then compared by their pointers. Atoms
+ *	are stored in an append-only memory area with their precomputed hash and
+ *	length, and stay valid until the table is deleted.
+ *
+ *	Atoms can then key ordinary maps with atom_map_hash() and atom_map_comp(),
+ *	which neither hash nor compare the strings again.
+ *
+ *	Atom tables can be used by several threads at once. Looking up an atom
+ *	never takes a lock, only interning a new string does.
+ */
+#ifndef __SCELIB_ATOM_H
+#define __SCELIB_ATOM_H
+
+#include "defs.h"
+#include "map.h"
+#include <stdlib.h>
+
+SCELIB_BEGIN_CDECL
+
+/** An atom, which is a constant null terminated string.
+ */
+typedef const char *atom_t;
+
+/** The atom table object.
+ */
+typedef struct atoms_type *atoms_t;
+
+/** Creates a new atom table.
+ *
+ *	@param[in] size	expected number of atoms, or MAP_SIZE_AUTO
+ *	@return a new atom table, or NULL if any error.
+ */
+atoms_t atoms_new(int size);
+
+/** Deletes an atom table, and all its atoms.
+ *
+ *	@return -1 if an invalid table object was specified, or 0.
+ */
+int atoms_delete(atoms_t atoms);
+
+/** Returns the number of atoms in the table.
+ */
+int atoms_count(atoms_t atoms);
+
+/** Interns a string.
+ *
+ *	@param[in] atoms	the atom table object
+ *	@param[in] str		the string to intern
+ *	@return the atom equal to @a str, created if needed, or NULL if any
+ *			error.
+ */
+atom_t atom_intern(atoms_t atoms, const char *str);
+
+/** Interns the @a len first characters of a string.
+ *
+ *	The characters don't need to be null terminated, and mustn't contain
+ *	any null character.
+ *
+ *	@see atom_intern()
+ */
+atom_t atom_intern_len(atoms_t atoms, const char *str, size_t len);
+
+/** Finds the atom equal to a string, without creating it.
+ *
+ *	@return the atom equal to @a str, or NULL if it wasn't interned (errno
+ *			is then ERANGE).
+ */
+atom_t atom_find(atoms_t atoms, const char *str);
+
+/** Returns the hash of an atom, which must come from an atom table.
+ */
+int atom_hash(atom_t atom);
+
+/** Returns the length of an atom, which must come from an atom table.
+ */
+size_t atom_len(atom_t atom);
+
+/** Hash function of the maps keyed by atoms.
+ *
+ *	@see map_hash_t
+ */
+int atom_map_hash(int size, void *key);
+
+/** Comparaison function of the maps keyed by atoms, which compares pointers.
+ *
+ *	@see map_comp_t
+ */
+int atom_map_comp(void *key1, void *key2);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_ATOM_H */
+/* vi:set ts=4 sw=4: */
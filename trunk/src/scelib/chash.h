@@ -0,0 +1,121 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief Consistent hashing.
+ *
+ *	A consistent hash ring spreads keys across a set of nodes, so that adding
+ *	or removing a node only moves the keys of that node, instead of almost
+ *	all of them as a plain modulo would.
+ *
+ *	Each node is given a number of virtual nodes, proportional to its
+ *	weight, whose tokens are derived from the node name: rings built with
+ *	the same nodes by different processes route keys the same way. A key
+ *	goes to the node of the first token following its hash, found by a
+ *	binary search in the sorted tokens.
+ *
+ *	chash_jump() is also provided for nodes numbered from 0, which are only
+ *	added or removed at the end: it needs no memory at all.
+ *
+ *	Rings aren't thread safe: they must be locked by the user if modified
+ *	while other threads route keys.
+ */
+#ifndef __SCELIB_CHASH_H
+#define __SCELIB_CHASH_H
+
+#include "defs.h"
+#include "map.h"
+
+SCELIB_BEGIN_CDECL
+
+/** The consistent hash ring object.
+ */
+typedef struct chash_type *chash_t;
+
+/** Creates a new consistent hash ring, without any node.
+ *
+ *	@param[in] vnodes		virtual nodes per weight unit, 100 to 200 giving
+ *							a good balance
+ *	@param[in] hash_func	hash function of the keys, called with
+ *							@ref MAP_HASH_MAX as size, see map_hash_t
+ *	@return a new ring, or NULL if any error.
+ */
+chash_t chash_new(int vnodes, map_hash_t hash_func);
+
+/** Deletes a consistent hash ring.
+ *
+ *	@return -1 if an invalid ring object was specified, or 0.
+ */
+int chash_delete(chash_t ring);
+
+/** Returns the number of nodes of the ring.
+ */
+int chash_count(chash_t ring);
+
+/** Adds a node to the ring.
+ *
+ *	@param[in] ring		the ring object
+ *	@param[in] name		the node name, unique in the ring, which is copied
+ *	@param[in] weight	the node weight, 1 for a standard node
+ *	@param[in] node		the user data routed to, which can't be NULL
+ *	@return the new number of nodes, or -1 if any error (EEXIST if the name
+ *			is already used, ERANGE if the ring would get more than 2^24
+ *			virtual nodes).
+ */
+int chash_add(chash_t ring, const char *name, int weight, void *node);
+
+/** Removes a node from the ring.
+ *
+ *	@param[in] ring		the ring object
+ *	@param[in] name		the node name
+ *	@param[out] node	back pointer to the node user data, or NULL
+ *	@return the new number of nodes, or -1 if any error (ERANGE if the node
+ *			wasn't found).
+ */
+int chash_remove(chash_t ring, const char *name, void **node);
+
+/** Returns the node of a key.
+ *
+ *	@return the user data of the node, or NULL if the ring is empty.
+ */
+void *chash_get(chash_t ring, void *key);
+
+/** Routes several keys at once.
+ *
+ *	@param[in] ring		the ring object
+ *	@param[in] keys		the keys to route
+ *	@param[out] nodes	array receiving the node user data of each key
+ *	@param[in] n		the number of keys
+ *	@return 0 if ok, -1 if any error (ERANGE if the ring is empty).
+ */
+int chash_route(chash_t ring, void **keys, void **nodes, int n);
+
+/** Jump consistent hash.
+ *
+ *	Returns the bucket of a hash among @a buckets ones. When the number of
+ *	buckets grows, only the keys moving to the new buckets change of bucket.
+ *
+ *	@param[in] hash		the key hash, as returned by a map_hash_t function
+ *	@param[in] buckets	the number of buckets
+ *	@return the bucket, from 0 to @a buckets - 1, or -1 if any error.
+ */
+int chash_jump(int hash, int buckets);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_CHASH_H */
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,88 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief Concurrent map handling.
+ *
+ *	A concurrent map can be used by several threads at once without any
+ *	external lock. Its buckets are protected by a set of striped locks, so
+ *	threads working on different keys rarely wait for each other.
+ *
+ *	When the map grows, its table isn't rebuilt by a single thread: the
+ *	buckets are moved to the new table by chunks, and every thread using the
+ *	map while a resize is in progress claims and moves chunks before doing
+ *	its own operation. A resize thus takes less time as more threads work on
+ *	the map, and no thread waits for the whole table to be rebuilt.
+ *
+ *	Old tables are only released when the map is deleted, as other threads
+ *	may still be reading them. They take less memory than the current table.
+ */
+#ifndef __SCELIB_CMAP_H
+#define __SCELIB_CMAP_H
+
+#include "defs.h"
+#include "map.h"
+
+SCELIB_BEGIN_CDECL
+
+/** The concurrent map object.
+ */
+typedef struct cmap_type *cmap_t;
+
+/** Creates a new concurrent map.
+ *
+ *	The callback functions are the same as the map_new() ones, and must be
+ *	thread safe. The hash function is called with @ref MAP_HASH_MAX as size.
+ *
+ *	@param[in] size	expected number of items, or MAP_SIZE_AUTO
+ *	@return a pointer to the newly created map object, or NULL if any error.
+ */
+cmap_t cmap_new(int size, map_hash_t hash_func, map_comp_t comp_func,
+				map_alloc_t alloc_func, map_free_t free_func);
+
+/** Deletes a concurrent map, which must not be used by any other thread.
+ *
+ *	@return -1 if an invalid map object was specified, or 0.
+ */
+int cmap_delete(cmap_t map);
+
+/** Returns the number of elements in the map.
+ */
+int cmap_count(cmap_t map);
+
+/** Retrieves the data associated with the key.
+ *
+ *	@see map_get()
+ */
+void *cmap_get(cmap_t map, void *key);
+
+/** Associates the key with the given value.
+ *
+ *	@see map_set()
+ */
+int cmap_set(cmap_t map, void *key, void *data, void **olddata);
+
+/** Deletes the key/value pair from the map.
+ *
+ *	@see map_unset()
+ */
+int cmap_unset(cmap_t map, void *key, void **olddata);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_CMAP_H */
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,114 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief Concurrent counting map.
+ *
+ *	A counting map associates keys with counters, which can be incremented by
+ *	several threads at once. Each thread accumulates its increments in its own
+ *	small map, only locked by itself, and these buffers are merged into the
+ *	shared table every few thousands increments, when a thread calls
+ *	count_flush() or exits, and when the counters are read. Threads thus
+ *	almost never wait for each other when counting.
+ */
+#ifndef __SCELIB_COUNT_H
+#define __SCELIB_COUNT_H
+
+#include "defs.h"
+#include "map.h"
+
+SCELIB_BEGIN_CDECL
+
+/** The counting map object.
+ */
+typedef struct count_type *count_t;
+
+/** Counter returned by count_snapshot().
+ */
+typedef struct count_entry_type
+{
+	void *key;		/**< the key, as stored in the counting map */
+	long count;		/**< the counter value */
+} count_entry_t;
+
+/** Creates a new counting map.
+ *
+ *	The callback functions are the same as the map_new() ones, and must be
+ *	thread safe. Keys are duplicated by @a alloc_func in each thread buffer
+ *	and in the shared table.
+ *
+ *	@return a pointer to the newly created map object, or NULL if any error.
+ */
+count_t count_new(map_hash_t hash_func, map_comp_t comp_func,
+				  map_alloc_t alloc_func, map_free_t free_func);
+
+/** Deletes a counting map.
+ *
+ *	The threads must not use the map anymore, but they don't need to have
+ *	exited: their buffers are freed too.
+ *
+ *	@return -1 if an invalid map object was specified, or 0.
+ */
+int count_delete(count_t map);
+
+/** Adds a value to the counter of the key.
+ *
+ *	@param[in] map		the counting map object
+ *	@param[in] key		the counter key, created if needed
+ *	@param[in] delta	the value to add to the counter
+ *	@return 0 if ok, -1 if any error.
+ */
+int count_add(count_t map, void *key, long delta);
+
+/** Adds values to several counters at once.
+ *
+ *	@param[in] map		the counting map object
+ *	@param[in] keys		the counters keys
+ *	@param[in] deltas	the values to add to each counter, or NULL to add 1
+ *	@param[in] n		the number of counters
+ *	@return 0 if ok, -1 if any error.
+ */
+int count_add_bulk(count_t map, void **keys, long *deltas, int n);
+
+/** Merges the calling thread buffer into the shared table.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int count_flush(count_t map);
+
+/** Returns the counter value of a key, including the buffered increments.
+ *
+ *	@return the counter value, 0 for an unknown key.
+ */
+long count_get(count_t map, void *key);
+
+/** Takes a snapshot of all the counters.
+ *
+ *	All threads buffers are merged first. The returned keys are the ones
+ *	stored in the shared table, which stay valid until the map is deleted.
+ *
+ *	@param[in] map	the counting map object
+ *	@param[out] n	back pointer to the number of counters
+ *	@return an array of @a n counters, to be freed with free(), or NULL if
+ *			any error.
+ */
+count_entry_t *count_snapshot(count_t map, int *n);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_COUNT_H */
+/* vi:set ts=4 sw=4: */
@@ -18,11 +18,23 @@
 /** @file
  *	@brief Map/Dictionnary handling.
  *
+ *	The map object uses a compact layout: key/value pairs are stored in a
+ *	dense table, in their insertion order, and a small sparse index table
+ *	(of 8, 16 or 32 bits slot numbers, depending on the map size) points to
+ *	them. Iterating a map is thus a linear scan of the dense table, and keys
+ *	are always returned in the order they were first inserted.
+ *
+ *	Entries can also be given an expiry with map_set_ttl(). Expired entries
+ *	are seen as missing by lookups and iterations, and are removed (their key
+ *	being freed by the map_free_t function) by map_expire(), which only
+ *	visits the entries due, thanks to a hierarchical timing wheel.
  */
 #ifndef __SCELIB_MAP_H
 #define __SCELIB_MAP_H
 
 #include "defs.h"
+#include "memory.h"
+#include <limits.h>
 
 SCELIB_BEGIN_CDECL
 
@@ -35,6 +47,15 @@ SCELIB_BEGIN_CDECL
  */
 #define MAP_SIZE_AUTO		-1
 
+/** Size passed to the hash functions by the map object.
+ *
+ *	The map doesn't ask for a hash value bounded to its current table size,
+ *	but for a value in the [0, MAP_HASH_MAX[ range, which it stores beside the
+ *	key. That way, the hash function is called once per key, whatever the
+ *	number of times the map table grows.
+ */
+#define MAP_HASH_MAX		INT_MAX
+
 /** The map object.
  *
  *	The map object is an opaque structure, and you access it only by this
@@ -48,7 +69,9 @@ typedef struct map_type *map_t;
  *	on its table size. Each hash function must have this prototype. You pass
  *	such a function pointer to the map_new() function.
  *
- *	@param[in] size	the size of the map table
+ *	The map object always calls it with @ref MAP_HASH_MAX as @a size.
+ *
+ *	@param[in] size	the upper bound (excluded) of the hash value
  *	@param[in] key	data key to compute the hash for
  *	@return the hash value.
  */
@@ -89,6 +112,18 @@ typedef void* (*map_alloc_t)(void *key);
  */
 typedef void (*map_free_t)(void *key);
 
+/** Pointer to function choosing the data of a key found in both maps.
+ *
+ *	The map merging functions call such a function when a key is in both the
+ *	destination and the source maps.
+ *
+ *	@param[in] key		the key, as stored in the destination map
+ *	@param[in] dstdata	the data of the key in the destination map
+ *	@param[in] srcdata	the data of the key in the source map
+ *	@return the data to associate with the key in the destination map.
+ */
+typedef void* (*map_conflict_t)(void *key, void *dstdata, void *srcdata);
+
 /** Object to iterate in a map object.
  *
  *	This opaque type is a structured handle to an iteration object, permitting
@@ -111,9 +146,9 @@ int map_ptr_hash(int size, void *key);
  *	This function allocates all needed data to let you use a map/dictionnary,
  *	and gives you back a handle to this object.
  *
- *	@param[in] size			initial size of the map. Set it to MAP_SIZE_AUTO
- *							if you don't want to bother with the map table
- *							size
+ *	@param[in] size			initial size of the map, in number of items. Set
+ *							it to MAP_SIZE_AUTO if you don't want to bother
+ *							with the map table size
  *	@param[in] hash_func	hash function compatible with the map_hash_t
  *							prototype
  *	@param[in] comp_func	comparaison function compatible with the map_comp_t
@@ -128,13 +163,26 @@ int map_ptr_hash(int size, void *key);
 map_t map_new(int size, map_hash_t hash_func, map_comp_t comp_func,
 			  map_alloc_t alloc_func, map_free_t free_func);
 
+/** Creates a new map object, taking its memory from an allocator.
+ *
+ *	The keys duplicated by @a alloc_func don't come from the allocator.
+ *
+ *	@param[in] allocator	the allocator of the map memory, or NULL to use
+ *							the one returned by mem_allocator_get()
+ *	@see map_new(), mem_allocator_t
+ */
+map_t map_new_ex(int size, map_hash_t hash_func, map_comp_t comp_func,
+				 map_alloc_t alloc_func, map_free_t free_func,
+				 const mem_allocator_t *allocator);
+
 /** Returns the number of elements in the map.
  *
  *	This function is obvious :-)
  *
  *	@param[in] map	the map object
  *	@return the number of items actually in the map, or -1 if an invalid map
- *			object was specified.
+ *			object was specified. Expired entries are counted until removed
+ *			by map_expire().
  */
 int map_count(map_t map);
 
@@ -205,6 +253,19 @@ void *map_get(map_t map, void *key);
  */
 int map_set(map_t map, void *key, void *data, void **olddata);
 
+/** Gets the data of a key, for an update in place.
+ *
+ *	The key is added with a NULL data if it isn't in the map yet, so that
+ *	reading and updating its data only needs a single lookup, as for
+ *	counters.
+ *
+ *	@param[in] map	the map object
+ *	@param[in] key	the key to find or create
+ *	@return a pointer to the data of the key, valid until the map is modified,
+ *			or NULL if any error.
+ */
+void **map_slot(map_t map, void *key);
+
 /** Delete the key/value pair from the map.
  *
  *	When you don't want a key/value pair to be stored in the map, you unset it.
@@ -218,6 +279,91 @@ int map_set(map_t map, void *key, void *data, void **olddata);
  */
 int map_unset(map_t map, void *key, void **olddata);
 
+/** Reserves room in the map for a number of items.
+ *
+ *	Filling the map up to @a count items won't rebuild its table.
+ *
+ *	@param[in] map		the map object
+ *	@param[in] count	the number of items the map should hold
+ *	@return 0 if ok, or -1 if any error.
+ */
+int map_reserve(map_t map, int count);
+
+/** Adds the key/value pairs of a map to another one.
+ *
+ *	The destination map is reserved for the source pairs first. If both maps
+ *	use the same hash function, the hash values cached by the source map are
+ *	reused. New keys are duplicated by the destination map_alloc_t function.
+ *
+ *	@param[in] dst		the map receiving the pairs
+ *	@param[in] src		the map to add to @a dst
+ *	@param[in] conflict	function choosing the data of keys in both maps, or
+ *						NULL for the source data to replace the destination
+ *						one
+ *	@return the new item count of @a dst, or -1 if any error.
+ */
+int map_merge(map_t dst, map_t src, map_conflict_t conflict);
+
+/** Adds the key/value pairs of several maps to another one, in parallel.
+ *
+ *	The source keys are hashed and looked up in the destination map by
+ *	@a nthreads threads (the calling one included), then the pairs are
+ *	added to the destination by the calling thread, in the order of the
+ *	sources. The callbacks of the destination map must thus be thread safe,
+ *	and the maps must not be modified during the call.
+ *
+ *	@param[in] dst		the map receiving the pairs
+ *	@param[in] srcs		the maps to add to @a dst
+ *	@param[in] n		the number of maps in @a srcs
+ *	@param[in] conflict	see map_merge()
+ *	@param[in] nthreads	the number of threads to use
+ *	@return the new item count of @a dst, or -1 if any error.
+ */
+int map_merge_all(map_t dst, map_t *srcs, int n, map_conflict_t conflict,
+				  int nthreads);
+
+/** Removes from a map the keys not found in another one.
+ *
+ *	@param[in] dst		the map to filter
+ *	@param[in] src		the map of the keys to keep
+ *	@param[in] conflict	function choosing the data of the kept keys, or NULL
+ *						to keep the destination data
+ *	@return the new item count of @a dst, or -1 if any error.
+ */
+int map_intersect(map_t dst, map_t src, map_conflict_t conflict);
+
+/** Removes from a map the keys found in another one.
+ *
+ *	@return the new item count of @a dst, or -1 if any error.
+ */
+int map_diff(map_t dst, map_t src);
+
+/** Sets the time to live of a key/value pair.
+ *
+ *	Once expired, the pair is seen as missing, and it's removed on the next
+ *	call to map_expire(). Replacing the value of the key with map_set()
+ *	keeps its expiry.
+ *
+ *	@param[in] map		the map object
+ *	@param[in] key		the key of the pair
+ *	@param[in] seconds	time to live of the pair from now, or 0 to make it
+ *						persistent again
+ *	@return 0 if ok, or -1 if any error (ERANGE if the key wasn't found).
+ */
+int map_set_ttl(map_t map, void *key, int seconds);
+
+/** Removes the expired key/value pairs from the map.
+ *
+ *	This function should be called periodically (every second or so) to
+ *	release the expired pairs. It only visits the pairs due since its last
+ *	call, however big the map is.
+ *
+ *	@param[in] map	the map object
+ *	@return the number of removed pairs, or -1 if an invalid map object was
+ *			specified.
+ */
+int map_expire(map_t map);
+
 /** Creates a new iteration object.
  *
  *	@see map_iter_t
@@ -238,9 +384,11 @@ int map_iter_delete(map_iter_t iter);
 
 /** Get the next (or first) key/value pair from the map.
  *
- *	This's the iteration function, which permit to traverse the map. Note that
- *	data isn't sorted, so you won't get the key/value pair in the order you
- *	inserted them.
+ *	This's the iteration function, which permit to traverse the map. Key/value
+ *	pairs are returned in the order their keys were inserted (replacing the
+ *	value of an existing key doesn't change its position). Removing pairs
+ *	while iterating is allowed, but adding new keys may reorganize the map
+ *	table, and you should then restart the iteration.
  *
  *	@param[in] iter		the iteration object
  *	@param[out] key		the next key in the map
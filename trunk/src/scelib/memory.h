@@ -31,6 +31,7 @@
 
 #include "defs.h"
 #include <stdlib.h>
+#include <stdio.h>
 
 SCELIB_BEGIN_CDECL
 
@@ -101,6 +102,502 @@ void *mem_dup(void *mem, size_t size);
 #define mem_dupt(type, mem, cnt) \
 	(type *) mem_dup((void *) (mem), sizeof(type) * (cnt))
 
+/** Size of the processors cache lines, assumed by the padded allocations.
+ */
+#define MEM_CACHE_LINE		64
+
+/** Allocates aligned and zero initialized memory, like calloc().
+ *
+ *	@param[in] size		size of an element
+ *	@param[in] count	number of elements
+ *	@param[in] align	alignment of the memory, a power of 2
+ *	@return the allocated memory, to be freed with mem_free_aligned(), or NULL
+ *			if any error.
+ */
+void *mem_aligned_calloc(size_t size, size_t count, size_t align);
+
+/** Reallocates aligned memory, free it if error.
+ *
+ *	Acts like mem_realloc() for memory allocated by mem_aligned_calloc(),
+ *	the memory added being zero initialized. The alignment may differ from
+ *	the one of the first allocation.
+ */
+void *mem_aligned_realloc(void **pmem, size_t count, size_t align);
+
+/** Frees aligned memory and reinit pointee, like mem_free().
+ */
+void mem_free_aligned(void **pmem);
+
+/** C++ style aligned heap memory allocation.
+ *
+ *	Acts like mem_new(), with memory aligned on @a align bytes. The memory
+ *	must be freed with mem_free_aligned().
+ */
+#define mem_new_aligned(type, cnt, align) \
+	(type *) mem_aligned_calloc(sizeof(type), (cnt), (align))
+
+/** C++ style aligned heap memory reallocation.
+ */
+#define mem_renew_aligned(mem, type, cnt, align) \
+	(type *) mem_aligned_realloc((void **)(&(mem)), sizeof(type) * (cnt), (align))
+
+/** Allocates an array whose elements each start a cache line.
+ *
+ *	Elements modified by different threads, like per thread or per processor
+ *	counters, don't share any cache line, and never slow each other down.
+ *	The elements are zero initialized, and accessed with mem_lines_at().
+ *
+ *	@param[in] size		size of an element
+ *	@param[in] count	number of elements, see thread_cpu_count()
+ *	@param[out] stride	back pointer to the distance between two elements
+ *	@return the array, to be freed with mem_free_aligned(), or NULL if any
+ *			error.
+ */
+void *mem_lines_new(size_t size, size_t count, size_t *stride);
+
+/** Element @a i of an array allocated by mem_lines_new().
+ */
+#define mem_lines_at(type, lines, stride, i) \
+	((type *) ((char *) (lines) + (size_t) (i) * (stride)))
+
+/** Default size from which mem_large_alloc() maps memory from the system.
+ */
+#define MEM_LARGE_THRESHOLD	(2 * 1024 * 1024)
+
+/** Sets the size from which mem_large_alloc() maps memory from the system.
+ *
+ *	Smaller blocks come from calloc(). The threshold applies to the following
+ *	allocations, and can be changed at any time.
+ *
+ *	@param[in] threshold	size in bytes, 0 for @ref MEM_LARGE_THRESHOLD
+ *	@return the previous threshold.
+ */
+size_t mem_large_threshold(size_t threshold);
+
+/** Allocates a large block of zero initialized memory.
+ *
+ *	Blocks above the threshold are mapped directly from the system, on huge
+ *	pages when possible, so that big tables and buffers cause less TLB
+ *	misses. Their memory comes zeroed from the kernel, and is only touched
+ *	when used. On systems without mmap(), calloc() is used.
+ *
+ *	@param[in] size	size of the block
+ *	@return the allocated memory, to be freed with mem_large_free(), or NULL
+ *			if any error.
+ */
+void *mem_large_alloc(size_t size);
+
+/** Reallocates a large block, free it if error.
+ *
+ *	Acts like mem_realloc() for memory allocated by mem_large_alloc(), the
+ *	memory added being zero initialized. Mapped blocks are grown in place
+ *	when there is room, and remapped without copying them on Linux.
+ */
+void *mem_large_realloc(void **pmem, size_t size);
+
+/** Frees a large block and reinit pointee, like mem_free().
+ */
+void mem_large_free(void **pmem);
+
+/** Arena allocator object.
+ *
+ *	An arena allocates memory by bumping a pointer in large chunks, and frees
+ *	all of it at once: objects sharing the same lifetime, like the ones of a
+ *	request, are then allocated very quickly, and freed in a time depending
+ *	on the number of chunks only. Arena memory can't be freed or reallocated
+ *	one object at a time.
+ */
+typedef struct mem_arena_type *mem_arena_t;
+
+/** Arena savepoint, see mem_arena_save().
+ */
+typedef struct mem_arena_mark_type
+{
+	void *chunks;		/**< the chunks list at the savepoint */
+	void *current;		/**< the chunk allocated from */
+	size_t used;		/**< the bytes used in the current chunk */
+} mem_arena_mark_t;
+
+/** Default size of the arena chunks.
+ */
+#define MEM_ARENA_CHUNK		65536
+
+/** Creates an arena.
+ *
+ *	@param[in] chunk_size	size of the chunks, or 0 for MEM_ARENA_CHUNK.
+ *							Allocations larger than the quarter of a chunk get
+ *							their own chunk.
+ *	@return a new arena, or NULL if any error.
+ */
+mem_arena_t mem_arena_create(size_t chunk_size);
+
+/** Destroys an arena, and frees all its memory.
+ */
+void mem_arena_destroy(mem_arena_t arena);
+
+/** Allocates uninitialized memory from an arena.
+ *
+ *	The memory is aligned as malloc() one, and valid until the arena is
+ *	reset, rewound before the allocation, or destroyed.
+ *
+ *	@return the allocated memory, or NULL if any error.
+ */
+void *mem_arena_alloc(mem_arena_t arena, size_t size);
+
+/** Allocates zero initialized memory from an arena, like calloc().
+ */
+void *mem_arena_calloc(mem_arena_t arena, size_t size, size_t count);
+
+/** Arena version of mem_new().
+ */
+#define mem_arena_new(arena, type, cnt) \
+	(type *) mem_arena_calloc((arena), sizeof(type), (cnt))
+
+/** Arena version of mem_dup().
+ */
+void *mem_arena_dup(mem_arena_t arena, const void *mem, size_t size);
+
+/** Copies a string into an arena.
+ */
+char *mem_arena_strdup(mem_arena_t arena, const char *str);
+
+/** Saves the allocation state of an arena.
+ *
+ *	@param[in] arena	the arena object
+ *	@param[out] mark	the savepoint, to be given to mem_arena_rewind()
+ */
+void mem_arena_save(mem_arena_t arena, mem_arena_mark_t *mark);
+
+/** Frees all the memory allocated from an arena after a savepoint.
+ *
+ *	Savepoints taken after @a mark become invalid.
+ */
+void mem_arena_rewind(mem_arena_t arena, const mem_arena_mark_t *mark);
+
+/** Frees all the memory allocated from an arena.
+ *
+ *	One chunk is kept for the next allocations, and all savepoints become
+ *	invalid.
+ */
+void mem_arena_reset(mem_arena_t arena);
+
+/** Returns the number of bytes allocated from the arena, and optionally the
+ *	memory taken by its chunks.
+ */
+size_t mem_arena_used(mem_arena_t arena, size_t *reserved);
+
+/** Object pool.
+ *
+ *	A pool allocates objects of a single size, and recycles the freed ones
+ *	instead of giving them back to the system. Each thread keeps the objects
+ *	it frees in small caches, the magazines, and allocates from them without
+ *	any lock: threads only share a depot of full and empty magazines, which
+ *	they exchange a magazine at a time.
+ *
+ *	Objects can be freed by another thread than the one which allocated them.
+ *	The pool memory is only given back to the system when it is destroyed.
+ */
+typedef struct mem_pool_type *mem_pool_t;
+
+/** Creates an object pool.
+ *
+ *	@param[in] size	the size of the objects
+ *	@param[in] zero	non zero to zero initialize the allocated objects, like
+ *					mem_new() does
+ *	@return a new pool, or NULL if any error.
+ */
+mem_pool_t mem_pool_create(size_t size, int zero);
+
+/** Destroys an object pool, and frees all its objects.
+ *
+ *	No thread must use the pool anymore, but they don't need to have exited.
+ */
+void mem_pool_destroy(mem_pool_t pool);
+
+/** Allocates an object from a pool.
+ *
+ *	@return the object, aligned as malloc() memory, or NULL if any error.
+ */
+void *mem_pool_alloc(mem_pool_t pool);
+
+/** Pool version of mem_new(), for a single object.
+ */
+#define mem_pool_new(pool, type) \
+	(type *) mem_pool_alloc(pool)
+
+/** Gives an object back to its pool.
+ */
+void mem_pool_free(mem_pool_t pool, void *obj);
+
+/** Size of the scratch region of each thread.
+ */
+#define MEM_SCRATCH_SIZE	(1024 * 1024)
+
+/** Allocates uninitialized memory on the scratch stack of the thread.
+ *
+ *	Scratch memory is meant for temporaries which don't outlive the function
+ *	allocating them. It's taken from a region reserved for each thread by
+ *	moving an offset, without any lock or call to malloc(), and must be given
+ *	back with mem_scratch_pop() in the reverse order of the pushes. Once the
+ *	region is full, the memory comes from the heap.
+ *
+ *	@param[in] size	size of the memory
+ *	@return the memory, aligned as malloc() one, or NULL if any error.
+ */
+void *mem_scratch_push(size_t size);
+
+/** Allocates zero initialized memory on the scratch stack, like calloc().
+ */
+void *mem_scratch_calloc(size_t size, size_t count);
+
+/** Scratch version of mem_new().
+ */
+#define mem_scratch_new(type, cnt) \
+	(type *) mem_scratch_calloc(sizeof(type), (cnt))
+
+/** Gives scratch memory back, with all the memory pushed after it.
+ *
+ *	@param[in] mem	memory returned by mem_scratch_push() in the same thread,
+ *					or NULL
+ */
+void mem_scratch_pop(void *mem);
+
+/** Reference counted buffer object.
+ *
+ *	A buffer holds bytes which are shared instead of copied: each thread or
+ *	module keeping it takes a reference, and gives it back when done, the
+ *	last one releasing the memory. A slice is a buffer viewing a part of
+ *	another one, and keeps it alive. The contents of a buffer must not be
+ *	modified once it's shared.
+ *
+ *	The counts are atomically updated, so references may be taken and given
+ *	back by any thread. The buffer memory comes from the allocator of the
+ *	creating thread, which must then be usable by all of them.
+ */
+typedef struct mem_buf_type *mem_buf_t;
+
+/** Function releasing memory given to mem_buf_wrap().
+ *
+ *	@param[in] data		the wrapped memory
+ *	@param[in] len		its size
+ *	@param[in] context	the context given to mem_buf_wrap()
+ */
+typedef void (*mem_buf_release_t)(void *data, size_t len, void *context);
+
+/** Creates a buffer of uninitialized memory, with one reference.
+ *
+ *	The memory is filled through mem_buf_data() before sharing the buffer.
+ *
+ *	@return a new buffer, or NULL if any error.
+ */
+mem_buf_t mem_buf_new(size_t len);
+
+/** Creates a buffer holding a copy of some memory, with one reference.
+ */
+mem_buf_t mem_buf_dup(const void *data, size_t len);
+
+/** Creates a buffer owning external memory, with one reference.
+ *
+ *	The memory isn't copied, and @a release is called by the thread giving
+ *	the last reference back, if not NULL. Memory mapped with mem_map_file()
+ *	or allocated by another library can then be shared as well.
+ *
+ *	@return a new buffer, or NULL if any error (the memory isn't released).
+ */
+mem_buf_t mem_buf_wrap(void *data, size_t len, mem_buf_release_t release,
+					   void *context);
+
+/** Creates a slice of a buffer, with one reference.
+ *
+ *	The slice views @a len bytes of @a buf from @a offset, without copying
+ *	them, and holds a reference to the buffer until it's released itself.
+ *
+ *	@return a new buffer, or NULL if any error (ERANGE if out of @a buf).
+ */
+mem_buf_t mem_buf_slice(mem_buf_t buf, size_t offset, size_t len);
+
+/** Takes a reference to a buffer.
+ *
+ *	@return @a buf.
+ */
+mem_buf_t mem_buf_ref(mem_buf_t buf);
+
+/** Gives a reference back, releasing the buffer if it was the last one.
+ */
+void mem_buf_unref(mem_buf_t buf);
+
+/** Returns the memory of a buffer.
+ */
+void *mem_buf_data(mem_buf_t buf);
+
+/** Returns the size of a buffer.
+ */
+size_t mem_buf_len(mem_buf_t buf);
+
+/** Returns the number of references to a buffer, slices included.
+ */
+int mem_buf_refs(mem_buf_t buf);
+
+/** Allocator interface.
+ *
+ *	The map, vec, rope and cmdline objects, the threads, and the arenas,
+ *	pools and buffers of this module don't call malloc(), realloc() and
+ *	free() directly, but the functions of an allocator, so that their memory
+ *	can come from an arena, a pool, or another malloc() implementation.
+ *	Objects keep the allocator they were created with, and always free their
+ *	memory with it. The strings returned by the str_*() functions and
+ *	vaprint(), and the strings of the strbuf objects, always come from
+ *	mem_allocator_std, so that they can be freed with free(); the other
+ *	modules use malloc() directly.
+ *
+ *	The allocator used is, in this order: the one given when creating an
+ *	object (see map_new_ex() for example), the one of the calling thread set
+ *	by mem_allocator_set_thread(), the global one set by mem_allocator_set(),
+ *	and finally mem_allocator_std.
+ *
+ *	An allocator must stay valid while objects created with it exist.
+ */
+typedef struct mem_allocator_type
+{
+	void *(*alloc)(void *context, size_t size);		/**< like malloc() */
+	void *(*realloc)(void *context, void *mem, size_t size);	/**< like realloc() */
+	void (*free)(void *context, void *mem);			/**< like free() */
+	void *context;		/**< user data given to the functions */
+} mem_allocator_t;
+
+/** The standard allocator, using malloc(), realloc() and free().
+ */
+extern const mem_allocator_t mem_allocator_std;
+
+/** Sets the global allocator, or resets it to mem_allocator_std if NULL.
+ */
+void mem_allocator_set(const mem_allocator_t *allocator);
+
+/** Sets the allocator of the calling thread, or resets it to the global one
+ *	if NULL.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int mem_allocator_set_thread(const mem_allocator_t *allocator);
+
+/** Returns the allocator of the calling thread, or the global one.
+ */
+const mem_allocator_t *mem_allocator_get(void);
+
+/** Allocates memory with an allocator, or with mem_allocator_get() if
+ *	@a allocator is NULL.
+ */
+void *mem_allocator_alloc(const mem_allocator_t *allocator, size_t size);
+
+/** Allocates zero initialized memory with an allocator, like calloc().
+ *
+ *	@see mem_allocator_alloc()
+ */
+void *mem_allocator_calloc(const mem_allocator_t *allocator, size_t size,
+						   size_t count);
+
+/** Reallocates memory with the allocator which allocated it.
+ *
+ *	@see mem_allocator_alloc()
+ */
+void *mem_allocator_realloc(const mem_allocator_t *allocator, void *mem,
+							size_t size);
+
+/** Frees memory with the allocator which allocated it.
+ *
+ *	@see mem_allocator_alloc()
+ */
+void mem_allocator_free(const mem_allocator_t *allocator, void *mem);
+
+/** Allocator version of mem_new().
+ */
+#define mem_allocator_new(allocator, type, cnt) \
+	(type *) mem_allocator_calloc((allocator), sizeof(type), (cnt))
+
+/** Initializes an allocator taking its memory from an arena.
+ *
+ *	Freeing memory does nothing, it is only freed with the arena: all the
+ *	memory of objects created with this allocator is freed at once by
+ *	mem_arena_reset(), without deleting them.
+ *
+ *	@param[in] arena		the arena object
+ *	@param[out] allocator	the allocator to initialize
+ */
+void mem_arena_allocator(mem_arena_t arena, mem_allocator_t *allocator);
+
+/** Number of allocation size classes of the trace statistics, the class n
+ *	counting the allocations of 2^(n-1) to 2^n - 1 bytes.
+ */
+#define MEM_TRACE_CLASSES	32
+
+/** Allocation trace statistics, see mem_trace_stats().
+ */
+typedef struct mem_trace_stats_type
+{
+	long allocs;		/**< traced allocations */
+	long frees;			/**< traced frees */
+	size_t bytes;		/**< bytes allocated */
+	size_t live;		/**< bytes in use, estimated if sampling */
+	size_t peak;		/**< highest bytes in use, estimated if sampling */
+	long sizes[MEM_TRACE_CLASSES];	/**< allocations per size class */
+} mem_trace_stats_t;
+
+/** Sets the sampling interval of the allocation trace.
+ *
+ *	When the library users are compiled with SCELIB_MEM_TRACE defined,
+ *	mem_new(), mem_renew(), mem_dup() and mem_free() count the allocations
+ *	and frees of each call site, and record some allocations to estimate the
+ *	memory in use: an allocation is recorded about every @a interval bytes,
+ *	and stands for @a interval bytes. The default interval, 0, records all
+ *	allocations, giving exact statistics; an interval of 512 KB or more keeps
+ *	the trace cost to a few percent, for production use.
+ *
+ *	Memory must be freed with mem_free() to be known as freed.
+ */
+void mem_trace_sample(size_t interval);
+
+/** Gets the allocation trace global statistics.
+ */
+void mem_trace_stats(mem_trace_stats_t *stats);
+
+/** Writes the allocation trace statistics, the counters of each call site,
+ *	and the heap profile, which is the memory in use by allocation site.
+ *
+ *	@param[in] out	the file to write to
+ *	@return 0 if ok, -1 if any error.
+ */
+int mem_trace_dump(FILE *out);
+
+/** Traced version of mem_new(), see mem_trace_sample().
+ */
+void *mem_trace_calloc(size_t size, size_t count, const char *file, int line);
+
+/** Traced version of mem_renew().
+ */
+void *mem_trace_realloc(void **pmem, size_t count, const char *file, int line);
+
+/** Traced version of mem_dup().
+ */
+void *mem_trace_dup(void *mem, size_t size, const char *file, int line);
+
+/** Traced version of mem_free().
+ */
+void mem_trace_free(void **pmem, const char *file, int line);
+
+#if defined(SCELIB_MEM_TRACE) && !defined(SCELIB_MEM_NOTRACE)
+#undef mem_new
+#define mem_new(type, cnt) \
+	(type *) mem_trace_calloc(sizeof(type), (cnt), __FILE__, __LINE__)
+#undef mem_renew
+#define mem_renew(mem, type, cnt) \
+	(type *) mem_trace_realloc((void **)(&(mem)), sizeof(type) * (cnt), \
+							   __FILE__, __LINE__)
+#define mem_dup(mem, size) \
+	mem_trace_dup((mem), (size), __FILE__, __LINE__)
+#define mem_free(pmem) \
+	mem_trace_free((pmem), __FILE__, __LINE__)
+#endif
+
 SCELIB_END_CDECL
 
 #endif /* __SCELIB_MEMORY_H */
@@ -0,0 +1,105 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief Memory mapped files.
+ *
+ *	A mapped file is read straight from the system page cache: its contents
+ *	are neither copied to a buffer nor allocated on the heap, and its pages
+ *	are only read from the disk when accessed (unless asked otherwise). Large
+ *	inputs, like dictionaries or snapshots, can then be parsed in place.
+ *
+ *	The mapped memory isn't terminated by a nul character, and parsers must
+ *	rely on its length. On systems without mmap(), the file is read in a
+ *	heap buffer instead, the same functions being used.
+ */
+#ifndef __SCELIB_MMAP_H
+#define __SCELIB_MMAP_H
+
+#include "defs.h"
+#include <stdlib.h>
+
+SCELIB_BEGIN_CDECL
+
+/** Mapping flags enumeration.
+ *
+ *	These flags control how mem_map_file() maps the file. The hints are
+ *	ignored where the system doesn't support them.
+ */
+enum mem_map_flags
+{
+	/** Maps writable memory. The changes are private, and never written back
+	 *	to the file.
+	 */
+	MEM_MAP_WRITE		= 0x0001,
+
+	/** Hints the pages will be read in order, so that they are read ahead.
+	 */
+	MEM_MAP_SEQUENTIAL	= 0x0002,
+
+	/** Hints the pages will be read in no order, disabling read-ahead.
+	 */
+	MEM_MAP_RANDOM		= 0x0004,
+
+	/** Hints the pages will be read soon, starting to read them in background.
+	 */
+	MEM_MAP_WILLNEED	= 0x0008,
+
+	/** Reads all the pages before returning, so that accessing them never
+	 *	waits for the disk.
+	 */
+	MEM_MAP_POPULATE	= 0x0010
+};
+
+/** Maps a whole file in memory.
+ *
+ *	The memory is read only unless @ref MEM_MAP_WRITE is given, and is valid
+ *	until mem_unmap_file() is called, even if the file is closed or removed.
+ *	Changes made to the file by other processes meanwhile may or may not be
+ *	seen.
+ *
+ *	@param[in] path		the path of the file
+ *	@param[in] flags	a combination of the MEM_MAP_* flags
+ *	@param[out] len		back pointer to the file size
+ *	@return the file contents, or NULL if any error (see errno, EINVAL if
+ *			the path isn't a regular file). An empty file gives a valid
+ *			pointer, and a zero @a len; so do the pseudo-files reporting a
+ *			zero size, like the /proc ones, whatever they would read.
+ */
+void *mem_map_file(const char *path, int flags, size_t *len);
+
+/** Gives hints about the way a mapped file will be read.
+ *
+ *	@param[in] mem		memory returned by mem_map_file()
+ *	@param[in] len		the file size
+ *	@param[in] flags	MEM_MAP_SEQUENTIAL, MEM_MAP_RANDOM or MEM_MAP_WILLNEED
+ *	@return -1 if an error occured, or 0.
+ */
+int mem_map_advise(void *mem, size_t len, int flags);
+
+/** Unmaps a file mapped by mem_map_file().
+ *
+ *	@param[in] mem	memory returned by mem_map_file()
+ *	@param[in] len	the file size
+ *	@return -1 if an error occured, or 0.
+ */
+int mem_unmap_file(void *mem, size_t len);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_MMAP_H */
+/* vi:set ts=4 sw=4: */
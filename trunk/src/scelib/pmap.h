@@ -0,0 +1,132 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief Persistent map handling.
+ *
+ *	A persistent map is a hash array mapped trie: a tree of 32 ways nodes
+ *	indexed by successive 5 bits slices of the key hash. Its nodes are never
+ *	modified once built, so an update only copies the nodes on the path from
+ *	the root to the key, and shares all other ones with the previous version.
+ *
+ *	This makes pmap_snapshot() a constant time operation: it gives a new
+ *	handle on the current version of the map, which won't see subsequent
+ *	updates of the original handle (and vice versa). Nodes are reference
+ *	counted, and freed once the last handle using them is deleted.
+ *
+ *	A handle can't be modified by several threads at once, but snapshots can
+ *	be freely given to other threads, which read and delete them without any
+ *	lock.
+ */
+#ifndef __SCELIB_PMAP_H
+#define __SCELIB_PMAP_H
+
+#include "defs.h"
+#include "map.h"
+
+SCELIB_BEGIN_CDECL
+
+/** The persistent map object.
+ *
+ *	The persistent map is an opaque structure, and you access it only by this
+ *	handle type. Each handle refers to one version of the map.
+ */
+typedef struct pmap_type *pmap_t;
+
+/** Object to iterate in a persistent map.
+ */
+typedef struct pmap_iter_type *pmap_iter_t;
+
+/** Creates a new, empty, persistent map.
+ *
+ *	The callback functions are the same as the map_new() ones. The hash
+ *	function is called with @ref MAP_HASH_MAX as size.
+ *
+ *	@return a pointer to the newly created map object, or NULL if any error.
+ */
+pmap_t pmap_new(map_hash_t hash_func, map_comp_t comp_func,
+				map_alloc_t alloc_func, map_free_t free_func);
+
+/** Takes a snapshot of the persistent map.
+ *
+ *	The returned handle shares all the map content with @a map, and must be
+ *	deleted with pmap_delete() too.
+ *
+ *	@return a new handle on the current map version, or NULL if any error.
+ */
+pmap_t pmap_snapshot(pmap_t map);
+
+/** Deletes a persistent map handle.
+ *
+ *	Nodes and keys which aren't used by any other snapshot are freed.
+ *
+ *	@return -1 if an invalid map object was specified, or 0.
+ */
+int pmap_delete(pmap_t map);
+
+/** Returns the number of elements in the map version.
+ */
+int pmap_count(pmap_t map);
+
+/** Finds the real key memory area in the map.
+ *
+ *	@see map_find()
+ */
+void *pmap_find(pmap_t map, void *key);
+
+/** Retrieves the data associated with the key.
+ *
+ *	@see map_get()
+ */
+void *pmap_get(pmap_t map, void *key);
+
+/** Associates the key with the given value in this handle version.
+ *
+ *	@see map_set()
+ */
+int pmap_set(pmap_t map, void *key, void *data, void **olddata);
+
+/** Deletes the key/value pair from this handle version.
+ *
+ *	@see map_unset()
+ */
+int pmap_unset(pmap_t map, void *key, void **olddata);
+
+/** Creates a new iteration object.
+ *
+ *	The iterator works on the map version current at its creation, and is
+ *	not affected by later updates of the handle.
+ */
+pmap_iter_t pmap_iter_new(pmap_t map);
+
+/** Destroys a persistent map iteration object.
+ */
+int pmap_iter_delete(pmap_iter_t iter);
+
+/** Gets the next (or first) key/value pair from the map.
+ *
+ *	Pairs are returned in hash order.
+ *
+ *	@return a positive number if the key/value pair could be retrieved, 0 if
+ *			reached the end of the map.
+ */
+int pmap_iter_next(pmap_iter_t iter, void **key, void **data);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_PMAP_H */
+/* vi:set ts=4 sw=4: */
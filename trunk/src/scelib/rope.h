@@ -0,0 +1,124 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief Ropes.
+ *
+ *	A rope is a string made of chunks held in a balanced tree, for large
+ *	texts edited in place. Inserting or erasing characters anywhere takes a
+ *	logarithmic time, instead of moving the whole tail of the string as the
+ *	str_* functions and string buffers do.
+ *
+ *	The text is read by chunks with rope_chunk(), or as a whole with
+ *	rope_str(): the contiguous string is only built when asked for, and kept
+ *	until the next modification of the rope.
+ */
+#ifndef __SCELIB_ROPE_H
+#define __SCELIB_ROPE_H
+
+#include "defs.h"
+#include <stdlib.h>
+
+SCELIB_BEGIN_CDECL
+
+/** The rope object.
+ */
+typedef struct rope_type *rope_t;
+
+/** Creates a new empty rope.
+ *
+ *	@return a new rope, or NULL if any error.
+ */
+rope_t rope_new(void);
+
+/** Deletes a rope.
+ *
+ *	@return -1 if an invalid rope object was specified, or 0.
+ */
+int rope_delete(rope_t rope);
+
+/** Returns the number of characters of the rope.
+ */
+size_t rope_len(rope_t rope);
+
+/** Inserts characters.
+ *
+ *	@param[in] rope	the rope object
+ *	@param[in] pos	the position of the first inserted character, from 0 to
+ *					rope_len()
+ *	@param[in] str	the characters
+ *	@param[in] len	the number of characters
+ *	@return 0 if ok, -1 if any error (ERANGE if @a pos is out of the rope).
+ */
+int rope_insert(rope_t rope, size_t pos, const char *str, size_t len);
+
+/** Appends characters.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int rope_append(rope_t rope, const char *str, size_t len);
+
+/** Removes characters.
+ *
+ *	@return 0 if ok, -1 if any error (ERANGE if the characters are out of
+ *			the rope).
+ */
+int rope_erase(rope_t rope, size_t pos, size_t count);
+
+/** Gives the chunk holding a character, to read the rope without copy.
+ *
+ *	The whole rope is read with:
+ *	@code
+ *	for (pos = 0; (chunk = rope_chunk(rope, pos, &len)); pos += len)
+ *		...
+ *	@endcode
+ *
+ *	@param[in] rope	the rope object
+ *	@param[in] pos	the position of the character
+ *	@param[out] len	back pointer to the number of characters from @a pos to
+ *					the end of the chunk
+ *	@return a pointer to the character, valid until the rope is modified, or
+ *			NULL at the end of the rope or if any error.
+ */
+const char *rope_chunk(rope_t rope, size_t pos, size_t *len);
+
+/** Copies characters out of the rope.
+ *
+ *	@param[in] rope		the rope object
+ *	@param[in] pos		the position of the first copied character
+ *	@param[in] count	the number of characters
+ *	@param[out] dest	where to copy the characters, which aren't nul
+ *						terminated
+ *	@return the number of copied characters, less than @a count at the end
+ *			of the rope.
+ */
+size_t rope_copy(rope_t rope, size_t pos, size_t count, char *dest);
+
+/** Returns the whole text of the rope as a nul terminated string.
+ *
+ *	The string is built on the first call, and given back by the next ones
+ *	until the rope is modified.
+ *
+ *	@return the string, valid until the rope is modified, or NULL if any
+ *			error.
+ */
+const char *rope_str(rope_t rope);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_ROPE_H */
+/* vi:set ts=4 sw=4: */
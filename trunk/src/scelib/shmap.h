@@ -0,0 +1,161 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief Shared memory map.
+ *
+ *	A shared map is a hash map living in a named shared memory segment, so
+ *	several processes can attach it: one process fills it, and the others
+ *	read it without having to build their own copy.
+ *
+ *	As the segment isn't mapped at the same address in each process, the map
+ *	doesn't store pointers but offsets from the segment start, and keys and
+ *	values are copied into the segment. Writers are serialized by a process
+ *	shared lock stored in the segment, while readers never lock: records are
+ *	only published once fully written, and their memory is never reused.
+ *	The lock is robust: if a writer dies while holding it, the next writer
+ *	recovers it: the deleted flags and the count are rebuilt from the
+ *	buckets, so the key being written keeps either its old or its new value.
+ *	That's also why removing or replacing a key doesn't give back its space,
+ *	so you should size the segment for the whole life of the map.
+ *
+ *	The hash and comparaison functions can't be stored in the segment, so
+ *	each process gives them when attaching the map, and they must be the
+ *	same for all processes. Shared maps are only available on Unix platforms
+ *	(programs may need to be linked with the realtime library, -lrt).
+ */
+#ifndef __SCELIB_SHMAP_H
+#define __SCELIB_SHMAP_H
+
+#include "defs.h"
+#include "map.h"
+#include <stdlib.h>
+
+SCELIB_BEGIN_CDECL
+
+/** Shared map flags enumeration.
+ *
+ *	These flags control how shmap_open() accesses the segment.
+ */
+enum shmap_flags
+{
+	/** Creates the named segment, which must not exist yet.
+	 */
+	SHMAP_CREATE	= 0x0001,
+
+	/** Attaches the segment for reading only. Such a map can't be modified.
+	 */
+	SHMAP_RDONLY	= 0x0002
+};
+
+/** The shared map object.
+ *
+ *	This is the per process handle to a shared map segment.
+ */
+typedef struct shmap_type *shmap_t;
+
+/** Creates or attaches a shared map.
+ *
+ *	@param[in] name			name of the shared memory segment, which should
+ *							start with a '/'
+ *	@param[in] flags		a combination of @ref shmap_flags
+ *	@param[in] bytes		size of the segment to create. Ignored when
+ *							attaching an existing segment
+ *	@param[in] size			number of hash buckets of the map to create, or
+ *							MAP_SIZE_AUTO. Ignored when attaching
+ *	@param[in] hash_func	hash function, see map_hash_t
+ *	@param[in] comp_func	comparaison function, see map_comp_t
+ *	@return the shared map handle, or NULL if any error (see errno). ENOSPC
+ *			is reported if @a bytes is too small for the map table, EBADF
+ *			if the segment isn't a shared map one.
+ */
+shmap_t shmap_open(const char *name, int flags, size_t bytes, int size,
+				   map_hash_t hash_func, map_comp_t comp_func);
+
+/** Detaches the shared map from the current process.
+ *
+ *	The segment itself stays available to other processes until it is
+ *	@ref shmap_unlink() "unlinked" and detached by all of them.
+ *
+ *	@return 0 if ok, -1 if an invalid map object was specified.
+ */
+int shmap_close(shmap_t map);
+
+/** Removes the shared map segment name.
+ *
+ *	@return 0 if ok, -1 if any error (see errno).
+ */
+int shmap_unlink(const char *name);
+
+/** Returns the number of elements in the shared map.
+ *
+ *	@return the item count, or -1 if an invalid map object was specified.
+ */
+int shmap_count(shmap_t map);
+
+/** Returns the number of bytes still free in the segment.
+ */
+size_t shmap_avail(shmap_t map);
+
+/** Retrieves the data associated with the key.
+ *
+ *	@param[in] map	the shared map object
+ *	@param[in] key	the key to find
+ *	@param[out] len	back pointer to the data length, or NULL
+ *	@return a pointer to the data copy in the segment, or NULL if not found.
+ */
+void *shmap_get(shmap_t map, void *key, size_t *len);
+
+/** Associates a copy of the key with a copy of the given data.
+ *
+ *	@param[in] map		the shared map object
+ *	@param[in] key		the key to create or modify
+ *	@param[in] keylen	number of bytes to copy from @a key (including the
+ *						trailing '\\0' for a string)
+ *	@param[in] data		the data to copy
+ *	@param[in] datalen	number of bytes to copy from @a data
+ *	@return the new item count, or -1 if any error (ENOSPC if the segment
+ *			is full, EPERM if the map is read only).
+ */
+int shmap_set(shmap_t map, void *key, size_t keylen, void *data,
+			  size_t datalen);
+
+/** Deletes the key/value pair from the shared map.
+ *
+ *	@return the new item count, or -1 if any error (ERANGE if not found).
+ */
+int shmap_unset(shmap_t map, void *key);
+
+/** Gets the next (or first) key/value pair from the shared map.
+ *
+ *	Pairs are returned in the order they were written to the segment. The
+ *	cursor must be set to 0 before the first call.
+ *
+ *	@param[in] map			the shared map object
+ *	@param[in,out] cursor	iteration position
+ *	@param[out] key			the next key in the map
+ *	@param[out] data		the value associated with the key
+ *	@param[out] len			the value length
+ *	@return 1 if a key/value pair was retrieved, 0 at the end of the map.
+ */
+int shmap_iter_next(shmap_t map, size_t *cursor, void **key, void **data,
+					size_t *len);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_SHMAP_H */
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,193 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief Frequency and cardinality sketches.
+ *
+ *	Sketches answer approximately the questions a map is often only filled
+ *	for, in a fixed amount of memory whatever the number of distinct keys:
+ *	- a Count-Min sketch estimates how many times each key was counted, and
+ *	  keeps the most frequent keys (the heavy hitters) in a small heap;
+ *	- a HyperLogLog estimates how many distinct keys were added.
+ *
+ *	Both use the map_hash_t functions of the keys, called with
+ *	@ref MAP_HASH_MAX as size, and can be saved to a portable buffer, loaded
+ *	back, and merged with sketches of the same dimensions (built by other
+ *	processes for example).
+ */
+#ifndef __SCELIB_SKETCH_H
+#define __SCELIB_SKETCH_H
+
+#include "defs.h"
+#include "map.h"
+#include <stdlib.h>
+
+SCELIB_BEGIN_CDECL
+
+/** The Count-Min sketch object.
+ */
+typedef struct cms_type *cms_t;
+
+/** Heavy hitter returned by cms_top().
+ */
+typedef struct cms_entry_type
+{
+	void *key;		/**< the key, as stored in the sketch */
+	long count;		/**< its estimated count */
+} cms_entry_t;
+
+/** Creates a new Count-Min sketch.
+ *
+ *	The estimated counts exceed the real ones by at most @a epsilon times
+ *	the total count, with a probability of 1 - @a delta. The sketch takes
+ *	about e / @a epsilon * ln(1 / @a delta) counters.
+ *
+ *	@param[in] epsilon		relative error, 0.01 for example
+ *	@param[in] delta		error probability, 0.01 for example
+ *	@param[in] topk			number of heavy hitters to keep, 0 for none
+ *	@param[in] hash_func	hash function, see map_hash_t
+ *	@param[in] comp_func	comparaison function of the heavy hitters keys
+ *	@param[in] alloc_func	heavy hitters keys duplication function, or NULL
+ *	@param[in] free_func	heavy hitters keys free function, or NULL
+ *	@return a new sketch, or NULL if any error.
+ */
+cms_t cms_new(double epsilon, double delta, int topk, map_hash_t hash_func,
+			  map_comp_t comp_func, map_alloc_t alloc_func,
+			  map_free_t free_func);
+
+/** Destroys a Count-Min sketch.
+ *
+ *	@return -1 if an invalid sketch object was specified, or 0.
+ */
+int cms_delete(cms_t cms);
+
+/** Counts a key.
+ *
+ *	@param[in] cms		the sketch object
+ *	@param[in] key		the key to count
+ *	@param[in] count	the number of occurrences to add
+ *	@return the new estimated count of the key, or -1 if any error.
+ */
+long cms_add(cms_t cms, void *key, long count);
+
+/** Returns the estimated count of a key.
+ */
+long cms_estimate(cms_t cms, void *key);
+
+/** Returns the total count of the sketch.
+ */
+long cms_total(cms_t cms);
+
+/** Gets the heavy hitters, the most frequent first.
+ *
+ *	@param[in] cms		the sketch object
+ *	@param[out] entries	array receiving the heavy hitters
+ *	@param[in] n		size of the array
+ *	@return the number of heavy hitters written to @a entries.
+ */
+int cms_top(cms_t cms, cms_entry_t *entries, int n);
+
+/** Adds the counts of a sketch to another one.
+ *
+ *	Both sketches must have the same dimensions. The heavy hitters of both
+ *	are estimated again in the merged sketch, and the heaviest ones kept.
+ *
+ *	@return 0 if ok, -1 if any error (EINVAL if dimensions differ).
+ */
+int cms_merge(cms_t dst, cms_t src);
+
+/** Saves the sketch counters to a buffer.
+ *
+ *	The heavy hitters keys, which are opaque to the sketch, aren't saved.
+ *
+ *	@param[in] cms	the sketch object
+ *	@param[out] len	back pointer to the buffer length
+ *	@return a buffer to be freed with free(), or NULL if any error.
+ */
+void *cms_save(cms_t cms, size_t *len);
+
+/** Creates a sketch from a buffer made by cms_save().
+ *
+ *	As the heavy hitters aren't saved, the heap of the loaded sketch starts
+ *	empty: cms_top() only returns the keys counted (or merged from another
+ *	sketch) after the load, with their estimates including the saved counts.
+ *
+ *	@return a new sketch, or NULL if any error (EBADF if the buffer isn't a
+ *			valid sketch).
+ */
+cms_t cms_load(const void *buf, size_t len, int topk, map_hash_t hash_func,
+			   map_comp_t comp_func, map_alloc_t alloc_func,
+			   map_free_t free_func);
+
+/** The HyperLogLog sketch object.
+ */
+typedef struct hll_type *hll_t;
+
+/** Creates a new HyperLogLog sketch.
+ *
+ *	The sketch uses 2^@a precision registers, for a standard error of
+ *	1.04 / sqrt(2^@a precision): 0.81% with a precision of 14, using 16 KB.
+ *	It starts with a sparse representation, only storing the registers set,
+ *	and switches to the dense one when it would take less memory.
+ *
+ *	@param[in] precision	4 to 16
+ *	@param[in] hash_func	hash function, see map_hash_t
+ *	@return a new sketch, or NULL if any error.
+ */
+hll_t hll_new(int precision, map_hash_t hash_func);
+
+/** Destroys a HyperLogLog sketch.
+ *
+ *	@return -1 if an invalid sketch object was specified, or 0.
+ */
+int hll_delete(hll_t hll);
+
+/** Adds a key to the sketch.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int hll_add(hll_t hll, void *key);
+
+/** Returns the estimated number of distinct keys added.
+ */
+double hll_count(hll_t hll);
+
+/** Adds the keys of a sketch to another one, of the same precision.
+ *
+ *	@return 0 if ok, -1 if any error (EINVAL if precisions differ).
+ */
+int hll_merge(hll_t dst, hll_t src);
+
+/** Saves the sketch to a buffer.
+ *
+ *	@param[in] hll	the sketch object
+ *	@param[out] len	back pointer to the buffer length
+ *	@return a buffer to be freed with free(), or NULL if any error.
+ */
+void *hll_save(hll_t hll, size_t *len);
+
+/** Creates a sketch from a buffer made by hll_save().
+ *
+ *	@return a new sketch, or NULL if any error (EBADF if the buffer isn't a
+ *			valid sketch).
+ */
+hll_t hll_load(const void *buf, size_t len, map_hash_t hash_func);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_SKETCH_H */
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,133 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief Disk spilling map.
+ *
+ *	A spilling map is a map limited to a memory budget. Its keys are hash
+ *	partitioned, and when the memory used by the map goes over the budget,
+ *	the least recently used partitions are written to files in a spill
+ *	directory, and freed. Accessing a spilled partition maps its file back
+ *	in memory (spilling other ones if needed), so a map with more keys than
+ *	the memory can hold keeps working, only slower.
+ *
+ *	As partitions are written to files, keys and values are copied in the
+ *	map, and the pointers given back by the map are only valid until the
+ *	next call on the same map object.
+ */
+#ifndef __SCELIB_SMAP_H
+#define __SCELIB_SMAP_H
+
+#include "defs.h"
+#include "map.h"
+#include <stdlib.h>
+
+SCELIB_BEGIN_CDECL
+
+/** The spilling map object.
+ */
+typedef struct smap_type *smap_t;
+
+/** Object to iterate in a spilling map.
+ */
+typedef struct smap_iter_type *smap_iter_t;
+
+/** Creates a new spilling map.
+ *
+ *	@param[in] dir			directory where partitions are spilled
+ *	@param[in] budget		memory budget of the map, in bytes
+ *	@param[in] nparts		number of partitions, 0 for a default one. The
+ *							budget should hold several partitions
+ *	@param[in] hash_func	hash function, see map_hash_t
+ *	@param[in] comp_func	comparaison function, see map_comp_t
+ *	@return a new spilling map, or NULL if any error (see errno).
+ */
+smap_t smap_new(const char *dir, size_t budget, int nparts,
+				map_hash_t hash_func, map_comp_t comp_func);
+
+/** Destroys the spilling map, and removes its spill files.
+ *
+ *	@return -1 if an invalid map object was specified, or 0.
+ */
+int smap_delete(smap_t map);
+
+/** Returns the number of elements in the map.
+ */
+int smap_count(smap_t map);
+
+/** Returns the number of bytes the map actually holds in memory.
+ */
+size_t smap_resident(smap_t map);
+
+/** Retrieves the data associated with the key.
+ *
+ *	@param[in] map	the spilling map object
+ *	@param[in] key	the key to find
+ *	@param[out] len	back pointer to the data length, or NULL
+ *	@return a pointer to the map copy of the data, valid until the next call
+ *			on the map, or NULL if not found or any error.
+ */
+void *smap_get(smap_t map, void *key, size_t *len);
+
+/** Associates a copy of the key with a copy of the given data.
+ *
+ *	@param[in] map		the spilling map object
+ *	@param[in] key		the key to create or modify
+ *	@param[in] keylen	number of bytes to copy from @a key
+ *	@param[in] data		the data to copy
+ *	@param[in] datalen	number of bytes to copy from @a data
+ *	@return the new item count, or -1 if any error.
+ */
+int smap_set(smap_t map, void *key, size_t keylen, void *data,
+			 size_t datalen);
+
+/** Deletes the key/value pair from the map.
+ *
+ *	@return the new item count, or -1 if any error (ERANGE if not found).
+ */
+int smap_unset(smap_t map, void *key);
+
+/** Writes all partitions to the spill directory, and frees them.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int smap_spill(smap_t map);
+
+/** Creates a new iteration object.
+ *
+ *	The map is iterated partition by partition, each one being loaded in
+ *	turn. The map must not be modified during the iteration, smap_spill()
+ *	included, but can be read with smap_get(): the partition being iterated
+ *	is then never spilled to make room for another one.
+ */
+smap_iter_t smap_iter_new(smap_t map);
+
+/** Destroys a spilling map iteration object.
+ */
+int smap_iter_delete(smap_iter_t iter);
+
+/** Gets the next (or first) key/value pair from the map.
+ *
+ *	@return a positive number if the key/value pair could be retrieved, 0 if
+ *			reached the end of the map or any error.
+ */
+int smap_iter_next(smap_iter_t iter, void **key, void **data, size_t *len);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_SMAP_H */
+/* vi:set ts=4 sw=4: */
@@ -27,6 +27,9 @@
 
 SCELIB_BEGIN_CDECL
 
+/* The strings are allocated with mem_allocator_std whatever the allocator
+ * set, so that they can be given to free().
+ */
 char *str_dup(const char *str);
 char *str_set(char **dest, size_t *dlen, const char *fmt, ...);
 char *str_vset(char **dest, size_t *dlen, const char *fmt, va_list ap);
@@ -0,0 +1,164 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief String buffers.
+ *
+ *	A string buffer holds a nul terminated string along with its length and
+ *	the size allocated for it. Its capacity grows geometrically, so that
+ *	building a string piece by piece takes a linear time and a logarithmic
+ *	number of reallocations, where the str_* functions compute the length
+ *	and reallocate the string at each call.
+ *
+ *	The string is allocated as the str_* ones, and moves from a plain
+ *	@c char @c * to a buffer and back without being copied (see
+ *	strbuf_from() and strbuf_detach()), so that code can switch to buffers
+ *	a function at a time.
+ */
+#ifndef __SCELIB_STRBUF_H
+#define __SCELIB_STRBUF_H
+
+#include "defs.h"
+#include <stdarg.h>
+#include <stdlib.h>
+
+SCELIB_BEGIN_CDECL
+
+/** The string buffer object.
+ */
+typedef struct strbuf_type *strbuf_t;
+
+/** Creates a new empty string buffer.
+ *
+ *	@param[in] capacity	the string length to allocate room for, or 0
+ *	@return a new buffer, or NULL if any error.
+ */
+strbuf_t strbuf_new(size_t capacity);
+
+/** Creates a string buffer holding a string, which isn't copied.
+ *
+ *	@param[in] str	a string allocated like the str_* ones (by str_dup() or
+ *					strbuf_detach() for instance), now owned by the buffer,
+ *					or NULL for an empty buffer
+ *	@return a new buffer, or NULL if any error (the string isn't freed).
+ */
+strbuf_t strbuf_from(char *str);
+
+/** Deletes a string buffer and its string.
+ *
+ *	@return -1 if an invalid buffer object was specified, or 0.
+ */
+int strbuf_delete(strbuf_t sb);
+
+/** Deletes a string buffer, giving its string back.
+ *
+ *	The string isn't copied, and can be used with the str_* functions.
+ *
+ *	@return the string, freed as the str_dup() ones, or NULL if any
+ *			error.
+ */
+char *strbuf_detach(strbuf_t sb);
+
+/** Returns the string of the buffer, valid until the buffer is modified.
+ */
+const char *strbuf_str(strbuf_t sb);
+
+/** Returns the length of the string.
+ */
+size_t strbuf_len(strbuf_t sb);
+
+/** Returns the string length the buffer can hold without reallocation.
+ */
+size_t strbuf_capacity(strbuf_t sb);
+
+/** Allocates room for a string length.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int strbuf_reserve(strbuf_t sb, size_t capacity);
+
+/** Appends a string.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int strbuf_append(strbuf_t sb, const char *str);
+
+/** Appends the @a len first characters of a string.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int strbuf_append_len(strbuf_t sb, const char *str, size_t len);
+
+/** Appends a character.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int strbuf_append_char(strbuf_t sb, char c);
+
+/** Appends a formatted string, see str_set().
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int strbuf_printf(strbuf_t sb, const char *fmt, ...);
+
+/** Appends a formatted string, see str_vset().
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int strbuf_vprintf(strbuf_t sb, const char *fmt, va_list ap);
+
+/** Inserts characters.
+ *
+ *	@param[in] sb	the buffer object
+ *	@param[in] pos	the position of the first inserted character, from 0 to
+ *					strbuf_len()
+ *	@param[in] str	the characters, which may be in the buffer
+ *	@param[in] len	the number of characters
+ *	@return 0 if ok, -1 if any error (ERANGE if @a pos is out of the string).
+ */
+int strbuf_insert(strbuf_t sb, size_t pos, const char *str, size_t len);
+
+/** Removes characters.
+ *
+ *	@return 0 if ok, -1 if any error (ERANGE if the characters are out of
+ *			the string).
+ */
+int strbuf_erase(strbuf_t sb, size_t pos, size_t count);
+
+/** Replaces characters by others, which may be in the buffer.
+ *
+ *	@param[in] sb		the buffer object
+ *	@param[in] pos		the position of the first replaced character
+ *	@param[in] count	the number of replaced characters
+ *	@param[in] str		the new characters
+ *	@param[in] len		the number of new characters
+ *	@return 0 if ok, -1 if any error (ERANGE if the replaced characters are
+ *			out of the string).
+ */
+int strbuf_replace(strbuf_t sb, size_t pos, size_t count, const char *str,
+				   size_t len);
+
+/** Empties the string, keeping the capacity.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int strbuf_clear(strbuf_t sb);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_STRBUF_H */
+/* vi:set ts=4 sw=4: */
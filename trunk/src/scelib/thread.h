@@ -51,6 +51,13 @@ typedef struct lock_type *lock_t;
  */
 typedef struct thread_type *thread_t;
 
+/** Thread local storage key.
+ *
+ *	Unlike thread_data_set(), which gives a single slot to each thread, a
+ *	thread local storage key gives each thread its own slot for a given use.
+ */
+typedef struct tls_type *tls_t;
+
 /** User defined thread routine.
  *
  *	This function pointer prototype is how your thread routine function must
@@ -80,6 +87,19 @@ void thread_lock_new(lock_t lock);
  */
 void thread_lock_delete(lock_t lock);
 
+/** Allocates and initializes a new locker.
+ *
+ *	As lock_t is an opaque type, this is the way to get a locking variable
+ *	without knowing its size. It must be freed with thread_lock_destroy().
+ *
+ *	@return a new locker, or NULL if any error.
+ */
+lock_t thread_lock_create(void);
+
+/** Deletes and frees a locker allocated by thread_lock_create().
+ */
+void thread_lock_destroy(lock_t lock);
+
 /** Locks the scoped portion of code.
  *
  *	If the locking variable is already locked, this will wait for the other
@@ -122,6 +142,33 @@ void thread_data_set(void *data);
  */
 void *thread_data_get(void);
 
+/** Creates a new thread local storage key.
+ *
+ *	@param[in] destructor	function called with the thread value when a
+ *							thread having set a non null one exits, or NULL.
+ *							It's only called on Unix platforms
+ *	@return a new key, or NULL if any error.
+ */
+tls_t thread_tls_new(void (*destructor)(void *data));
+
+/** Deletes a thread local storage key.
+ *
+ *	The destructor isn't called for the values still stored with the key.
+ */
+void thread_tls_delete(tls_t tls);
+
+/** Stores a data in the calling thread slot of the key.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int thread_tls_set(tls_t tls, void *data);
+
+/** Gets the data stored in the calling thread slot of the key.
+ *
+ *	@return the stored data, or NULL if none was stored by this thread.
+ */
+void *thread_tls_get(tls_t tls);
+
 /** Creates a suspended thread with the given routine.
  *
  *	Call this function to create a new thread of execution. The thread is
@@ -162,6 +209,13 @@ void thread_detach(thread_t t);
  */
 void thread_yield(void);
 
+/** Returns the number of processors online, at least 1.
+ *
+ *	This is the number of elements of per processor arrays, see
+ *	mem_lines_new().
+ */
+int thread_cpu_count(void);
+
 /** Makes the current thread sleeping during seconds.
  *
  *	As the number is a floating point value, it can be defined as little as
@@ -178,6 +232,28 @@ void thread_sleep(double seconds);
  */
 void thread_exit(int retval);
 
+/** Atomically adds a value to an integer.
+ *
+ *	The read, addition and write of the integer are done as a single
+ *	operation, with a full memory barrier, so several threads can update a
+ *	shared counter without any lock.
+ *
+ *	@param[in] ptr		the integer to update
+ *	@param[in] value	the value to add (negative to substract)
+ *	@return the new value of the integer.
+ */
+int thread_atomic_add(volatile int *ptr, int value);
+
+/** Atomically replaces an integer value if it equals an expected one.
+ *
+ *	@param[in] ptr		the integer to update
+ *	@param[in] oldval	the expected value
+ *	@param[in] newval	the new value to store if the integer equals
+ *						@a oldval
+ *	@return 1 if the value was replaced, 0 otherwise.
+ */
+int thread_atomic_cas(volatile int *ptr, int oldval, int newval);
+
 SCELIB_END_CDECL
 
 #endif /* __SCELIB_THREAD_H */
@@ -0,0 +1,161 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+/** @file
+ *	@brief Dynamic arrays.
+ *
+ *	A vector is an array of elements of a single size, which grows as
+ *	elements are added. Its capacity is doubled when full, so that appending
+ *	an element takes a constant time on average, instead of a reallocation
+ *	each time.
+ *
+ *	The elements are stored contiguously, and vec_data() can be used as a
+ *	plain C array, until the vector is modified. Vectors take their memory
+ *	from an allocator, which can take it from an arena (see
+ *	mem_arena_allocator()): the old arrays are then only freed with the
+ *	arena.
+ */
+#ifndef __SCELIB_VEC_H
+#define __SCELIB_VEC_H
+
+#include "defs.h"
+#include "memory.h"
+
+SCELIB_BEGIN_CDECL
+
+/** The vector object.
+ */
+typedef struct vec_type *vec_t;
+
+/** Creates a new vector.
+ *
+ *	@param[in] elsize	the size of the elements
+ *	@param[in] capacity	the number of elements to allocate room for, or 0
+ *	@return a new vector, or NULL if any error.
+ */
+vec_t vec_new(size_t elsize, int capacity);
+
+/** Creates a new vector, taking its memory from an allocator.
+ *
+ *	@param[in] allocator	the allocator, or NULL to use the one returned by
+ *							mem_allocator_get()
+ *	@see vec_new()
+ */
+vec_t vec_new_ex(size_t elsize, int capacity, const mem_allocator_t *allocator);
+
+/** Deletes a vector.
+ *
+ *	@return -1 if an invalid vector object was specified, or 0.
+ */
+int vec_delete(vec_t vec);
+
+/** Returns the number of elements of the vector.
+ */
+int vec_count(vec_t vec);
+
+/** Returns the number of elements the vector can hold without reallocation.
+ */
+int vec_capacity(vec_t vec);
+
+/** Returns the array of the elements, or NULL if the vector never had any
+ *	element.
+ */
+void *vec_data(vec_t vec);
+
+/** Returns an element.
+ *
+ *	@return a pointer to the element @a index, or NULL if it doesn't exist
+ *			(errno is then ERANGE).
+ */
+void *vec_at(vec_t vec, int index);
+
+/** Typed version of vec_at().
+ */
+#define vec_get(type, vec, index) \
+	((type *) vec_at((vec), (index)))
+
+/** Allocates room for a number of elements.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int vec_reserve(vec_t vec, int capacity);
+
+/** Reduces the capacity to the number of elements.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int vec_shrink(vec_t vec);
+
+/** Appends an element.
+ *
+ *	@param[in] vec	the vector object
+ *	@param[in] elem	the element to copy, or NULL for a zeroed element
+ *	@return the new number of elements, or -1 if any error.
+ */
+int vec_push(vec_t vec, const void *elem);
+
+/** Removes the last element.
+ *
+ *	@param[in] vec	the vector object
+ *	@param[out] elem	where to copy the element, or NULL
+ *	@return the new number of elements, or -1 if any error (ERANGE if the
+ *			vector is empty).
+ */
+int vec_pop(vec_t vec, void *elem);
+
+/** Appends several elements.
+ *
+ *	@param[in] vec		the vector object
+ *	@param[in] elems	the elements to copy, or NULL for zeroed elements
+ *	@param[in] n		the number of elements
+ *	@return the new number of elements, or -1 if any error.
+ */
+int vec_append(vec_t vec, const void *elems, int n);
+
+/** Inserts several elements.
+ *
+ *	@param[in] vec		the vector object
+ *	@param[in] index	the position of the first inserted element, from 0
+ *						to vec_count()
+ *	@param[in] elems	the elements to copy, which may be in the vector, or
+ *						NULL for zeroed elements
+ *	@param[in] n		the number of elements
+ *	@return the new number of elements, or -1 if any error (ERANGE if
+ *			@a index is out of the vector).
+ */
+int vec_insert(vec_t vec, int index, const void *elems, int n);
+
+/** Removes several elements.
+ *
+ *	@param[in] vec		the vector object
+ *	@param[in] index	the position of the first removed element
+ *	@param[in] n		the number of elements
+ *	@return the new number of elements, or -1 if any error (ERANGE if the
+ *			elements are out of the vector).
+ */
+int vec_erase(vec_t vec, int index, int n);
+
+/** Removes all the elements, keeping the capacity.
+ *
+ *	@return 0 if ok, -1 if any error.
+ */
+int vec_clear(vec_t vec);
+
+SCELIB_END_CDECL
+
+#endif /* __SCELIB_VEC_H */
+/* vi:set ts=4 sw=4: */
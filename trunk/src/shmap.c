@@ -0,0 +1,512 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  shmap.c - shared memory map functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#define _XOPEN_SOURCE 700		/* shm_open() and process shared robust mutexes */
+
+#include "scelib/shmap.h"
+#include "scelib/memory.h"
+#include "scelib/platform.h"
+#if PLATFORM_IS(UNIX)
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+
+/* ========================================================================= */
+/* Constants and macros used in this module                                  */
+
+#define SHM_MAGIC			0x53434D50	/* 'SCMP' */
+#define SHM_VERSION			2	/* 2: robust writers lock */
+#define SHM_DEFAULT_SIZE	1601
+
+/* every structure in the segment is aligned on 16 bytes */
+#define SHM_ALIGN(n)		(((n) + 15) & ~((size_t) 15))
+
+/* offset to pointer conversion, 0 being the null offset */
+#define SHM_PTR(map, off)	((void *) ((char *) (map)->hdr + (off)))
+
+#define REC_KEY(rec)		((char *) (rec) + SHM_ALIGN(sizeof(shm_record_t)))
+#define REC_DATA(rec)		(REC_KEY(rec) + SHM_ALIGN((rec)->keylen))
+#define REC_SIZE(klen, dlen) \
+	(SHM_ALIGN(sizeof(shm_record_t)) + SHM_ALIGN(klen) + SHM_ALIGN(dlen))
+
+/* readers don't lock, so records must be fully written before published */
+#if defined(__GNUC__)
+#define SHM_BARRIER()		__sync_synchronize()
+#else
+#define SHM_BARRIER()
+#endif
+
+
+
+#if PLATFORM_IS(UNIX)
+
+/* ========================================================================= */
+/* internal types                                                            */
+
+/* ------------------------------------------------------------------------- */
+/* segment header, followed by the buckets table of 'size' offsets           */
+typedef struct shm_header_type
+{
+	unsigned int magic;
+	unsigned int version;
+	pthread_mutex_t lock;	/* serializes writers */
+	size_t bytes;			/* whole segment size */
+	size_t first;			/* offset of the first record */
+	size_t top;				/* offset of the first free byte */
+	int size;
+	int count;
+} shm_header_t;
+
+/* ------------------------------------------------------------------------- */
+/* key/value record, followed by the key and data bytes                      */
+typedef struct shm_record_type
+{
+	size_t next;			/* next record offset in the bucket */
+	size_t keylen;
+	size_t datalen;
+	int hash;
+	int deleted;
+} shm_record_t;
+
+/* ------------------------------------------------------------------------- */
+/* used as shmap_t                                                           */
+struct shmap_type
+{
+	shm_header_t *hdr;
+	size_t *buckets;
+	size_t bytes;
+	int flags;
+	map_hash_t hashf;
+	map_comp_t compf;
+};
+
+
+
+/* ========================================================================= */
+/* static functions definitions                                              */
+
+/* ------------------------------------------------------------------------- */
+static int shmap_hash(shmap_t map, void *key)
+{
+	int h = map->hashf(MAP_HASH_MAX, key);
+	return (h < 0 ? -(h + 1) : h);
+}
+
+/* ------------------------------------------------------------------------- */
+/* returns the link referring to the key record, or the null ending link of  */
+/* the bucket if not found                                                   */
+static size_t *shmap_find_link(shmap_t map, int hash, void *key)
+{
+	size_t *link;
+	shm_record_t *rec;
+
+	link = map->buckets + (hash % map->hdr->size);
+	while (*link)
+	{
+		rec = (shm_record_t *) SHM_PTR(map, *link);
+		if (rec->hash == hash && !map->compf(key, REC_KEY(rec)))
+			break;
+		link = &rec->next;
+	}
+	return link;
+}
+
+/* ------------------------------------------------------------------------- */
+/* takes the writers lock. If its owner died, it may have left a record     */
+/* written but not linked, or replaced or unlinked but not flagged deleted:  */
+/* the deleted flags and the count are rebuilt from what the buckets link,   */
+/* and at worst the space of a record is lost                                */
+static int shmap_lock(shmap_t map)
+{
+	shm_header_t *hdr = map->hdr;
+	shm_record_t *rec;
+	size_t off, link;
+	int err, count = 0;
+
+	err = pthread_mutex_lock(&hdr->lock);
+	if (err == EOWNERDEAD)
+	{
+		for (off = hdr->first; off < hdr->top;
+			 off += REC_SIZE(rec->keylen, rec->datalen))
+		{
+			rec = (shm_record_t *) SHM_PTR(map, off);
+			for (link = map->buckets[rec->hash % hdr->size]; link && link != off;
+				 link = ((shm_record_t *) SHM_PTR(map, link))->next)
+				;
+			rec->deleted = (link != off);
+			if (!rec->deleted)
+				++ count;
+		}
+		hdr->count = count;
+		err = pthread_mutex_consistent(&hdr->lock);
+	}
+	if (err)
+		return RETERROR(err, -1);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static int shmap_init(shmap_t map, int size)
+{
+	pthread_mutexattr_t attr;
+	shm_header_t *hdr = map->hdr;
+
+	/* the segment was zero filled by ftruncate() */
+	if (pthread_mutexattr_init(&attr))
+		return -1;
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	if (pthread_mutex_init(&hdr->lock, &attr))
+	{
+		pthread_mutexattr_destroy(&attr);
+		return -1;
+	}
+	pthread_mutexattr_destroy(&attr);
+
+	hdr->version = SHM_VERSION;
+	hdr->bytes = map->bytes;
+	hdr->size = size;
+	hdr->count = 0;
+	hdr->first = SHM_ALIGN(sizeof(shm_header_t)) +
+		SHM_ALIGN(size * sizeof(size_t));
+	hdr->top = hdr->first;
+
+	SHM_BARRIER();
+	hdr->magic = SHM_MAGIC;
+	return 0;
+}
+
+#endif	/* UNIX */
+
+
+
+/* ========================================================================= */
+/* public functions                                                          */
+
+/* ------------------------------------------------------------------------- */
+shmap_t shmap_open(const char *name, int flags, size_t bytes, int size,
+				   map_hash_t hash_func, map_comp_t comp_func)
+{
+#if PLATFORM_IS(UNIX)
+	shmap_t map;
+	struct stat st;
+	void *base;
+	int fd;
+
+	if (!name || !hash_func || !comp_func ||
+		((flags & SHMAP_CREATE) && (flags & SHMAP_RDONLY)))
+		return RETERROR(EINVAL, NULL);
+
+	if (flags & SHMAP_CREATE)
+	{
+		if (size == MAP_SIZE_AUTO)
+			size = SHM_DEFAULT_SIZE;
+		else if (size <= 0)
+			return RETERROR(EINVAL, NULL);
+		if (bytes < SHM_ALIGN(sizeof(shm_header_t)) +
+			SHM_ALIGN(size * sizeof(size_t)))
+			return RETERROR(ENOSPC, NULL);
+
+		if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) == -1)
+			return NULL;
+		if (ftruncate(fd, (off_t) bytes) == -1)
+		{
+			SAFEERRNO(close(fd); shm_unlink(name));
+			return NULL;
+		}
+	}
+	else
+	{
+		fd = shm_open(name, (flags & SHMAP_RDONLY) ? O_RDONLY : O_RDWR, 0);
+		if (fd == -1)
+			return NULL;
+		if (fstat(fd, &st) == -1)
+		{
+			SAFEERRNO(close(fd));
+			return NULL;
+		}
+		bytes = (size_t) st.st_size;
+		if (bytes < sizeof(shm_header_t))
+		{
+			close(fd);
+			return RETERROR(EBADF, NULL);
+		}
+	}
+
+	base = mmap(NULL, bytes, PROT_READ |
+		((flags & SHMAP_RDONLY) ? 0 : PROT_WRITE), MAP_SHARED, fd, 0);
+	SAFEERRNO(close(fd));
+	if (base == MAP_FAILED)
+	{
+		if (flags & SHMAP_CREATE)
+			SAFEERRNO(shm_unlink(name));
+		return NULL;
+	}
+
+	if (!(map = (shmap_t) malloc(sizeof(struct shmap_type))))
+	{
+		SAFEERRNO(munmap(base, bytes));
+		return NULL;
+	}
+	map->hdr = (shm_header_t *) base;
+	map->buckets = (size_t *) ((char *) base + SHM_ALIGN(sizeof(shm_header_t)));
+	map->bytes = bytes;
+	map->flags = flags;
+	map->hashf = hash_func;
+	map->compf = comp_func;
+
+	if (flags & SHMAP_CREATE)
+	{
+		if (shmap_init(map, size))
+		{
+			SAFEERRNO(munmap(base, bytes); shm_unlink(name); free(map));
+			return NULL;
+		}
+	}
+	else if (map->hdr->magic != SHM_MAGIC ||
+		map->hdr->version != SHM_VERSION || map->hdr->bytes != bytes)
+	{
+		munmap(base, bytes);
+		free(map);
+		return RETERROR(EBADF, NULL);
+	}
+	return map;
+#else
+	return RETERROR(ENOSYS, NULL);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+int shmap_close(shmap_t map)
+{
+#if PLATFORM_IS(UNIX)
+	if (!map)
+		return RETERROR(EINVAL, -1);
+
+	munmap((void *) map->hdr, map->bytes);
+	free(map);
+	return 0;
+#else
+	return RETERROR(ENOSYS, -1);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+int shmap_unlink(const char *name)
+{
+#if PLATFORM_IS(UNIX)
+	if (!name)
+		return RETERROR(EINVAL, -1);
+	return shm_unlink(name);
+#else
+	return RETERROR(ENOSYS, -1);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+int shmap_count(shmap_t map)
+{
+#if PLATFORM_IS(UNIX)
+	if (!map)
+		return RETERROR(EINVAL, -1);
+	return map->hdr->count;
+#else
+	return RETERROR(ENOSYS, -1);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+size_t shmap_avail(shmap_t map)
+{
+#if PLATFORM_IS(UNIX)
+	if (!map)
+		return RETERROR(EINVAL, 0);
+	return map->bytes - map->hdr->top;
+#else
+	return RETERROR(ENOSYS, 0);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+void *shmap_get(shmap_t map, void *key, size_t *len)
+{
+#if PLATFORM_IS(UNIX)
+	shm_record_t *rec;
+	size_t off;
+	int hash;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, NULL);
+
+	/* lock free: we only follow fully written records */
+	hash = shmap_hash(map, key);
+	off = map->buckets[hash % map->hdr->size];
+	while (off)
+	{
+		rec = (shm_record_t *) SHM_PTR(map, off);
+		if (rec->hash == hash && !map->compf(key, REC_KEY(rec)))
+		{
+			mem_init(len, rec->datalen);
+			return REC_DATA(rec);
+		}
+		off = rec->next;
+	}
+	return NULL;
+#else
+	return RETERROR(ENOSYS, NULL);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+int shmap_set(shmap_t map, void *key, size_t keylen, void *data,
+			  size_t datalen)
+{
+#if PLATFORM_IS(UNIX)
+	shm_header_t *hdr;
+	shm_record_t *rec, *old;
+	size_t *link, off, need;
+	int hash, count;
+
+	if (!map || !key || !keylen || (datalen && !data))
+		return RETERROR(EINVAL, -1);
+	if (map->flags & SHMAP_RDONLY)
+		return RETERROR(EPERM, -1);
+
+	hdr = map->hdr;
+	hash = shmap_hash(map, key);
+	need = REC_SIZE(keylen, datalen);
+
+	if (shmap_lock(map))
+		return -1;
+	if (need > hdr->bytes - hdr->top)
+	{
+		pthread_mutex_unlock(&hdr->lock);
+		return RETERROR(ENOSPC, -1);
+	}
+
+	/* write the new record at the top of the segment */
+	off = hdr->top;
+	rec = (shm_record_t *) SHM_PTR(map, off);
+	link = shmap_find_link(map, hash, key);
+	old = (*link) ? (shm_record_t *) SHM_PTR(map, *link) : NULL;
+	rec->next = (old) ? old->next : 0;
+	rec->keylen = keylen;
+	rec->datalen = datalen;
+	rec->hash = hash;
+	rec->deleted = 0;
+	memcpy(REC_KEY(rec), key, keylen);
+	if (datalen)
+		memcpy(REC_DATA(rec), data, datalen);
+
+	/* and publish it, replacing the old one if any */
+	SHM_BARRIER();
+	hdr->top = off + need;
+	*link = off;
+	if (old)
+		old->deleted = 1;
+	else
+		++ hdr->count;
+	count = hdr->count;
+	pthread_mutex_unlock(&hdr->lock);
+	return count;
+#else
+	return RETERROR(ENOSYS, -1);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+int shmap_unset(shmap_t map, void *key)
+{
+#if PLATFORM_IS(UNIX)
+	shm_record_t *rec;
+	size_t *link;
+	int count;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, -1);
+	if (map->flags & SHMAP_RDONLY)
+		return RETERROR(EPERM, -1);
+
+	if (shmap_lock(map))
+		return -1;
+	link = shmap_find_link(map, shmap_hash(map, key), key);
+	if (!*link)
+	{
+		pthread_mutex_unlock(&map->hdr->lock);
+		return RETERROR(ERANGE, -1);
+	}
+
+	/* readers on this record can still follow its next link */
+	rec = (shm_record_t *) SHM_PTR(map, *link);
+	*link = rec->next;
+	rec->deleted = 1;
+	count = -- map->hdr->count;
+	pthread_mutex_unlock(&map->hdr->lock);
+	return count;
+#else
+	return RETERROR(ENOSYS, -1);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+int shmap_iter_next(shmap_t map, size_t *cursor, void **key, void **data,
+					size_t *len)
+{
+#if PLATFORM_IS(UNIX)
+	shm_record_t *rec;
+	size_t top;
+
+	if (!map || !cursor)
+		return RETERROR(EINVAL, 0);
+
+	if (*cursor == 0)
+		*cursor = map->hdr->first;
+	top = map->hdr->top;
+	SHM_BARRIER();
+
+	/* records are contiguous, in their writing order */
+	while (*cursor < top)
+	{
+		rec = (shm_record_t *) SHM_PTR(map, *cursor);
+		*cursor += REC_SIZE(rec->keylen, rec->datalen);
+		if (!rec->deleted)
+		{
+			mem_init(key, (void *) REC_KEY(rec));
+			mem_init(data, (void *) REC_DATA(rec));
+			mem_init(len, rec->datalen);
+			return 1;
+		}
+	}
+	return 0;
+#else
+	return RETERROR(ENOSYS, 0);
+#endif
+}
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,711 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  sketch.c - frequency and cardinality sketches functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "scelib/sketch.h"
+#include "scelib/memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+
+
+/* ========================================================================= */
+/* Constants and macros used in this module                                  */
+
+#define CMS_MAGIC			0x534B434DUL	/* 'SKCM' */
+#define HLL_MAGIC			0x534B484CUL	/* 'SKHL' */
+#define SKETCH_VERSION		1
+
+#define CMS_HEADER			24
+#define HLL_HEADER			16
+
+#define HLL_MIN_PRECISION	4
+#define HLL_MAX_PRECISION	16
+
+/* sparse registers are stored as their index and rank, sorted by index */
+#define SPARSE(ix, rank)	(((unsigned int) (ix) << 8) | (unsigned int) (rank))
+#define SPARSE_IX(v)		((int) ((v) >> 8))
+#define SPARSE_RANK(v)		((int) ((v) & 0xFF))
+
+/* heap positions are stored as map data, 0 meaning not in the heap */
+#define HEAP_POS(data)		((int) (long) (data) - 1)
+#define HEAP_DATA(pos)		((void *) (long) ((pos) + 1))
+
+
+
+/* ========================================================================= */
+/* internal types                                                            */
+
+/* ------------------------------------------------------------------------- */
+struct cms_type
+{
+	int width;
+	int depth;
+	long total;
+	long *counters;			/* depth rows of width counters */
+	cms_entry_t *heap;		/* min heap of the heavy hitters */
+	int heapsize;
+	int topk;
+	map_t heapmap;			/* heavy hitter key -> heap position */
+	map_hash_t hashf;
+};
+
+/* ------------------------------------------------------------------------- */
+struct hll_type
+{
+	int precision;
+	int m;					/* number of registers */
+	unsigned char *registers;	/* dense registers, NULL while sparse */
+	unsigned int *sparse;
+	int nsparse;
+	int maxsparse;
+	map_hash_t hashf;
+};
+
+
+
+/* ========================================================================= */
+/* common functions                                                          */
+
+/* ------------------------------------------------------------------------- */
+/* spreads the key hash bits (MurmurHash3 finalizer)                         */
+static unsigned int sketch_mix(unsigned int h)
+{
+	h ^= h >> 16;
+	h *= 0x85EBCA6BU;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35U;
+	h ^= h >> 16;
+	return h;
+}
+
+/* ------------------------------------------------------------------------- */
+static unsigned int sketch_hash(map_hash_t hashf, void *key)
+{
+	int h = hashf(MAP_HASH_MAX, key);
+	return sketch_mix((unsigned int) (h < 0 ? -(h + 1) : h));
+}
+
+/* ------------------------------------------------------------------------- */
+/* buffers are little endian, whatever the platform                          */
+static void sketch_put32(unsigned char *p, unsigned long v)
+{
+	p[0] = (unsigned char) v;
+	p[1] = (unsigned char) (v >> 8);
+	p[2] = (unsigned char) (v >> 16);
+	p[3] = (unsigned char) (v >> 24);
+}
+
+static unsigned long sketch_get32(const unsigned char *p)
+{
+	return (unsigned long) p[0] | ((unsigned long) p[1] << 8) |
+		((unsigned long) p[2] << 16) | ((unsigned long) p[3] << 24);
+}
+
+static void sketch_put64(unsigned char *p, long v)
+{
+	unsigned long u = (unsigned long) v;
+
+	sketch_put32(p, u & 0xFFFFFFFFUL);
+	sketch_put32(p + 4, (u >> 16) >> 16);
+}
+
+static long sketch_get64(const unsigned char *p)
+{
+	return (long) (sketch_get32(p) | ((sketch_get32(p + 4) << 16) << 16));
+}
+
+
+
+/* ========================================================================= */
+/* Count-Min sketch heavy hitters heap                                       */
+
+/* ------------------------------------------------------------------------- */
+static void cms_heap_place(cms_t cms, int pos, cms_entry_t *e)
+{
+	cms->heap[pos] = *e;
+	map_set(cms->heapmap, e->key, HEAP_DATA(pos), NULL);
+}
+
+/* ------------------------------------------------------------------------- */
+/* moves the entry at 'pos' to its place in the min heap                     */
+static void cms_heap_fix(cms_t cms, int pos)
+{
+	cms_entry_t e = cms->heap[pos];
+	int child;
+
+	while (pos > 0 && cms->heap[(pos - 1) / 2].count > e.count)
+	{
+		cms_heap_place(cms, pos, cms->heap + (pos - 1) / 2);
+		pos = (pos - 1) / 2;
+	}
+	while ((child = pos * 2 + 1) < cms->heapsize)
+	{
+		if (child + 1 < cms->heapsize &&
+			cms->heap[child + 1].count < cms->heap[child].count)
+			++ child;
+		if (cms->heap[child].count >= e.count)
+			break;
+		cms_heap_place(cms, pos, cms->heap + child);
+		pos = child;
+	}
+	cms_heap_place(cms, pos, &e);
+}
+
+/* ------------------------------------------------------------------------- */
+/* updates the key count in the heap, or inserts it if heavy enough          */
+static int cms_heap_offer(cms_t cms, void *key, long count)
+{
+	void *data;
+	int pos;
+
+	if ((data = map_get(cms->heapmap, key)))
+	{
+		pos = HEAP_POS(data);
+		cms->heap[pos].count = count;
+		cms_heap_fix(cms, pos);
+		return 0;
+	}
+
+	if (cms->heapsize < cms->topk)
+		pos = cms->heapsize++;
+	else if (count > cms->heap[0].count)
+	{
+		pos = 0;
+		map_unset(cms->heapmap, cms->heap[0].key, NULL);
+	}
+	else
+		return 0;
+
+	if (map_set(cms->heapmap, key, HEAP_DATA(pos), NULL) == -1)
+	{
+		/* the heap loses its entry: moves the last one there */
+		if (--cms->heapsize > pos)
+		{
+			cms->heap[pos] = cms->heap[cms->heapsize];
+			cms_heap_fix(cms, pos);
+		}
+		return -1;
+	}
+	cms->heap[pos].key = map_find(cms->heapmap, key);
+	cms->heap[pos].count = count;
+	cms_heap_fix(cms, pos);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static int cms_top_comp(const void *e1, const void *e2)
+{
+	long c1 = ((const cms_entry_t *) e1)->count;
+	long c2 = ((const cms_entry_t *) e2)->count;
+
+	return (c1 < c2 ? 1 : (c1 > c2 ? -1 : 0));
+}
+
+
+
+/* ========================================================================= */
+/* Count-Min sketch                                                          */
+
+/* ------------------------------------------------------------------------- */
+static cms_t cms_alloc(int width, int depth, int topk, map_hash_t hash_func,
+					   map_comp_t comp_func, map_alloc_t alloc_func,
+					   map_free_t free_func)
+{
+	cms_t cms;
+
+	if (!(cms = mem_new(struct cms_type, 1)))
+		return NULL;
+	cms->width = width;
+	cms->depth = depth;
+	cms->topk = topk;
+	cms->hashf = hash_func;
+	if (!(cms->counters = mem_new(long, (size_t) width * depth)) ||
+		(topk && (!(cms->heap = mem_new(cms_entry_t, topk)) ||
+				  !(cms->heapmap = map_new(topk, hash_func, comp_func,
+										   alloc_func, free_func)))))
+	{
+		SAFEERRNO(cms_delete(cms));
+		return NULL;
+	}
+	return cms;
+}
+
+/* ------------------------------------------------------------------------- */
+/* gets the counter of the key in each row, with double hashing              */
+static long cms_update(cms_t cms, void *key, long count)
+{
+	unsigned int h1 = sketch_hash(cms->hashf, key);
+	unsigned int h2 = sketch_mix(h1 ^ 0x9E3779B9U) | 1;
+	long *c, min = 0;
+	int i;
+
+	for (i = 0; i < cms->depth; ++i, h1 += h2)
+	{
+		c = cms->counters + (size_t) i * cms->width + h1 % cms->width;
+		*c += count;
+		if (!i || *c < min)
+			min = *c;
+	}
+	return min;
+}
+
+/* ------------------------------------------------------------------------- */
+cms_t cms_new(double epsilon, double delta, int topk, map_hash_t hash_func,
+			  map_comp_t comp_func, map_alloc_t alloc_func,
+			  map_free_t free_func)
+{
+	if (epsilon <= 0 || epsilon >= 1 || delta <= 0 || delta >= 1 ||
+		topk < 0 || !hash_func || (topk && !comp_func))
+		return RETERROR(EINVAL, NULL);
+
+	return cms_alloc((int) ceil(exp(1.0) / epsilon), (int) ceil(log(1 / delta)),
+					 topk, hash_func, comp_func, alloc_func, free_func);
+}
+
+/* ------------------------------------------------------------------------- */
+int cms_delete(cms_t cms)
+{
+	if (!cms)
+		return RETERROR(EINVAL, -1);
+
+	if (cms->heapmap)
+		map_delete(cms->heapmap);
+	free(cms->heap);
+	free(cms->counters);
+	free(cms);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+long cms_add(cms_t cms, void *key, long count)
+{
+	long estimate;
+
+	if (!cms || !key)
+		return RETERROR(EINVAL, -1);
+
+	estimate = cms_update(cms, key, count);
+	cms->total += count;
+	if (cms->topk && cms_heap_offer(cms, key, estimate))
+		return -1;
+	return estimate;
+}
+
+/* ------------------------------------------------------------------------- */
+long cms_estimate(cms_t cms, void *key)
+{
+	if (!cms || !key)
+		return RETERROR(EINVAL, 0);
+	return cms_update(cms, key, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+long cms_total(cms_t cms)
+{
+	if (!cms)
+		return RETERROR(EINVAL, 0);
+	return cms->total;
+}
+
+/* ------------------------------------------------------------------------- */
+int cms_top(cms_t cms, cms_entry_t *entries, int n)
+{
+	cms_entry_t *sorted;
+
+	if (!cms || !entries || n < 0)
+		return RETERROR(EINVAL, 0);
+
+	if (!cms->heapsize)
+		return 0;
+	if (!(sorted = (cms_entry_t *) mem_scratch_push(cms->heapsize * sizeof(cms_entry_t))))
+		return 0;
+	memcpy(sorted, cms->heap, cms->heapsize * sizeof(cms_entry_t));
+	qsort(sorted, cms->heapsize, sizeof(cms_entry_t), cms_top_comp);
+	if (n > cms->heapsize)
+		n = cms->heapsize;
+	memcpy(entries, sorted, n * sizeof(cms_entry_t));
+	mem_scratch_pop(sorted);
+	return n;
+}
+
+/* ------------------------------------------------------------------------- */
+int cms_merge(cms_t dst, cms_t src)
+{
+	size_t i, n;
+	int pos, ret = 0;
+
+	if (!dst || !src || dst->width != src->width || dst->depth != src->depth)
+		return RETERROR(EINVAL, -1);
+
+	for (i = 0, n = (size_t) dst->width * dst->depth; i < n; ++i)
+		dst->counters[i] += src->counters[i];
+	dst->total += src->total;
+
+	if (dst->topk)
+	{
+		for (pos = 0; pos < dst->heapsize; ++pos)
+			dst->heap[pos].count = cms_update(dst, dst->heap[pos].key, 0);
+		for (pos = dst->heapsize / 2 - 1; pos >= 0; --pos)
+			cms_heap_fix(dst, pos);
+		for (pos = 0; pos < src->heapsize; ++pos)
+		{
+			if (cms_heap_offer(dst, src->heap[pos].key,
+							   cms_update(dst, src->heap[pos].key, 0)))
+				ret = -1;
+		}
+	}
+	return ret;
+}
+
+/* ------------------------------------------------------------------------- */
+void *cms_save(cms_t cms, size_t *len)
+{
+	unsigned char *buf, *p;
+	size_t i, n;
+
+	if (!cms || !len)
+		return RETERROR(EINVAL, NULL);
+
+	n = (size_t) cms->width * cms->depth;
+	if (!(buf = (unsigned char *) malloc(CMS_HEADER + n * 8)))
+		return NULL;
+	sketch_put32(buf, CMS_MAGIC);
+	sketch_put32(buf + 4, SKETCH_VERSION);
+	sketch_put32(buf + 8, cms->width);
+	sketch_put32(buf + 12, cms->depth);
+	sketch_put64(buf + 16, cms->total);
+	for (i = 0, p = buf + CMS_HEADER; i < n; ++i, p += 8)
+		sketch_put64(p, cms->counters[i]);
+
+	*len = CMS_HEADER + n * 8;
+	return buf;
+}
+
+/* ------------------------------------------------------------------------- */
+cms_t cms_load(const void *buf, size_t len, int topk, map_hash_t hash_func,
+			   map_comp_t comp_func, map_alloc_t alloc_func,
+			   map_free_t free_func)
+{
+	const unsigned char *p = (const unsigned char *) buf;
+	unsigned long width, depth;
+	size_t i, n;
+	cms_t cms;
+
+	if (!buf || topk < 0 || !hash_func || (topk && !comp_func))
+		return RETERROR(EINVAL, NULL);
+
+	if (len < CMS_HEADER || sketch_get32(p) != CMS_MAGIC ||
+		sketch_get32(p + 4) != SKETCH_VERSION)
+		return RETERROR(EBADF, NULL);
+	width = sketch_get32(p + 8);
+	depth = sketch_get32(p + 12);
+	if (!width || !depth || width > 0x7FFFFFFFUL || depth > 0x7FFFFFFFUL ||
+		(len - CMS_HEADER) / 8 / width != depth ||
+		(len - CMS_HEADER) % (8 * width))
+		return RETERROR(EBADF, NULL);
+
+	if (!(cms = cms_alloc((int) width, (int) depth, topk, hash_func,
+						  comp_func, alloc_func, free_func)))
+		return NULL;
+	cms->total = sketch_get64(p + 16);
+	for (i = 0, n = width * depth, p += CMS_HEADER; i < n; ++i, p += 8)
+		cms->counters[i] = sketch_get64(p);
+	return cms;
+}
+
+
+
+/* ========================================================================= */
+/* HyperLogLog sketch                                                        */
+
+/* ------------------------------------------------------------------------- */
+static int hll_dense(hll_t hll)
+{
+	int i;
+
+	if (!(hll->registers = mem_new(unsigned char, hll->m)))
+		return -1;
+	for (i = 0; i < hll->nsparse; ++i)
+		hll->registers[SPARSE_IX(hll->sparse[i])] = SPARSE_RANK(hll->sparse[i]);
+	mem_free((void **) &hll->sparse);
+	hll->nsparse = hll->maxsparse = 0;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* raises the register to the rank                                          */
+static int hll_set(hll_t hll, int ix, int rank)
+{
+	int lo, hi, mid;
+
+	if (hll->registers)
+	{
+		if (hll->registers[ix] < rank)
+			hll->registers[ix] = (unsigned char) rank;
+		return 0;
+	}
+
+	for (lo = 0, hi = hll->nsparse; lo < hi; )
+	{
+		mid = (lo + hi) / 2;
+		if (SPARSE_IX(hll->sparse[mid]) < ix)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < hll->nsparse && SPARSE_IX(hll->sparse[lo]) == ix)
+	{
+		if (SPARSE_RANK(hll->sparse[lo]) < rank)
+			hll->sparse[lo] = SPARSE(ix, rank);
+		return 0;
+	}
+
+	/* the dense registers take less memory from a quarter of them set */
+	if (hll->nsparse >= hll->m / 4)
+	{
+		if (hll_dense(hll))
+			return -1;
+		return hll_set(hll, ix, rank);
+	}
+	if (hll->nsparse == hll->maxsparse)
+	{
+		int max = (hll->maxsparse ? hll->maxsparse * 2 : 16);
+		unsigned int *sparse;
+
+		if (!(sparse = (unsigned int *) realloc(hll->sparse, max * sizeof(unsigned int))))
+			return -1;
+		hll->sparse = sparse;
+		hll->maxsparse = max;
+	}
+	memmove(hll->sparse + lo + 1, hll->sparse + lo,
+			(hll->nsparse - lo) * sizeof(unsigned int));
+	hll->sparse[lo] = SPARSE(ix, rank);
+	++ hll->nsparse;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+hll_t hll_new(int precision, map_hash_t hash_func)
+{
+	hll_t hll;
+
+	if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION ||
+		!hash_func)
+		return RETERROR(EINVAL, NULL);
+
+	if (!(hll = mem_new(struct hll_type, 1)))
+		return NULL;
+	hll->precision = precision;
+	hll->m = 1 << precision;
+	hll->hashf = hash_func;
+	return hll;
+}
+
+/* ------------------------------------------------------------------------- */
+int hll_delete(hll_t hll)
+{
+	if (!hll)
+		return RETERROR(EINVAL, -1);
+
+	free(hll->registers);
+	free(hll->sparse);
+	free(hll);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+int hll_add(hll_t hll, void *key)
+{
+	unsigned int h, w;
+	int rank = 1;
+
+	if (!hll || !key)
+		return RETERROR(EINVAL, -1);
+
+	/* first bits select the register, which keeps the longest run of */
+	/* leading zeros seen in the following ones                       */
+	h = sketch_hash(hll->hashf, key);
+	for (w = h << hll->precision; rank <= 32 - hll->precision &&
+		 !(w & 0x80000000U); w <<= 1)
+		++ rank;
+	return hll_set(hll, (int) (h >> (32 - hll->precision)), rank);
+}
+
+/* ------------------------------------------------------------------------- */
+double hll_count(hll_t hll)
+{
+	double sum = 0, estimate, alpha, m, two32 = 4294967296.0;
+	int i, zeros = 0;
+
+	if (!hll)
+		return RETERROR(EINVAL, 0);
+
+	m = hll->m;
+	if (hll->registers)
+	{
+		for (i = 0; i < hll->m; ++i)
+		{
+			sum += ldexp(1.0, -hll->registers[i]);
+			if (!hll->registers[i])
+				++ zeros;
+		}
+	}
+	else
+	{
+		zeros = hll->m - hll->nsparse;
+		sum = zeros;
+		for (i = 0; i < hll->nsparse; ++i)
+			sum += ldexp(1.0, -SPARSE_RANK(hll->sparse[i]));
+	}
+
+	switch (hll->m)
+	{
+	case 16:	alpha = 0.673; break;
+	case 32:	alpha = 0.697; break;
+	case 64:	alpha = 0.709; break;
+	default:	alpha = 0.7213 / (1 + 1.079 / m); break;
+	}
+	estimate = alpha * m * m / sum;
+
+	/* small cardinalities are better estimated by linear counting, and */
+	/* large ones must take hash collisions into account                */
+	if (estimate <= 2.5 * m && zeros)
+		estimate = m * log(m / zeros);
+	else if (estimate > two32 / 30)
+		estimate = -two32 * log(1 - estimate / two32);
+	return estimate;
+}
+
+/* ------------------------------------------------------------------------- */
+int hll_merge(hll_t dst, hll_t src)
+{
+	int i;
+
+	if (!dst || !src || dst->precision != src->precision)
+		return RETERROR(EINVAL, -1);
+
+	if (!src->registers)
+	{
+		for (i = 0; i < src->nsparse; ++i)
+		{
+			if (hll_set(dst, SPARSE_IX(src->sparse[i]), SPARSE_RANK(src->sparse[i])))
+				return -1;
+		}
+		return 0;
+	}
+
+	if (!dst->registers && hll_dense(dst))
+		return -1;
+	for (i = 0; i < dst->m; ++i)
+	{
+		if (dst->registers[i] < src->registers[i])
+			dst->registers[i] = src->registers[i];
+	}
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+void *hll_save(hll_t hll, size_t *len)
+{
+	unsigned char *buf;
+	size_t size;
+	int i;
+
+	if (!hll || !len)
+		return RETERROR(EINVAL, NULL);
+
+	size = HLL_HEADER + (hll->registers ? (size_t) hll->m : (size_t) hll->nsparse * 4);
+	if (!(buf = (unsigned char *) malloc(size)))
+		return NULL;
+	sketch_put32(buf, HLL_MAGIC);
+	sketch_put32(buf + 4, SKETCH_VERSION);
+	sketch_put32(buf + 8, hll->precision);
+	sketch_put32(buf + 12, (hll->registers ? 0xFFFFFFFFUL : (unsigned long) hll->nsparse));
+	if (hll->registers)
+		memcpy(buf + HLL_HEADER, hll->registers, hll->m);
+	else
+	{
+		for (i = 0; i < hll->nsparse; ++i)
+			sketch_put32(buf + HLL_HEADER + i * 4, hll->sparse[i]);
+	}
+
+	*len = size;
+	return buf;
+}
+
+/* ------------------------------------------------------------------------- */
+hll_t hll_load(const void *buf, size_t len, map_hash_t hash_func)
+{
+	const unsigned char *p = (const unsigned char *) buf;
+	unsigned long precision, nsparse, v;
+	hll_t hll;
+	int i, bad = 0;
+
+	if (!buf || !hash_func)
+		return RETERROR(EINVAL, NULL);
+
+	if (len < HLL_HEADER || sketch_get32(p) != HLL_MAGIC ||
+		sketch_get32(p + 4) != SKETCH_VERSION)
+		return RETERROR(EBADF, NULL);
+	precision = sketch_get32(p + 8);
+	nsparse = sketch_get32(p + 12);
+	if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION ||
+		len - HLL_HEADER != (nsparse == 0xFFFFFFFFUL ?
+							 (1UL << precision) : nsparse * 4))
+		return RETERROR(EBADF, NULL);
+
+	if (!(hll = hll_new((int) precision, hash_func)))
+		return NULL;
+	if (nsparse == 0xFFFFFFFFUL)
+	{
+		if (hll_dense(hll))
+		{
+			SAFEERRNO(hll_delete(hll));
+			return NULL;
+		}
+		memcpy(hll->registers, p + HLL_HEADER, hll->m);
+		for (i = 0; i < hll->m && !bad; ++i)
+			bad = (hll->registers[i] > 33 - precision);
+	}
+	else
+	{
+		for (i = 0; i < (int) nsparse && !bad; ++i)
+		{
+			v = sketch_get32(p + HLL_HEADER + i * 4);
+			if (SPARSE_IX(v) >= hll->m || SPARSE_RANK(v) > 33 - (int) precision)
+				bad = 1;
+			else if (hll_set(hll, SPARSE_IX(v), SPARSE_RANK(v)))
+			{
+				SAFEERRNO(hll_delete(hll));
+				return NULL;
+			}
+		}
+	}
+	if (bad)
+	{
+		hll_delete(hll);
+		return RETERROR(EBADF, NULL);
+	}
+	return hll;
+}
+
+/* vi:set ts=4 sw=4: */
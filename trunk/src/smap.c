@@ -0,0 +1,629 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  smap.c - disk spilling map functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#define _XOPEN_SOURCE 600		/* mkstemp() */
+
+#include "scelib/smap.h"
+#include "scelib/memory.h"
+#include "scelib/mmap.h"
+#include "scelib/platform.h"
+#if PLATFORM_IS(UNIX)
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _DEBUG
+#define DPRINT(m)	printf m
+#else
+#define DPRINT(m)
+#endif
+
+
+/* ========================================================================= */
+/* Constants and macros used in this module                                  */
+
+#define SMAP_DEFAULT_PARTS	64
+#define SMAP_CHUNK_SIZE		65536
+
+/* approximate index memory used by each item of a loaded partition */
+#define SMAP_ENTRY_COST		(6 * sizeof(void *))
+
+/* records are aligned the same way in memory and in spill files */
+#define SMAP_ALIGN(n)		(((n) + 7) & ~((size_t) 7))
+
+#define REC_KEY(rec)		((char *) (rec) + SMAP_ALIGN(sizeof(smap_record_t)))
+#define REC_DATA(rec)		(REC_KEY(rec) + SMAP_ALIGN((rec)->keylen))
+#define REC_SIZE(klen, dlen) \
+	(SMAP_ALIGN(sizeof(smap_record_t)) + SMAP_ALIGN(klen) + SMAP_ALIGN(dlen))
+
+#define CHUNK_DATA(chunk)	((char *) (chunk) + SMAP_ALIGN(sizeof(smap_chunk_t)))
+
+
+
+/* ========================================================================= */
+/* internal types                                                            */
+
+/* ------------------------------------------------------------------------- */
+/* key/value record, followed by the key and data bytes                      */
+typedef struct smap_record_type
+{
+	size_t keylen;
+	size_t datalen;
+} smap_record_t;
+
+/* ------------------------------------------------------------------------- */
+/* memory block holding the records written since the partition was loaded   */
+typedef struct smap_chunk_type
+{
+	struct smap_chunk_type *next;
+	size_t size;
+	size_t used;
+} smap_chunk_t;
+
+/* ------------------------------------------------------------------------- */
+/* partition of the map                                                      */
+typedef struct smap_part_type
+{
+	map_t index;			/* key -> record, NULL while spilled */
+	smap_chunk_t *chunks;	/* records written since loaded */
+	char *file;				/* spill file, NULL if never spilled */
+	void *base;				/* spill file contents while loaded */
+	size_t filesize;
+	size_t bytes;			/* memory accounted to the partition */
+	int count;				/* item count while spilled */
+	int dirty;				/* modified since loaded */
+	int pinned;				/* iterations in progress, preventing spills */
+	unsigned long stamp;	/* last access, for LRU spilling */
+} smap_part_t;
+
+/* ------------------------------------------------------------------------- */
+/* main spilling map structure                                               */
+struct smap_type
+{
+	char *dir;
+	size_t budget;
+	size_t resident;		/* sum of the partitions bytes */
+	int nparts;
+	int count;
+	unsigned long clock;
+	smap_part_t *parts;
+	map_hash_t hashf;
+	map_comp_t compf;
+};
+
+/* ------------------------------------------------------------------------- */
+/* iterator, holding a map iterator on the current partition                 */
+struct smap_iter_type
+{
+	smap_t map;
+	int part;
+	map_iter_t iter;
+};
+
+
+
+/* ========================================================================= */
+/* spill files                                                               */
+
+/* ------------------------------------------------------------------------- */
+/* makes a new unique file name in the spill directory                       */
+static char *smap_file_new(smap_t map, int n)
+{
+	char *path;
+
+	if (!(path = (char *) malloc(strlen(map->dir) + 32)))
+		return NULL;
+#if PLATFORM_IS(UNIX)
+	{
+		int fd;
+
+		(void) n;	/* mkstemp() makes the name unique */
+		sprintf(path, "%s/smapXXXXXX", map->dir);
+		if ((fd = mkstemp(path)) == -1)
+		{
+			SAFEERRNO(free(path));
+			return NULL;
+		}
+		close(fd);
+	}
+#else
+	sprintf(path, "%s/smap%lx.%d", map->dir, (unsigned long) map, n);
+#endif
+	return path;
+}
+
+/* ------------------------------------------------------------------------- */
+/* maps the spill file of the partition in memory, reading all its pages as */
+/* its index is rebuilt from every record                                    */
+static void *smap_file_load(smap_part_t *part)
+{
+	void *base;
+	size_t len;
+
+	if (!(base = mem_map_file(part->file, MEM_MAP_POPULATE, &len)))
+		return NULL;
+	if (len != part->filesize)
+	{
+		mem_unmap_file(base, len);
+		return RETERROR(EIO, NULL);
+	}
+	return base;
+}
+
+/* ------------------------------------------------------------------------- */
+static void smap_file_unload(smap_part_t *part)
+{
+	if (!part->base)
+		return;
+	mem_unmap_file(part->base, part->filesize);
+	part->base = NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* writes the partition records to a new file replacing the old one, as the  */
+/* old one may still be mapped and hold some of the records                  */
+static int smap_file_write(smap_t map, smap_part_t *part, int n)
+{
+	map_iter_t iter;
+	smap_record_t *rec;
+	void *key;
+	char *tmp;
+	FILE *f;
+	size_t size, total = 0;
+
+	if (!part->file && !(part->file = smap_file_new(map, n)))
+		return -1;
+	if (!(tmp = (char *) malloc(strlen(part->file) + 2)))
+		return -1;
+	sprintf(tmp, "%s~", part->file);
+	if (!(f = fopen(tmp, "wb")))
+	{
+		SAFEERRNO(free(tmp));
+		return -1;
+	}
+
+	if (!(iter = map_iter_new(part->index)))
+	{
+		SAFEERRNO(fclose(f); remove(tmp); free(tmp));
+		return -1;
+	}
+	while (map_iter_next(iter, &key, (void **) &rec))
+	{
+		size = REC_SIZE(rec->keylen, rec->datalen);
+		if (fwrite(rec, 1, size, f) != size)
+			break;
+		total += size;
+	}
+	map_iter_delete(iter);
+
+	if (ferror(f) | fclose(f))
+	{
+		SAFEERRNO(remove(tmp); free(tmp));
+		return RETERROR(errno ? errno : EIO, -1);
+	}
+
+#if !PLATFORM_IS(UNIX)
+	remove(part->file);
+#endif
+	if (rename(tmp, part->file))
+	{
+		SAFEERRNO(remove(tmp); free(tmp));
+		return -1;
+	}
+	free(tmp);
+	smap_file_unload(part);
+	part->filesize = total;
+	return 0;
+}
+
+
+
+/* ========================================================================= */
+/* partitions                                                                */
+
+/* ------------------------------------------------------------------------- */
+static int smap_part_num(smap_t map, void *key)
+{
+	int h = map->hashf(MAP_HASH_MAX, key);
+	return (h < 0 ? -(h + 1) : h) % map->nparts;
+}
+
+/* ------------------------------------------------------------------------- */
+/* frees all the partition memory, which must have been written if needed    */
+static void smap_part_free(smap_t map, smap_part_t *part)
+{
+	smap_chunk_t *chunk;
+
+	if (part->index)
+	{
+		part->count = map_count(part->index);
+		map_delete(part->index);
+		part->index = NULL;
+	}
+	while ((chunk = part->chunks))
+	{
+		part->chunks = chunk->next;
+		free(chunk);
+	}
+	smap_file_unload(part);
+	map->resident -= part->bytes;
+	part->bytes = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static int smap_part_spill(smap_t map, int n)
+{
+	smap_part_t *part = map->parts + n;
+
+	if (!part->index)
+		return 0;
+
+	/* a clean partition is already in its file, as is */
+	if ((part->dirty || !part->file) && smap_file_write(map, part, n))
+		return -1;
+
+	DPRINT(("spilled partition %d to %s\n", n, part->file));
+	smap_part_free(map, part);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* spills the least recently used partitions (but 'except' and the pinned    */
+/* ones) until 'need' more bytes fit in the budget, and returns the number   */
+/* of spilled ones                                                           */
+static int smap_reserve(smap_t map, int except, size_t need)
+{
+	int i, lru, spilled = 0;
+
+	while (map->resident + need > map->budget)
+	{
+		for (lru = -1, i = 0; i < map->nparts; i++)
+		{
+			if (i != except && map->parts[i].index && !map->parts[i].pinned &&
+				(lru == -1 || map->parts[i].stamp < map->parts[lru].stamp))
+				lru = i;
+		}
+		if (lru == -1 || smap_part_spill(map, lru))
+			break;
+		++ spilled;
+	}
+	return spilled;
+}
+
+/* ------------------------------------------------------------------------- */
+/* called after an allocation failure: if the memory is short, spills all    */
+/* other partitions, and tells whether the allocation is worth a retry       */
+static int smap_retry(smap_t map, int n)
+{
+	if (errno != ENOMEM)
+		return 0;
+	return smap_reserve(map, n, map->budget) > 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static int smap_part_load(smap_t map, int n)
+{
+	smap_part_t *part = map->parts + n;
+	smap_record_t *rec;
+	size_t off;
+
+	part->stamp = ++ map->clock;
+	if (part->index)
+		return 0;
+
+	smap_reserve(map, n, part->filesize + part->count * SMAP_ENTRY_COST);
+	while (!(part->index = map_new(part->count, map->hashf, map->compf,
+								   NULL, NULL)))
+	{
+		if (!smap_retry(map, n))
+			return -1;
+	}
+
+	if (part->file && part->filesize)
+	{
+		while (!(part->base = smap_file_load(part)))
+		{
+			if (!smap_retry(map, n))
+			{
+				SAFEERRNO(map_delete(part->index); part->index = NULL);
+				return -1;
+			}
+		}
+		for (off = 0; off < part->filesize; off += REC_SIZE(rec->keylen,
+															 rec->datalen))
+		{
+			rec = (smap_record_t *) ((char *) part->base + off);
+			if (map_set(part->index, REC_KEY(rec), rec, NULL) == -1)
+			{
+				SAFEERRNO(map_delete(part->index); part->index = NULL;
+						  smap_file_unload(part));
+				return -1;
+			}
+		}
+	}
+
+	part->bytes = part->filesize + part->count * SMAP_ENTRY_COST;
+	map->resident += part->bytes;
+	part->dirty = 0;
+	DPRINT(("loaded partition %d, %d items\n", n, part->count));
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static smap_record_t *smap_record_new(smap_t map, smap_part_t *part,
+									  size_t keylen, size_t datalen)
+{
+	smap_chunk_t *chunk = part->chunks;
+	size_t size = REC_SIZE(keylen, datalen);
+	smap_record_t *rec;
+
+	if (!chunk || chunk->size - chunk->used < size)
+	{
+		size_t csize = (size > SMAP_CHUNK_SIZE ? size : SMAP_CHUNK_SIZE);
+
+		/* zeroed, so that no uninitialized padding goes to the files */
+		chunk = (smap_chunk_t *) calloc(1, SMAP_ALIGN(sizeof(smap_chunk_t)) +
+										csize);
+		if (!chunk)
+			return NULL;
+		chunk->size = csize;
+		chunk->next = part->chunks;
+		part->chunks = chunk;
+		part->bytes += csize;
+		map->resident += csize;
+	}
+
+	rec = (smap_record_t *) (CHUNK_DATA(chunk) + chunk->used);
+	chunk->used += size;
+	rec->keylen = keylen;
+	rec->datalen = datalen;
+	return rec;
+}
+
+
+
+/* ========================================================================= */
+/* public functions                                                          */
+
+smap_t smap_new(const char *dir, size_t budget, int nparts,
+				map_hash_t hash_func, map_comp_t comp_func)
+{
+	smap_t map;
+
+	if (!dir || !budget || nparts < 0 || !hash_func || !comp_func)
+		return RETERROR(EINVAL, NULL);
+	if (!nparts)
+		nparts = SMAP_DEFAULT_PARTS;
+
+	if (!(map = mem_new(struct smap_type, 1)))
+		return NULL;
+	if (!(map->dir = (char *) mem_dup((void *) dir, strlen(dir) + 1)) ||
+		!(map->parts = mem_new(smap_part_t, nparts)))
+	{
+		SAFEERRNO(free(map->dir); free(map));
+		return NULL;
+	}
+	map->budget = budget;
+	map->nparts = nparts;
+	map->hashf = hash_func;
+	map->compf = comp_func;
+	return map;
+}
+
+int smap_delete(smap_t map)
+{
+	int i;
+
+	if (!map)
+		return RETERROR(EINVAL, -1);
+
+	for (i = 0; i < map->nparts; i++)
+	{
+		smap_part_free(map, map->parts + i);
+		if (map->parts[i].file)
+		{
+			remove(map->parts[i].file);
+			free(map->parts[i].file);
+		}
+	}
+	free(map->parts);
+	free(map->dir);
+	free(map);
+	return 0;
+}
+
+int smap_count(smap_t map)
+{
+	if (!map)
+		return RETERROR(EINVAL, -1);
+	return map->count;
+}
+
+size_t smap_resident(smap_t map)
+{
+	if (!map)
+		return RETERROR(EINVAL, 0);
+	return map->resident;
+}
+
+void *smap_get(smap_t map, void *key, size_t *len)
+{
+	smap_record_t *rec;
+	int n;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, NULL);
+
+	n = smap_part_num(map, key);
+	if (smap_part_load(map, n))
+		return NULL;
+	if (!(rec = (smap_record_t *) map_get(map->parts[n].index, key)))
+		return NULL;
+	mem_init(len, rec->datalen);
+	return REC_DATA(rec);
+}
+
+int smap_set(smap_t map, void *key, size_t keylen, void *data,
+			 size_t datalen)
+{
+	smap_part_t *part;
+	smap_record_t *rec;
+	int n, count;
+
+	if (!map || !key || !keylen || (datalen && !data))
+		return RETERROR(EINVAL, -1);
+
+	n = smap_part_num(map, key);
+	part = map->parts + n;
+	if (smap_part_load(map, n))
+		return -1;
+
+	while (!(rec = smap_record_new(map, part, keylen, datalen)))
+	{
+		if (!smap_retry(map, n))
+			return -1;
+	}
+	memcpy(REC_KEY(rec), key, keylen);
+	if (datalen)
+		memcpy(REC_DATA(rec), data, datalen);
+
+	/* an existing key keeps its old record key, which stays valid until the */
+	/* partition is spilled, and then is written from the new record         */
+	count = map_count(part->index);
+	while (map_set(part->index, REC_KEY(rec), rec, NULL) == -1)
+	{
+		if (!smap_retry(map, n))
+			return -1;
+	}
+	part->dirty = 1;
+	if (map_count(part->index) > count)
+	{
+		part->bytes += SMAP_ENTRY_COST;
+		map->resident += SMAP_ENTRY_COST;
+		++ map->count;
+	}
+
+	smap_reserve(map, n, 0);
+	return map->count;
+}
+
+int smap_unset(smap_t map, void *key)
+{
+	smap_part_t *part;
+	int n;
+
+	if (!map || !key)
+		return RETERROR(EINVAL, -1);
+
+	n = smap_part_num(map, key);
+	part = map->parts + n;
+	if (smap_part_load(map, n))
+		return -1;
+	if (map_unset(part->index, key, NULL) == -1)
+		return -1;
+
+	part->dirty = 1;
+	part->bytes -= SMAP_ENTRY_COST;
+	map->resident -= SMAP_ENTRY_COST;
+	return -- map->count;
+}
+
+int smap_spill(smap_t map)
+{
+	int i, ret = 0;
+
+	if (!map)
+		return RETERROR(EINVAL, -1);
+
+	for (i = 0; i < map->nparts; i++)
+	{
+		if (smap_part_spill(map, i))
+			ret = -1;
+	}
+	return ret;
+}
+
+smap_iter_t smap_iter_new(smap_t map)
+{
+	smap_iter_t iter;
+
+	if (!map)
+		return RETERROR(EINVAL, NULL);
+
+	if (!(iter = mem_new(struct smap_iter_type, 1)))
+		return NULL;
+	iter->map = map;
+	return iter;
+}
+
+int smap_iter_delete(smap_iter_t iter)
+{
+	if (!iter)
+		return RETERROR(EINVAL, -1);
+
+	if (iter->iter)
+	{
+		map_iter_delete(iter->iter);
+		-- iter->map->parts[iter->part].pinned;
+	}
+	free(iter);
+	return 0;
+}
+
+int smap_iter_next(smap_iter_t iter, void **key, void **data, size_t *len)
+{
+	smap_t map;
+	smap_record_t *rec;
+	void *k;
+
+	if (!iter)
+		return RETERROR(EINVAL, 0);
+
+	map = iter->map;
+	while (iter->part < map->nparts)
+	{
+		if (!iter->iter)
+		{
+			if (smap_part_load(map, iter->part) ||
+				!(iter->iter = map_iter_new(map->parts[iter->part].index)))
+				return 0;
+			/* smap_get() mustn't spill the partition under the iterator */
+			++ map->parts[iter->part].pinned;
+		}
+		if (map_iter_next(iter->iter, &k, (void **) &rec))
+		{
+			mem_init(key, REC_KEY(rec));
+			mem_init(data, REC_DATA(rec));
+			mem_init(len, rec->datalen);
+			return 1;
+		}
+		map_iter_delete(iter->iter);
+		iter->iter = NULL;
+		-- map->parts[iter->part].pinned;
+		++ iter->part;
+	}
+	return 0;
+}
+
+/* vi:set ts=4 sw=4: */
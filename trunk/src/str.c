@@ -31,6 +31,27 @@
 /* NULL, size of resulting string is not returned.                           */
 char *vaprint(char **dest, size_t *dlen, const char *fmt, va_list ap);
 
+/* ========================================================================= */
+/* Static functions definitions                                              */
+
+/* ------------------------------------------------------------------------- */
+/* reallocates a string with mem_allocator_std, like mem_renew()             */
+
+static char *str_realloc(char **str, size_t size) {
+
+	char *ptr;
+
+	if (!size) {
+		mem_allocator_free(&mem_allocator_std, *str);
+		return (*str = NULL);
+	}
+	if (!(ptr = (char *) mem_allocator_realloc(&mem_allocator_std, *str, size))) {
+		mem_allocator_free(&mem_allocator_std, *str);
+	}
+	return (*str = ptr);
+
+}
+
 /* ========================================================================= */
 /* Public functions definitions                                              */
 
@@ -47,7 +68,7 @@ char *str_dup(const char *str) {
 		return NULL;
 	}
 
-	if (!(dest = mem_new(char, (len = strlen(str) + 1)))) {
+	if (!(dest = mem_allocator_new(&mem_allocator_std, char, (len = strlen(str) + 1)))) {
 		return NULL;
 	}
 
@@ -87,7 +108,7 @@ char *str_grow(char **str, size_t add) {
 		errno = EINVAL;
 		return NULL;
 	}
-	return mem_renew(*str, char, strlen(*str) + add);
+	return str_realloc(str, strlen(*str) + add);
 
 }
 
@@ -114,7 +135,7 @@ char *str_contract(char **str, size_t pos, size_t count) {
 	}
 
 	memmove(*str + pos, *str + pos + count, (orig - pos - count) * sizeof(char));
-	return mem_renew(*str, char, orig - count);
+	return str_realloc(str, orig - count);
 
 }
 
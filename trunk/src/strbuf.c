@@ -0,0 +1,295 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  strbuf.c - string buffers functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "scelib/strbuf.h"
+#include "scelib/str.h"
+#include "scelib/memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+
+/* ========================================================================= */
+/* Constants and macros used in this module                                  */
+
+/* capacity of a buffer at its first growth */
+#define STRBUF_MIN_CAPACITY	16
+
+
+
+/* ========================================================================= */
+/* internal types                                                            */
+
+/* ------------------------------------------------------------------------- */
+/* the string is NULL until some room is allocated, the capacity excluding   */
+/* the terminating nul; it comes from mem_allocator_std like the str_* ones, */
+/* the allocator being used for the buffer object only                       */
+struct strbuf_type
+{
+	char *str;
+	size_t len;
+	size_t capacity;
+	const mem_allocator_t *allocator;
+};
+
+
+
+/* ========================================================================= */
+/* static functions                                                          */
+
+/* ------------------------------------------------------------------------- */
+/* reallocates the string for the given capacity                             */
+static int strbuf_resize(strbuf_t sb, size_t capacity)
+{
+	char *str;
+
+	if (capacity == (size_t) -1)
+		return RETERROR(ENOMEM, -1);
+	if (!(str = (char *) mem_allocator_realloc(&mem_allocator_std, sb->str,
+												  capacity + 1)))
+		return -1;
+	if (!sb->str)
+		str[0] = '\0';
+	sb->str = str;
+	sb->capacity = capacity;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* makes room for n more characters, doubling the capacity                   */
+static int strbuf_grow(strbuf_t sb, size_t n)
+{
+	size_t capacity = sb->capacity;
+
+	if (n > (size_t) -2 - sb->len)
+		return RETERROR(ENOMEM, -1);
+	if (sb->str && sb->len + n <= capacity)
+		return 0;
+
+	if (capacity < STRBUF_MIN_CAPACITY)
+		capacity = STRBUF_MIN_CAPACITY;
+	while (capacity < sb->len + n)
+		capacity = (capacity > (size_t) -2 / 2 ? (size_t) -2 : capacity * 2);
+	return strbuf_resize(sb, capacity);
+}
+
+
+
+/* ========================================================================= */
+/* public functions                                                          */
+
+strbuf_t strbuf_new(size_t capacity)
+{
+	const mem_allocator_t *allocator = mem_allocator_get();
+	strbuf_t sb;
+
+	if (!(sb = mem_allocator_new(allocator, struct strbuf_type, 1)))
+		return NULL;
+	sb->allocator = allocator;
+	if (capacity && strbuf_resize(sb, capacity))
+	{
+		SAFEERRNO(mem_allocator_free(allocator, sb));
+		return NULL;
+	}
+	return sb;
+}
+
+strbuf_t strbuf_from(char *str)
+{
+	strbuf_t sb;
+
+	if (!(sb = strbuf_new(0)))
+		return NULL;
+	if (str)
+	{
+		sb->str = str;
+		sb->len = strlen(str);
+		sb->capacity = sb->len;
+	}
+	return sb;
+}
+
+int strbuf_delete(strbuf_t sb)
+{
+	if (!sb)
+		return RETERROR(EINVAL, -1);
+
+	mem_allocator_free(&mem_allocator_std, sb->str);
+	mem_allocator_free(sb->allocator, sb);
+	return 0;
+}
+
+char *strbuf_detach(strbuf_t sb)
+{
+	char *str;
+
+	if (!sb)
+		return RETERROR(EINVAL, NULL);
+	if (!sb->str && strbuf_resize(sb, 0))
+		return NULL;
+
+	str = sb->str;
+	mem_allocator_free(sb->allocator, sb);
+	return str;
+}
+
+const char *strbuf_str(strbuf_t sb)
+{
+	if (!sb)
+		return RETERROR(EINVAL, NULL);
+	return (sb->str ? sb->str : "");
+}
+
+size_t strbuf_len(strbuf_t sb)
+{
+	if (!sb)
+		return RETERROR(EINVAL, 0);
+	return sb->len;
+}
+
+size_t strbuf_capacity(strbuf_t sb)
+{
+	if (!sb)
+		return RETERROR(EINVAL, 0);
+	return sb->capacity;
+}
+
+int strbuf_reserve(strbuf_t sb, size_t capacity)
+{
+	if (!sb)
+		return RETERROR(EINVAL, -1);
+	if (sb->str && capacity <= sb->capacity)
+		return 0;
+	return strbuf_resize(sb, capacity);
+}
+
+int strbuf_append(strbuf_t sb, const char *str)
+{
+	if (!str)
+		return RETERROR(EINVAL, -1);
+	return strbuf_replace(sb, (sb ? sb->len : 0), 0, str, strlen(str));
+}
+
+int strbuf_append_len(strbuf_t sb, const char *str, size_t len)
+{
+	return strbuf_replace(sb, (sb ? sb->len : 0), 0, str, len);
+}
+
+int strbuf_append_char(strbuf_t sb, char c)
+{
+	if (!sb)
+		return RETERROR(EINVAL, -1);
+
+	if (strbuf_grow(sb, 1))
+		return -1;
+	sb->str[sb->len++] = c;
+	sb->str[sb->len] = '\0';
+	return 0;
+}
+
+int strbuf_printf(strbuf_t sb, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = strbuf_vprintf(sb, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+int strbuf_vprintf(strbuf_t sb, const char *fmt, va_list ap)
+{
+	char *str;
+	size_t len;
+	int ret;
+
+	if (!sb)
+		return RETERROR(EINVAL, -1);
+
+	if (!str_vset(&str, &len, fmt, ap))
+		return -1;
+	ret = strbuf_append_len(sb, str, len);
+	SAFEERRNO(mem_allocator_free(&mem_allocator_std, str));
+	return ret;
+}
+
+int strbuf_insert(strbuf_t sb, size_t pos, const char *str, size_t len)
+{
+	return strbuf_replace(sb, pos, 0, str, len);
+}
+
+int strbuf_erase(strbuf_t sb, size_t pos, size_t count)
+{
+	return strbuf_replace(sb, pos, count, NULL, 0);
+}
+
+int strbuf_replace(strbuf_t sb, size_t pos, size_t count, const char *str,
+				   size_t len)
+{
+	char *copy = NULL;
+
+	if (!sb || (!str && len))
+		return RETERROR(EINVAL, -1);
+	if (pos > sb->len || count > sb->len - pos)
+		return RETERROR(ERANGE, -1);
+
+	/* characters taken from the buffer are copied first, as they may be
+	   moved by the reallocation or by the shift of the tail */
+	if (len && sb->str && str >= sb->str && str <= sb->str + sb->capacity)
+	{
+		if (!(copy = (char *) mem_scratch_push(len)))
+			return -1;
+		str = (const char *) memcpy(copy, str, len);
+	}
+
+	if (len > count && strbuf_grow(sb, len - count))
+	{
+		SAFEERRNO(mem_scratch_pop(copy));
+		return -1;
+	}
+	if (!sb->str)
+	{
+		mem_scratch_pop(copy);
+		return 0;
+	}
+
+	if (len != count)
+		memmove(sb->str + pos + len, sb->str + pos + count,
+				sb->len - pos - count + 1);
+	if (len)
+		memcpy(sb->str + pos, str, len);
+	sb->len = sb->len - count + len;
+	mem_scratch_pop(copy);
+	return 0;
+}
+
+int strbuf_clear(strbuf_t sb)
+{
+	if (!sb)
+		return RETERROR(EINVAL, -1);
+	if (sb->str)
+		sb->str[0] = '\0';
+	sb->len = 0;
+	return 0;
+}
+
+/* vi:set ts=4 sw=4: */
@@ -16,13 +16,17 @@
  *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#define _XOPEN_SOURCE 600		/* recursive mutexes */
+
 #include "scelib/thread.h"
 #include "scelib/platform.h"
+#include "scelib/memory.h"
 #if PLATFORM_IS(UNIX)
 #include <pthread.h>
 #include <sched.h>
 #include <sys/select.h>
 #include <sys/time.h>
+#include <unistd.h>
 #else
 #define WIN32_LEAN_AND_MEAN		/* remove unusual definitions */
 #define STRICT					/* strict type checking */
@@ -49,8 +53,21 @@ typedef struct lock_type
 #else
 	CRITICAL_SECTION handle;
 #endif
+	const mem_allocator_t *allocator;
 } lock_type;
 
+/* ------------------------------------------------------------------------- */
+/* used as tls_t                                                             */
+typedef struct tls_type
+{
+#if PLATFORM_IS(UNIX)
+	pthread_key_t key;
+#else
+	DWORD index;
+#endif
+	const mem_allocator_t *allocator;
+} tls_type;
+
 /* ------------------------------------------------------------------------- */
 /* used as thread_t                                                          */
 typedef struct thread_type
@@ -61,6 +78,7 @@ typedef struct thread_type
 #else
 	HANDLE handle;
 #endif
+	const mem_allocator_t *allocator;
 } thread_type;
 
 /* ------------------------------------------------------------------------- */
@@ -85,6 +103,11 @@ static pthread_key_t s_key = KEY_NULL;
 static DWORD s_key = KEY_NULL;
 #endif
 
+#if PLATFORM_IS(UNIX) && !defined(__GNUC__)
+/* without compiler builtins, atomic operations are serialized by a mutex */
+static pthread_mutex_t s_atomic = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 
 
 /* ========================================================================= */
@@ -103,9 +126,9 @@ static unsigned long __stdcall thread_real_proc(void *params)
 #if PLATFORM_IS(UNIX)
 	thread_lock(self->starter);
 	thread_unlock(self->starter);
-	thread_lock_delete(self->starter);
+	thread_lock_destroy(self->starter);
 #endif
-	free(params);
+	mem_allocator_free(self->allocator, params);
 
 	proc(self, arg);
 
@@ -156,6 +179,29 @@ void thread_lock_delete(lock_t lock)
 #endif
 }
 
+/* ------------------------------------------------------------------------- */
+lock_t thread_lock_create(void)
+{
+	const mem_allocator_t *allocator = mem_allocator_get();
+	lock_t lock;
+
+	if ((lock = (lock_t) mem_allocator_alloc(allocator, sizeof(lock_type))) == NULL)
+		return NULL;
+	thread_lock_new(lock);
+	lock->allocator = allocator;
+	return lock;
+}
+
+/* ------------------------------------------------------------------------- */
+void thread_lock_destroy(lock_t lock)
+{
+	if (lock == NULL)
+		return;
+
+	thread_lock_delete(lock);
+	mem_allocator_free(lock->allocator, lock);
+}
+
 /* ------------------------------------------------------------------------- */
 void thread_lock(lock_t lock)
 {
@@ -237,9 +283,80 @@ void *thread_data_get(void)
 	return retval;
 }
 
+/* ------------------------------------------------------------------------- */
+tls_t thread_tls_new(void (*destructor)(void *data))
+{
+	const mem_allocator_t *allocator = mem_allocator_get();
+	tls_t tls;
+
+	if ((tls = (tls_t) mem_allocator_alloc(allocator, sizeof(tls_type))) == NULL)
+		return NULL;
+	tls->allocator = allocator;
+
+#if PLATFORM_IS(UNIX)
+	if ((errno = pthread_key_create(&tls->key, destructor)))
+#else
+	if ((tls->index = TlsAlloc()) == TLS_OUT_OF_INDEXES)
+#endif
+	{
+		SAFEERRNO(mem_allocator_free(allocator, tls));
+		return NULL;
+	}
+	return tls;
+}
+
+/* ------------------------------------------------------------------------- */
+void thread_tls_delete(tls_t tls)
+{
+	if (tls == NULL)
+		return;
+
+#if PLATFORM_IS(UNIX)
+	pthread_key_delete(tls->key);
+#else
+	TlsFree(tls->index);
+#endif
+	SAFEERRNO(mem_allocator_free(tls->allocator, tls));
+}
+
+/* ------------------------------------------------------------------------- */
+int thread_tls_set(tls_t tls, void *data)
+{
+	if (tls == NULL)
+		return RETERROR(EINVAL, -1);
+
+#if PLATFORM_IS(UNIX)
+	if ((errno = pthread_setspecific(tls->key, data)))
+		return -1;
+#else
+	if (!TlsSetValue(tls->index, data))
+		return RETERROR(ENOMEM, -1);
+#endif
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+void *thread_tls_get(tls_t tls)
+{
+	int err = errno;
+	void *retval;
+
+	if (tls == NULL)
+		return NULL;
+
+#if PLATFORM_IS(UNIX)
+	retval = pthread_getspecific(tls->key);
+#else
+	retval = TlsGetValue(tls->index);
+#endif
+	errno = err;
+	return retval;
+}
+
 /* ------------------------------------------------------------------------- */
 thread_t thread_new(thread_proc_t proc, void *arg)
 {
+	const mem_allocator_t *allocator = mem_allocator_get();
 	thread_t t = NULL;
 	thread_params_t *params;
 #if PLATFORM_IS(WINDOWS)
@@ -249,12 +366,13 @@ thread_t thread_new(thread_proc_t proc, void *arg)
 	if (proc == NULL)
 		return RETERROR(EINVAL, NULL);
 
-	if ((t = (thread_t) malloc(sizeof(thread_type))) == NULL)
+	if ((t = (thread_t) mem_allocator_alloc(allocator, sizeof(thread_type))) == NULL)
 		return NULL;
+	t->allocator = allocator;
 
-	params = (thread_params_t *) malloc(sizeof(thread_params_t));
+	params = (thread_params_t *) mem_allocator_alloc(allocator, sizeof(thread_params_t));
 	if (params == NULL) {
-		free(t);
+		mem_allocator_free(allocator, t);
 		return RETERROR(ENOMEM, NULL);
 	}
 
@@ -263,12 +381,20 @@ thread_t thread_new(thread_proc_t proc, void *arg)
 	params->arg = arg;
 
 #if PLATFORM_IS(UNIX)
-	thread_lock_new(t->starter);
+	if ((t->starter = thread_lock_create()) == NULL)
+	{
+		SAFEERRNO(mem_allocator_free(allocator, params);
+				  mem_allocator_free(allocator, t));
+		return NULL;
+	}
 	thread_lock(t->starter);
-	if (pthread_create(&t->handle, NULL, thread_real_proc, params))
+	if ((errno = pthread_create(&t->handle, NULL, thread_real_proc, params)))
 	{
 		int err = errno;
-		free(t);
+		thread_unlock(t->starter);
+		thread_lock_destroy(t->starter);
+		mem_allocator_free(allocator, params);
+		mem_allocator_free(allocator, t);
 		errno = err;
 		return NULL;
 	}
@@ -277,7 +403,8 @@ thread_t thread_new(thread_proc_t proc, void *arg)
 	if (t->handle == NULL)
 	{
 		DWORD err = GetLastError();
-		free(t);
+		mem_allocator_free(allocator, params);
+		mem_allocator_free(allocator, t);
 		SetLastError(err);
 		return NULL;
 	}
@@ -299,14 +426,17 @@ void thread_start(thread_t t)
 int thread_waitfor(thread_t t)
 {
 	int retval;
-
 #if PLATFORM_IS(UNIX)
-	pthread_join(t->handle, (void **) &retval);
+	void *exitval = NULL;
+
+	/* the exit value is a pointer, which may be larger than an int */
+	pthread_join(t->handle, &exitval);
+	retval = (int) (long) exitval;
 #else
 	WaitForSingleObject(t->handle, INFINITE);
 	GetExitCodeThread(t->handle, (LPDWORD) &retval);
 #endif
-	free(t);
+	mem_allocator_free(t->allocator, t);
 	return retval;
 }
 
@@ -318,7 +448,7 @@ void thread_detach(thread_t t)
 #else
 	CloseHandle(t->handle);
 #endif
-	SAFEERRNO(free(t));
+	SAFEERRNO(mem_allocator_free(t->allocator, t));
 }
 
 /* ------------------------------------------------------------------------- */
@@ -331,6 +461,19 @@ void thread_yield(void)
 #endif
 }
 
+/* ------------------------------------------------------------------------- */
+int thread_cpu_count(void)
+{
+#if PLATFORM_IS(UNIX)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0 ? (int) n : 1);
+#else
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (info.dwNumberOfProcessors > 0 ? (int) info.dwNumberOfProcessors : 1);
+#endif
+}
+
 /* ------------------------------------------------------------------------- */
 void thread_sleep(double seconds)
 {
@@ -356,10 +499,44 @@ void thread_sleep(double seconds)
 void thread_exit(int retval)
 {
 #if PLATFORM_IS(UNIX)
-	pthread_exit((void *) retval);
+	pthread_exit((void *) (long) retval);
 #else
 	ExitThread((DWORD) retval);
 #endif
 }
 
+/* ------------------------------------------------------------------------- */
+int thread_atomic_add(volatile int *ptr, int value)
+{
+#if PLATFORM_IS(WINDOWS)
+	return InterlockedExchangeAdd((volatile LONG *) ptr, value) + value;
+#elif defined(__GNUC__)
+	return __sync_add_and_fetch(ptr, value);
+#else
+	int retval;
+	pthread_mutex_lock(&s_atomic);
+	retval = (*ptr += value);
+	pthread_mutex_unlock(&s_atomic);
+	return retval;
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+int thread_atomic_cas(volatile int *ptr, int oldval, int newval)
+{
+#if PLATFORM_IS(WINDOWS)
+	return (InterlockedCompareExchange((volatile LONG *) ptr, newval,
+		oldval) == oldval);
+#elif defined(__GNUC__)
+	return __sync_bool_compare_and_swap(ptr, oldval, newval);
+#else
+	int retval;
+	pthread_mutex_lock(&s_atomic);
+	if ((retval = (*ptr == oldval)))
+		*ptr = newval;
+	pthread_mutex_unlock(&s_atomic);
+	return retval;
+#endif
+}
+
 /* vi:set ts=4 sw=4: */
@@ -33,6 +33,8 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 
 
 
@@ -51,20 +53,13 @@
 #define FLAG_FLT_G			(1 << 9)
 #define FLAG_WIDTH			(1 << 10)
 #define FLAG_PRECISION		(1 << 11)
+#define FLAG_NEGATIVE		(1 << 12)
 
-/* to avoid using <float.h>, let's define some big values */
-#define MAX_INT_PART		99 + 1
-#define MAX_FRAC_PART		99 + 1
-
-#define mymax(a, b)			(((a) > (b)) ? (a) : (b))
-
-#define myswap(type, a, b)	\
-{							\
-	type t;					\
-	t = (a);				\
-	(a) = (b);				\
-	(b) = t;				\
-}
+/* the digits are counted from the bit length with 64 bits integers */
+#if defined(__GNUC__) && UINTMAX_MAX == ULLONG_MAX && \
+	UINTMAX_MAX == 0xffffffffffffffffull
+#define FAST_DIGITS
+#endif
 
 
 /* ========================================================================= */
@@ -77,7 +72,11 @@ typedef enum fmtlength
 	lenDefault = 0,
 	lenChar,		/* hh */
 	lenShort,		/* h */
-	lenLong			/* l */
+	lenLong,		/* l */
+	lenLongLong,	/* ll */
+	lenSize,		/* z */
+	lenIntMax,		/* j */
+	lenPtrDiff		/* t */
 } fmtlength_e;
 
 /* ------------------------------------------------------------------------- */
@@ -97,7 +96,8 @@ typedef enum fmtconv
 typedef union fmtarg
 {
 	char c;				/* for char and % */
-	double d;			/* for numeric values */
+	uintmax_t u;		/* for integers, the absolute value */
+	double d;			/* for floating point values */
 	void *p;			/* for string, pointer and result (n) */
 } fmtarg_u;
 
@@ -118,6 +118,7 @@ typedef struct fmtspec
 	fmtlength_e len;	/* length modifier */
 	fmtconv_e conv;		/* conversion specifier */
 	fmtarg_u arg;		/* the actual argument */
+	char *text;			/* conversion kept from the length pass, or NULL */
 } fmtspec_t;
 
 /* ------------------------------------------------------------------------- */
@@ -149,6 +150,27 @@ static const char format_flags[] = "-+ #0";
 /* list of supported conversion characters */
 static const char format_conv[] = "diouxXfFeEgGcspn%";
 
+/* the decimal numbers from 00 to 99, to convert two digits at a time */
+static const char format_digits[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/* the hexadecimal digits, lowercase and uppercase */
+static const char format_xdigits[] = "0123456789abcdef0123456789ABCDEF";
+
+#if defined(FAST_DIGITS)
+/* the powers of ten, to fix the digit count estimation */
+static const uintmax_t format_pow10[] =
+{
+	1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull,
+	10000000ull, 100000000ull, 1000000000ull, 10000000000ull,
+	100000000000ull, 1000000000000ull, 10000000000000ull,
+	100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+	100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull
+};
+#endif
+
 
 
 /* ========================================================================= */
@@ -165,250 +187,99 @@ static int free_ctx(fmtctx_t *pctx, int free_buffer)
 	int s_errno = errno;
 
 	if (pctx->specs)
-		free(pctx->specs);
+		mem_scratch_pop(pctx->specs);
 
 	if (pctx->outbuf && free_buffer)
 	{
-		free(pctx->outbuf);
+		mem_allocator_free(&mem_allocator_std, pctx->outbuf);
+		pctx->outbuf = NULL;
 		pctx->outlen = 0;
 	}
 	return s_errno;
 }
 
 /* ------------------------------------------------------------------------- */
-/* format_output()                                                           */
-/* use all preceding collected informations (specifiers and arguments) to    */
-/* make the output string.                                                   */
-
-static int format_output(fmtctx_t *pctx)
-{
-	return 0;
-}
-
-/* ------------------------------------------------------------------------- */
-/* log_10()                                                                  */
-/* find the integral part of the log in base 10.                             */
-/* Note: this not a real log10() with an int output, just an approximation   */
-/* for the integer part of x in :                                            */
-/* 10^x ~= r                                                                 */
-/* log_10(200) = 2; log_10(250) = 2;                                         */
-
-static int log_10(double r)
-{
-	int i = 0;
-	double result = 1;
-
-	if (r < 0)
-		r = -r;
-	else if (r == 0)
-		return 0;
-
-	if (r < 1)
-	{
-		while (result >= r)
-		{
-			result *= .1;
-			++i;
-		}
-		return -i;
-	}
-
-    while (result <= r)
-	{
-		result *= 10;
-		i++;
-	}
-	return (i - 1);
-}
-
-/* ------------------------------------------------------------------------- */
-/* pow_10()                                                                  */
-/* find the nth power of 10                                                  */
-
-static double pow_10(int n)
-{
-	int i;
-	double dpow;
-
-	if (n < 0)
-	{
-		for (i = 1, dpow = 1, n = -n; i <= n; ++i)
-			dpow *= 0.1;
-	}
-	else
-	{
-		for (i = 1, dpow = 1; i <= n ; ++i)
-			dpow *= 10.0;
-	}
-	return dpow;
-}
-
-/* ------------------------------------------------------------------------- */
-/* integral()                                                                */
-/* do the job of the standard modf C function, but with that, we're not      */
-/* required to link against the math library.                                */
+/* count_digits()                                                            */
+/* number of digits of an integer in base 8, 10 or 16, 1 for 0. The bit     */
+/* length gives the count in octal and hexadecimal, and a decimal estimation */
+/* fixed by a single compare, without any division or branch.               */
 
-static double integral(double real, double *fp)
+static int count_digits(uintmax_t val, int base)
 {
-	double dpow, sub, idx;
-	int ilog;
-	double ip = 0;
-
-	if (real == 0)
-	{
-		mem_init(fp, 0);
-		return 0;
-	}
-
-	/* negative ? */
-	if (real < 0)
-		real = -real;
-
-	/* a fraction ? */
-	if (real < 1)
-	{
-		mem_init(fp, real);
-		return 0;
-	}
-
-	/* process extraction */
-	for (ilog = log_10(real); ilog >= 0; --ilog)
-	{
-		dpow = pow_10(ilog);
-		sub = (real - ip) / dpow;
-
-		idx = 0;
-		while (idx + 1 <= sub)
-			++idx;
-
-		ip += idx * dpow;
-	}
+#if !defined(FAST_DIGITS)
+	uintmax_t rest;
+#endif
+	int bits;
+
+	val |= 1;	/* same digit count, and 0 needs one digit */
+#if defined(FAST_DIGITS)
+	bits = 64 - __builtin_clzll(val);
+#else
+	for (bits = 0, rest = val; rest; rest >>= 1)
+		++bits;
+#endif
 
-	mem_init(fp, real - ip);
-	return ip;
+	if (base == 16)
+		return (bits + 3) / 4;
+	if (base == 8)
+		return (bits + 2) / 3;
+
+#if defined(FAST_DIGITS)
+	/* log10(2) ~= 1233 / 4096 */
+	bits = bits * 1233 >> 12;
+	return bits + 1 - (val < format_pow10[bits]);
+#else
+	for (bits = 1; val >= 10; ++bits)
+		val /= 10;
+	return bits;
+#endif
 }
 
 /* ------------------------------------------------------------------------- */
-/* roundto()                                                                 */
-/* round a floating point value to the precision, which is the number of     */
-/* digits after the decimal point if dec=1, or the number of significant     */
-/* digits of the whole number if dec=0.                                      */
-
-static double roundto(double val, int precision, int decimal)
-{
-	double ip, fp, rounded;
-	int digits, flag;
-
-	flag = (val < 0) ? 1 : 0;	/* if the number is negative */
-	ip = integral(val, &fp);
-	digits = ((decimal) ? precision : precision - 1 - log_10(ip));
-
-	rounded = floor(fp * pow_10(digits + 1)) / 10;
-	rounded = ((rounded + 0.5 < ceil(rounded)) ?
-		floor(rounded) : ceil(rounded));
-	fp = rounded * pow_10(-digits);
-	rounded = ip + fp;
-	return ((flag && rounded) ? -rounded : rounded);
-}
-/*
-static double roundto(double val, int precision, int decimal) {
-
-	double ip, fp;
-	int digits;
-	double rounded;
-
-	ip = integral(val, &fp);
-	digits = ((decimal) ? precision : precision - 1 - log_10(ip));
-	rounded = (val < 0) ? ceil(fp * pow_10(digits)) : floor(fp * pow_10(digits));
-	fp = rounded * pow_10(-digits);
-	return (ip + fp);
-
-}
-*/
+/* int2str()                                                                 */
+/* write the digits of an integer backward, ending at the given position.    */
+/* Decimal digits are converted two at a time, other bases only need shifts. */
 
-/* ------------------------------------------------------------------------- */
-/* num2str()                                                                 */
-/* extract in string format the integral and fractional parts of a number.   */
-/* the integral string is assumed to be at least MAX_INT_PART long, the      */
-/* fractional one MAX_FRAC_PART long, or null.                               */
-/* return > 0 if positive value, < 0 if negative one, = 0 if zero one        */
-static int num2str(double number, int base, int precision, char *integral_part,
-				   char *fraction_part)
+static void int2str(uintmax_t val, int base, int upper, char *end)
 {
-	register int i, j;
-	double ip, fp; /* integer and fraction part */
-	double fraction, round_prec, sign;
-	int ch, digits = MAX_INT_PART - 1;
-	char frac_part[MAX_FRAC_PART];
-
-	/* taking care of the obvious case: 0.0 */
-	if (number == 0)
-	{
-		integral_part[0] = '0';
-		integral_part[1] = '\0';
-		frac_part[0] = '0';
-		frac_part[1] = '\0';
-		if (fraction_part)
-			strcpy(fraction_part, frac_part);
-		return 0;
-	}
-
-	round_prec = pow_10(-6);
-
-	/* for negative numbers */
-	if ((sign = number) < 0)
-		number = -number;
+	const char *digits;
+	unsigned int i;
 
-	ip = integral(number, &fraction);
-	number = ip;
-	/* do the integral part */
-	if ( ip == 0)
+	if (base == 10)
 	{
-		integral_part[0] = '0';
-		i = 1;
-	}
-	else
-	{
-		for ( i = 0; i < digits && number != 0; ++i)
+		while (val >= 100)
 		{
-			number /= base;
-			ip = integral(number, &fp);
-			ch = (int) ((fp + round_prec) * base); /* force to round */
-			integral_part[i] = (ch <= 9) ? ch + '0' : ch + 'a' - 10;
-			if (! isxdigit(integral_part[i]))
-				/* bail out overflow !! */
-				break;
-			number = ip;
+			i = (unsigned int) (val % 100) * 2;
+			val /= 100;
+			*--end = format_digits[i + 1];
+			*--end = format_digits[i];
 		}
+		if (val >= 10)
+		{
+			i = (unsigned int) val * 2;
+			*--end = format_digits[i + 1];
+			*--end = format_digits[i];
+		}
+		else
+			*--end = (char) ('0' + val);
 	}
-
-	/* Oh No !! out of bound, ho well fill it up ! */
-	if (number != 0)
+	else if (base == 16)
 	{
-		for (i = 0; i < digits; ++i)
-			integral_part[i] = '9';
+		digits = format_xdigits + (upper ? 16 : 0);
+		do
+		{
+			*--end = digits[val & 15];
+			val >>= 4;
+		} while (val);
 	}
-	integral_part[i] = '\0';
-
-	/* reverse every thing */
-	for ( i--, j = 0; j < i; j++, i--)
-		myswap(int, integral_part[i], integral_part[j]);
-
-	/* the fractionnal part */
-	for (i = 0, fp = fraction; precision > 0 && i < MAX_FRAC_PART;
-		i++, precision--)
+	else
 	{
-		frac_part[i] = (int) ((fp + round_prec) * 10 + '0');
-		if (! isdigit(frac_part[i]))
-			/* underflow ? */
-			break;
-		fp = (fp * 10) - (double) (long) ((fp + round_prec) * 10);
+		do
+		{
+			*--end = (char) ('0' + (val & 7));
+			val >>= 3;
+		} while (val);
 	}
-	frac_part[i] = '\0';
-	if (fraction_part)
-		strcpy(fraction_part, frac_part);
-
-	return (sign > 0) ? 1 : -1;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -417,64 +288,51 @@ static int num2str(double number, int base, int precision, char *integral_part,
 /* compute the final size before the allocation                              */
 static size_t fmt_integer(fmtspec_t *spec, char **out)
 {
-	char ipart[MAX_INT_PART];
-	char *tmp, *outstr;
-	int len, spadlen, zpadlen, baselen = 0;
+	char *outstr;
+	int len, ndigits, precision, spadlen, zpadlen, prefixlen = 0;
 	char sign = 0;
 
 	outstr = (out) ? *out : 0;
 
-	if (spec->arg.d == 0)
-	{
-		if (spec->precision != 0 ||
-			(spec->base == 8 && (spec->flags & FLAG_ALT)))
-			strcpy(ipart, "0");
-		else
-			ipart[0] = '\0';
-	}
+	/* no digit at all for a zero value with a zero precision */
+	if (!spec->arg.u && !spec->precision)
+		ndigits = 0;
 	else
-		num2str(spec->arg.d, spec->base, 0, ipart, 0);
-
-	tmp = ipart;
-	len = (int) strlen(tmp);
+		ndigits = count_digits(spec->arg.u, spec->base);
+	precision = spec->precision;
 
 	/* calculate extra characters */
-	if (!(spec->flags & FLAG_UNSIGNED))
-	{
-		if (spec->arg.d < 0)
-			sign = '-';
-		else if (spec->flags & FLAG_SIGN)
-			sign = '+';
-		else if (spec->flags & FLAG_SPACE)
-			sign = ' ';
-
-		if (sign)
-			++len;
-	}
+	if (spec->flags & FLAG_NEGATIVE)
+		sign = '-';
+	else if (spec->flags & FLAG_SIGN)
+		sign = '+';
+	else if (spec->flags & FLAG_SPACE)
+		sign = ' ';
 
-	if (spec->base != 10 && (spec->flags & FLAG_ALT))
+	if (spec->flags & FLAG_ALT)
 	{
-		/* '0' for octal, '0x' for hexa */
-		if (spec->base == 16)
-			baselen = 2;
-		else if (spec->arg.d != 0)
-			++len;
+		/* '0x' for non zero hexa, the first digit being a '0' for octal */
+		if (spec->base == 16 && spec->arg.u)
+			prefixlen = 2;
+		else if (spec->base == 8 && precision <= ndigits &&
+				 (spec->arg.u || !ndigits))
+			precision = ndigits + 1;
 	}
 
 	/* adding padding characters */
-	zpadlen = spec->precision - len + (sign ? 1 : 0);
+	zpadlen = precision - ndigits;
 	if (zpadlen < 0)
 		zpadlen = 0;
 
-	spadlen = spec->width - (len + zpadlen + baselen);
+	len = (sign ? 1 : 0) + prefixlen + zpadlen + ndigits;
+	spadlen = spec->width - len;
 	if (spadlen < 0)
 		spadlen = 0;
-
-	len += spadlen + zpadlen + baselen;
+	len += spadlen;
 
 	if (spec->flags & FLAG_ZERO)
 	{
-		zpadlen = mymax(zpadlen, spadlen);
+		zpadlen += spadlen;
 		spadlen = 0;
 	}
 
@@ -492,12 +350,10 @@ static size_t fmt_integer(fmtspec_t *spec, char **out)
 		if (sign)
 			*outstr++ = sign;
 
-		if (spec->arg.d != 0 && !sign &&
-			(spec->base != 10) && (spec->flags & FLAG_ALT))
+		if (prefixlen)
 		{
 			*outstr++ = '0';
-			if (spec->base == 16)
-				*outstr++ = (spec->flags & FLAG_UPPERCASE) ? 'X' : 'x';
+			*outstr++ = (spec->flags & FLAG_UPPERCASE) ? 'X' : 'x';
 		}
 
 		while (zpadlen > 0)
@@ -506,10 +362,11 @@ static size_t fmt_integer(fmtspec_t *spec, char **out)
 			--zpadlen;
 		}
 
-		while (*tmp)
+		if (ndigits)
 		{
-			*outstr++ = (spec->flags & FLAG_UPPERCASE) ? toupper(*tmp) : *tmp;
-			++tmp;
+			outstr += ndigits;
+			int2str(spec->arg.u, spec->base, spec->flags & FLAG_UPPERCASE,
+					outstr);
 		}
 
 		while (spadlen++ < 0)
@@ -521,123 +378,12 @@ static size_t fmt_integer(fmtspec_t *spec, char **out)
 /* ------------------------------------------------------------------------- */
 /* fmt_floating()                                                            */
 /* format the floating point number, and assign output only if asked (to be  */
-/* able to compute the final size before the allocation                      */
+/* able to compute the final size before the allocation. The digits come    */
+/* from the C library, as exact conversions are out of our scope             */
 static size_t fmt_floating(fmtspec_t *spec, char **out)
 {
-	char ipart[MAX_INT_PART], fpart[MAX_FRAC_PART];
-	char *outstr, *itmp, *ftmp;
-	double val;
-	char sign = 0, point = 0;
-	int ilen, flen;
-	int len, spadlen, zpadlen;
-
-	outstr = (out) ? *out : 0;
-
-	/* round the value to precision */
-	val = roundto(spec->arg.d, spec->precision,
-		(spec->flags & FLAG_FLT_G) ? 0 : 1);
-	num2str(val, 10, spec->precision, ipart, fpart);
-	itmp = ipart; ilen = (int) strlen(ipart);
-	ftmp = fpart; flen = (int) strlen(fpart);
-	if (flen == 1 && *ftmp == '0')
-		ftmp[--flen] = '\0';
-
-	if ((spec->flags & FLAG_FLT_F) && spec->precision > 0)
-	{
-		point = '.';
-		while (flen < spec->precision)
-		{
-			ftmp[flen++] = '0';
-			ftmp[flen] = '\0';
-		}
-
-	}
-	if (spec->flags & FLAG_FLT_G)
-	{
-		if (flen > 0)
-		{
-			point = '.';
-			if (!(spec->flags & FLAG_ALT))
-			{
-				while (flen > 0 && ftmp[flen-1] == '0')
-					ftmp[--flen] = '\0';
-			}
-		}
-	}
-	if (!flen && (spec->flags & FLAG_ALT))
-		point = '.';
-
-	len = ilen + flen + ((point) ? 1 : 0);
-
-	if (spec->arg.d < 0)
-		sign = '-';
-	else if (spec->flags & FLAG_SIGN)
-		sign = '+';
-	else if (spec->flags & FLAG_SPACE)
-		sign = ' ';
-
-	if (sign)
-		++len;
-
-	zpadlen = spec->precision - len + (sign ? 1 : 0);
-	if (zpadlen < 0)
-		zpadlen = 0;
-
-	spadlen = spec->width - (len + zpadlen);
-	if (spadlen < 0)
-		spadlen = 0;
-
-	len += spadlen + zpadlen;
-	if (spec->flags & FLAG_ZERO)
-	{
-		zpadlen = mymax(zpadlen, spadlen);
-		spadlen = 0;
-	}
-	if (spec->flags & FLAG_JUSTIFY)
-		spadlen = -spadlen;
-
-	if (outstr)
-	{
-		while (spadlen > 0)
-		{
-			*outstr++ = ' ';
-			--spadlen;
-		}
-
-		if (sign)
-			*outstr++ = sign;
-
-		while (zpadlen > 0)
-		{
-			*outstr++ = '0';
-			--zpadlen;
-		}
-
-		while (*itmp)
-			*outstr++ = *itmp++;
-
-		if (point)
-		{
-			*outstr++ = '.';
-			while (*ftmp)
-				*outstr++ = *ftmp++;
-		}
-
-		while (spadlen++ < 0)
-			*outstr++ = ' ';
-	}
-	return len;
-}
-
-/* ------------------------------------------------------------------------- */
-/* fmt_exponent()                                                            */
-/* format the floating point number in scientific format, and assign output  */
-/* only if asked (to be able to compute the final size before the allocation */
-
-static size_t fmt_exponent(fmtspec_t *spec, char **out)
-{
-	char tmp[512];
-	char *outstr, *ptr;
+	char tmp[512], conv[8];
+	char *outstr, *ptr, *digits;
 	double val;
 	char sign = 0;
 	int len, spadlen, zpadlen;
@@ -645,7 +391,7 @@ static size_t fmt_exponent(fmtspec_t *spec, char **out)
 	outstr = (out) ? *out : 0;
 
 	/* calculate sign characters */
-	if (spec->arg.d < 0)
+	if (signbit(spec->arg.d))
 	{
 		sign = '-';
 		val = -spec->arg.d;
@@ -659,47 +405,56 @@ static size_t fmt_exponent(fmtspec_t *spec, char **out)
 			sign = ' ';
 	}
 
-	/* basic floating point output */
-	if (spec->flags & FLAG_UPPERCASE)
+	/* basic floating point output, the '#' flag being kept */
+	ptr = conv;
+	*ptr++ = '%';
+	if (spec->flags & FLAG_ALT)
+		*ptr++ = '#';
+	*ptr++ = '.';
+	*ptr++ = '*';
+	*ptr++ = (char) spec->fmtconv;
+	*ptr = '\0';
+
+	if (spec->text)
 	{
-		len = sprintf(tmp,
-			(spec->flags & FLAG_FLT_G) ? "%.*G" : "%.*E",
-			spec->precision, val);
+		/* already converted by the length pass */
+		digits = spec->text;
+		len = (int) strlen(digits);
 	}
 	else
 	{
-		len = sprintf(tmp,
-			(spec->flags & FLAG_FLT_G) ? "%.*g" : "%.*e",
-			spec->precision, val);
-	}
-	ptr = tmp;
-
-	if (!strchr(tmp, '.') && (spec->flags & FLAG_ALT))
-	{
-		/* adding '.' before the 'e' */
-		ptr = strrchr(tmp, (spec->flags & FLAG_UPPERCASE) ? 'E' : 'e');
-		if (ptr)
+		digits = tmp;
+		len = snprintf(tmp, sizeof(tmp), conv, spec->precision, val);
+		if (len < 0)
+			return 0;
+		if ((size_t) len >= sizeof(tmp))
 		{
-			memmove(ptr+1, ptr, strlen(ptr));
-			*ptr = '.';
-			tmp[++len] = '\0';
+			/* huge numbers in %f, or huge precisions */
+			if (!(digits = (char *) mem_scratch_push((size_t) len + 1)))
+				return 0;
+			snprintf(digits, (size_t) len + 1, conv, spec->precision, val);
 		}
-		else
+
+		/* keep the digits on the scratch stack for the output pass, they
+		   are popped with the specifiers */
+		if (!outstr)
 		{
-			tmp[len++] = '.';
-			tmp[len] = '\0';
+			if (digits == tmp && (spec->text = (char *)
+								  mem_scratch_push((size_t) len + 1)))
+				memcpy(spec->text, tmp, (size_t) len + 1);
+			else if (digits != tmp)
+				spec->text = digits;
 		}
-		ptr = tmp;
 	}
 	if (sign)
 		++len;
 
-	/* adding padding characters */
+	/* adding padding characters, never zeroes for infinity or nan */
 	spadlen = spec->width - len;
 	if (spadlen < 0)
 		spadlen = 0;
 	len += spadlen;
-	if (spec->flags & FLAG_ZERO)
+	if ((spec->flags & FLAG_ZERO) && isfinite(val))
 	{
 		zpadlen = spadlen;
 		spadlen = 0;
@@ -727,99 +482,44 @@ static size_t fmt_exponent(fmtspec_t *spec, char **out)
 			--zpadlen;
 		}
 
-		while (*ptr)
+		for (ptr = digits; *ptr; )
 			*outstr++ = *ptr++;
 
 		while (spadlen++ < 0)
 			*outstr++ = ' ';
 	}
-	return len;
-
-#if 0
-	char ipart[MAX_INT_PART], fpart[MAX_FRAC_PART];
-	char tmp[MAX_INT_PART + MAX_FRAC_PART + 1];
-	char *itmp, *ftmp;
-	double val;
-	int width, j;
-	size_t i;
-
-	j = log_10(spec->arg.d);
-	val = spec->arg.d / pow_10(j);	/* get the mantissa */
-
-	/* round up/down near the precision */
-	val += ((val < 0) ? - 0.5 : 0.5) * pow_10(-spec->precision);
-
-	num2str(val, 10, spec->precision, ipart, fpart);
-	itmp = ipart;
-	ftmp = fpart;
-
-	/* calculate how much padding need */
-	/* 1 for unit, 1 for the '.', 1 for 'e|E',
-	* 1 for '+|-', 3 for 'exp' */
-	width = spec->width -
-		((val > 0 && !(spec->flags & FLAG_JUSTIFY)) ? 1 : 0) -
-		((spec->flags & FLAG_SPACE) ? 1 : 0) - spec->precision - 7;
-
-	/* PAD_RIGHT(spec); */
-	/* PUT_PLUS(val, spec); */
-	/* PUT_SPACE(val, spec); */
-	while (*itmp) {/* the integral */
-		/*PUT_CHAR(*tmp, spec);*/
-		++itmp;
-	}
-
-	if (spec->precision != 0 || (spec->flags & FLAG_ALT)) {
-		/* PUT_CHAR('.', spec); */  /* the '.' */
-	}
-
-	/* smash the trailing zeros */
-	if (spec->flags & FLAG_FLT_G) {
-		for (i = strlen(ftmp) - 1; i >= 0 && ftmp[i] == '0'; --i) {
-			ftmp[i] = '\0';
-		}
-	}
-
-	for (; *ftmp; ++ftmp) {
-		/* PUT_CHAR(*ftmp, spec); */ /* the fraction */
-	}
 
-	/* the exponent put the 'e|E' */
-	if (spec->flags & FLAG_UPPERCASE) {
-		/* PUT_CHAR('E', spec); */
-	}
-	else {
-		/* PUT_CHAR('e', spec); */
-	}
-
-	if (j > 0) {  /* the sign of the exp */
-		/* PUT_CHAR('+', spec); */
-	}
-	else {
-		/* PUT_CHAR('-', spec); */
-		j = -j;
-	}
+	if (digits != tmp && digits != spec->text)
+		mem_scratch_pop(digits);
+	return len;
+}
 
-	num2str(j, 10, 0, ipart, 0);
-	if (j < 9) {  /* need to pad the exponent with 0 '000' */
-		/* PUT_CHAR('0', spec);
-		PUT_CHAR('0', spec); */
-	}
-	else if (j < 99) {
-		/* PUT_CHAR('0', spec); */
-	}
+/* ------------------------------------------------------------------------- */
+/* fmt_char()                                                                */
+/* format the character value, and assign output only if asked               */
+static size_t fmt_char(fmtspec_t *spec, char **out)
+{
+	char *outstr;
+	int len = 1, padlen;
 
-	while (*itmp) { /* the exponent */
-		/* PUT_CHAR(*itmp, spec); */
-		++itmp;
-	}
+	outstr = (out) ? *out : 0;
 
-	/*PAD_LEFT(spec);*/
+	padlen = (spec->fmtconv == 'c') ? spec->width - 1 : 0;
+	if (padlen < 0)
+		padlen = 0;
+	len += padlen;
+	if (spec->flags & FLAG_JUSTIFY)
+		padlen = -padlen;	/* < 0 => right pad */
 
-	if (out) {
-		*out = str_dup(tmp);
+	if (outstr)
+	{
+		while (padlen-- > 0)
+			*outstr++ = ' ';
+		*outstr++ = spec->arg.c;
+		while (padlen++ < 0)
+			*outstr++ = ' ';
 	}
-	return strlen(tmp);
-#endif
+	return len;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -830,7 +530,7 @@ static size_t fmt_string(fmtspec_t *spec, char **out)
 {
 	char *tmp;
 	char *outstr;
-	int i, len, padlen;
+	int len, copylen, padlen;
 
 	tmp = (char *) spec->arg.p;
 	outstr = (out) ? *out : 0;
@@ -846,6 +546,7 @@ static size_t fmt_string(fmtspec_t *spec, char **out)
 	for (len = 0; (spec->precision == -1 || len < spec->precision) && tmp[len];
 		++len)
 		;
+	copylen = len;
 
 	padlen = spec->width - len;
 	if (padlen < 0)
@@ -862,9 +563,8 @@ static size_t fmt_string(fmtspec_t *spec, char **out)
 			*outstr++ = ' ';
 
 		/* do the copy, precision max if given */
-		i = 0;
-		while (*tmp && (spec->precision == -1 || (i < spec->precision)))
-			*outstr++ = *tmp++;
+		memcpy(outstr, tmp, copylen);
+		outstr += copylen;
 
 		/* do right padding if needed */
 		while (padlen++ < 0)
@@ -883,6 +583,7 @@ static int analyze_format(fmtctx_t *pctx, va_list ap)
 {
 	char *ptr;
 	int i;
+	intmax_t ival;
 	char *fmt = pctx->fmt;
 	fmtspec_t *spec = NULL;
 	int curarg = 0;
@@ -909,7 +610,7 @@ static int analyze_format(fmtctx_t *pctx, va_list ap)
 		 * to set specifier flag field accordingly, going through until
 		 * the next character isn't one of the predefined flags
 		 */
-		while (strchr(format_flags, *fmt))
+		while (*fmt && strchr(format_flags, *fmt))
 		{
 			ptr = (char *) format_flags;
 			i = 1;
@@ -1021,38 +722,34 @@ static int analyze_format(fmtctx_t *pctx, va_list ap)
 			spec->flags &= ~FLAG_ZERO;
 
 		/* length modifiers
-		 * can be specified by one or two letters.
-		 * when we're done, update the index 'i' to break the loop
+		 * can be specified by one or two letters: "h" is short, "hh" is
+		 * char, "l" is long, "ll" is long long, and "z", "j" and "t" are
+		 * size_t, intmax_t and ptrdiff_t.
 		 */
-		i = 0;
-		while (i++ < 2)
+		if (*fmt == 'h' || *fmt == 'l')
 		{
-			switch (*fmt)
+			if (fmt[1] == *fmt)
 			{
-				case 'h':
-					/* "h" is short, "hh" is char */
-					spec->len = (spec->len == lenShort) ? lenChar : lenShort;
-					break;
-				case 'l':
-					/* "l" is long, "ll" is long long */
-					spec->len = lenLong;
-					++i;
-					break;
-				default:
-					i = 3;
-			}
-			if (i == 3)
-				break;
-			if (i <= 2)
-			{ /* caught another char than length modifiers one */
+				spec->len = (*fmt == 'h') ? lenChar : lenLongLong;
 				++fmt;
 				++(spec->fmtlen);
 			}
+			else
+				spec->len = (*fmt == 'h') ? lenShort : lenLong;
+			++fmt;
+			++(spec->fmtlen);
+		}
+		else if (*fmt == 'z' || *fmt == 'j' || *fmt == 't')
+		{
+			spec->len = (*fmt == 'z') ? lenSize :
+				(*fmt == 'j') ? lenIntMax : lenPtrDiff;
+			++fmt;
+			++(spec->fmtlen);
 		}
 
 		/* conversion specifier */
 		/* none of the supported conversion specifiers defined */
-		if (!strchr(format_conv, *fmt))
+		if (!*fmt || !strchr(format_conv, *fmt))
 			return EINVAL;
 
 		spec->fmtconv = *fmt;	/* store the conversion specifier */
@@ -1061,77 +758,131 @@ static int analyze_format(fmtctx_t *pctx, va_list ap)
 		/* basic int output */
 		if (strchr("di", *fmt))
 		{
-			spec->conv = convInt;
+			spec->conv = (spec->len >= lenLong) ? convLong : convInt;
 
-			if (spec->len == lenLong)
+			switch (spec->len)
 			{
-				spec->conv = convLong;
-				spec->arg.d = (long) va_arg(ap, long);
+				case lenChar:
+					ival = (signed char) va_arg(ap, int);
+					break;
+				case lenShort:
+					ival = (short) va_arg(ap, int);
+					break;
+				case lenLong:
+					ival = va_arg(ap, long);
+					break;
+				case lenLongLong:
+					ival = va_arg(ap, long long);
+					break;
+				case lenIntMax:
+					ival = va_arg(ap, intmax_t);
+					break;
+				case lenSize:		/* the signed size_t */
+				case lenPtrDiff:
+					ival = va_arg(ap, ptrdiff_t);
+					break;
+				default:
+					ival = va_arg(ap, int);
+			}
+
+			/* keep the absolute value, INTMAX_MIN included */
+			if (ival < 0)
+			{
+				spec->flags |= FLAG_NEGATIVE;
+				spec->arg.u = (uintmax_t) 0 - (uintmax_t) ival;
 			}
-			else if (spec->len == lenChar)
-				spec->arg.d = (char) va_arg(ap, int);
-			else if (spec->len == lenShort)
-				spec->arg.d = (short) va_arg(ap, int);
 			else
-				spec->arg.d = (int) va_arg(ap, int);
+				spec->arg.u = (uintmax_t) ival;
 
 			/* adapt flags according to ISO defines */
 			if (spec->precision < 0)	/* default precision of 1 */
 				spec->precision = 1;
-			else if (spec->precision == 0 && (spec->flags & FLAG_ZERO))
-				/* if precision=0 and zero flag, flag ignored */
+			else
+				/* if precision given, zero flag ignored */
 				spec->flags &= ~FLAG_ZERO;
 
-			if (spec->arg.d == 0)
-				/* if zero value, # flag ignored */
-				spec->flags &= ~FLAG_ALT;
+			/* '#' flag meaningless in decimal */
+			spec->flags &= ~FLAG_ALT;
 
 			/* calculate room for output */
 			spec->outlen = fmt_integer(spec, 0);
 		}
 
+		/* pointers, in hexadecimal with the 0x prefix, like the C library */
+		else if (*fmt == 'p')
+		{
+			spec->arg.p = va_arg(ap, void *);
+			if (!spec->arg.p)
+			{
+				spec->conv = convString;
+				spec->arg.p = (void *) "(nil)";
+				spec->precision = -1;
+				spec->outlen = fmt_string(spec, 0);
+			}
+			else
+			{
+				spec->conv = convLong;
+				spec->arg.u = (uintmax_t) (uintptr_t) spec->arg.p;
+				spec->flags |= FLAG_UNSIGNED | FLAG_ALT;
+				spec->flags &= ~(FLAG_SPACE|FLAG_SIGN);
+				spec->base = 16;
+				spec->precision = 1;
+				spec->outlen = fmt_integer(spec, 0);
+			}
+		}
+
 		/* other bases decimal output */
-		else if (strchr("oxXup", *fmt))
+		else if (strchr("oxXu", *fmt))
 		{
-			spec->conv = convInt;
+			spec->conv = (spec->len >= lenLong) ? convLong : convInt;
 			spec->flags |= FLAG_UNSIGNED;
 			spec->flags &= ~(FLAG_SPACE|FLAG_SIGN);
 
-			if (spec->len == lenLong)
+			switch (spec->len)
 			{
-				spec->conv = convLong;
-				spec->arg.d = (unsigned long) va_arg(ap, unsigned long);
+				case lenChar:
+					spec->arg.u = (unsigned char) va_arg(ap, unsigned int);
+					break;
+				case lenShort:
+					spec->arg.u = (unsigned short) va_arg(ap, unsigned int);
+					break;
+				case lenLong:
+					spec->arg.u = va_arg(ap, unsigned long);
+					break;
+				case lenLongLong:
+					spec->arg.u = va_arg(ap, unsigned long long);
+					break;
+				case lenIntMax:
+					spec->arg.u = va_arg(ap, uintmax_t);
+					break;
+				case lenSize:
+					spec->arg.u = va_arg(ap, size_t);
+					break;
+				case lenPtrDiff:	/* the unsigned ptrdiff_t */
+					spec->arg.u = (uintmax_t) (size_t) va_arg(ap, ptrdiff_t);
+					break;
+				default:
+					spec->arg.u = va_arg(ap, unsigned int);
 			}
-			else if (spec->len == lenChar)
-				/*spec->arg.d = (unsigned char) va_arg(ap, unsigned char);*/
-				spec->arg.d = (unsigned char) va_arg(ap, unsigned int);
-			else if (spec->len == lenShort)
-				spec->arg.d = (unsigned short) va_arg(ap, unsigned int);
-			else
-				spec->arg.d = (unsigned int) va_arg(ap, unsigned int);
 
 			if (*fmt == 'o')
 				spec->base = 8;
-			else if (*fmt == 'X' || *fmt == 'P')
+			else if (*fmt == 'X')
 			{
 				spec->flags |= FLAG_UPPERCASE;
 				spec->base = 16;
 			}
-			else if (*fmt == 'x' || *fmt == 'p')
+			else if (*fmt == 'x')
 				spec->base = 16;
 
 			/* adapt flags according to ISO defines */
 			if (spec->precision < 0)
 				/* default precision of 1 */
 				spec->precision = 1;
-			else if (spec->precision == 0 && (spec->flags & FLAG_ZERO))
-				/* if precision=0 and zero flag, flag ignored */
+			else
+				/* if precision given, zero flag ignored */
 				spec->flags &= ~FLAG_ZERO;
 
-			if (spec->arg.d == 0 && spec->base != 8)
-				/* if zero value, # flag ignored */
-				spec->flags &= ~FLAG_ALT;
-
 			/* calculate room for output */
 			spec->outlen = fmt_integer(spec, 0);
 		}
@@ -1148,37 +899,24 @@ static int analyze_format(fmtctx_t *pctx, va_list ap)
 			{
 				case 'F':
 				case 'f':
-					/* adapt flags according to ISO defines */
-					if (spec->precision < 0)
-						spec->precision = 6;
 					spec->flags |= FLAG_FLT_F;
-					spec->outlen = fmt_floating(spec, 0);
 					break;
 				case 'E':
 				case 'e':
-					/* adapt flags according to ISO defines */
-					if (spec->precision < 0)
-						spec->precision = 6;
 					spec->flags |= FLAG_FLT_E;
-					spec->outlen = fmt_exponent(spec, 0);
 					break;
 				case 'G':
 				case 'g':
-					/* adapt flags according to ISO defines */
-					if (spec->precision == 0)
-						spec->precision = 1;
-					else if (spec->precision < 0)
-						/* but trailing zeroes removed */
-						spec->precision = 6;
 					spec->flags |= FLAG_FLT_G;
-					i = log_10(spec->arg.d);
-					/* for '%g|%G' ANSI: use f if exponent is in the range or
-					 * [-4,p] exclusively else use %e|%E
-					 */
-					spec->outlen = (i > -4 && i < spec->precision) ?
-						fmt_floating(spec, 0) : fmt_exponent(spec, 0);
 					break;
 			}
+
+			/* adapt flags according to ISO defines, the C library choosing
+			 * between the %f and %e styles for %g
+			 */
+			if (spec->precision < 0)
+				spec->precision = 6;
+			spec->outlen = fmt_floating(spec, 0);
 		}
 
 		/* character output or '%' */
@@ -1186,7 +924,7 @@ static int analyze_format(fmtctx_t *pctx, va_list ap)
 		{
 			spec->conv = convChar;
 			spec->arg.c = (*fmt == 'c') ? (char) va_arg(ap, int) : *fmt;
-			spec->outlen = 1;
+			spec->outlen = fmt_char(spec, 0);
 			++fmt;	/* skip the second '%' */
 		}
 
@@ -1210,6 +948,94 @@ static int analyze_format(fmtctx_t *pctx, va_list ap)
 		++spec->fmtlen;
 
 	}
+
+	/* the first count may be too high, as in "%5%" */
+	pctx->nbspecs = curarg;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* format_output()                                                           */
+/* use all preceding collected informations (specifiers and arguments) to    */
+/* make the output string. The length of each specifier output is already   */
+/* known, so the output is allocated once, and written in a single pass.     */
+
+static int format_output(fmtctx_t *pctx)
+{
+	fmtspec_t *spec, *end = pctx->specs + pctx->nbspecs;
+	char *fmt, *next, *out;
+	size_t len;
+
+	/* the output length, literal text included */
+	len = pctx->fmtlen;
+	for (spec = pctx->specs; spec < end; ++spec)
+		len = len - spec->fmtlen + spec->outlen;
+
+	if (!(pctx->outbuf = mem_allocator_new(&mem_allocator_std, char, len + 1)))
+		return ENOMEM;
+	pctx->outlen = len;
+
+	out = pctx->outbuf;
+	fmt = pctx->fmt;
+	for (spec = pctx->specs; spec < end; ++spec)
+	{
+		/* the text before the specifier */
+		next = strchr(fmt, '%');
+		memcpy(out, fmt, next - fmt);
+		out += next - fmt;
+		fmt = next + spec->fmtlen;
+
+		switch (spec->conv)
+		{
+			case convInt:
+			case convLong:
+				fmt_integer(spec, &out);
+				break;
+			case convDouble:
+				fmt_floating(spec, &out);
+				break;
+			case convChar:
+				fmt_char(spec, &out);
+				break;
+			case convString:
+				fmt_string(spec, &out);
+				break;
+			case convPointer:
+				/* %n, the number of characters written so far */
+				len = (size_t) (out - pctx->outbuf);
+				switch (spec->len)
+				{
+					case lenChar:
+						*(signed char *) spec->arg.p = (signed char) len;
+						break;
+					case lenShort:
+						*(short *) spec->arg.p = (short) len;
+						break;
+					case lenLong:
+						*(long *) spec->arg.p = (long) len;
+						break;
+					case lenLongLong:
+						*(long long *) spec->arg.p = (long long) len;
+						break;
+					case lenIntMax:
+						*(intmax_t *) spec->arg.p = (intmax_t) len;
+						break;
+					case lenSize:
+					case lenPtrDiff:
+						*(ptrdiff_t *) spec->arg.p = (ptrdiff_t) len;
+						break;
+					default:
+						*(int *) spec->arg.p = (int) len;
+				}
+				break;
+			default:
+				break;
+		}
+		out += spec->outlen;
+	}
+
+	/* the text after the last specifier */
+	strcpy(out, fmt);
 	return 0;
 }
 
@@ -1217,7 +1043,8 @@ static int analyze_format(fmtctx_t *pctx, va_list ap)
 /* Public functions definitions                                              */
 
 /* ------------------------------------------------------------------------- */
-/* cmd_create()                                                              */
+/* vaprint()                                                                 */
+/* the result comes from mem_allocator_std, and can be given to free()       */
 
 char *vaprint(char **dest, size_t *dlen, const char *fmt, va_list ap)
 {
@@ -1254,7 +1081,7 @@ char *vaprint(char **dest, size_t *dlen, const char *fmt, va_list ap)
 	if (! ctx.nbspecs)
 	{
 		ctx.outlen = ctx.fmtlen;
-		ctx.outbuf = mem_new(char, ctx.outlen + 1);
+		ctx.outbuf = mem_allocator_new(&mem_allocator_std, char, ctx.outlen + 1);
 		if (!ctx.outbuf)
 			return NULL;
 
@@ -1264,8 +1091,9 @@ char *vaprint(char **dest, size_t *dlen, const char *fmt, va_list ap)
 		return ctx.outbuf;
 	}
 
-	/* allocate room for the spec structures */
-	ctx.specs = mem_new(fmtspec_t, ctx.nbspecs);
+	/* allocate room for the spec structures, on the thread scratch stack as
+	   they don't outlive the call */
+	ctx.specs = mem_scratch_new(fmtspec_t, ctx.nbspecs);
 	if (!ctx.specs)
 	{
 		errno = free_ctx(&ctx, 1);
@@ -1275,13 +1103,15 @@ char *vaprint(char **dest, size_t *dlen, const char *fmt, va_list ap)
 	/* extract format string informations */
 	if ((s_errno = analyze_format(&ctx, ap)))
 	{
-		errno = free_ctx(&ctx, 1);
+		errno = s_errno;
+		free_ctx(&ctx, 1);
 		return NULL;
 	}
 
 	/* do the format thing */
-	s_errno = format_output(&ctx);
-	errno = free_ctx(&ctx, (s_errno) ? 1 : 0);
+	if ((s_errno = format_output(&ctx)))
+		errno = s_errno;
+	free_ctx(&ctx, (s_errno) ? 1 : 0);
 
 	/* finish returning results */
 	mem_init(dest, ctx.outbuf);
@@ -0,0 +1,297 @@
+/*	scelib - Simple C Extension Library
+ *  Copyright (C) 2005-2007 Richard 'riri' GILL <richard@houbathecat.info>
+ *
+ *  vec.c - dynamic array functions.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "scelib/vec.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+
+
+/* ========================================================================= */
+/* Constants and macros used in this module                                  */
+
+/* capacity of a vector at its first growth */
+#define VEC_MIN_CAPACITY	8
+
+#define VEC_AT(vec, i)		((char *) (vec)->data + (size_t) (i) * (vec)->elsize)
+
+
+
+/* ========================================================================= */
+/* internal types                                                            */
+
+/* ------------------------------------------------------------------------- */
+struct vec_type
+{
+	void *data;
+	size_t elsize;
+	int count;
+	int capacity;
+	const mem_allocator_t *allocator;
+};
+
+
+
+/* ========================================================================= */
+/* static functions                                                          */
+
+/* ------------------------------------------------------------------------- */
+/* sets the capacity, which must hold the elements                           */
+static int vec_resize(vec_t vec, int capacity)
+{
+	void *data;
+
+	if ((size_t) capacity > (size_t) -1 / vec->elsize)
+		return RETERROR(ENOMEM, -1);
+
+	if (!capacity)
+	{
+		mem_allocator_free(vec->allocator, vec->data);
+		data = NULL;
+	}
+	else if (!(data = mem_allocator_realloc(vec->allocator, vec->data,
+											(size_t) capacity * vec->elsize)))
+		return -1;
+	vec->data = data;
+	vec->capacity = capacity;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* makes room for n more elements, doubling the capacity                     */
+static int vec_grow(vec_t vec, int n)
+{
+	int capacity = vec->capacity;
+
+	if (n < 0 || n > INT_MAX - vec->count)
+		return RETERROR(ENOMEM, -1);
+	if (vec->count + n <= capacity)
+		return 0;
+
+	if (capacity < VEC_MIN_CAPACITY)
+		capacity = VEC_MIN_CAPACITY;
+	while (capacity < vec->count + n)
+		capacity = (capacity > INT_MAX / 2 ? INT_MAX : capacity * 2);
+	return vec_resize(vec, capacity);
+}
+
+/* ------------------------------------------------------------------------- */
+/* tells if some memory is in the storage of a vector                        */
+static int vec_owns(vec_t vec, const void *mem)
+{
+	return (vec->data && (const char *) mem >= (char *) vec->data &&
+			(const char *) mem < VEC_AT(vec, vec->capacity));
+}
+
+
+
+/* ========================================================================= */
+/* public functions                                                          */
+
+vec_t vec_new(size_t elsize, int capacity)
+{
+	return vec_new_ex(elsize, capacity, NULL);
+}
+
+vec_t vec_new_ex(size_t elsize, int capacity, const mem_allocator_t *allocator)
+{
+	vec_t vec;
+
+	if (!elsize || capacity < 0)
+		return RETERROR(EINVAL, NULL);
+
+	if (!allocator)
+		allocator = mem_allocator_get();
+	if (!(vec = mem_allocator_new(allocator, struct vec_type, 1)))
+		return NULL;
+	vec->elsize = elsize;
+	vec->allocator = allocator;
+	if (capacity && vec_resize(vec, capacity))
+	{
+		SAFEERRNO(mem_allocator_free(allocator, vec));
+		return NULL;
+	}
+	return vec;
+}
+
+int vec_delete(vec_t vec)
+{
+	if (!vec)
+		return RETERROR(EINVAL, -1);
+
+	mem_allocator_free(vec->allocator, vec->data);
+	mem_allocator_free(vec->allocator, vec);
+	return 0;
+}
+
+int vec_count(vec_t vec)
+{
+	if (!vec)
+		return RETERROR(EINVAL, -1);
+	return vec->count;
+}
+
+int vec_capacity(vec_t vec)
+{
+	if (!vec)
+		return RETERROR(EINVAL, -1);
+	return vec->capacity;
+}
+
+void *vec_data(vec_t vec)
+{
+	if (!vec)
+		return RETERROR(EINVAL, NULL);
+	return vec->data;
+}
+
+void *vec_at(vec_t vec, int index)
+{
+	if (!vec)
+		return RETERROR(EINVAL, NULL);
+	if (index < 0 || index >= vec->count)
+		return RETERROR(ERANGE, NULL);
+	return VEC_AT(vec, index);
+}
+
+int vec_reserve(vec_t vec, int capacity)
+{
+	if (!vec || capacity < 0)
+		return RETERROR(EINVAL, -1);
+	if (capacity <= vec->capacity)
+		return 0;
+	return vec_resize(vec, capacity);
+}
+
+int vec_shrink(vec_t vec)
+{
+	if (!vec)
+		return RETERROR(EINVAL, -1);
+	if (vec->count == vec->capacity)
+		return 0;
+	return vec_resize(vec, vec->count);
+}
+
+int vec_push(vec_t vec, const void *elem)
+{
+	if (!vec)
+		return RETERROR(EINVAL, -1);
+
+	/* an element of the vector is found back after the reallocation */
+	if (elem && vec_owns(vec, elem))
+	{
+		size_t offset = (size_t) ((const char *) elem - (char *) vec->data);
+
+		if (vec->count == vec->capacity && vec_grow(vec, 1))
+			return -1;
+		elem = (char *) vec->data + offset;
+	}
+	else if (vec->count == vec->capacity && vec_grow(vec, 1))
+		return -1;
+	if (elem)
+		memcpy(VEC_AT(vec, vec->count), elem, vec->elsize);
+	else
+		memset(VEC_AT(vec, vec->count), 0, vec->elsize);
+	return ++ vec->count;
+}
+
+int vec_pop(vec_t vec, void *elem)
+{
+	if (!vec)
+		return RETERROR(EINVAL, -1);
+	if (!vec->count)
+		return RETERROR(ERANGE, -1);
+
+	-- vec->count;
+	if (elem)
+		memcpy(elem, VEC_AT(vec, vec->count), vec->elsize);
+	return vec->count;
+}
+
+int vec_append(vec_t vec, const void *elems, int n)
+{
+	if (!vec)
+		return RETERROR(EINVAL, -1);
+	return vec_insert(vec, vec->count, elems, n);
+}
+
+int vec_insert(vec_t vec, int index, const void *elems, int n)
+{
+	void *copy = NULL;
+
+	if (!vec || n < 0)
+		return RETERROR(EINVAL, -1);
+	if (index < 0 || index > vec->count)
+		return RETERROR(ERANGE, -1);
+	if (!n)
+		return vec->count;
+
+	/* elements taken from the vector are copied first, as they may be
+	   moved by the reallocation or by the shift of the tail */
+	if (elems && vec_owns(vec, elems))
+	{
+		if (!(copy = mem_scratch_push((size_t) n * vec->elsize)))
+			return -1;
+		elems = memcpy(copy, elems, (size_t) n * vec->elsize);
+	}
+
+	if (vec_grow(vec, n))
+	{
+		SAFEERRNO(mem_scratch_pop(copy));
+		return -1;
+	}
+
+	memmove(VEC_AT(vec, index + n), VEC_AT(vec, index),
+			(size_t) (vec->count - index) * vec->elsize);
+	if (elems)
+		memcpy(VEC_AT(vec, index), elems, (size_t) n * vec->elsize);
+	else
+		memset(VEC_AT(vec, index), 0, (size_t) n * vec->elsize);
+	vec->count += n;
+	mem_scratch_pop(copy);
+	return vec->count;
+}
+
+int vec_erase(vec_t vec, int index, int n)
+{
+	if (!vec || n < 0)
+		return RETERROR(EINVAL, -1);
+	if (index < 0 || n > vec->count - index)
+		return RETERROR(ERANGE, -1);
+	if (!n)
+		return vec->count;
+
+	memmove(VEC_AT(vec, index), VEC_AT(vec, index + n),
+			(size_t) (vec->count - index - n) * vec->elsize);
+	vec->count -= n;
+	return vec->count;
+}
+
+int vec_clear(vec_t vec)
+{
+	if (!vec)
+		return RETERROR(EINVAL, -1);
+	vec->count = 0;
+	return 0;
+}
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,116 @@
+#include <scelib/atom.h>
+#include <scelib/thread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define NB_THREADS	8
+#define NB_STRINGS	20000
+
+static volatile int errors = 0;
+static atoms_t atoms;
+static atom_t interned[NB_THREADS][NB_STRINGS];
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+/* all threads intern the same strings in different orders, growing the */
+/* table, and find back the ones they interned without locking          */
+void worker(thread_t self, void *data)
+{
+	int t = (int) (size_t) data, i, j, bad = 0;
+	char str[32];
+
+	for (i = 0; i < NB_STRINGS; ++i)
+	{
+		j = (t & 1) ? NB_STRINGS - 1 - i : i;
+		sprintf(str, "string %d", j);
+		if (!(interned[t][j] = atom_intern(atoms, str)) ||
+			strcmp(interned[t][j], str))
+			++bad;
+		if (i > 16)
+		{
+			j = (t & 1) ? NB_STRINGS - 1 - i / 2 : i / 2;
+			sprintf(str, "string %d", j);
+			if (atom_find(atoms, str) != interned[t][j])
+				++bad;
+		}
+	}
+	if (bad)
+		thread_atomic_add(&errors, bad);
+}
+
+void test_threads(void)
+{
+	thread_t threads[NB_THREADS];
+	char str[32];
+	int i, t, ok;
+
+	atoms = atoms_new(MAP_SIZE_AUTO);
+	for (t = 0; t < NB_THREADS; ++t)
+	{
+		threads[t] = thread_new(worker, (void *) (size_t) t);
+		thread_start(threads[t]);
+	}
+	for (t = 0; t < NB_THREADS; ++t)
+		thread_waitfor(threads[t]);
+
+	check(atoms_count(atoms) == NB_STRINGS, "count");
+	for (i = 0, ok = 1; i < NB_STRINGS; ++i)
+	{
+		for (t = 1; t < NB_THREADS; ++t)
+			ok &= (interned[t][i] == interned[0][i]);
+		sprintf(str, "string %d", i);
+		ok &= (atom_find(atoms, str) == interned[0][i]);
+		ok &= (atom_len(interned[0][i]) == strlen(str));
+	}
+	check(ok, "single atom per string");
+	check(!atom_find(atoms, "missing") && errno == ERANGE, "find missing");
+	check(atom_intern_len(atoms, "string 12 and more", 9) == interned[0][12],
+		  "intern a prefix");
+}
+
+/* atoms key maps by their pointers */
+void test_map(void)
+{
+	map_t map;
+	char str[32];
+	int i, ok;
+
+	map = map_new(MAP_SIZE_AUTO, atom_map_hash, atom_map_comp, NULL, NULL);
+	for (i = 0; i < NB_STRINGS; i += 10)
+		map_set(map, (void *) interned[0][i], (void *) (size_t) (i + 1), NULL);
+	check(map_count(map) == NB_STRINGS / 10, "map count");
+	for (i = 0, ok = 1; i < NB_STRINGS; ++i)
+	{
+		sprintf(str, "string %d", i);
+		ok &= (map_get(map, (void *) atom_intern(atoms, str)) ==
+			   ((i % 10) ? NULL : (void *) (size_t) (i + 1)));
+	}
+	check(ok, "map keyed by atoms");
+	check(atom_map_hash(97, (void *) interned[0][5]) ==
+		  atom_hash(interned[0][5]) % 97, "map hash");
+	map_delete(map);
+	atoms_delete(atoms);
+}
+
+int main(int argc, char **argv)
+{
+	test_threads();
+	test_map();
+
+	if (errors)
+	{
+		printf("atom tests failed\n");
+		return 1;
+	}
+	printf("atom tests passed\n");
+	return 0;
+}
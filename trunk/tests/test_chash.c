@@ -0,0 +1,151 @@
+#include <scelib/chash.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+
+#define NB_KEYS		100000
+#define NB_NODES	10
+#define NB_VNODES	160
+#define NB_LOOKUPS	2000000
+
+static int errors = 0;
+static char keys[NB_KEYS][16];
+static void *routes[NB_KEYS];
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+void test_balance(chash_t ring, long *ids)
+{
+	int counts[NB_NODES + 1], i;
+
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < NB_KEYS; ++i)
+	{
+		routes[i] = chash_get(ring, keys[i]);
+		++counts[(long *) routes[i] - ids];
+	}
+	for (i = 0; i < NB_NODES; ++i)
+	{
+		/* +/- 25% with 160 virtual nodes per node */
+		check(counts[i] > NB_KEYS / NB_NODES * 3 / 4 &&
+			  counts[i] < NB_KEYS / NB_NODES * 5 / 4, "balance");
+	}
+}
+
+void test_moves(chash_t ring, long *ids)
+{
+	void **batch = (void **) malloc(NB_KEYS * sizeof(void *));
+	static void *keyptrs[NB_KEYS];
+	void *node;
+	int i, moved = 0;
+
+	for (i = 0; i < NB_KEYS; ++i)
+		keyptrs[i] = keys[i];
+	check(chash_add(ring, "node-extra", 1, &ids[NB_NODES]) == NB_NODES + 1, "add");
+	check(chash_add(ring, "node-extra", 1, &ids[NB_NODES]) == -1, "add twice");
+	check(!chash_route(ring, keyptrs, batch, NB_KEYS), "route");
+	for (i = 0; i < NB_KEYS; ++i)
+	{
+		check(batch[i] == chash_get(ring, keys[i]), "route equals get");
+		if (batch[i] != routes[i])
+		{
+			++moved;
+			check(batch[i] == &ids[NB_NODES], "moves to the new node only");
+		}
+	}
+	check(moved > NB_KEYS / (NB_NODES + 1) / 2 &&
+		  moved < NB_KEYS / (NB_NODES + 1) * 2, "moved keys");
+
+	check(chash_remove(ring, "node-extra", &node) == NB_NODES &&
+		  node == &ids[NB_NODES], "remove");
+	for (i = 0; i < NB_KEYS; ++i)
+		check(chash_get(ring, keys[i]) == routes[i], "routes restored");
+	free(batch);
+}
+
+void test_jump(void)
+{
+	int i, h, moved = 0;
+
+	for (i = 0; i < NB_KEYS; ++i)
+	{
+		h = map_ptr_hash(MAP_HASH_MAX, keys[i]);
+		if (chash_jump(h, 10) != chash_jump(h, 11))
+		{
+			++moved;
+			check(chash_jump(h, 11) == 10, "jump moves to the new bucket");
+		}
+	}
+	check(moved > NB_KEYS / 11 / 2 && moved < NB_KEYS / 11 * 2, "jump moved keys");
+}
+
+void bench(chash_t ring)
+{
+	clock_t start;
+	void *sink = NULL;
+	int i;
+
+	start = clock();
+	for (i = 0; i < NB_LOOKUPS; ++i)
+		sink = chash_get(ring, keys[i % NB_KEYS]);
+	printf("%d lookups over %d virtual nodes: %.3fs\n", NB_LOOKUPS,
+		   NB_NODES * NB_VNODES, (double) (clock() - start) / CLOCKS_PER_SEC);
+
+	start = clock();
+	for (i = 0; i < NB_LOOKUPS; ++i)
+		sink = (void *) (long) chash_jump(map_ptr_hash(MAP_HASH_MAX, keys[i % NB_KEYS]),
+										  NB_NODES);
+	printf("%d jump hashes: %.3fs\n", NB_LOOKUPS,
+		   (double) (clock() - start) / CLOCKS_PER_SEC);
+	(void) sink;
+}
+
+int main(int argc, char **argv)
+{
+	long ids[NB_NODES + 1];
+	char name[16];
+	chash_t ring;
+	int i;
+
+	for (i = 0; i < NB_KEYS; ++i)
+		sprintf(keys[i], "key%d", i);
+
+	ring = chash_new(NB_VNODES, map_ptr_hash);
+	check(chash_get(ring, keys[0]) == NULL, "empty ring");
+	for (i = 0; i < NB_NODES; ++i)
+	{
+		sprintf(name, "node-%d", i);
+		check(chash_add(ring, name, 1, &ids[i]) == i + 1, "add count");
+	}
+
+	/* too many virtual nodes, for a node or the ring */
+	check(chash_add(ring, "huge", INT_MAX, &ids[NB_NODES]) == -1 &&
+		  errno == ERANGE, "huge weight");
+	check(chash_add(ring, "big", 100000, &ids[NB_NODES]) == NB_NODES + 1 &&
+		  chash_add(ring, "bigger", 100000, &ids[NB_NODES]) == -1 &&
+		  errno == ERANGE, "too many tokens");
+	check(chash_remove(ring, "big", NULL) == NB_NODES, "remove big");
+	test_balance(ring, ids);
+	test_moves(ring, ids);
+	test_jump();
+	bench(ring);
+	chash_delete(ring);
+
+	if (errors)
+	{
+		printf("chash tests failed\n");
+		return 1;
+	}
+	printf("chash tests passed\n");
+	return 0;
+}
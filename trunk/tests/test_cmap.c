@@ -0,0 +1,117 @@
+#include <scelib/cmap.h>
+#include <scelib/thread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NB_THREADS	8
+#define NB_KEYS		20000	/* per thread */
+
+static volatile int errors = 0;
+static volatile int key_allocs = 0;
+static cmap_t map;
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+int str_hash(int size, void *key)
+{
+	unsigned int h = 5381;
+	char *k;
+
+	for (k = (char *) key; *k; ++k)
+		h = h * 33 + (unsigned char) *k;
+	return (int) (h % (unsigned int) size);
+}
+
+int str_comp(void *key1, void *key2)
+{
+	return strcmp((char *) key1, (char *) key2);
+}
+
+void *str_alloc(void *key)
+{
+	char *k = (char *) malloc(strlen((char *) key) + 1);
+
+	thread_atomic_add(&key_allocs, 1);
+	return (k ? strcpy(k, (char *) key) : NULL);
+}
+
+/* each thread works on its own keys, while the others make the map grow */
+void worker(thread_t self, void *data)
+{
+	int t = (int) (size_t) data, i, bad = 0;
+	char key[32];
+	void *old;
+
+	for (i = 0; i < NB_KEYS; ++i)
+	{
+		sprintf(key, "%d-%d", t, i);
+		if (cmap_set(map, key, (void *) (size_t) (i + 1), NULL) < 0)
+			++bad;
+	}
+	for (i = 0; i < NB_KEYS; ++i)
+	{
+		sprintf(key, "%d-%d", t, i);
+		if (cmap_get(map, key) != (void *) (size_t) (i + 1))
+			++bad;
+		old = NULL;
+		if (cmap_set(map, key, (void *) (size_t) (i + 2), &old) < 0 ||
+			old != (void *) (size_t) (i + 1))
+			++bad;
+	}
+	for (i = 0; i < NB_KEYS; i += 2)
+	{
+		sprintf(key, "%d-%d", t, i);
+		old = NULL;
+		if (cmap_unset(map, key, &old) < 0 || old != (void *) (size_t) (i + 2))
+			++bad;
+	}
+	for (i = 0; i < NB_KEYS; ++i)
+	{
+		sprintf(key, "%d-%d", t, i);
+		if (cmap_get(map, key) != ((i & 1) ? (void *) (size_t) (i + 2) : NULL))
+			++bad;
+	}
+	if (bad)
+		thread_atomic_add(&errors, bad);
+}
+
+void test_threads(void)
+{
+	thread_t threads[NB_THREADS];
+	int i;
+
+	map = cmap_new(0, str_hash, str_comp, str_alloc, free);
+	for (i = 0; i < NB_THREADS; ++i)
+	{
+		threads[i] = thread_new(worker, (void *) (size_t) i);
+		thread_start(threads[i]);
+	}
+	for (i = 0; i < NB_THREADS; ++i)
+		thread_waitfor(threads[i]);
+
+	check(cmap_count(map) == NB_THREADS * NB_KEYS / 2, "count");
+	/* replacing values doesn't copy the keys */
+	check(key_allocs == NB_THREADS * NB_KEYS, "key copies");
+	cmap_delete(map);
+}
+
+int main(int argc, char **argv)
+{
+	test_threads();
+
+	if (errors)
+	{
+		printf("cmap tests failed\n");
+		return 1;
+	}
+	printf("cmap tests passed\n");
+	return 0;
+}
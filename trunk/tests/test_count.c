@@ -0,0 +1,181 @@
+#include <scelib/count.h>
+#include <scelib/thread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NB_THREADS	8
+#define NB_KEYS		3000	/* more than a thread buffer keeps */
+#define NB_ADDS		100000	/* per thread */
+
+static int errors = 0;
+static count_t counts;
+static char keys[NB_KEYS][16];
+static long expected[NB_KEYS];
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+int str_hash(int size, void *key)
+{
+	unsigned int h = 5381;
+	char *k;
+
+	for (k = (char *) key; *k; ++k)
+		h = h * 33 + (unsigned char) *k;
+	return (int) (h % (unsigned int) size);
+}
+
+int str_comp(void *key1, void *key2)
+{
+	return strcmp((char *) key1, (char *) key2);
+}
+
+void *str_alloc(void *key)
+{
+	char *k = (char *) malloc(strlen((char *) key) + 1);
+	return (k ? strcpy(k, (char *) key) : NULL);
+}
+
+/* key and delta of the ith increment of a thread */
+int add_key(int t, int i)
+{
+	return (i * 7 + t * 13) % NB_KEYS;
+}
+
+long add_delta(int k)
+{
+	return k % 3 + 1;
+}
+
+/* even threads add one by one, odd ones in bulk; their buffers are merged */
+/* as they exit                                                             */
+void worker(thread_t self, void *data)
+{
+	int t = (int) (size_t) data, i, j, k;
+	void *bkeys[64];
+	long bdeltas[64];
+
+	for (i = 0; i < NB_ADDS; i += 64)
+	{
+		for (j = 0; j < 64; ++j)
+		{
+			k = add_key(t, i + j);
+			if (t & 1)
+			{
+				bkeys[j] = keys[k];
+				bdeltas[j] = add_delta(k);
+			}
+			else
+				count_add(counts, keys[k], add_delta(k));
+		}
+		if (t & 1)
+			count_add_bulk(counts, bkeys, bdeltas, 64);
+	}
+}
+
+void test_threads(void)
+{
+	thread_t threads[NB_THREADS];
+	count_entry_t *snap;
+	long total = 0, sum = 0;
+	int i, t, n, ok;
+
+	for (i = 0; i < NB_KEYS; ++i)
+		sprintf(keys[i], "key%d", i);
+	for (t = 0; t < NB_THREADS; ++t)
+	{
+		for (i = 0; i < NB_ADDS; i += 64)
+		{
+			for (n = 0; n < 64; ++n)
+			{
+				expected[add_key(t, i + n)] += add_delta(add_key(t, i + n));
+				total += add_delta(add_key(t, i + n));
+			}
+		}
+	}
+
+	counts = count_new(str_hash, str_comp, str_alloc, free);
+	for (t = 0; t < NB_THREADS; ++t)
+	{
+		threads[t] = thread_new(worker, (void *) (size_t) t);
+		thread_start(threads[t]);
+	}
+	for (t = 0; t < NB_THREADS; ++t)
+		thread_waitfor(threads[t]);
+
+	for (i = 0, ok = 1; i < NB_KEYS; ++i)
+		ok &= (count_get(counts, keys[i]) == expected[i]);
+	check(ok, "merged counters");
+	check(count_get(counts, "unknown") == 0, "unknown counter");
+
+	/* the calling thread buffer is also part of the counters */
+	count_add(counts, keys[0], 5);
+	check(count_get(counts, keys[0]) == expected[0] + 5, "own buffer");
+
+	snap = count_snapshot(counts, &n);
+	check(snap && n == NB_KEYS, "snapshot count");
+	for (i = 0; snap && i < n; ++i)
+		sum += snap[i].count;
+	check(sum == total + 5, "snapshot total");
+	free(snap);
+	count_delete(counts);
+}
+
+/* adds to a hot counter, the other keys making the buffer merge often */
+static volatile int adding;
+
+void hot_worker(thread_t self, void *data)
+{
+	int i;
+
+	for (i = 0; i < NB_ADDS; ++i)
+	{
+		count_add(counts, "hot", 1);
+		count_add(counts, keys[i % NB_KEYS], 1);
+	}
+	adding = 0;
+}
+
+/* a counter only incremented never reads lower, even while merged */
+void test_monotonic(void)
+{
+	thread_t thread;
+	long value, last = 0;
+	int ok = 1;
+
+	counts = count_new(str_hash, str_comp, str_alloc, free);
+	adding = 1;
+	thread = thread_new(hot_worker, NULL);
+	thread_start(thread);
+	while (adding)
+	{
+		value = count_get(counts, "hot");
+		ok &= (value >= last);
+		last = value;
+	}
+	thread_waitfor(thread);
+	check(ok, "monotonic counter");
+	check(count_get(counts, "hot") == NB_ADDS, "hot counter");
+	count_delete(counts);
+}
+
+int main(int argc, char **argv)
+{
+	test_threads();
+	test_monotonic();
+
+	if (errors)
+	{
+		printf("count tests failed\n");
+		return 1;
+	}
+	printf("count tests passed\n");
+	return 0;
+}
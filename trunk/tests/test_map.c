@@ -0,0 +1,265 @@
+#include <scelib/map.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NB_KEYS		10000
+
+static int errors = 0;
+static time_t fake_now = 0;
+
+/* the clock of the maps, set by the tests when fake_now isn't 0 */
+time_t time(time_t *t)
+{
+	struct timespec ts;
+	time_t now = fake_now;
+
+	if (!now)
+	{
+		clock_gettime(CLOCK_REALTIME, &ts);
+		now = ts.tv_sec;
+	}
+	if (t)
+		*t = now;
+	return now;
+}
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+int str_comp(void *key1, void *key2)
+{
+	return strcmp((char *) key1, (char *) key2);
+}
+
+void *str_alloc(void *key)
+{
+	char *k = (char *) malloc(strlen((char *) key) + 1);
+	return (k ? strcpy(k, (char *) key) : NULL);
+}
+
+void test_order(void)
+{
+	static char *keys[] = { "one", "two", "three", "four", "five", NULL };
+	map_t map;
+	map_iter_t iter;
+	void *key, *data;
+	int i;
+
+	map = map_new(MAP_SIZE_AUTO, map_ptr_hash, str_comp, str_alloc, free);
+	for (i = 0; keys[i]; ++i)
+		map_set(map, keys[i], keys[i], NULL);
+	map_unset(map, "two", NULL);
+	map_set(map, "two", keys[1], NULL);
+	map_set(map, "one", keys[0], NULL);	/* replacing keeps the position */
+
+	iter = map_iter_new(map);
+	i = 0;
+	while (map_iter_next(iter, &key, &data))
+	{
+		static char *expected[] = { "one", "three", "four", "five", "two" };
+		check(!strcmp((char *) key, expected[i]), "insertion order");
+		check(data != key, "keys duplicated");
+		++i;
+	}
+	check(i == 5, "iteration count");
+	map_iter_delete(iter);
+	map_delete(map);
+}
+
+void test_growth(void)
+{
+	static char keys[NB_KEYS][8];
+	map_t map;
+	map_iter_t iter;
+	void *key, *data;
+	int i;
+
+	map = map_new(MAP_SIZE_AUTO, map_ptr_hash, str_comp, NULL, NULL);
+	for (i = 0; i < NB_KEYS; ++i)
+	{
+		sprintf(keys[i], "k%d", i);
+		check(map_set(map, keys[i], keys[i], NULL) == i + 1, "set count");
+	}
+	for (i = 0; i < NB_KEYS; i += 2)
+		check(map_unset(map, keys[i], &data) == NB_KEYS - i / 2 - 1, "unset count");
+	for (i = 0; i < NB_KEYS; ++i)
+		check(map_get(map, keys[i]) == ((i % 2) ? keys[i] : NULL), "get");
+
+	iter = map_iter_new(map);
+	i = 1;
+	while (map_iter_next(iter, &key, &data))
+	{
+		check(key == keys[i], "order after deletions");
+		i += 2;
+	}
+	map_iter_delete(iter);
+
+	check(map_clear(map, MAP_SIZE_AUTO) == 0 && map_count(map) == 0, "clear");
+	map_delete(map);
+}
+
+void test_ttl(void)
+{
+	static char *keys[] = { "short", "long", "none", "reset", NULL };
+	map_t map;
+	time_t start;
+	int i;
+
+	map = map_new(MAP_SIZE_AUTO, map_ptr_hash, str_comp, str_alloc, free);
+	for (i = 0; keys[i]; ++i)
+		map_set(map, keys[i], keys[i], NULL);
+	check(map_set_ttl(map, "short", 1) == 0, "set ttl");
+	check(map_set_ttl(map, "long", 3600) == 0, "set long ttl");
+	check(map_set_ttl(map, "reset", 1) == 0 && map_set_ttl(map, "reset", 0) == 0,
+		  "reset ttl");
+	check(map_set_ttl(map, "missing", 1) == -1, "ttl of a missing key");
+	check(map_expire(map) == 0, "nothing expired yet");
+
+	/* waits for the short ttl to elapse */
+	for (start = time(NULL); time(NULL) < start + 2; )
+		;
+	check(map_get(map, "short") == NULL, "expired key missing");
+	check(map_get(map, "long") == keys[1], "long ttl key present");
+	check(map_get(map, "reset") == keys[3], "reset key present");
+	check(map_count(map) == 4, "count before sweep");
+	check(map_expire(map) == 1 && map_count(map) == 3, "sweep");
+	map_delete(map);
+}
+
+/* a timer of the second level due on its first second is cascaded when due */
+void test_ttl_boundary(void)
+{
+	map_t map;
+	time_t due;
+
+	fake_now = 64 * 1000 + 10;
+	due = 64 * 1002;	/* more than 64 s away */
+	map = map_new(MAP_SIZE_AUTO, map_ptr_hash, str_comp, str_alloc, free);
+	map_set(map, "due", (void *) 1, NULL);
+	map_set(map, "later", (void *) 1, NULL);
+	map_set_ttl(map, "due", (int) (due - fake_now));
+	map_set_ttl(map, "later", (int) (due + 1 - fake_now));
+
+	fake_now = due - 1;
+	check(map_expire(map) == 0, "boundary not yet due");
+	fake_now = due;
+	check(map_expire(map) == 1 && !map_get(map, "due") && map_count(map) == 1,
+		  "boundary due");
+	fake_now = due + 1;
+	check(map_expire(map) == 1 && map_count(map) == 0, "boundary next");
+	map_delete(map);
+	fake_now = 0;
+}
+
+void *sum_data(void *key, void *dstdata, void *srcdata)
+{
+	return (void *) ((long) dstdata + (long) srcdata);
+}
+
+void test_merge(void)
+{
+	static char keys[NB_KEYS][8];
+	map_t shards[4], map;
+	int i, s;
+
+	for (s = 0; s < 4; ++s)
+	{
+		shards[s] = map_new(MAP_SIZE_AUTO, map_ptr_hash, str_comp, NULL, NULL);
+		for (i = s; i < NB_KEYS; i += s + 1)
+		{
+			sprintf(keys[i], "k%d", i);
+			map_set(shards[s], keys[i], (void *) 1L, NULL);
+		}
+	}
+
+	/* keys are shared by the shards, and hashed as pointers */
+	map = map_new(MAP_SIZE_AUTO, map_ptr_hash, str_comp, NULL, NULL);
+	check(map_merge_all(map, shards, 4, sum_data, 4) == NB_KEYS, "merge count");
+	check((long) map_get(map, keys[11]) == 4 && (long) map_get(map, keys[5]) == 3,
+		  "merge conflicts");
+	check(map_merge(map, shards[0], NULL) == NB_KEYS &&
+		  (long) map_get(map, keys[11]) == 1, "merge replace");
+	check(map_intersect(map, shards[3], sum_data) == NB_KEYS / 4 &&
+		  (long) map_get(map, keys[3]) == 2, "intersect");
+	check(map_diff(map, shards[2]) == NB_KEYS / 4 - (NB_KEYS + 1) / 12, "diff");
+	check(map_get(map, keys[7]) && !map_get(map, keys[11]), "diff keys");
+	map_delete(map);
+	for (s = 0; s < 4; ++s)
+		map_delete(shards[s]);
+}
+
+int str_hash(int size, void *key)
+{
+	unsigned int h = 5381;
+	char *k;
+
+	for (k = (char *) key; *k; ++k)
+		h = h * 33 + (unsigned char) *k;
+	return (int) (h % (unsigned int) size);
+}
+
+/* a destination key expired before the merge is replaced by the first */
+/* source having it, and freed                                          */
+void test_merge_expired(void)
+{
+	map_t shards[2], map;
+	time_t start;
+	int s;
+
+	map = map_new(MAP_SIZE_AUTO, str_hash, str_comp, str_alloc, free);
+	map_set(map, "expired", (void *) 10L, NULL);
+	map_set(map, "kept", (void *) 10L, NULL);
+	map_set_ttl(map, "expired", 1);
+	for (s = 0; s < 2; ++s)
+	{
+		shards[s] = map_new(MAP_SIZE_AUTO, str_hash, str_comp, str_alloc, free);
+		map_set(shards[s], "expired", (void *) 1L, NULL);
+		map_set(shards[s], "kept", (void *) 1L, NULL);
+	}
+	for (start = time(NULL); time(NULL) < start + 2; )
+		;
+
+	check(map_merge_all(map, shards, 2, sum_data, 2) == 2, "merge expired count");
+	check((long) map_get(map, "expired") == 2 && (long) map_get(map, "kept") == 12,
+		  "merge expired");
+	map_delete(map);
+	for (s = 0; s < 2; ++s)
+		map_delete(shards[s]);
+}
+
+void test_slot(void)
+{
+	map_t map;
+	void **slot;
+
+	map = map_new(MAP_SIZE_AUTO, map_ptr_hash, str_comp, str_alloc, free);
+	slot = map_slot(map, "counter");
+	check(slot && !*slot && map_count(map) == 1, "slot of a new key");
+	*slot = (void *) 1;
+	slot = map_slot(map, "counter");
+	check(slot && *slot == (void *) 1 && map_count(map) == 1, "slot of a key");
+	*slot = (void *) 2;
+	check(map_get(map, "counter") == (void *) 2, "slot update");
+	map_delete(map);
+}
+
+int main(int argc, char **argv)
+{
+	test_order();
+	test_growth();
+	test_ttl();
+	test_ttl_boundary();
+	test_merge();
+	test_merge_expired();
+	test_slot();
+	printf("%s\n", errors ? "map tests failed" : "map tests passed");
+	return (errors ? 1 : 0);
+}
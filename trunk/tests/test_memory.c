@@ -0,0 +1,388 @@
+#include <scelib/memory.h>
+#include <scelib/thread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <sys/time.h>
+
+#define NB_OBJS		100000
+#define NB_LIVE		256
+#define NB_THREADS	8
+#define OBJ_SIZE	48
+
+static int errors = 0;
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void test_arena(void)
+{
+	mem_arena_t arena = mem_arena_create(1024);
+	mem_arena_mark_t mark;
+	size_t used;
+	int i, *ints;
+
+	for (i = 0; i < 100; ++i)
+	{
+		ints = mem_arena_new(arena, int, 10);
+		check(ints && !ints[9] && !((size_t) ints % sizeof(double)), "arena new");
+	}
+	used = mem_arena_used(arena, NULL);
+	mem_arena_save(arena, &mark);
+	check(!strcmp(mem_arena_strdup(arena, "request"), "request"), "arena strdup");
+	check(mem_arena_alloc(arena, 10000) != NULL, "arena large");
+	mem_arena_rewind(arena, &mark);
+	check(mem_arena_used(arena, NULL) == used, "arena rewind");
+	mem_arena_reset(arena);
+	check(mem_arena_used(arena, NULL) == 0, "arena reset");
+	mem_arena_destroy(arena);
+}
+
+/* allocates and frees objects, keeping NB_LIVE of them alive */
+void churn(thread_t self, void *data)
+{
+	mem_pool_t pool = (mem_pool_t) data;
+	void *live[NB_LIVE];
+	int i, j;
+
+	memset(live, 0, sizeof(live));
+	for (i = 0; i < NB_OBJS; ++i)
+	{
+		j = (i * 7) % NB_LIVE;
+		if (pool)
+		{
+			mem_pool_free(pool, live[j]);
+			live[j] = mem_pool_alloc(pool);
+		}
+		else
+		{
+			free(live[j]);
+			live[j] = calloc(1, OBJ_SIZE);
+		}
+		if (!live[j] || *(int *) live[j])
+			++errors;
+		*(int *) live[j] = i + 1;
+	}
+	for (j = 0; j < NB_LIVE; ++j)
+	{
+		if (pool)
+			mem_pool_free(pool, live[j]);
+		else
+			free(live[j]);
+	}
+}
+
+double run(int nthreads, mem_pool_t pool)
+{
+	thread_t threads[NB_THREADS];
+	double start = now();
+	int i;
+
+	for (i = 0; i < nthreads; ++i)
+	{
+		threads[i] = thread_new(churn, pool);
+		thread_start(threads[i]);
+	}
+	for (i = 0; i < nthreads; ++i)
+		thread_waitfor(threads[i]);
+	return now() - start;
+}
+
+void test_pool(void)
+{
+	mem_pool_t pool = mem_pool_create(OBJ_SIZE, 1);
+	void *objs[1000];
+	int i, n;
+
+	for (i = 0; i < 1000; ++i)
+		objs[i] = mem_pool_alloc(pool);
+	for (i = 1; i < 1000; ++i)
+		check(objs[i] != objs[i - 1], "pool distinct objects");
+	for (i = 0; i < 1000; ++i)
+		mem_pool_free(pool, objs[i]);
+
+	/* objects are recycled by other threads, and zeroed */
+	for (n = 1; n <= NB_THREADS; n *= 2)
+	{
+		printf("%d thread(s), %d alloc/free each: pool %.3fs, calloc %.3fs\n",
+			   n, NB_OBJS, run(n, pool), run(n, NULL));
+	}
+	mem_pool_destroy(pool);
+}
+
+/* counts the releases of a wrapped buffer */
+void release(void *data, size_t len, void *context)
+{
+	++ *(int *) context;
+	free(data);
+}
+
+void test_buf(void)
+{
+	mem_buf_t root, slice, sub;
+	int released = 0;
+	char *data;
+
+	data = (char *) malloc(100);
+	memset(data, 'a', 100);
+	root = mem_buf_wrap(data, 100, release, &released);
+	check(root && mem_buf_refs(root) == 1 && mem_buf_data(root) == data &&
+		  mem_buf_len(root) == 100, "buf wrap");
+
+	check(!mem_buf_slice(root, 90, 11) && !mem_buf_slice(root, 101, 0),
+		  "buf slice out of range");
+	slice = mem_buf_slice(root, 10, 50);
+	check(slice && mem_buf_data(slice) == data + 10 && mem_buf_len(slice) == 50 &&
+		  mem_buf_refs(root) == 2, "buf slice");
+	check(!mem_buf_slice(slice, 40, 11), "buf slice of slice out of range");
+
+	/* a slice of a slice refers to the root */
+	sub = mem_buf_slice(slice, 5, 10);
+	check(sub && mem_buf_data(sub) == data + 15 && mem_buf_refs(root) == 3 &&
+		  mem_buf_refs(slice) == 1, "buf slice of slice");
+
+	/* the slices keep the root alive */
+	mem_buf_unref(root);
+	check(!released && mem_buf_refs(root) == 2, "buf root kept by slices");
+	mem_buf_unref(slice);
+	check(!released && ((char *) mem_buf_data(sub))[9] == 'a',
+		  "buf root kept by a slice of slice");
+	mem_buf_ref(sub);
+	mem_buf_unref(sub);
+	check(!released, "buf shared slice");
+	mem_buf_unref(sub);
+	check(released == 1, "buf released once");
+
+	/* owned copies */
+	root = mem_buf_dup("copy", 5);
+	check(root && !strcmp((char *) mem_buf_data(root), "copy"), "buf dup");
+	mem_buf_unref(root);
+}
+
+/* tells if scratch memory is in the region starting at first */
+int in_region(char *mem, char *first)
+{
+	return (mem >= first && mem < first + MEM_SCRATCH_SIZE);
+}
+
+void test_scratch(void)
+{
+	char *outer, *a, *b, *heap1, *heap2;
+	size_t mapped;
+	int *ints;
+
+	outer = (char *) mem_scratch_push(100);
+	mapped = mallinfo2().hblkhd;	/* the region included */
+	a = (char *) mem_scratch_push(100);
+	check(outer && a > outer && !((size_t) a % sizeof(double)), "scratch push");
+
+	/* LIFO: popped memory is pushed again */
+	mem_scratch_pop(a);
+	b = (char *) mem_scratch_push(50);
+	check(b == a, "scratch pop");
+	ints = mem_scratch_new(int, 100);
+	check(ints && !ints[0] && !ints[99], "scratch calloc");
+
+	/* past the region, the memory comes from the heap */
+	heap1 = (char *) mem_scratch_push(MEM_SCRATCH_SIZE);
+	check(heap1 && !in_region(heap1, outer), "scratch heap");
+	memset(heap1, 1, MEM_SCRATCH_SIZE);
+	a = (char *) mem_scratch_push(100);
+	check(a && in_region(a, outer), "scratch region after heap");
+	heap2 = (char *) mem_scratch_push(MEM_SCRATCH_SIZE);
+	check(heap2 && !in_region(heap2, outer), "scratch heap again");
+	memset(heap2, 2, MEM_SCRATCH_SIZE);
+
+	/* popping the outer block gives all of them back, heap ones included */
+	mem_scratch_pop(outer);
+	a = (char *) mem_scratch_push(100);
+	check(a == outer, "scratch pop outer");
+	/* glibc maps blocks this large, and unmaps them when freed */
+	check(mallinfo2().hblkhd == mapped, "scratch heap freed");
+	mem_scratch_pop(a);
+	mem_scratch_pop(NULL);
+}
+
+/* tells if all the bytes of some memory are zero */
+int zeroed(const char *mem, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+	{
+		if (mem[i])
+			return 0;
+	}
+	return 1;
+}
+
+void test_aligned(void)
+{
+	char *mem, *lines;
+	size_t stride;
+	int i, ok;
+
+	mem = mem_new_aligned(char, 100, 256);
+	check(mem && !((size_t) mem % 256) && zeroed(mem, 100), "aligned new");
+	check(!mem_new_aligned(char, 10, 24), "aligned on a non power of 2");
+	memset(mem, 'a', 100);
+
+	/* growing keeps the contents and zeroes the rest, whatever alignment */
+	mem = mem_renew_aligned(mem, char, 10000, 4096);
+	check(mem && !((size_t) mem % 4096), "aligned realloc alignment");
+	for (i = 0, ok = (mem != NULL); ok && i < 100; ++i)
+		ok &= (mem[i] == 'a');
+	check(ok && zeroed(mem + 100, 9900), "aligned realloc contents");
+	mem = mem_renew_aligned(mem, char, 50, 16);
+	check(mem && !((size_t) mem % 16) && mem[49] == 'a', "aligned shrink");
+	mem_free_aligned((void **) &mem);
+	check(!mem, "aligned free");
+
+	/* each element on its own cache lines */
+	lines = (char *) mem_lines_new(MEM_CACHE_LINE + 1, 8, &stride);
+	check(lines && !((size_t) lines % MEM_CACHE_LINE) &&
+		  stride == 2 * MEM_CACHE_LINE, "lines stride");
+	check(zeroed(lines, 8 * stride), "lines zeroed");
+	check(mem_lines_at(char, lines, stride, 3) == lines + 3 * stride, "lines at");
+	mem_free_aligned((void **) &lines);
+	lines = (char *) mem_lines_new(sizeof(long), 4, &stride);
+	check(lines && stride == MEM_CACHE_LINE, "lines small stride");
+	mem_free_aligned((void **) &lines);
+}
+
+/* tells if memory holds n bytes of c, then zeroes up to len */
+int filled(const char *mem, char c, size_t n, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+	{
+		if (mem[i] != c)
+			return 0;
+	}
+	return zeroed(mem + n, len - n);
+}
+
+void test_large(void)
+{
+	size_t old = mem_large_threshold(4096);
+	char *mem;
+
+	/* calloc() memory, moving to a mapping when grown */
+	mem = (char *) mem_large_alloc(100);
+	check(mem && zeroed(mem, 100), "large small alloc");
+	memset(mem, 'a', 100);
+	mem_large_realloc((void **) &mem, 10000);
+	check(mem && filled(mem, 'a', 100, 10000), "large to mapping");
+	memset(mem, 'b', 10000);
+
+	/* shrinking within the same pages, then growing in place */
+	mem_large_realloc((void **) &mem, 9000);
+	check(mem && filled(mem, 'b', 9000, 9000), "large shrink in place");
+	mem_large_realloc((void **) &mem, 10000);
+	check(mem && filled(mem, 'b', 9000, 10000), "large grow in place");
+
+	/* shrinking the mapping, then growing it back */
+	mem_large_realloc((void **) &mem, 5000);
+	check(mem && filled(mem, 'b', 5000, 5000), "large shrink mapping");
+	mem_large_realloc((void **) &mem, 10000);
+	check(mem && filled(mem, 'b', 5000, 10000), "large grow mapping");
+
+	/* remapped when much larger */
+	mem_large_realloc((void **) &mem, 10 * 1024 * 1024);
+	check(mem && filled(mem, 'b', 5000, 10 * 1024 * 1024), "large remap");
+	mem_large_free((void **) &mem);
+	check(!mem, "large free");
+
+	check(mem_large_threshold(old) == 4096, "large threshold");
+}
+
+void test_trace(void)
+{
+	mem_trace_stats_t base, stats;
+	void *objs[1000];
+	char line[256];
+	FILE *out;
+	long live;
+	int i, found = 0;
+
+	/* every allocation recorded */
+	mem_trace_sample(0);
+	mem_trace_stats(&base);
+	for (i = 0; i < 10; ++i)
+		objs[i] = mem_trace_calloc(100, 1, "trace.c", 1);
+	mem_trace_realloc(&objs[0], 1000, "trace.c", 2);
+	mem_trace_stats(&stats);
+	check(stats.allocs == base.allocs + 11 && stats.frees == base.frees &&
+		  stats.bytes == base.bytes + 2000, "trace counts");
+	check(stats.live == base.live + 1900 && stats.peak >= base.live + 1900,
+		  "trace live bytes");
+	check(stats.sizes[7] == base.sizes[7] + 10 &&
+		  stats.sizes[10] == base.sizes[10] + 1, "trace size classes");
+
+	/* the dump lists the call sites */
+	out = tmpfile();
+	check(out && !mem_trace_dump(out), "trace dump");
+	rewind(out);
+	while (fgets(line, sizeof(line), out))
+	{
+		if (!strncmp(line, "trace.c:1: live 900, allocs 10,", 31))
+			++found;
+	}
+	fclose(out);
+	check(found == 1, "trace dump sites");
+
+	for (i = 0; i < 10; ++i)
+		mem_trace_free(&objs[i], "trace.c", 3);
+	mem_trace_stats(&stats);
+	check(stats.frees == base.frees + 10 && stats.live == base.live,
+		  "trace frees");
+
+	/* sampled, the live bytes are estimated */
+	mem_trace_sample(4096);
+	for (i = 0; i < 1000; ++i)
+		objs[i] = mem_trace_calloc(100, 1, "trace.c", 4);
+	mem_trace_stats(&stats);
+	live = (long) (stats.live - base.live);
+	check(stats.allocs == base.allocs + 1011 &&
+		  live > 100000 - 2 * 4096 && live < 100000 + 2 * 4096, "trace sampling");
+	for (i = 0; i < 1000; ++i)
+		mem_trace_free(&objs[i], "trace.c", 5);
+	mem_trace_stats(&stats);
+	check(stats.live == base.live, "trace sampled frees");
+	mem_trace_sample(0);
+}
+
+int main(int argc, char **argv)
+{
+	test_arena();
+	test_pool();
+	test_buf();
+	test_scratch();
+	test_aligned();
+	test_large();
+	test_trace();
+
+	if (errors)
+	{
+		printf("memory tests failed\n");
+		return 1;
+	}
+	printf("memory tests passed\n");
+	return 0;
+}
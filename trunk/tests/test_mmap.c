@@ -0,0 +1,152 @@
+#include <scelib/mmap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define FILE_LEN	100000
+
+static int errors = 0;
+static int fail_file_maps = 0;
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+/* fails the file mappings on demand, as some file systems do, so that the */
+/* file is read instead                                                    */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+	if (fail_file_maps && fd != -1)
+	{
+		errno = ENODEV;
+		return MAP_FAILED;
+	}
+	return (void *) syscall(SYS_mmap, addr, len, prot, flags, fd, off);
+}
+
+/* writes a file of FILE_LEN known bytes */
+int write_file(const char *path)
+{
+	FILE *f;
+	int i;
+
+	if (!(f = fopen(path, "wb")))
+		return 0;
+	for (i = 0; i < FILE_LEN; ++i)
+		fputc('a' + i % 26, f);
+	return !fclose(f);
+}
+
+/* tells if memory holds the bytes of write_file() */
+int holds(const char *mem, size_t len)
+{
+	size_t i;
+
+	if (len != FILE_LEN)
+		return 0;
+	for (i = 0; i < len; ++i)
+	{
+		if (mem[i] != 'a' + (int) (i % 26))
+			return 0;
+	}
+	return 1;
+}
+
+void test_file(const char *path)
+{
+	char *mem;
+	size_t len;
+
+	mem = (char *) mem_map_file(path, MEM_MAP_SEQUENTIAL | MEM_MAP_POPULATE, &len);
+	check(mem && holds(mem, len), "map");
+	check(!mem_map_advise(mem, len, MEM_MAP_RANDOM | MEM_MAP_WILLNEED), "advise");
+	check(!mem_unmap_file(mem, len), "unmap");
+
+	/* private writable mapping */
+	mem = (char *) mem_map_file(path, MEM_MAP_WRITE, &len);
+	check(mem && holds(mem, len), "map writable");
+	if (mem)
+	{
+		memset(mem, 'z', len);
+		mem_unmap_file(mem, len);
+	}
+	mem = (char *) mem_map_file(path, 0, &len);
+	check(mem && holds(mem, len), "file unchanged by writes");
+	mem_unmap_file(mem, len);
+
+	/* read in memory when it can't be mapped */
+	fail_file_maps = 1;
+	mem = (char *) mem_map_file(path, 0, &len);
+	check(mem && holds(mem, len), "read instead of mapped");
+	check(!mem_unmap_file(mem, len), "unmap read file");
+	mem = (char *) mem_map_file(path, MEM_MAP_WRITE, &len);
+	check(mem && holds(mem, len), "read writable");
+	if (mem)
+	{
+		mem[0] = 'z';
+		mem_unmap_file(mem, len);
+	}
+	fail_file_maps = 0;
+}
+
+void test_special(const char *dir, const char *empty)
+{
+	FILE *f;
+	void *mem;
+	size_t len = 1;
+
+	f = fopen(empty, "wb");
+	fclose(f);
+	mem = mem_map_file(empty, 0, &len);
+	check(mem && len == 0, "empty file");
+	check(!mem_map_advise(mem, len, MEM_MAP_SEQUENTIAL) &&
+		  !mem_unmap_file(mem, len), "unmap empty file");
+
+	/* pseudo files report a zero size */
+	len = 1;
+	mem = mem_map_file("/proc/self/status", 0, &len);
+	check(mem && len == 0, "pseudo file");
+	mem_unmap_file(mem, len);
+
+	check(!mem_map_file(dir, 0, &len) && errno == EINVAL, "directory");
+	check(!mem_map_file("/nonexistent/file", 0, &len) && errno == ENOENT,
+		  "missing file");
+	check(!mem_map_file(empty, 0, NULL) && errno == EINVAL, "no length");
+	check(mem_unmap_file(NULL, 0) == -1 && errno == EINVAL, "unmap NULL");
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/mmapXXXXXX", path[64], empty[64];
+
+	if (!mkdtemp(dir))
+	{
+		printf("can't create the test directory\n");
+		return 1;
+	}
+	sprintf(path, "%s/file", dir);
+	sprintf(empty, "%s/empty", dir);
+	check(write_file(path), "write file");
+	test_file(path);
+	test_special(dir, empty);
+	unlink(path);
+	unlink(empty);
+	rmdir(dir);
+
+	if (errors)
+	{
+		printf("mmap tests failed\n");
+		return 1;
+	}
+	printf("mmap tests passed\n");
+	return 0;
+}
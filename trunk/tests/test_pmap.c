@@ -0,0 +1,123 @@
+#include <scelib/pmap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define NB_KEYS		300
+
+/* glibc allocator, to make malloc() fail on demand */
+extern void *__libc_malloc(size_t size);
+
+static int errors = 0;
+static int fail_countdown = 0;
+static int live_keys = 0;
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+/* fails the fail_countdown-th allocation */
+void *malloc(size_t size)
+{
+	if (fail_countdown && !--fail_countdown)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	return __libc_malloc(size);
+}
+
+/* a poor hash, so that chains and deep branches are built */
+int num_hash(int size, void *key)
+{
+	return (atoi((char *) key) * 37) % 1024 % size;
+}
+
+int str_comp(void *key1, void *key2)
+{
+	return strcmp((char *) key1, (char *) key2);
+}
+
+void *str_alloc(void *key)
+{
+	char *k = (char *) malloc(strlen((char *) key) + 1);
+
+	if (k)
+		++live_keys;
+	return (k ? strcpy(k, (char *) key) : NULL);
+}
+
+void str_free(void *key)
+{
+	--live_keys;
+	free(key);
+}
+
+/* every allocation of pmap_set() fails in turn, leaving the map untouched */
+void test_oom(void)
+{
+	pmap_t map, snap;
+	char key[16];
+	int i, n, ret, count;
+
+	map = pmap_new(num_hash, str_comp, str_alloc, str_free);
+	for (i = 0; i < NB_KEYS; ++i)
+	{
+		sprintf(key, "%d", i);
+		count = pmap_count(map);
+		for (n = 1; ; ++n)
+		{
+			fail_countdown = n;
+			ret = pmap_set(map, key, (void *) (size_t) (i + 1), NULL);
+			fail_countdown = 0;
+			if (ret >= 0)
+				break;
+			check(errno == ENOMEM, "set failure errno");
+			check(pmap_count(map) == count, "count kept on failure");
+			check(!pmap_get(map, key), "key not set on failure");
+		}
+		check(ret == count + 1, "set after failures");
+		check(pmap_get(map, key) == (void *) (size_t) (i + 1), "get");
+	}
+
+	/* replacing values of a shared tree */
+	snap = pmap_snapshot(map);
+	for (i = 0; i < NB_KEYS; i += 7)
+	{
+		sprintf(key, "%d", i);
+		for (n = 1; ; ++n)
+		{
+			fail_countdown = n;
+			ret = pmap_set(map, key, NULL, NULL);
+			fail_countdown = 0;
+			if (ret >= 0)
+				break;
+			check(pmap_get(map, key) == (void *) (size_t) (i + 1),
+				  "value kept on failure");
+		}
+		check(!pmap_get(map, key), "replaced");
+		check(pmap_get(snap, key) == (void *) (size_t) (i + 1), "snapshot");
+	}
+	pmap_delete(snap);
+	pmap_delete(map);
+	check(live_keys == 0, "keys freed once");
+}
+
+int main(int argc, char **argv)
+{
+	test_oom();
+
+	if (errors)
+	{
+		printf("pmap tests failed\n");
+		return 1;
+	}
+	printf("pmap tests passed\n");
+	return 0;
+}
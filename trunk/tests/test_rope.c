@@ -0,0 +1,164 @@
+#include <scelib/rope.h>
+#include <scelib/strbuf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define NB_EDITS	5000
+#define MAX_EDIT	3000	/* more than a chunk */
+#define BENCH_LEN	(2700 * 1024)
+#define BENCH_LOOPS	100000
+
+static int errors = 0;
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* tells if a rope holds a flat string, read as a whole and by chunks */
+int holds(rope_t rope, const char *flat, size_t len)
+{
+	const char *chunk;
+	size_t pos, n;
+
+	if (rope_len(rope) != len || strcmp(rope_str(rope), flat))
+		return 0;
+	for (pos = 0; (chunk = rope_chunk(rope, pos, &n)); pos += n)
+	{
+		if (!n || memcmp(chunk, flat + pos, n))
+			return 0;
+	}
+	return (pos == len);
+}
+
+/* random inserts and erases, spanning chunk boundaries, also made on a */
+/* flat string                                                          */
+void test_edits(void)
+{
+	rope_t rope;
+	char *flat, *str, copy[MAX_EDIT];
+	size_t len = 0, pos, n;
+	int i, ok;
+
+	srand(42);
+	flat = (char *) malloc(NB_EDITS * MAX_EDIT + 1);
+	str = (char *) malloc(MAX_EDIT);
+	flat[0] = '\0';
+	rope = rope_new();
+	check(rope && holds(rope, "", 0), "new");
+
+	for (i = 0, ok = 1; i < NB_EDITS; ++i)
+	{
+		pos = (len ? (size_t) rand() % (len + 1) : 0);
+		if (i % 3 == 2 && len)
+		{
+			n = (size_t) rand() % MAX_EDIT;
+			if (n > len - pos)
+				n = len - pos;
+			ok &= !rope_erase(rope, pos, n);
+			memmove(flat + pos, flat + pos + n, len - pos - n + 1);
+			len -= n;
+		}
+		else
+		{
+			/* mostly small insertions, filling the chunks in place */
+			n = (size_t) rand() % ((i % 4) ? 16 : MAX_EDIT) + 1;
+			memset(str, 'a' + i % 26, n);
+			ok &= !rope_insert(rope, pos, str, n);
+			memmove(flat + pos + n, flat + pos, len - pos + 1);
+			memcpy(flat + pos, str, n);
+			len += n;
+		}
+		if (i % 100 == 0)
+			ok &= holds(rope, flat, len);
+	}
+	check(ok, "edits");
+	check(holds(rope, flat, len), "edited rope");
+
+	for (i = 0, ok = 1; i < 100; ++i)
+	{
+		pos = (size_t) rand() % len;
+		n = rope_copy(rope, pos, MAX_EDIT, copy);
+		ok &= (n == (len - pos < MAX_EDIT ? len - pos : MAX_EDIT) &&
+			   !memcmp(copy, flat + pos, n));
+	}
+	check(ok, "copy");
+	check(rope_insert(rope, len + 1, "x", 1) < 0, "insert out");
+	check(rope_erase(rope, len, 1) < 0, "erase out");
+	check(!rope_chunk(rope, len, &n), "chunk at the end");
+
+	check(!rope_erase(rope, 0, len) && holds(rope, "", 0), "erase all");
+	check(!rope_append(rope, "abc", 3) && holds(rope, "abc", 3), "append");
+
+	rope_delete(rope);
+	free(str);
+	free(flat);
+}
+
+/* time of an insertion in the middle of a large text, with a rope or with */
+/* a string buffer                                                         */
+double bench(int lib)
+{
+	rope_t rope = NULL;
+	strbuf_t sb = NULL;
+	char *text;
+	double start;
+	int i, loops = (lib ? BENCH_LOOPS / 100 : BENCH_LOOPS);
+
+	text = (char *) malloc(BENCH_LEN);
+	memset(text, 'x', BENCH_LEN);
+	if (!lib)
+	{
+		rope = rope_new();
+		rope_append(rope, text, BENCH_LEN);
+	}
+	else
+	{
+		sb = strbuf_new(BENCH_LEN + loops);
+		strbuf_append_len(sb, text, BENCH_LEN);
+	}
+
+	start = now();
+	for (i = 0; i < loops; ++i)
+	{
+		if (!lib)
+			rope_insert(rope, rope_len(rope) / 2, "y", 1);
+		else
+			strbuf_insert(sb, strbuf_len(sb) / 2, "y", 1);
+	}
+	start = (now() - start) / loops;
+
+	rope_delete(rope);
+	strbuf_delete(sb);
+	free(text);
+	return start;
+}
+
+int main(int argc, char **argv)
+{
+	test_edits();
+	printf("middle insertion in %d KB: rope %.3fus, strbuf %.3fus\n",
+		   BENCH_LEN / 1024, bench(0) * 1e6, bench(1) * 1e6);
+
+	if (errors)
+	{
+		printf("rope tests failed\n");
+		return 1;
+	}
+	printf("rope tests passed\n");
+	return 0;
+}
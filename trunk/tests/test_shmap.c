@@ -0,0 +1,196 @@
+#include <scelib/shmap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#define SHM_NAME	"/scelib_test_shmap"
+
+static int errors = 0;
+static int die_in_lock = 0;
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+int str_hash(int size, void *key)
+{
+	unsigned int h = 5381;
+	char *k;
+
+	for (k = (char *) key; *k; ++k)
+		h = h * 33 + (unsigned char) *k;
+	return (int) (h % (unsigned int) size);
+}
+
+/* called by writers with the lock held, so a process can die holding it */
+int str_comp(void *key1, void *key2)
+{
+	if (die_in_lock)
+		_exit(0);
+	return strcmp((char *) key1, (char *) key2);
+}
+
+void test_basic(shmap_t map)
+{
+	size_t len;
+	char *data;
+
+	check(shmap_set(map, "one", 4, "1", 2) == 1, "set");
+	check(shmap_set(map, "two", 4, "2", 2) == 2, "set another");
+	check(shmap_set(map, "one", 4, "uno", 4) == 2, "replace");
+	data = (char *) shmap_get(map, "one", &len);
+	check(data && len == 4 && !strcmp(data, "uno"), "get");
+	check(shmap_unset(map, "two") == 1, "unset");
+	check(!shmap_get(map, "two", NULL), "get unset");
+}
+
+/* a writer dying with the lock mustn't block the others */
+void test_dead_writer(shmap_t map)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (!pid)
+	{
+		die_in_lock = 1;
+		shmap_set(map, "one", 4, "one", 4);
+		_exit(1);
+	}
+	waitpid(pid, &status, 0);
+	check(WIFEXITED(status) && !WEXITSTATUS(status), "writer died in lock");
+
+	alarm(5);	/* a deadlock fails the test */
+	check(shmap_set(map, "three", 6, "3", 2) == 2, "set after dead writer");
+	check(shmap_unset(map, "three") == 1, "unset after dead writer");
+	alarm(0);
+	check(shmap_count(map) == 1, "count after dead writer");
+}
+
+/* number of iterated records of a key, and its last value */
+int iterated(shmap_t map, char *key, char **value)
+{
+	size_t cursor = 0;
+	void *k, *d;
+	int n = 0;
+
+	while (shmap_iter_next(map, &cursor, &k, &d, NULL))
+	{
+		if (!strcmp((char *) k, key))
+		{
+			*value = (char *) d;
+			++n;
+		}
+	}
+	return n;
+}
+
+/* makes a writer crash on its first write to the record of a key, that is */
+/* after unlinking or replacing it, but before flagging it deleted         */
+void crash_on(shmap_t map, char *key)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	char *data = (char *) shmap_get(map, key, NULL);
+	uintptr_t first, last;
+
+	/* the record header is before the key and the data */
+	first = ((uintptr_t) data - 64) & ~(uintptr_t) (page - 1);
+	last = (uintptr_t) data & ~(uintptr_t) (page - 1);
+	mprotect((void *) first, last - first + page, PROT_READ);
+}
+
+/* a writer dying between publishing a record and deleting the old one */
+/* mustn't leave two records for a key                                  */
+void test_torn_writer(shmap_t map)
+{
+	char key[16], filler[1024], *value;
+	pid_t pid;
+	int i, status, count;
+
+	/* the records of the key on their own pages, far from the buckets */
+	memset(filler, 'f', sizeof(filler));
+	for (i = 0; i < 8; ++i)
+	{
+		sprintf(key, "filler%d", i);
+		shmap_set(map, key, strlen(key) + 1, filler, sizeof(filler));
+	}
+	shmap_set(map, "torn", 5, "old", 4);
+	shmap_set(map, "gone", 5, "old", 4);
+	for (i = 8; i < 16; ++i)
+	{
+		sprintf(key, "filler%d", i);
+		shmap_set(map, key, strlen(key) + 1, filler, sizeof(filler));
+	}
+	count = shmap_count(map);
+
+	pid = fork();
+	if (!pid)
+	{
+		crash_on(map, "torn");
+		shmap_set(map, "torn", 5, "new", 4);
+		_exit(0);
+	}
+	waitpid(pid, &status, 0);
+	/* killed, or exiting on the fault under a sanitizer */
+	check(!WIFEXITED(status) || WEXITSTATUS(status), "writer died replacing");
+
+	alarm(5);
+	check(shmap_set(map, "other", 6, "1", 2) == count + 1,
+		  "count after a torn replace");
+	alarm(0);
+	check(iterated(map, "torn", &value) == 1 && !strcmp(value, "new"),
+		  "iteration after a torn replace");
+
+	pid = fork();
+	if (!pid)
+	{
+		crash_on(map, "gone");
+		shmap_unset(map, "gone");
+		_exit(0);
+	}
+	waitpid(pid, &status, 0);
+	/* killed, or exiting on the fault under a sanitizer */
+	check(!WIFEXITED(status) || WEXITSTATUS(status), "writer died unsetting");
+
+	alarm(5);
+	check(shmap_unset(map, "other") == count - 1, "count after a torn unset");
+	alarm(0);
+	check(!shmap_get(map, "gone", NULL) && iterated(map, "gone", &value) == 0,
+		  "iteration after a torn unset");
+}
+
+int main(int argc, char **argv)
+{
+	shmap_t map;
+
+	shmap_unlink(SHM_NAME);
+	map = shmap_open(SHM_NAME, SHMAP_CREATE, 65536, MAP_SIZE_AUTO,
+					 str_hash, str_comp);
+	check(map != NULL, "open");
+	if (map)
+	{
+		test_basic(map);
+		test_dead_writer(map);
+		test_torn_writer(map);
+		shmap_close(map);
+	}
+	shmap_unlink(SHM_NAME);
+
+	if (errors)
+	{
+		printf("shmap tests failed\n");
+		return 1;
+	}
+	printf("shmap tests passed\n");
+	return 0;
+}
@@ -0,0 +1,185 @@
+#include <scelib/sketch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define NB_KEYS		10000
+#define NB_TOP		10
+#define NB_DISTINCT	100000
+
+static int errors = 0;
+static char keys[NB_KEYS][16];
+static long exact[NB_KEYS];
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+int str_hash(int size, void *key)
+{
+	unsigned int h = 5381;
+	char *k;
+
+	for (k = (char *) key; *k; ++k)
+		h = h * 33 + (unsigned char) *k;
+	return (int) (h % (unsigned int) size);
+}
+
+int str_comp(void *key1, void *key2)
+{
+	return strcmp((char *) key1, (char *) key2);
+}
+
+void *str_alloc(void *key)
+{
+	char *k = (char *) malloc(strlen((char *) key) + 1);
+	return (k ? strcpy(k, (char *) key) : NULL);
+}
+
+/* counts keys with a skewed distribution, key i being about 1/(i+1) as */
+/* frequent as key 0                                                    */
+void fill(cms_t cms, int first, int step)
+{
+	int i;
+
+	for (i = first; i < NB_KEYS; i += step)
+	{
+		exact[i] = 100000 / (i + 1) + 1;
+		cms_add(cms, keys[i], exact[i]);
+	}
+}
+
+void test_cms(void)
+{
+	cms_t cms, half, loaded;
+	cms_entry_t top[NB_TOP];
+	long total = 0, err, bad = 0;
+	void *buf;
+	size_t len;
+	int i, n, ok;
+
+	for (i = 0; i < NB_KEYS; ++i)
+		sprintf(keys[i], "key%d", i);
+	cms = cms_new(0.001, 0.01, NB_TOP, str_hash, str_comp, str_alloc, free);
+	fill(cms, 0, 1);
+	for (i = 0; i < NB_KEYS; ++i)
+		total += exact[i];
+	check(cms_total(cms) == total, "cms total");
+
+	/* never under the exact count, and rarely over the error bound */
+	for (i = 0, ok = 1; i < NB_KEYS; ++i)
+	{
+		err = cms_estimate(cms, keys[i]) - exact[i];
+		ok &= (err >= 0);
+		if (err > 0.001 * total)
+			++bad;
+	}
+	check(ok, "cms estimates over exact counts");
+	check(bad <= NB_KEYS / 100, "cms error bound");
+
+	n = cms_top(cms, top, NB_TOP);
+	for (i = 0, ok = (n == NB_TOP); ok && i < n; ++i)
+		ok &= !strcmp((char *) top[i].key, keys[i]);
+	check(ok, "cms heavy hitters");
+
+	/* round trip, the heavy hitters restarting empty */
+	buf = cms_save(cms, &len);
+	loaded = cms_load(buf, len, NB_TOP, str_hash, str_comp, str_alloc, free);
+	free(buf);
+	check(loaded != NULL, "cms load");
+	for (i = 0, ok = 1; loaded && i < NB_KEYS; ++i)
+		ok &= (cms_estimate(loaded, keys[i]) == cms_estimate(cms, keys[i]));
+	check(ok && cms_total(loaded) == total, "cms loaded estimates");
+	check(cms_top(loaded, top, NB_TOP) == 0, "cms loaded heavy hitters");
+	cms_add(loaded, keys[1], 1);
+	check(cms_top(loaded, top, NB_TOP) == 1 &&
+		  top[0].count == cms_estimate(cms, keys[1]) + 1, "cms loaded update");
+
+	/* two halves merged give the same counters as the whole */
+	cms_delete(loaded);
+	loaded = cms_new(0.001, 0.01, NB_TOP, str_hash, str_comp, str_alloc, free);
+	half = cms_new(0.001, 0.01, NB_TOP, str_hash, str_comp, str_alloc, free);
+	fill(loaded, 0, 2);
+	fill(half, 1, 2);
+	check(!cms_merge(loaded, half), "cms merge");
+	for (i = 0, ok = 1; i < NB_KEYS; ++i)
+		ok &= (cms_estimate(loaded, keys[i]) == cms_estimate(cms, keys[i]));
+	check(ok && cms_total(loaded) == total, "cms merged estimates");
+	n = cms_top(loaded, top, NB_TOP);
+	for (i = 0, ok = (n == NB_TOP); ok && i < n; ++i)
+		ok &= !strcmp((char *) top[i].key, keys[i]);
+	check(ok, "cms merged heavy hitters");
+
+	cms_delete(half);
+	cms_delete(loaded);
+	cms_delete(cms);
+}
+
+void test_hll(void)
+{
+	hll_t hll, half, loaded;
+	char key[32];
+	void *buf;
+	size_t len;
+	double count;
+	int i;
+
+	hll = hll_new(14, str_hash);
+	half = hll_new(14, str_hash);
+	for (i = 0; i < NB_DISTINCT; ++i)
+	{
+		sprintf(key, "distinct%d", i);
+		hll_add(hll, key);
+		hll_add(hll, key);	/* duplicates aren't counted */
+		if (i & 1)
+			hll_add(half, key);
+		if (i == 99)
+		{
+			/* still sparse */
+			count = hll_count(hll);
+			check(fabs(count - 100) < 5, "hll small count");
+		}
+	}
+	count = hll_count(hll);
+	check(fabs(count - NB_DISTINCT) < NB_DISTINCT * 0.03, "hll count");
+
+	buf = hll_save(hll, &len);
+	loaded = hll_load(buf, len, str_hash);
+	free(buf);
+	check(loaded && hll_count(loaded) == count, "hll round trip");
+	hll_delete(loaded);
+
+	/* a sparse sketch merged into an empty one, then the other half */
+	loaded = hll_new(14, str_hash);
+	for (i = 0; i < NB_DISTINCT; i += 2)
+	{
+		sprintf(key, "distinct%d", i);
+		hll_add(loaded, key);
+	}
+	check(!hll_merge(loaded, half), "hll merge");
+	check(hll_count(loaded) == count, "hll merged count");
+
+	hll_delete(loaded);
+	hll_delete(half);
+	hll_delete(hll);
+}
+
+int main(int argc, char **argv)
+{
+	test_cms();
+	test_hll();
+
+	if (errors)
+	{
+		printf("sketch tests failed\n");
+		return 1;
+	}
+	printf("sketch tests passed\n");
+	return 0;
+}
@@ -0,0 +1,138 @@
+#include <scelib/smap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NB_KEYS		20000
+#define BUDGET		(256 * 1024)
+
+static int errors = 0;
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+int str_hash(int size, void *key)
+{
+	unsigned int h = 5381;
+	char *k;
+
+	for (k = (char *) key; *k; ++k)
+		h = h * 33 + (unsigned char) *k;
+	return (int) (h % (unsigned int) size);
+}
+
+int str_comp(void *key1, void *key2)
+{
+	return strcmp((char *) key1, (char *) key2);
+}
+
+void test_spill(const char *dir)
+{
+	smap_t map;
+	smap_iter_t iter;
+	char key[32], value[64], *data;
+	void *k, *d;
+	size_t len;
+	int i, n, ok;
+
+	map = smap_new(dir, BUDGET, 0, str_hash, str_comp);
+	check(map != NULL, "new");
+	if (!map)
+		return;
+
+	/* far more than the budget */
+	for (i = 0, ok = 1; i < NB_KEYS; ++i)
+	{
+		sprintf(key, "key%d", i);
+		sprintf(value, "value of the key number %d", i);
+		ok &= (smap_set(map, key, strlen(key) + 1, value, strlen(value) + 1)
+			   == i + 1);
+	}
+	check(ok, "set");
+	check(smap_resident(map) <= BUDGET, "resident within the budget");
+
+	/* read back from the spilled partitions */
+	for (i = 0, ok = 1; i < NB_KEYS; i += 3)
+	{
+		sprintf(key, "key%d", i);
+		sprintf(value, "value of the key number %d", i);
+		data = (char *) smap_get(map, key, &len);
+		ok &= (data && len == strlen(value) + 1 && !strcmp(data, value));
+	}
+	check(ok, "get");
+	check(!smap_get(map, "missing", NULL), "get missing");
+
+	for (i = 0, ok = 1; i < NB_KEYS; i += 2)
+	{
+		sprintf(key, "key%d", i);
+		ok &= (smap_unset(map, key) >= 0);
+	}
+	check(ok, "unset");
+	check(smap_count(map) == NB_KEYS / 2, "count");
+
+	check(!smap_spill(map), "spill");
+	check(smap_resident(map) == 0, "nothing resident after spill");
+	check(!smap_get(map, "key0", NULL), "get unset after spill");
+	data = (char *) smap_get(map, "key1", NULL);
+	check(data && !strcmp(data, "value of the key number 1"), "get after spill");
+
+	iter = smap_iter_new(map);
+	n = 0;
+	ok = 1;
+	while (smap_iter_next(iter, &k, &d, &len))
+	{
+		sscanf((char *) k, "key%d", &i);
+		sprintf(value, "value of the key number %d", i);
+		ok &= ((i & 1) && !strcmp((char *) d, value));
+		++n;
+	}
+	smap_iter_delete(iter);
+	check(ok && n == NB_KEYS / 2, "iteration");
+
+	/* reads loading other partitions don't spill the iterated one */
+	iter = smap_iter_new(map);
+	n = 0;
+	ok = 1;
+	while (smap_iter_next(iter, &k, &d, &len))
+	{
+		sscanf((char *) k, "key%d", &i);
+		sprintf(value, "value of the key number %d", i);
+		ok &= !strcmp((char *) d, value);
+		sprintf(key, "key%d", (i * 7919 + 2 * n + 1) % NB_KEYS | 1);
+		ok &= (smap_get(map, key, NULL) != NULL);
+		++n;
+	}
+	smap_iter_delete(iter);
+	check(ok && n == NB_KEYS / 2, "iteration with reads");
+	check(smap_resident(map) <= BUDGET, "resident within the budget");
+
+	smap_delete(map);
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/smapXXXXXX";
+
+	if (!mkdtemp(dir))
+	{
+		printf("can't create the spill directory\n");
+		return 1;
+	}
+	test_spill(dir);
+	check(!rmdir(dir), "spill files removed");
+
+	if (errors)
+	{
+		printf("smap tests failed\n");
+		return 1;
+	}
+	printf("smap tests passed\n");
+	return 0;
+}
@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+#include <scelib/str.h>
+#include <scelib/memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/time.h>
+
+#define NB_LOOPS	200000
+
+static int errors = 0;
+
+/* compares str_vset() with the C library */
+void check(const char *fmt, ...)
+{
+	char ref[1024];
+	char *str;
+	size_t len;
+	va_list ap;
+
+	va_start(ap, fmt);
+	str = str_vset(NULL, &len, fmt, ap);
+	va_end(ap);
+	va_start(ap, fmt);
+	vsnprintf(ref, sizeof(ref), fmt, ap);
+	va_end(ap);
+
+	if (!str || strcmp(str, ref) || len != strlen(ref))
+	{
+		printf("FAILED: \"%s\" gives \"%s\" instead of \"%s\"\n",
+			   fmt, str ? str : "(null)", ref);
+		++errors;
+	}
+	free(str);
+}
+
+double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void test_format(void)
+{
+	int n1 = 0, n2 = 0;
+
+	check("no specifier");
+	check("%d|%5d|%-5d|%05d|%+d|% d|%.3d|%08.3d", 42, 42, 42, -42, 42, 42, 7, 7);
+	check("%x|%X|%#x|%o|%#o|%u|%ld", 255u, 255u, 255u, 8u, 8u, 3000000000u, -123456789l);
+	check("%hd|%hhd|%hu", (short) -5, (char) -3, (unsigned short) 65535);
+	check("%lld|%llu|%llx|%llo", LLONG_MIN, ULLONG_MAX, ULLONG_MAX, ULLONG_MAX);
+	check("%zu|%zx|%jd|%ju|%td", (size_t) -1, (size_t) 4096, INTMAX_MIN,
+		  UINTMAX_MAX, (ptrdiff_t) -7);
+	check("%#x|%#o|%#.0o|%.0d|%#.3o|%#010x|%+.3d|% 05d", 0, 0, 0, 0, 8, 255, 5, 3);
+	check("%llu|%llu|%llu|%llu", 9999999999ull, 10000000000ull,
+		  9999999999999999999ull, 10000000000000000000ull);
+	check("%f|%.2f|%10.3f|%-10.1f|%010.2f|%+f", 3.14159, 2.5, -1.5, 1.25, -3.75, 1.0);
+	check("%e|%E|%.3e|%.0e|%#.0f", 12345.678, 0.000123, 1e100, 2.5, 2.0);
+	check("%g|%g|%g|%G|%.3g|%#g", 0.0001, 123456789.0, 100.0, 1e-10, 3.14159, 1.0);
+	check("%f|%f|%5f", 1.0 / 0.0, -1.0 / 0.0, 0.0 / 0.0);
+	check("%.300f", 1e300);
+	check("%s|%10s|%-10s|%.2s|%5.1s", "abc", "abc", "abc", "abc", "abc");
+	check("%c|%3c|%-3c|%%", 'a', 'b', 'c');
+	check("%p|%p", &n1, (void *) 0);
+	check("%*d|%-*d|%.*f", 6, 1, 6, 2, 2, 3.14159);
+
+	free(str_set(NULL, NULL, "a%nbc%nd", &n1, &n2));
+	if (n1 != 1 || n2 != 3)
+	{
+		printf("FAILED: %%n gives %d and %d\n", n1, n2);
+		++errors;
+	}
+}
+
+/* an allocator counting its calls */
+static int counted = 0;
+
+void *counted_alloc(void *context, size_t size)
+{
+	++counted;
+	return malloc(size);
+}
+
+void *counted_realloc(void *context, void *mem, size_t size)
+{
+	++counted;
+	return realloc(mem, size);
+}
+
+void counted_free(void *context, void *mem)
+{
+	++counted;
+	free(mem);
+}
+
+/* the strings ignore the allocator set, and can be given to free() */
+void test_allocator(void)
+{
+	static const mem_allocator_t allocator = {
+		counted_alloc, counted_realloc, counted_free, NULL
+	};
+	char *str, *dup;
+
+	mem_allocator_set(&allocator);
+	dup = str_dup("a string");
+	str_set(&str, NULL, "%s and %d", dup, 42);
+	str_grow(&str, 100);
+	mem_allocator_set(NULL);
+	free(dup);
+	free(str);
+	if (counted)
+	{
+		printf("FAILED: the strings use the allocator set\n");
+		++errors;
+	}
+}
+
+/* formats a mix of specifiers with str_set() or vasprintf() */
+double bench(int lib, int mix)
+{
+	double start = now();
+	char *str;
+	int i;
+
+	for (i = 0; i < NB_LOOPS; ++i)
+	{
+		str = NULL;
+		switch (mix)
+		{
+			case 0:
+				if (lib)
+					asprintf(&str, "%d %u %x %ld %5d", i, i * 7u, i, i * 1000l, -i);
+				else
+					str_set(&str, NULL, "%d %u %x %ld %5d", i, i * 7u, i, i * 1000l, -i);
+				break;
+			case 1:
+				if (lib)
+					asprintf(&str, "%f %.2f %e %g", i / 7.0, i * 1.5, i * 1e10, i / 3.0);
+				else
+					str_set(&str, NULL, "%f %.2f %e %g", i / 7.0, i * 1.5, i * 1e10, i / 3.0);
+				break;
+			default:
+				if (lib)
+					asprintf(&str, "%s: %s=%-10s (%s)", "key", "name", "value", "a comment");
+				else
+					str_set(&str, NULL, "%s: %s=%-10s (%s)", "key", "name", "value", "a comment");
+				break;
+		}
+		free(str);
+	}
+	return now() - start;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *mixes[] = { "integers", "floats", "strings" };
+	int mix;
+
+	test_format();
+	test_allocator();
+	for (mix = 0; mix < 3; ++mix)
+	{
+		printf("%d %s formats: str_set %.3fs, vasprintf %.3fs\n",
+			   NB_LOOPS, mixes[mix], bench(0, mix), bench(1, mix));
+	}
+
+	if (errors)
+	{
+		printf("str tests failed\n");
+		return 1;
+	}
+	printf("str tests passed\n");
+	return 0;
+}
@@ -0,0 +1,174 @@
+#include <scelib/strbuf.h>
+#include <scelib/str.h>
+#include <scelib/memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NB_PIECES	10000
+
+static int errors = 0;
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+/* tells if a buffer holds a string, with the right length */
+int holds(strbuf_t sb, const char *str)
+{
+	return (!strcmp(strbuf_str(sb), str) && strbuf_len(sb) == strlen(str) &&
+			strbuf_capacity(sb) >= strlen(str));
+}
+
+/* builds a string piece by piece, compared with the str_* functions */
+void test_growth(void)
+{
+	strbuf_t sb;
+	char *ref = NULL, piece[32];
+	size_t capacity = 0;
+	int i, ok, reallocs = 0;
+
+	sb = strbuf_new(0);
+	check(sb && holds(sb, ""), "new");
+	str_set(&ref, NULL, "");
+	for (i = 0, ok = 1; i < NB_PIECES; ++i)
+	{
+		sprintf(piece, "%d,", i);
+		if (i % 3 == 0)
+			ok &= !strbuf_append(sb, piece);
+		else if (i % 3 == 1)
+			ok &= !strbuf_printf(sb, "%d,", i);
+		else
+		{
+			ok &= !strbuf_append_len(sb, piece, strlen(piece) - 1);
+			ok &= !strbuf_append_char(sb, ',');
+		}
+		str_grow(&ref, strlen(piece) + 1);
+		strcat(ref, piece);
+		if (strbuf_capacity(sb) != capacity)
+		{
+			capacity = strbuf_capacity(sb);
+			++reallocs;
+		}
+	}
+	check(ok && holds(sb, ref), "appended pieces");
+	/* geometric growth */
+	check(reallocs < 20, "number of reallocations");
+
+	check(!strbuf_reserve(sb, 2 * strbuf_len(sb)) &&
+		  strbuf_capacity(sb) >= 2 * strlen(ref) && holds(sb, ref), "reserve");
+	check(!strbuf_clear(sb) && holds(sb, ""), "clear");
+	free(ref);
+	strbuf_delete(sb);
+}
+
+/* characters taken from the buffer itself */
+void test_aliasing(void)
+{
+	strbuf_t sb;
+	const char *str;
+
+	sb = strbuf_new(8);
+	strbuf_append(sb, "abcdefgh");
+	check(strbuf_capacity(sb) == 8, "full buffer");
+
+	/* appended to itself while the buffer grows */
+	str = strbuf_str(sb);
+	check(!strbuf_append_len(sb, str, 8) && holds(sb, "abcdefghabcdefgh"),
+		  "self append");
+
+	/* inserted before themselves, the tail shifted over them */
+	str = strbuf_str(sb);
+	check(!strbuf_insert(sb, 2, str + 4, 6) &&
+		  holds(sb, "abefghabcdefghabcdefgh"), "self insert");
+
+	/* replacing a longer and a shorter range with an overlapping part */
+	str = strbuf_str(sb);
+	check(!strbuf_replace(sb, 0, 2, str + 1, 5) &&
+		  holds(sb, "befghefghabcdefghabcdefgh"), "self replace longer");
+	str = strbuf_str(sb);
+	check(!strbuf_replace(sb, 3, 10, str, 2) &&
+		  holds(sb, "befbeefghabcdefgh"), "self replace shorter");
+
+	check(!strbuf_erase(sb, 0, 3) && holds(sb, "beefghabcdefgh"), "erase");
+	check(strbuf_erase(sb, 10, 10) < 0, "erase out");
+	check(strbuf_insert(sb, 100, "x", 1) < 0, "insert out");
+	strbuf_delete(sb);
+}
+
+/* strings moving between the str_* functions and buffers */
+static int counted = 0;
+
+void *counted_alloc(void *context, size_t size)
+{
+	++counted;
+	return malloc(size);
+}
+
+void *counted_realloc(void *context, void *mem, size_t size)
+{
+	++counted;
+	return realloc(mem, size);
+}
+
+void counted_free(void *context, void *mem)
+{
+	++counted;
+	free(mem);
+}
+
+void test_detach(void)
+{
+	static const mem_allocator_t allocator = {
+		counted_alloc, counted_realloc, counted_free, NULL
+	};
+	strbuf_t sb;
+	char *str;
+	int objects;
+
+	/* the string keeps its memory, even under another allocator */
+	mem_allocator_set(&allocator);
+	sb = strbuf_from(str_dup("a string"));
+	objects = counted;
+	check(sb && holds(sb, "a string"), "from");
+	check(!strbuf_append(sb, " growing in a buffer"), "append to a string");
+	str = strbuf_detach(sb);
+	mem_allocator_set(NULL);
+	check(str && !strcmp(str, "a string growing in a buffer"), "detach");
+	check(counted == objects + 1, "buffer object only from the allocator");
+
+	/* and goes on with the str_* functions */
+	check(str_grow(&str, 10) != NULL, "str_grow after detach");
+	strcat(str, " again");
+	sb = strbuf_from(str);
+	check(holds(sb, "a string growing in a buffer again"), "from again");
+	strbuf_delete(sb);
+
+	/* an empty buffer still gives a string */
+	str = strbuf_detach(strbuf_new(0));
+	check(str && !*str, "detach empty");
+	free(str);
+	sb = strbuf_from(NULL);
+	check(sb && holds(sb, ""), "from NULL");
+	strbuf_delete(sb);
+}
+
+int main(int argc, char **argv)
+{
+	test_growth();
+	test_aliasing();
+	test_detach();
+
+	if (errors)
+	{
+		printf("strbuf tests failed\n");
+		return 1;
+	}
+	printf("strbuf tests passed\n");
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include <scelib/vec.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NB_ELEMS	1000
+
+static int errors = 0;
+
+void check(int cond, char *what)
+{
+	if (!cond)
+	{
+		printf("FAILED: %s\n", what);
+		++errors;
+	}
+}
+
+/* tells if the elements of a vector are first, first + 1, ... */
+int sequence(vec_t vec, int from, int n, int first)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		if (*(int *) vec_at(vec, from + i) != first + i)
+			return 0;
+	}
+	return 1;
+}
+
+void test_basics(void)
+{
+	vec_t vec;
+	int i, elem, ok;
+
+	vec = vec_new(sizeof(int), 0);
+	for (i = 0, ok = 1; i < NB_ELEMS; ++i)
+		ok &= (vec_push(vec, &i) == i + 1);
+	check(ok && vec_count(vec) == NB_ELEMS, "push");
+	check(vec_capacity(vec) >= NB_ELEMS, "capacity");
+	check(sequence(vec, 0, NB_ELEMS, 0), "pushed elements");
+
+	check(vec_pop(vec, &elem) == NB_ELEMS - 1 && elem == NB_ELEMS - 1, "pop");
+	check(vec_erase(vec, 10, 10) == NB_ELEMS - 11 &&
+		  sequence(vec, 0, 10, 0) && sequence(vec, 10, 10, 20), "erase");
+	check(vec_insert(vec, 10, NULL, 2) == NB_ELEMS - 9 &&
+		  *(int *) vec_at(vec, 10) == 0 && *(int *) vec_at(vec, 11) == 0 &&
+		  sequence(vec, 12, 10, 20), "insert zeroed");
+	check(vec_insert(vec, vec_count(vec) + 1, &elem, 1) < 0, "insert out");
+	check(!vec_at(vec, vec_count(vec)), "at out");
+
+	check(!vec_shrink(vec) && vec_capacity(vec) == vec_count(vec), "shrink");
+	check(!vec_clear(vec) && vec_count(vec) == 0, "clear");
+	check(vec_pop(vec, &elem) < 0, "pop empty");
+	vec_delete(vec);
+}
+
+/* elements taken from the vector itself, across reallocations */
+void test_aliasing(void)
+{
+	vec_t vec;
+	int i, n;
+
+	vec = vec_new(sizeof(int), 0);
+	for (i = 0; i < 8; ++i)
+		vec_push(vec, &i);
+	check(vec_capacity(vec) == vec_count(vec), "full vector");
+
+	/* the whole vector appended to itself, growing it */
+	check(vec_append(vec, vec_data(vec), 8) == 16, "self append");
+	check(sequence(vec, 0, 8, 0) && sequence(vec, 8, 8, 0), "self appended");
+
+	/* the tail inserted in front of itself, shifting the copied elements */
+	check(vec_insert(vec, 4, vec_at(vec, 8), 8) == 24, "self insert");
+	check(sequence(vec, 0, 4, 0) && sequence(vec, 4, 8, 0) &&
+		  sequence(vec, 12, 4, 4) && sequence(vec, 16, 8, 0), "self inserted");
+
+	/* the last element pushed again while the vector is full */
+	vec_shrink(vec);
+	n = vec_count(vec);
+	check(vec_push(vec, vec_at(vec, n - 1)) == n + 1 &&
+		  *(int *) vec_at(vec, n) == 7, "self push");
+	vec_delete(vec);
+}
+
+int main(int argc, char **argv)
+{
+	test_basics();
+	test_aliasing();
+
+	if (errors)
+	{
+		printf("vec tests failed\n");
+		return 1;
+	}
+	printf("vec tests passed\n");
+	return 0;
+}